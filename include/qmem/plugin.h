@@ -8,7 +8,7 @@
 
 #include "services/service.h"
 
-#define QMEM_PLUGIN_API_VERSION 1
+#define QMEM_PLUGIN_API_VERSION 4
 
 /* Plugin info structure - each plugin exports this */
 typedef struct {
@@ -5,11 +5,13 @@
 #define QMEM_PROTOCOL_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 /* IPC socket default path */
 #define QMEM_SOCKET_PATH "/run/qmem.sock"
 
-/* Maximum message size */
+/* Maximum frame size, header included; longer payloads span several frames */
 #define QMEM_MSG_MAX_SIZE (256 * 1024)
 
 /* Protocol version */
@@ -17,15 +19,39 @@
 
 /* Request types */
 typedef enum {
-    QMEM_REQ_STATUS = 1,      /* Get current status */
-    QMEM_REQ_SNAPSHOT = 2,    /* Get full snapshot */
+    QMEM_REQ_STATUS = 1,      /* Get current status (payload: optional "fields=a,b.c") */
+    QMEM_REQ_SNAPSHOT = 2,    /* Get snapshot (payload: optional "fields=a,b.c") */
     QMEM_REQ_HISTORY = 3,     /* Get historical data */
     QMEM_REQ_CONFIG = 4,      /* Get/set config */
-    QMEM_REQ_SUBSCRIBE = 5,   /* Subscribe to updates */
+    QMEM_REQ_SUBSCRIBE = 5,   /* Push snapshots (payload: "fields=a,b.c&changes=1") */
     QMEM_REQ_SERVICES = 6,    /* List services */
+    QMEM_REQ_QUERY = 7,       /* History range query (payload: URL query string) */
+    QMEM_REQ_SHARED = 8,      /* Shared snapshot region (read-only fd via SCM_RIGHTS) */
     QMEM_REQ_SHUTDOWN = 99,   /* Shutdown daemon */
 } qmem_req_type_t;
 
+/*
+ * Set in a request's type to ask for a CBOR payload (RFC 8949, wrapped in
+ * a stringref namespace, tag 256) instead of JSON. Responses carry it when
+ * their payload is CBOR; without it they are JSON, which stays the default
+ */
+#define QMEM_MSG_BINARY 0x8000
+
+/*
+ * Set in a response frame's type when more frames of the same payload
+ * follow. A payload is the concatenation of consecutive frames with the
+ * same seq, up to the first one without this flag
+ */
+#define QMEM_MSG_MORE 0x4000
+
+/*
+ * Set in a pushed SUBSCRIBE frame whose payload is a whole snapshot. With
+ * changes=1 frames without it are JSON merge patches (RFC 7396) against
+ * the document the client holds; a full frame replaces that document. The
+ * first frame is full, and so is any frame the daemon could not patch
+ */
+#define QMEM_MSG_FULL 0x2000
+
 /* Response status */
 typedef enum {
     QMEM_RESP_OK = 0,
@@ -54,4 +80,50 @@ static inline void qmem_msg_header_init(qmem_msg_header_t *h, uint16_t type, uin
     h->seq = 0;
 }
 
+/*
+ * Shared snapshot region
+ *
+ * The daemon mirrors every published snapshot into a memfd: this header
+ * followed by capacity bytes of JSON. Once the region has been requested,
+ * the daemon publishes after every collection. Map the descriptor
+ * PROT_READ/MAP_SHARED and read with qmem_shm_read(); a changed seq means
+ * a newer snapshot.
+ */
+#define QMEM_SHM_MAGIC 0x51534D48   /* "QSMH" */
+#define QMEM_SHM_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;        /* Bytes available for JSON after the header */
+    uint64_t seq;             /* Seqlock: odd while the daemon writes */
+    uint64_t len;             /* JSON length */
+    uint64_t reserved[4];
+} qmem_shm_header_t;
+
+/*
+ * Copy the current snapshot out of a mapped region, NUL-terminated
+ * Returns its length, or -1 if it does not fit size or the region stays busy
+ */
+static inline long qmem_shm_read(const qmem_shm_header_t *shm, char *buf, size_t size) {
+    const char *data = (const char *)(shm + 1);
+    
+    for (int tries = 0; tries < 1000; tries++) {
+        uint64_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+    
+        uint64_t len = __atomic_load_n(&shm->len, __ATOMIC_RELAXED);
+        int fits = len < size && len <= shm->capacity;
+        if (fits) memcpy(buf, data, len);
+    
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq) continue;
+        if (!fits) return -1;
+    
+        buf[len] = '\0';
+        return (long)len;
+    }
+    return -1;
+}
+
 #endif /* QMEM_PROTOCOL_H */
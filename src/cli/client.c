@@ -3,6 +3,7 @@
  */
 #define _POSIX_C_SOURCE 200809L
 #include "client.h"
+#include "common/json_patch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,52 +31,83 @@ int client_connect(const char *socket_path) {
     return fd;
 }
 
-int client_request(int fd, qmem_req_type_t type, const void *data, size_t data_len,
-                   char *response, size_t response_size) {
+char *client_request(int fd, qmem_req_type_t type, const void *data, size_t data_len,
+                     size_t *len) {
     /* Send header */
     qmem_msg_header_t header;
     qmem_msg_header_init(&header, type, data_len);
     
     if (send(fd, &header, sizeof(header), 0) != sizeof(header)) {
-        return -1;
+        return NULL;
     }
     
     /* Send data if any */
     if (data && data_len > 0) {
         if (send(fd, data, data_len, 0) != (ssize_t)data_len) {
-            return -1;
+            return NULL;
         }
     }
     
-    /* Receive response header */
+    return client_read_frame(fd, len);
+}
+
+/*
+ * Receive one message, reassembling the frames it was split into
+ * (QMEM_MSG_MORE), and report its type
+ */
+static char *read_message(int fd, size_t *len, uint16_t *type) {
+    char *message = NULL;
+    size_t used = 0;
     qmem_msg_header_t resp_header;
-    ssize_t n = recv(fd, &resp_header, sizeof(resp_header), MSG_WAITALL);
-    if (n != sizeof(resp_header)) {
-        return -1;
-    }
     
-    /* Validate */
-    if (resp_header.magic != QMEM_MSG_MAGIC) {
-        return -1;
-    }
+    do {
+        /* Receive frame header */
+        ssize_t n = recv(fd, &resp_header, sizeof(resp_header), MSG_WAITALL);
+        if (n != sizeof(resp_header) || resp_header.magic != QMEM_MSG_MAGIC ||
+            resp_header.length > QMEM_MSG_MAX_SIZE) {
+            free(message);
+            return NULL;
+        }
     
-    /* Receive payload */
-    size_t to_read = resp_header.length;
-    if (to_read >= response_size) {
-        to_read = response_size - 1;
-    }
+        /* Receive payload, leaving room for the terminator */
+        char *grown = realloc(message, used + resp_header.length + 1);
+        if (!grown) {
+            free(message);
+            return NULL;
+        }
+        message = grown;
     
-    if (to_read > 0) {
-        n = recv(fd, response, to_read, MSG_WAITALL);
-        if (n < 0) {
-            return -1;
+        if (resp_header.length > 0) {
+            n = recv(fd, message + used, resp_header.length, MSG_WAITALL);
+            if (n != (ssize_t)resp_header.length) {
+                free(message);
+                return NULL;
+            }
         }
-        response[n] = '\0';
-    } else {
-        response[0] = '\0';
-    }
+        used += resp_header.length;
+    } while (resp_header.type & QMEM_MSG_MORE);
     
-    return (int)resp_header.length;
+    message[used] = '\0';
+    if (len) {
+        *len = used;
+    }
+    if (type) {
+        *type = resp_header.type;
+    }
+    return message;
+}
+
+char *client_read_frame(int fd, size_t *len) {
+    return read_message(fd, len, NULL);
+}
+
+char *client_read_push(int fd, size_t *len, bool *full) {
+    uint16_t type = 0;
+    char *frame = read_message(fd, len, &type);
+    if (frame && full) {
+        *full = (type & QMEM_MSG_FULL) != 0;
+    }
+    return frame;
 }
 
 void client_disconnect(int fd) {
@@ -84,6 +116,13 @@ void client_disconnect(int fd) {
     }
 }
 
+/* Snapshot served instead of asking the daemon (see client_set_snapshot) */
+static const char *g_pushed_snapshot = NULL;
+
+void client_set_snapshot(const char *json) {
+    g_pushed_snapshot = json;
+}
+
 static char *do_request(const char *socket_path, qmem_req_type_t type, 
                        const void *data, size_t data_len) {
     int fd = client_connect(socket_path);
@@ -91,15 +130,10 @@ static char *do_request(const char *socket_path, qmem_req_type_t type,
         return NULL;
     }
     
-    static char response[256 * 1024];
-    int ret = client_request(fd, type, data, data_len, response, sizeof(response));
+    char *response = client_request(fd, type, data, data_len, NULL);
     client_disconnect(fd);
     
-    if (ret < 0) {
-        return NULL;
-    }
-    
-    return strdup(response);
+    return response;
 }
 
 char *client_get_status(const char *socket_path) {
@@ -107,9 +141,89 @@ char *client_get_status(const char *socket_path) {
 }
 
 char *client_get_snapshot(const char *socket_path) {
+    if (g_pushed_snapshot) {
+        return strdup(g_pushed_snapshot);
+    }
     return do_request(socket_path, QMEM_REQ_SNAPSHOT, NULL, 0);
 }
 
+char *client_get_snapshot_fields(const char *socket_path, const char *fields) {
+    char params[512];
+    snprintf(params, sizeof(params), "fields=%s", fields);
+    return do_request(socket_path, QMEM_REQ_SNAPSHOT, params, strlen(params));
+}
+
 char *client_get_history(const char *socket_path, int count) {
     return do_request(socket_path, QMEM_REQ_HISTORY, &count, sizeof(count));
 }
+
+char *client_query(const char *socket_path, const char *query) {
+    return do_request(socket_path, QMEM_REQ_QUERY, query, strlen(query));
+}
+
+int client_subscribe(const char *socket_path, const char *params, char **first) {
+    int fd = client_connect(socket_path);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    qmem_msg_header_t header;
+    size_t len = params ? strlen(params) : 0;
+    qmem_msg_header_init(&header, QMEM_REQ_SUBSCRIBE, len);
+    
+    if (send(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        (len > 0 && send(fd, params, len, 0) != (ssize_t)len)) {
+        close(fd);
+        return -1;
+    }
+    
+    /* Daemons without subscriptions answer once with an error instead of a snapshot */
+    size_t frame_len, error_len;
+    uint16_t type;
+    char *frame = read_message(fd, &frame_len, &type);
+    if (!frame ||
+        (type & ~(QMEM_MSG_BINARY | QMEM_MSG_MORE | QMEM_MSG_FULL)) != QMEM_REQ_SUBSCRIBE ||
+        json_object_find(frame, frame_len, "error", &error_len)) {
+        free(frame);
+        close(fd);
+        return -1;
+    }
+    
+    if (first) {
+        *first = frame;
+    } else {
+        free(frame);
+    }
+    return fd;
+}
+
+void *client_get_snapshot_cbor(const char *socket_path, const char *fields, size_t *len) {
+    int fd = client_connect(socket_path);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    char params[512] = "";
+    if (fields) {
+        snprintf(params, sizeof(params), "fields=%s", fields);
+    }
+    
+    qmem_msg_header_t header;
+    size_t params_len = strlen(params);
+    qmem_msg_header_init(&header, QMEM_REQ_SNAPSHOT | QMEM_MSG_BINARY, params_len);
+    
+    uint16_t type = 0;
+    char *response = NULL;
+    if (send(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        (params_len == 0 || send(fd, params, params_len, 0) == (ssize_t)params_len)) {
+        response = read_message(fd, len, &type);
+    }
+    client_disconnect(fd);
+    
+    /* A daemon that could not encode it answers in JSON */
+    if (response && !(type & QMEM_MSG_BINARY)) {
+        free(response);
+        return NULL;
+    }
+    return response;
+}
@@ -5,14 +5,40 @@
 #define QMEM_CLIENT_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <qmem/protocol.h>
 
 /* Connect to daemon */
 int client_connect(const char *socket_path);
 
-/* Send request and receive response */
-int client_request(int fd, qmem_req_type_t type, const void *data, size_t data_len,
-                   char *response, size_t response_size);
+/*
+ * Send request and receive response
+ * Returns it NUL-terminated (free() it) and sets *len if len is not NULL, or NULL
+ */
+char *client_request(int fd, qmem_req_type_t type, const void *data, size_t data_len,
+                     size_t *len);
+
+/* Receive one message (a response or a pushed frame), as client_request */
+char *client_read_frame(int fd, size_t *len);
+
+/*
+ * Receive one pushed subscription frame, as client_read_frame. Sets *full
+ * if it is a whole snapshot (QMEM_MSG_FULL); otherwise it is a JSON merge
+ * patch (RFC 7396) to apply to the document last received
+ */
+char *client_read_push(int fd, size_t *len, bool *full);
+
+/*
+ * Subscribe to snapshots ("services=a,b&changes=1", or "" for all of them)
+ * Returns the connection to read further frames from with client_read_push
+ * and stores the first (full) snapshot in *first, or -1 if the daemon refused.
+ * Without changes=1 every frame is full; with it, frames are pushed only
+ * when something changed, as patches unless flagged full
+ */
+int client_subscribe(const char *socket_path, const char *params, char **first);
+
+/* Answer client_get_snapshot() with json instead of asking the daemon (NULL: ask) */
+void client_set_snapshot(const char *json);
 
 /* Disconnect */
 void client_disconnect(int fd);
@@ -20,6 +46,14 @@ void client_disconnect(int fd);
 /* Convenience functions */
 char *client_get_status(const char *socket_path);
 char *client_get_snapshot(const char *socket_path);
+char *client_get_snapshot_fields(const char *socket_path, const char *fields);
 char *client_get_history(const char *socket_path, int count);
+char *client_query(const char *socket_path, const char *query);
+
+/*
+ * Get the snapshot CBOR-encoded (see QMEM_MSG_BINARY), only the given
+ * fields unless NULL; free() the result
+ */
+void *client_get_snapshot_cbor(const char *socket_path, const char *fields, size_t *len);
 
 #endif /* QMEM_CLIENT_H */
@@ -8,6 +8,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
+#include <poll.h>
 
 /* ANSI colors */
 #define RED     "\033[0;31m"
@@ -700,10 +702,50 @@ int cmd_slab(const char *socket_path) {
     return 0;
 }
 
+/* Redraw status for every pushed snapshot, at most once per interval */
+static int watch_subscribed(const char *socket_path, int fd, char *frame,
+                            int interval, const char *target) {
+    for (; frame; frame = client_read_frame(fd, NULL)) {
+        /* Skip to the newest frame that arrived while drawing or sleeping */
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        while (poll(&pfd, 1, 0) > 0) {
+            free(frame);
+            if (!(frame = client_read_frame(fd, NULL))) {
+                return 1;
+            }
+        }
+    
+        client_set_snapshot(frame);
+        printf("\033[2J\033[H");
+        cmd_status(socket_path, target);
+        if (!target) {
+            printf("\n");
+            cmd_top(socket_path);
+        }
+        client_set_snapshot(NULL);
+        free(frame);
+        fflush(stdout);
+    
+        sleep(interval);
+    }
+    
+    fprintf(stderr, "Error: Lost connection to daemon\n");
+    return 1;
+}
+
 int cmd_watch(const char *socket_path, int interval, const char *target) {
     printf("Watching memory changes (Ctrl+C to stop)...\n");
     printf("Interval: %d seconds\n\n", interval);
     
+    /* Pushed snapshots; daemons without subscriptions are polled */
+    char *first = NULL;
+    int fd = client_subscribe(socket_path, "", &first);
+    if (fd >= 0) {
+        int ret = watch_subscribed(socket_path, fd, first, interval, target);
+        client_disconnect(fd);
+        return ret;
+    }
+    
     while (1) {
         /* Clear screen */
         printf("\033[2J\033[H");
@@ -721,14 +763,28 @@ int cmd_watch(const char *socket_path, int interval, const char *target) {
     return 0;
 }
 
-int cmd_raw(const char *socket_path) {
-    char *response = client_get_snapshot(socket_path);
+int cmd_raw(const char *socket_path, const char *format, const char *fields) {
+    if (format && strcmp(format, "cbor") == 0) {
+        size_t len = 0;
+        void *data = client_get_snapshot_cbor(socket_path, fields, &len);
+        if (!data) {
+            fprintf(stderr, "Error: Cannot get a CBOR snapshot from daemon at %s\n", socket_path);
+            return 1;
+        }
+        fwrite(data, 1, len, stdout);
+        free(data);
+        return 0;
+    }
+    
+    char *response = fields ? client_get_snapshot_fields(socket_path, fields)
+                            : client_get_snapshot(socket_path);
     if (!response) {
         fprintf(stderr, "Error: Cannot connect to daemon at %s\n", socket_path);
         return 1;
     }
     
     printf("%s\n", response);
+    free(response);
     return 0;
 }
 
@@ -995,3 +1051,98 @@ int cmd_fdmon(const char *socket_path) {
     free(response);
     return 0;
 }
+
+/* Print one series' rows: [t, v...] arrays until the closing ']' */
+static const char *print_query_rows(const char *pos, int columns) {
+    while (*pos == '[' || *pos == ',') {
+        if (*pos == ',') pos++;
+        if (*pos != '[') break;
+        pos++;
+        
+        char *end;
+        time_t t = (time_t)strtoll(pos, &end, 10);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("  %-20s", when);
+        
+        for (int i = 0; i < columns && *end == ','; i++) {
+            printf(" %14.2f", strtod(end + 1, &end));
+        }
+        printf("\n");
+        
+        pos = strchr(end, ']');
+        if (!pos) return NULL;
+        pos++;
+    }
+    return *pos == ']' ? pos + 1 : NULL;
+}
+
+int cmd_query(const char *socket_path, int argc, char **argv) {
+    char query[2048] = "";
+    size_t len = 0;
+    
+    for (int i = 0; i < argc && len < sizeof(query); i++) {
+        /* A bare argument is the metric name */
+        len += snprintf(query + len, sizeof(query) - len, "%s%s%s",
+                        len ? "&" : "", strchr(argv[i], '=') ? "" : "metric=", argv[i]);
+    }
+    
+    char *response = client_query(socket_path, query);
+    if (!response) {
+        fprintf(stderr, "Error: Cannot connect to daemon at %s\n", socket_path);
+        return 1;
+    }
+    
+    const char *error = json_find_key(response, "error");
+    if (error) {
+        fprintf(stderr, "Error: %s\n", response);
+        free(response);
+        return 1;
+    }
+    
+    /* No metric given: list the available series */
+    if (argc == 0 || !json_find_key(response, "series")) {
+        const char *pos = json_find_key(response, "metrics");
+        pos = pos ? strchr(pos, '[') : NULL;
+        printf("\n" CYAN "=== Metrics ===" NC "\n");
+        while (pos && (pos = strchr(pos, '"')) != NULL) {
+            const char *end = strchr(pos + 1, '"');
+            if (!end) break;
+            printf("  %.*s\n", (int)(end - pos - 1), pos + 1);
+            pos = end + 1;
+        }
+        printf("\n");
+        free(response);
+        return 0;
+    }
+    
+    /* Bucketed rows carry min/max/avg/last, the others a single value */
+    int columns = strstr(response, "\"avg\"") ? 4 : 1;
+    const char *pos = strstr(response, "\"series\":{");
+    pos = pos ? pos + strlen("\"series\":{") : NULL;
+    
+    int shown = 0;
+    while (pos && *pos == '"') {
+        const char *end = strchr(pos + 1, '"');
+        if (!end || end[1] != ':' || end[2] != '[') break;
+        
+        printf("\n" CYAN "=== %.*s ===" NC "\n", (int)(end - pos - 1), pos + 1);
+        if (columns == 4) {
+            printf(BOLD "  %-20s %14s %14s %14s %14s" NC "\n", "Time", "Min", "Max", "Avg", "Last");
+        } else {
+            printf(BOLD "  %-20s %14s" NC "\n", "Time", "Value");
+        }
+        
+        pos = print_query_rows(end + 3, columns);
+        if (pos && *pos == ',') pos++;
+        shown++;
+    }
+    
+    if (shown == 0) {
+        printf("No matching series.\n");
+    }
+    printf("\n");
+    
+    free(response);
+    return 0;
+}
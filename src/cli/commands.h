@@ -17,8 +17,8 @@ int cmd_slab(const char *socket_path);
 /* Execute watch command (continuous monitoring) */
 int cmd_watch(const char *socket_path, int interval, const char *target);
 
-/* Execute raw command (dump JSON) */
-int cmd_raw(const char *socket_path);
+/* Execute raw command (dump JSON, or CBOR with format "cbor"; fields NULL for all) */
+int cmd_raw(const char *socket_path, const char *format, const char *fields);
 
 /* List active services */
 int cmd_services(const char *socket_path);
@@ -29,4 +29,8 @@ int cmd_sockets(const char *socket_path);
 /* Execute fdmon command (file descriptor monitoring) */
 int cmd_fdmon(const char *socket_path);
 
+/* Execute query command (history range query)
+ * args: metric name followed by key=value parameters, or none to list metrics */
+int cmd_query(const char *socket_path, int argc, char **argv);
+
 #endif /* QMEM_COMMANDS_H */
@@ -21,6 +21,10 @@ static void print_usage(const char *prog) {
     printf("  watch     Continuously monitor (like top)\n");
     printf("            Usage: watch [list]|[svc]\n");
     printf("  raw       Dump raw JSON snapshot\n");
+    printf("            Usage: raw [cbor] [fields]  (cbor: binary encoding, to stdout;\n");
+    printf("                   fields: only these, e.g. meminfo,procmem.top_rss)\n");
+    printf("  query     Query metric history (no metric: list metrics)\n");
+    printf("            Usage: query [metric] [from=-3600] [to=0] [step=SEC] [points=N] [mode=buckets|lttb|raw]\n");
     printf("\nOptions:\n");
     printf("  -s, --socket PATH   Unix socket path (default: %s)\n", DEFAULT_SOCKET);
     printf("  -i, --interval SEC  Watch interval in seconds (default: 2, memleak: 10)\n");
@@ -98,7 +102,15 @@ int main(int argc, char **argv) {
         }
         return cmd_watch(socket_path, interval, target);
     } else if (strcmp(command, "raw") == 0) {
-        return cmd_raw(socket_path);
+        const char *format = NULL;
+        const char *fields = NULL;
+        for (int i = optind + 1; i < argc; i++) {
+            if (strcmp(argv[i], "cbor") == 0) format = argv[i];
+            else fields = argv[i];
+        }
+        return cmd_raw(socket_path, format, fields);
+    } else if (strcmp(command, "query") == 0) {
+        return cmd_query(socket_path, argc - optind - 1, argv + optind + 1);
     } else if (strcmp(command, "fdmon") == 0 || strcmp(command, "fd") == 0) {
         return cmd_fdmon(socket_path);
     } else {
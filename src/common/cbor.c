@@ -0,0 +1,393 @@
+/*
+ * cbor.c - JSON to CBOR transcoding
+ */
+#include "cbor.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define MAX_DEPTH 64
+#define REF_TABLE_SIZE 4096             /* Strings remembered for references */
+
+/* CBOR major types */
+#define MAJOR_UINT   0x00
+#define MAJOR_NINT   0x20
+#define MAJOR_TEXT   0x60
+#define MAJOR_ARRAY  0x80
+#define MAJOR_MAP    0xa0
+#define MAJOR_TAG    0xc0
+#define MAJOR_SIMPLE 0xe0
+
+#define TAG_STRINGREF 25
+#define TAG_STRINGREF_NAMESPACE 256
+
+typedef struct {
+    uint32_t offset;            /* Position of the string's bytes in out */
+    uint32_t len;
+    uint32_t index;             /* Stringref index, UINT32_MAX if the slot is empty */
+} ref_entry_t;
+
+typedef struct {
+    const char *p;
+    const char *end;
+    uint8_t *out;
+    size_t size;
+    size_t pos;
+    bool error;
+    
+    /* Strings seen, for stringref */
+    ref_entry_t *refs;
+    uint32_t ref_count;         /* Entries in refs */
+    uint32_t next_index;        /* Strings the decoder has numbered */
+} encoder_t;
+
+static void put(encoder_t *e, const void *data, size_t len) {
+    if (e->error || e->pos + len > e->size) {
+        e->error = true;
+        return;
+    }
+    memcpy(e->out + e->pos, data, len);
+    e->pos += len;
+}
+
+static void put_byte(encoder_t *e, uint8_t b) {
+    put(e, &b, 1);
+}
+
+/* Initial byte and argument, in the shortest form */
+static void put_head(encoder_t *e, uint8_t major, uint64_t value) {
+    uint8_t buf[9];
+    size_t len;
+    
+    if (value < 24) {
+        buf[0] = major | (uint8_t)value;
+        len = 1;
+    } else if (value <= 0xff) {
+        buf[0] = major | 24;
+        buf[1] = (uint8_t)value;
+        len = 2;
+    } else if (value <= 0xffff) {
+        buf[0] = major | 25;
+        len = 3;
+    } else if (value <= 0xffffffff) {
+        buf[0] = major | 26;
+        len = 5;
+    } else {
+        buf[0] = major | 27;
+        len = 9;
+    }
+    
+    /* Big-endian argument */
+    for (size_t i = 1; len > 2 && i < len; i++) {
+        buf[i] = (uint8_t)(value >> (8 * (len - 1 - i)));
+    }
+    put(e, buf, len);
+}
+
+static void skip_ws(encoder_t *e) {
+    while (e->p < e->end && (*e->p == ' ' || *e->p == '\t' || *e->p == '\n' || *e->p == '\r')) {
+        e->p++;
+    }
+}
+
+static bool match(encoder_t *e, const char *word) {
+    size_t len = strlen(word);
+    if ((size_t)(e->end - e->p) < len || memcmp(e->p, word, len) != 0) {
+        return false;
+    }
+    e->p += len;
+    return true;
+}
+
+/*
+ * Stringref
+ */
+
+/* Shortest string worth numbering at index: longer than a reference to it */
+static size_t ref_min_len(uint32_t index) {
+    if (index < 24) return 3;
+    if (index < 256) return 4;
+    if (index < 65536) return 5;
+    return 7;
+}
+
+static uint32_t hash_bytes(const uint8_t *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void put_string(encoder_t *e, const char *text, size_t len);
+
+/*
+ * Values
+ */
+
+static void encode_value(encoder_t *e, int depth);
+
+/* Decode the JSON string at e->p (past its opening quote) into CBOR text */
+static void encode_string(encoder_t *e) {
+    const char *start = e->p;
+    bool escaped = false;
+    
+    while (e->p < e->end && *e->p != '"') {
+        if (*e->p == '\\') {
+            escaped = true;
+            e->p++;
+        }
+        e->p++;
+    }
+    if (e->p >= e->end) {
+        e->error = true;
+        return;
+    }
+    size_t raw_len = (size_t)(e->p - start);
+    e->p++;
+    
+    if (!escaped) {
+        put_string(e, start, raw_len);
+        return;
+    }
+    
+    /* Unescaped text is never longer than its escaped form */
+    char *text = malloc(raw_len + 1);
+    if (!text) {
+        e->error = true;
+        return;
+    }
+    size_t n = 0;
+    for (const char *s = start; s < start + raw_len; s++) {
+        if (*s != '\\') {
+            text[n++] = *s;
+            continue;
+        }
+        s++;
+        switch (*s) {
+            case 'n': text[n++] = '\n'; break;
+            case 'r': text[n++] = '\r'; break;
+            case 't': text[n++] = '\t'; break;
+            case 'b': text[n++] = '\b'; break;
+            case 'f': text[n++] = '\f'; break;
+            case 'u': {
+                unsigned int cp = 0;
+                for (int i = 1; i <= 4 && s + i < start + raw_len; i++) {
+                    char c = s[i];
+                    cp = cp * 16 + (unsigned int)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                }
+                s += 4;
+                /* UTF-8; surrogate pairs are not produced by the builder */
+                if (cp < 0x80) {
+                    text[n++] = (char)cp;
+                } else if (cp < 0x800) {
+                    text[n++] = (char)(0xc0 | (cp >> 6));
+                    text[n++] = (char)(0x80 | (cp & 0x3f));
+                } else {
+                    text[n++] = (char)(0xe0 | (cp >> 12));
+                    text[n++] = (char)(0x80 | ((cp >> 6) & 0x3f));
+                    text[n++] = (char)(0x80 | (cp & 0x3f));
+                }
+                break;
+            }
+            default: text[n++] = *s; break;
+        }
+    }
+    put_string(e, text, n);
+    free(text);
+}
+
+/* Write a text string, or a reference to an earlier copy of it */
+static void put_string(encoder_t *e, const char *text, size_t len) {
+    const uint8_t *s = (const uint8_t *)text;
+    
+    if (len >= ref_min_len(0) && !e->error) {
+        uint32_t slot = hash_bytes(s, len) & (REF_TABLE_SIZE - 1);
+        while (e->refs[slot].index != UINT32_MAX) {
+            ref_entry_t *r = &e->refs[slot];
+            if (r->len == len && memcmp(e->out + r->offset, s, len) == 0) {
+                put_head(e, MAJOR_TAG, TAG_STRINGREF);
+                put_head(e, MAJOR_UINT, r->index);
+                return;
+            }
+            slot = (slot + 1) & (REF_TABLE_SIZE - 1);
+        }
+    
+        /* A literal the decoder numbers: remember where its bytes land */
+        if (len >= ref_min_len(e->next_index)) {
+            put_head(e, MAJOR_TEXT, len);
+            if (e->ref_count < REF_TABLE_SIZE / 2 && e->pos + len <= e->size) {
+                e->refs[slot].offset = (uint32_t)e->pos;
+                e->refs[slot].len = (uint32_t)len;
+                e->refs[slot].index = e->next_index;
+                e->ref_count++;
+            }
+            e->next_index++;
+            put(e, s, len);
+            return;
+        }
+    }
+    
+    put_head(e, MAJOR_TEXT, len);
+    put(e, s, len);
+}
+
+static void encode_number(encoder_t *e) {
+    const char *start = e->p;
+    bool integral = true;
+    
+    while (e->p < e->end && ((*e->p && strchr("+-0123456789", *e->p)) || *e->p == '.' ||
+                             *e->p == 'e' || *e->p == 'E')) {
+        if (*e->p == '.' || *e->p == 'e' || *e->p == 'E') integral = false;
+        e->p++;
+    }
+    if (e->p == start) {
+        e->error = true;
+        return;
+    }
+    
+    char buf[64];
+    size_t len = (size_t)(e->p - start);
+    if (len >= sizeof(buf)) {
+        e->error = true;
+        return;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    
+    if (integral) {
+        if (buf[0] == '-') {
+            long long v = strtoll(buf, NULL, 10);
+            put_head(e, MAJOR_NINT, (uint64_t)(-(v + 1)));
+        } else {
+            put_head(e, MAJOR_UINT, strtoull(buf, NULL, 10));
+        }
+        return;
+    }
+    
+    double d = strtod(buf, NULL);
+    float f = (float)d;
+    uint8_t out[9];
+    if ((double)f == d) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        out[0] = MAJOR_SIMPLE | 26;
+        for (int i = 0; i < 4; i++) out[1 + i] = (uint8_t)(bits >> (24 - 8 * i));
+        put(e, out, 5);
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        out[0] = MAJOR_SIMPLE | 27;
+        for (int i = 0; i < 8; i++) out[1 + i] = (uint8_t)(bits >> (56 - 8 * i));
+        put(e, out, 9);
+    }
+}
+
+/* Members or elements up to the closing bracket, as an indefinite-length container */
+static void encode_container(encoder_t *e, int depth, bool object) {
+    char close = object ? '}' : ']';
+    
+    put_byte(e, (object ? MAJOR_MAP : MAJOR_ARRAY) | 31);
+    e->p++;
+    
+    skip_ws(e);
+    if (e->p < e->end && *e->p == close) {
+        e->p++;
+        put_byte(e, 0xff);
+        return;
+    }
+    
+    while (!e->error) {
+        skip_ws(e);
+        if (object) {
+            if (e->p >= e->end || *e->p != '"') {
+                e->error = true;
+                return;
+            }
+            e->p++;
+            encode_string(e);
+            skip_ws(e);
+            if (e->p >= e->end || *e->p != ':') {
+                e->error = true;
+                return;
+            }
+            e->p++;
+        }
+        encode_value(e, depth + 1);
+    
+        skip_ws(e);
+        if (e->p < e->end && *e->p == ',') {
+            e->p++;
+        } else if (e->p < e->end && *e->p == close) {
+            e->p++;
+            put_byte(e, 0xff);
+            return;
+        } else {
+            e->error = true;
+        }
+    }
+}
+
+static void encode_value(encoder_t *e, int depth) {
+    if (depth > MAX_DEPTH) {
+        e->error = true;
+        return;
+    }
+    
+    skip_ws(e);
+    if (e->p >= e->end) {
+        e->error = true;
+        return;
+    }
+    
+    switch (*e->p) {
+        case '{': encode_container(e, depth, true); break;
+        case '[': encode_container(e, depth, false); break;
+        case '"':
+            e->p++;
+            encode_string(e);
+            break;
+        case 't':
+            if (match(e, "true")) put_byte(e, MAJOR_SIMPLE | 21);
+            else e->error = true;
+            break;
+        case 'f':
+            if (match(e, "false")) put_byte(e, MAJOR_SIMPLE | 20);
+            else e->error = true;
+            break;
+        case 'n':
+            if (match(e, "null")) put_byte(e, MAJOR_SIMPLE | 22);
+            else e->error = true;
+            break;
+        default:
+            encode_number(e);
+            break;
+    }
+}
+
+size_t cbor_from_json(const char *json, size_t len, uint8_t *out, size_t size) {
+    encoder_t e = {
+        .p = json,
+        .end = json + len,
+        .out = out,
+        .size = size,
+    };
+    
+    e.refs = malloc(REF_TABLE_SIZE * sizeof(*e.refs));
+    if (!e.refs) {
+        return 0;
+    }
+    for (int i = 0; i < REF_TABLE_SIZE; i++) {
+        e.refs[i].index = UINT32_MAX;
+    }
+    
+    put_head(&e, MAJOR_TAG, TAG_STRINGREF_NAMESPACE);
+    encode_value(&e, 0);
+    skip_ws(&e);
+    if (e.p != e.end) {
+        e.error = true;
+    }
+    
+    free(e.refs);
+    return e.error ? 0 : e.pos;
+}
@@ -0,0 +1,22 @@
+/*
+ * cbor.h - JSON to CBOR transcoding
+ *
+ * Produces CBOR (RFC 8949) wrapped in a stringref namespace (tag 256):
+ * repeated keys and strings are sent once and then referenced by index
+ * (tag 25), which is where most of the size of a snapshot goes. Objects
+ * and arrays use indefinite lengths; integers are sent as integers and
+ * other numbers as single or double precision floats.
+ */
+#ifndef QMEM_CBOR_H
+#define QMEM_CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Transcode a JSON document into out
+ * Returns the CBOR length, or 0 if the JSON is malformed or out is too small
+ */
+size_t cbor_from_json(const char *json, size_t len, uint8_t *out, size_t size);
+
+#endif /* QMEM_CBOR_H */
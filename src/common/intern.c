@@ -0,0 +1,132 @@
+/*
+ * intern.c - Per-process string interning
+ */
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct intern_entry {
+    pid_t pid;
+    unsigned long long starttime;
+    char comm[INTERN_COMM_MAX];
+    bool stale;                     /* Process exec'd: never found again */
+    atomic_int refs;
+    unsigned int generation;        /* Last pass the process was seen */
+    size_t len;
+    struct intern_entry *next;
+    char str[];
+};
+
+static intern_entry_t *entry_of(const char *str) {
+    return (intern_entry_t *)(uintptr_t)(str - offsetof(intern_entry_t, str));
+}
+
+static unsigned int hash_key(const intern_cache_t *cache, pid_t pid,
+                             unsigned long long starttime) {
+    return ((unsigned int)pid * 2654435761u ^ (unsigned int)starttime) % cache->bucket_count;
+}
+
+int intern_init(intern_cache_t *cache, int bucket_count) {
+    memset(cache, 0, sizeof(*cache));
+    cache->buckets = calloc(bucket_count, sizeof(*cache->buckets));
+    if (!cache->buckets) {
+        return -1;
+    }
+    cache->bucket_count = bucket_count;
+    return 0;
+}
+
+void intern_free(intern_cache_t *cache) {
+    for (int b = 0; b < cache->bucket_count; b++) {
+        intern_entry_t *e = cache->buckets[b];
+        while (e) {
+            intern_entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(cache->buckets);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void intern_begin(intern_cache_t *cache) {
+    cache->generation++;
+}
+
+void intern_sweep(intern_cache_t *cache) {
+    for (int b = 0; b < cache->bucket_count; b++) {
+        intern_entry_t **pp = &cache->buckets[b];
+        while (*pp) {
+            intern_entry_t *e = *pp;
+            if (e->generation != cache->generation &&
+                atomic_load_explicit(&e->refs, memory_order_acquire) == 0) {
+                *pp = e->next;
+                cache->count--;
+                cache->bytes -= e->len + 1;
+                free(e);
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+}
+
+const char *intern_lookup(intern_cache_t *cache, pid_t pid,
+                          unsigned long long starttime, const char *comm) {
+    intern_entry_t *e = cache->buckets[hash_key(cache, pid, starttime)];
+    while (e) {
+        if (e->pid == pid && e->starttime == starttime && !e->stale) {
+            if (strncmp(e->comm, comm, INTERN_COMM_MAX) != 0) {
+                /* Left for the sweep once nobody holds it */
+                e->stale = true;
+                return NULL;
+            }
+            e->generation = cache->generation;
+            return e->str;
+        }
+        e = e->next;
+    }
+    return NULL;
+}
+
+const char *intern_add(intern_cache_t *cache, pid_t pid, unsigned long long starttime,
+                       const char *comm, const char *str, size_t len) {
+    intern_entry_t *e = malloc(sizeof(*e) + len + 1);
+    if (!e) {
+        return NULL;
+    }
+    
+    e->pid = pid;
+    e->starttime = starttime;
+    snprintf(e->comm, sizeof(e->comm), "%s", comm);
+    e->stale = false;
+    atomic_init(&e->refs, 0);
+    e->generation = cache->generation;
+    e->len = len;
+    memcpy(e->str, str, len);
+    e->str[len] = '\0';
+    
+    unsigned int idx = hash_key(cache, pid, starttime);
+    e->next = cache->buckets[idx];
+    cache->buckets[idx] = e;
+    cache->count++;
+    cache->bytes += len + 1;
+    
+    return e->str;
+}
+
+const char *intern_retain(const char *str) {
+    if (str) {
+        atomic_fetch_add_explicit(&entry_of(str)->refs, 1, memory_order_relaxed);
+    }
+    return str;
+}
+
+void intern_release(const char *str) {
+    if (str) {
+        atomic_fetch_sub_explicit(&entry_of(str)->refs, 1, memory_order_release);
+    }
+}
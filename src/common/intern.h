@@ -0,0 +1,61 @@
+/*
+ * intern.h - Per-process string interning
+ *
+ * Stores one copy of a process's command line for its lifetime, keyed by
+ * (pid, starttime) so a reused PID gets a fresh entry. The process name
+ * (comm) is kept alongside and checked on lookup, so a process that
+ * execs another program gets a fresh entry too. Interned strings are
+ * plain const char * handles; holders that keep one beyond the current
+ * collection take a reference.
+ */
+#ifndef QMEM_INTERN_H
+#define QMEM_INTERN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define INTERN_COMM_MAX 16
+
+typedef struct intern_entry intern_entry_t;
+
+typedef struct {
+    intern_entry_t **buckets;
+    int bucket_count;
+    unsigned int generation;        /* Current pass */
+    int count;                      /* Live entries */
+    size_t bytes;                   /* String bytes held */
+} intern_cache_t;
+
+/* Initialize cache. Returns 0 on success, -1 on error */
+int intern_init(intern_cache_t *cache, int bucket_count);
+
+/* Free all entries, including referenced ones */
+void intern_free(intern_cache_t *cache);
+
+/* Start a pass: lookups and adds mark processes as seen */
+void intern_begin(intern_cache_t *cache);
+
+/* Free entries of processes not seen this pass that hold no references */
+void intern_sweep(intern_cache_t *cache);
+
+/*
+ * Find the string of a process and mark it seen
+ * Returns NULL if not interned yet, or if comm changed (the process
+ * exec'd); the old string stays valid for holders of a reference
+ */
+const char *intern_lookup(intern_cache_t *cache, pid_t pid,
+                          unsigned long long starttime, const char *comm);
+
+/*
+ * Intern len bytes of str for a process running comm
+ * Returns the interned string, or NULL on allocation failure
+ */
+const char *intern_add(intern_cache_t *cache, pid_t pid, unsigned long long starttime,
+                       const char *comm, const char *str, size_t len);
+
+/* Take/drop a reference on an interned string (NULL is ignored) */
+const char *intern_retain(const char *str);
+void intern_release(const char *str);
+
+#endif /* QMEM_INTERN_H */
@@ -3,12 +3,32 @@
  */
 #include "json.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define GROWABLE_MIN_SIZE 256
+
+/* Make room for len more bytes and the terminator */
+static bool json_reserve(json_builder_t *j, size_t len) {
+    size_t need = j->pos + len + 1;
+    if (need <= j->size) return true;
+    if (!j->growable || (j->limit > 0 && need > j->limit)) return false;
+    
+    size_t size = j->size < GROWABLE_MIN_SIZE ? GROWABLE_MIN_SIZE : j->size;
+    while (size < need) size *= 2;
+    if (j->limit > 0 && size > j->limit) size = j->limit;
+    
+    char *buf = realloc(j->buf, size);
+    if (!buf) return false;
+    j->buf = buf;
+    j->size = size;
+    return true;
+}
+
 static void json_write(json_builder_t *j, const char *str, size_t len) {
     if (j->error) return;
     
-    if (j->pos + len >= j->size) {
+    if (!json_reserve(j, len)) {
         j->error = true;
         return;
     }
@@ -36,12 +56,30 @@ void json_init(json_builder_t *j, char *buf, size_t size) {
     j->depth = 0;
     j->needs_comma = false;
     j->error = false;
+    j->growable = false;
+    j->limit = 0;
     
     if (size > 0) {
         buf[0] = '\0';
     }
 }
 
+void json_init_growable(json_builder_t *j, char *buf, size_t size, size_t limit) {
+    if (!buf) {
+        if (size < GROWABLE_MIN_SIZE) size = GROWABLE_MIN_SIZE;
+        if (limit > 0 && size > limit) size = limit;
+        buf = malloc(size);
+        if (!buf) size = 0;
+    }
+    
+    json_init(j, buf, size);
+    j->growable = true;
+    j->limit = limit;
+    if (!buf) {
+        j->error = true;
+    }
+}
+
 void json_object_start(json_builder_t *j) {
     json_comma_if_needed(j);
     json_write(j, "{", 1);
@@ -87,6 +125,13 @@ void json_key(json_builder_t *j, const char *key) {
     json_write(j, "\":", 2);
 }
 
+void json_key_raw(json_builder_t *j, const char *key, size_t len) {
+    json_comma_if_needed(j);
+    json_write(j, "\"", 1);
+    json_write(j, key, len);
+    json_write(j, "\":", 2);
+}
+
 void json_string(json_builder_t *j, const char *value) {
     json_comma_if_needed(j);
     
@@ -158,6 +203,12 @@ void json_null(json_builder_t *j) {
     j->needs_comma = true;
 }
 
+void json_raw(json_builder_t *j, const char *json, size_t len) {
+    json_comma_if_needed(j);
+    json_write(j, json, len);
+    j->needs_comma = true;
+}
+
 void json_kv_string(json_builder_t *j, const char *key, const char *value) {
     json_key(j, key);
     j->needs_comma = false;
@@ -16,11 +16,21 @@ typedef struct {
     int depth;
     bool needs_comma;
     bool error;
+    bool growable;          /* buf is realloc()ed as needed */
+    size_t limit;           /* Largest size a growable buffer reaches, 0 for none */
 } json_builder_t;
 
 /* Initialize JSON builder with buffer */
 void json_init(json_builder_t *j, char *buf, size_t size);
 
+/*
+ * Initialize a builder whose buffer grows with realloc() up to limit bytes
+ * (0: no limit). buf is a malloc()ed buffer of size bytes, or NULL to
+ * allocate size bytes. The caller owns j->buf, of j->size bytes,
+ * afterwards, even on error
+ */
+void json_init_growable(json_builder_t *j, char *buf, size_t size, size_t limit);
+
 /* Start/end object */
 void json_object_start(json_builder_t *j);
 void json_object_end(json_builder_t *j);
@@ -32,6 +42,9 @@ void json_array_end(json_builder_t *j);
 /* Add key (for objects) */
 void json_key(json_builder_t *j, const char *key);
 
+/* Add a key that is already escaped, without quotes */
+void json_key_raw(json_builder_t *j, const char *key, size_t len);
+
 /* Add values */
 void json_string(json_builder_t *j, const char *value);
 void json_int(json_builder_t *j, int64_t value);
@@ -40,6 +53,9 @@ void json_double(json_builder_t *j, double value);
 void json_bool(json_builder_t *j, bool value);
 void json_null(json_builder_t *j);
 
+/* Add an already serialized JSON value verbatim */
+void json_raw(json_builder_t *j, const char *json, size_t len);
+
 /* Convenience: key + value */
 void json_kv_string(json_builder_t *j, const char *key, const char *value);
 void json_kv_int(json_builder_t *j, const char *key, int64_t value);
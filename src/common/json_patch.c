@@ -0,0 +1,326 @@
+/*
+ * json_patch.c - Reading serialized JSON and computing merge patches
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "json_patch.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROJECT_MAX_PATHS 64
+
+typedef struct {
+    const char *key;            /* Escaped key, without quotes */
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} member_t;
+
+/* Members of an object, with their keys hashed for lookup */
+typedef struct {
+    member_t *members;
+    bool *matched;
+    int count;
+    int *slots;                 /* Member index + 1, 0 if free */
+    size_t mask;
+} member_index_t;
+
+static const char *skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+/* Past the closing quote of the string starting at p */
+static const char *string_end(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '"') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static const char *value_end(const char *p, const char *end) {
+    if (p >= end) return NULL;
+    
+    if (*p == '"') {
+        return string_end(p, end);
+    }
+    
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (p < end) {
+            if (*p == '"') {
+                p = string_end(p, end);
+                if (!p) return NULL;
+                continue;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                return p + 1;
+            }
+            p++;
+        }
+        return NULL;
+    }
+    
+    /* Number, true, false or null */
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+           *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    return p > start ? p : NULL;
+}
+
+/* Parse the member at p (just past '{' or the previous value). NULL at the end */
+static const char *next_member(const char *p, const char *end, member_t *m) {
+    p = skip_ws(p, end);
+    if (p < end && *p == ',') p = skip_ws(p + 1, end);
+    if (p >= end || *p != '"') return NULL;
+    
+    const char *key_end = string_end(p, end);
+    if (!key_end) return NULL;
+    m->key = p + 1;
+    m->key_len = (size_t)(key_end - p - 2);
+    
+    p = skip_ws(key_end, end);
+    if (p >= end || *p != ':') return NULL;
+    p = skip_ws(p + 1, end);
+    
+    const char *vend = value_end(p, end);
+    if (!vend) return NULL;
+    m->value = p;
+    m->value_len = (size_t)(vend - p);
+    return vend;
+}
+
+/* Just past the '{' of the object starting at json, NULL if it is not one */
+static const char *object_body(const char *json, const char *end) {
+    const char *p = skip_ws(json, end);
+    return p < end && *p == '{' ? p + 1 : NULL;
+}
+
+static bool find_member(const char *json, size_t len, const char *key, size_t key_len,
+                        member_t *out) {
+    const char *end = json + len;
+    const char *p = object_body(json, end);
+    if (!p) return false;
+    
+    while ((p = next_member(p, end, out))) {
+        if (out->key_len == key_len && memcmp(out->key, key, key_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t json_value_len(const char *json, size_t len) {
+    const char *end = value_end(json, json + len);
+    return end ? (size_t)(end - json) : 0;
+}
+
+const char *json_object_find(const char *json, size_t len, const char *key, size_t *value_len) {
+    member_t m;
+    if (!find_member(json, len, key, strlen(key), &m)) {
+        return NULL;
+    }
+    *value_len = m.value_len;
+    return m.value;
+}
+
+static bool is_object(const char *json, size_t len) {
+    return object_body(json, json + len) != NULL;
+}
+
+static uint32_t key_hash(const char *key, size_t len) {
+    uint32_t h = 2166136261u;               /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void free_index(member_index_t *idx) {
+    free(idx->members);
+    free(idx->matched);
+    free(idx->slots);
+}
+
+/* Index the members of the object at json. Returns -1 if out of memory */
+static int index_members(member_index_t *idx, const char *json, size_t len) {
+    const char *end = json + len;
+    member_t m;
+    int count = 0;
+    
+    for (const char *p = object_body(json, end); p && (p = next_member(p, end, &m)); ) {
+        count++;
+    }
+    
+    size_t slots = 8;
+    while (slots < (size_t)count * 2) slots <<= 1;
+    
+    memset(idx, 0, sizeof(*idx));
+    idx->members = malloc((count ? count : 1) * sizeof(*idx->members));
+    idx->matched = calloc(count ? count : 1, sizeof(*idx->matched));
+    idx->slots = calloc(slots, sizeof(*idx->slots));
+    idx->mask = slots - 1;
+    if (!idx->members || !idx->matched || !idx->slots) {
+        free_index(idx);
+        return -1;
+    }
+    
+    for (const char *p = object_body(json, end); p && (p = next_member(p, end, &m)); ) {
+        size_t slot = key_hash(m.key, m.key_len) & idx->mask;
+        while (idx->slots[slot]) slot = (slot + 1) & idx->mask;
+        idx->members[idx->count] = m;
+        idx->slots[slot] = ++idx->count;
+    }
+    return 0;
+}
+
+/* Index of the member named key, -1 if there is none */
+static int lookup_member(const member_index_t *idx, const char *key, size_t key_len) {
+    for (size_t slot = key_hash(key, key_len) & idx->mask; idx->slots[slot];
+         slot = (slot + 1) & idx->mask) {
+        const member_t *m = &idx->members[idx->slots[slot] - 1];
+        if (m->key_len == key_len && memcmp(m->key, key, key_len) == 0) {
+            return idx->slots[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+static bool diff_objects(json_builder_t *j, const char *old, size_t old_len,
+                         const char *new_json, size_t new_len) {
+    bool changed = false;
+    const char *new_end = new_json + new_len;
+    member_index_t old_members;
+    member_t m;
+    
+    if (index_members(&old_members, old, old_len) < 0) {
+        j->error = true;
+        return true;
+    }
+    
+    json_object_start(j);
+    
+    /* Changed and added members */
+    for (const char *p = object_body(new_json, new_end); p && (p = next_member(p, new_end, &m)); ) {
+        int i = lookup_member(&old_members, m.key, m.key_len);
+        if (i >= 0) {
+            const member_t *o = &old_members.members[i];
+            old_members.matched[i] = true;
+            if (o->value_len == m.value_len && memcmp(o->value, m.value, m.value_len) == 0) {
+                continue;
+            }
+            json_key_raw(j, m.key, m.key_len);
+            if (is_object(o->value, o->value_len) && is_object(m.value, m.value_len)) {
+                diff_objects(j, o->value, o->value_len, m.value, m.value_len);
+            } else {
+                json_raw(j, m.value, m.value_len);
+            }
+        } else {
+            json_key_raw(j, m.key, m.key_len);
+            json_raw(j, m.value, m.value_len);
+        }
+        changed = true;
+    }
+    
+    /* Removed members */
+    for (int i = 0; i < old_members.count; i++) {
+        if (!old_members.matched[i]) {
+            json_key_raw(j, old_members.members[i].key, old_members.members[i].key_len);
+            json_null(j);
+            changed = true;
+        }
+    }
+    
+    json_object_end(j);
+    free_index(&old_members);
+    return changed;
+}
+
+bool json_merge_diff(json_builder_t *j, const char *old, size_t old_len,
+                     const char *new_json, size_t new_len) {
+    if (is_object(old, old_len) && is_object(new_json, new_len)) {
+        return diff_objects(j, old, old_len, new_json, new_len);
+    }
+    
+    json_raw(j, new_json, new_len);
+    return old_len != new_len || memcmp(old, new_json, new_len) != 0;
+}
+
+/* First segment of a dotted path and its length */
+static size_t segment_len(const char *path) {
+    const char *dot = strchr(path, '.');
+    return dot ? (size_t)(dot - path) : strlen(path);
+}
+
+/* Members of the object at json named by the first segments of paths, and below */
+static void project_object(json_builder_t *j, const char *json, size_t len,
+                           const char **paths, int count) {
+    const char *rest[PROJECT_MAX_PATHS];
+    member_t m;
+    
+    json_object_start(j);
+    
+    for (int i = 0; i < count; i++) {
+        size_t seg = segment_len(paths[i]);
+    
+        /* Paths sharing a first segment are handled with the first of them */
+        bool seen = false;
+        for (int k = 0; k < i && !seen; k++) {
+            seen = segment_len(paths[k]) == seg && memcmp(paths[k], paths[i], seg) == 0;
+        }
+        if (seen || seg == 0 || !find_member(json, len, paths[i], seg, &m)) continue;
+    
+        /* Whole member if any path ends here, else only the parts below it */
+        int nrest = 0;
+        bool whole = false;
+        for (int k = i; k < count; k++) {
+            if (segment_len(paths[k]) != seg || memcmp(paths[k], paths[i], seg) != 0) continue;
+            if (paths[k][seg] == '\0') {
+                whole = true;
+            } else {
+                rest[nrest++] = paths[k] + seg + 1;
+            }
+        }
+    
+        if (!whole && !is_object(m.value, m.value_len)) continue;
+        json_key_raw(j, m.key, m.key_len);
+        if (whole) {
+            json_raw(j, m.value, m.value_len);
+        } else {
+            project_object(j, m.value, m.value_len, rest, nrest);
+        }
+    }
+    
+    json_object_end(j);
+}
+
+void json_project(json_builder_t *j, const char *json, size_t len, const char *fields) {
+    char *buf = strdup(fields);
+    if (!buf) {
+        j->error = true;
+        return;
+    }
+    
+    const char *paths[PROJECT_MAX_PATHS];
+    int count = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok && count < PROJECT_MAX_PATHS;
+         tok = strtok_r(NULL, ",", &save)) {
+        paths[count++] = tok;
+    }
+    
+    if (is_object(json, len)) {
+        project_object(j, json, len, paths, count);
+    } else {
+        json_null(j);
+    }
+    free(buf);
+}
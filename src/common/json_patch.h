@@ -0,0 +1,41 @@
+/*
+ * json_patch.h - Reading serialized JSON and computing merge patches
+ *
+ * These work on documents produced by the JSON builder: values are found
+ * by scanning the text, and members are compared byte for byte.
+ * Projections copy the selected values as they are, without reparsing
+ * them.
+ */
+#ifndef QMEM_JSON_PATCH_H
+#define QMEM_JSON_PATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "json.h"
+
+/* Length of the JSON value starting at json, 0 if it is malformed */
+size_t json_value_len(const char *json, size_t len);
+
+/*
+ * Find a member of the object starting at json
+ * Returns its value and sets *value_len, or NULL if there is no such key
+ */
+const char *json_object_find(const char *json, size_t len, const char *key, size_t *value_len);
+
+/*
+ * Write a JSON merge patch (RFC 7396) that turns old into new_json:
+ * changed and added members, null for removed ones, recursing into
+ * objects present in both. Anything but two objects is replaced whole.
+ * Returns true if the documents differ
+ */
+bool json_merge_diff(json_builder_t *j, const char *old, size_t old_len,
+                     const char *new_json, size_t new_len);
+
+/*
+ * Write the parts of the object at json named by fields, a comma-separated
+ * list of dotted member paths ("meminfo,procmem.top_rss"), nested as in
+ * json. Paths that do not exist are left out
+ */
+void json_project(json_builder_t *j, const char *json, size_t len, const char *fields);
+
+#endif /* QMEM_JSON_PATCH_H */
@@ -1,6 +1,8 @@
 /*
  * proc_utils.c - /proc filesystem utilities
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "proc_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +12,7 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 ssize_t proc_read_file(const char *path, char *buf, size_t size) {
     int fd = open(path, O_RDONLY);
@@ -65,15 +68,105 @@ int64_t proc_read_status_kb(pid_t pid, const char *field) {
     return -1;
 }
 
-int proc_read_cmdline(pid_t pid, char *buf, size_t size) {
+static const struct {
+    const char *name;
+    size_t len;
+} status_keys[PROC_STATUS_COUNT] = {
+    [PROC_STATUS_VMSIZE] = { "VmSize", 6 },
+    [PROC_STATUS_VMHWM] = { "VmHWM", 5 },
+    [PROC_STATUS_VMRSS] = { "VmRSS", 5 },
+    [PROC_STATUS_VMDATA] = { "VmData", 6 },
+    [PROC_STATUS_VMSWAP] = { "VmSwap", 6 },
+    [PROC_STATUS_THREADS] = { "Threads", 7 },
+    [PROC_STATUS_VOLUNTARY_CTXT] = { "voluntary_ctxt_switches", 23 },
+    [PROC_STATUS_NONVOLUNTARY_CTXT] = { "nonvoluntary_ctxt_switches", 26 },
+};
+
+int proc_parse_status(const char *buf, unsigned int mask, int64_t *values) {
+    unsigned int pending = mask & PROC_STATUS_ALL;
+    int found = 0;
+    
+    for (int i = 0; i < PROC_STATUS_COUNT; i++) {
+        values[i] = -1;
+    }
+    
+    const char *line = buf;
+    while (pending && *line) {
+        const char *colon = strchr(line, ':');
+        if (!colon) break;
+        
+        size_t key_len = colon - line;
+        for (int i = 0; i < PROC_STATUS_COUNT; i++) {
+            if (!(pending & PROC_STATUS_MASK(i))) continue;
+            if (key_len == status_keys[i].len &&
+                memcmp(line, status_keys[i].name, key_len) == 0) {
+                values[i] = strtoll(colon + 1, NULL, 10);
+                pending &= ~PROC_STATUS_MASK(i);
+                found++;
+                break;
+            }
+        }
+        
+        /* Next line */
+        line = strchr(colon, '\n');
+        if (!line) break;
+        line++;
+    }
+    
+    return found;
+}
+
+int proc_read_status(pid_t pid, unsigned int mask, int64_t *values) {
     char path[64];
-    snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    char buf[4096];
     
-    ssize_t n = proc_read_file(path, buf, size);
-    if (n < 0) {
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (proc_read_file(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    
+    return proc_parse_status(buf, mask, values);
+}
+
+static int parse_statm(const char *buf, proc_statm_t *statm) {
+    long long size, resident, shared, text, lib, data;
+    if (sscanf(buf, "%lld %lld %lld %lld %lld %lld",
+               &size, &resident, &shared, &text, &lib, &data) != 6) {
         return -1;
     }
     
+    statm->size = size;
+    statm->resident = resident;
+    statm->shared = shared;
+    statm->text = text;
+    statm->data = data;
+    return 0;
+}
+
+int proc_read_statm(pid_t pid, proc_statm_t *statm) {
+    char path[64];
+    char buf[128];
+    
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    if (proc_read_file(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    
+    return parse_statm(buf, statm);
+}
+
+int64_t proc_page_kb(void) {
+    static int64_t page_kb;
+    
+    if (page_kb == 0) {
+        long size = sysconf(_SC_PAGESIZE);
+        page_kb = size > 0 ? size / 1024 : 4;
+    }
+    return page_kb;
+}
+
+/* Turn raw cmdline bytes into a printable string */
+static int cmdline_to_string(char *buf, ssize_t n) {
     /* Replace null bytes with spaces */
     for (ssize_t i = 0; i < n - 1; i++) {
         if (buf[i] == '\0') {
@@ -89,6 +182,18 @@ int proc_read_cmdline(pid_t pid, char *buf, size_t size) {
     return (int)n;
 }
 
+int proc_read_cmdline(pid_t pid, char *buf, size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    
+    ssize_t n = proc_read_file(path, buf, size);
+    if (n < 0) {
+        return -1;
+    }
+    
+    return cmdline_to_string(buf, n);
+}
+
 int proc_read_comm(pid_t pid, char *buf, size_t size) {
     char path[64];
     snprintf(path, sizeof(path), "/proc/%d/comm", pid);
@@ -180,3 +285,601 @@ int64_t proc_parse_kv_kb(const char *line, char *key_buf, size_t key_size) {
     
     return strtoll(val, NULL, 10);
 }
+
+/*
+ * Per-PID file descriptor cache
+ */
+
+static const char *const fd_slot_names[PROC_FD_SLOTS] = {
+    [PROC_FD_SLOT_STAT] = "stat",
+    [PROC_FD_SLOT_STATUS] = "status",
+    [PROC_FD_SLOT_CMDLINE] = "cmdline",
+    [PROC_FD_SLOT_STATM] = "statm",
+};
+
+int proc_fd_cache_init(proc_fd_cache_t *cache, int budget) {
+    memset(cache, 0, sizeof(*cache));
+    cache->bucket_count = 4096;
+    cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets));
+    if (!cache->buckets) {
+        return -1;
+    }
+    cache->budget = budget;
+    return 0;
+}
+
+static void close_fd_entry(proc_fd_cache_t *cache, proc_fd_entry_t *e) {
+    for (int i = 0; i < PROC_FD_SLOTS; i++) {
+        if (e->fds[i] >= 0) {
+            close(e->fds[i]);
+            cache->open_fds--;
+        }
+    }
+    free(e);
+}
+
+void proc_fd_cache_free(proc_fd_cache_t *cache) {
+    for (int b = 0; b < cache->bucket_count; b++) {
+        proc_fd_entry_t *e = cache->buckets[b];
+        while (e) {
+            proc_fd_entry_t *next = e->next;
+            close_fd_entry(cache, e);
+            e = next;
+        }
+    }
+    free(cache->buckets);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void proc_fd_cache_begin(proc_fd_cache_t *cache) {
+    cache->generation++;
+}
+
+void proc_fd_cache_sweep(proc_fd_cache_t *cache) {
+    for (int b = 0; b < cache->bucket_count; b++) {
+        proc_fd_entry_t **pp = &cache->buckets[b];
+        while (*pp) {
+            proc_fd_entry_t *e = *pp;
+            if (e->generation != cache->generation) {
+                *pp = e->next;
+                close_fd_entry(cache, e);
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+}
+
+static proc_fd_entry_t **find_fd_entry(proc_fd_cache_t *cache, pid_t pid) {
+    proc_fd_entry_t **pp = &cache->buckets[(unsigned int)pid % cache->bucket_count];
+    while (*pp && (*pp)->pid != pid) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static ssize_t pread_all(int fd, char *buf, size_t size) {
+    ssize_t total = 0;
+    while ((size_t)total < size - 1) {
+        ssize_t n = pread(fd, buf + total, size - 1 - total, total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    buf[total] = '\0';
+    return total;
+}
+
+ssize_t proc_fd_cache_read(proc_fd_cache_t *cache, pid_t pid, int slot,
+                           char *buf, size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, fd_slot_names[slot]);
+    
+    proc_fd_entry_t **pp = find_fd_entry(cache, pid);
+    proc_fd_entry_t *e = *pp;
+    
+    if (e && e->fds[slot] >= 0) {
+        ssize_t n = pread_all(e->fds[slot], buf, size);
+        if (n >= 0) {
+            e->generation = cache->generation;
+            return n;
+        }
+        
+        /* Process exited or PID was reused: drop stale fds, reopen */
+        *pp = e->next;
+        close_fd_entry(cache, e);
+        e = NULL;
+    }
+    
+    if (cache->open_fds >= cache->budget) {
+        return proc_read_file(path, buf, size);
+    }
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    if (!e) {
+        e = malloc(sizeof(*e));
+        if (!e) {
+            close(fd);
+            return proc_read_file(path, buf, size);
+        }
+        e->pid = pid;
+        for (int i = 0; i < PROC_FD_SLOTS; i++) e->fds[i] = -1;
+        e->next = cache->buckets[(unsigned int)pid % cache->bucket_count];
+        cache->buckets[(unsigned int)pid % cache->bucket_count] = e;
+    }
+    e->fds[slot] = fd;
+    e->generation = cache->generation;
+    cache->open_fds++;
+    
+    return pread_all(fd, buf, size);
+}
+
+/*
+ * Incremental fd scans
+ */
+
+int proc_fd_scans_init(proc_fd_scans_t *scans, int max_age) {
+    memset(scans, 0, sizeof(*scans));
+    scans->bucket_count = 4096;
+    scans->buckets = calloc(scans->bucket_count, sizeof(*scans->buckets));
+    if (!scans->buckets) {
+        return -1;
+    }
+    scans->max_age = max_age > 0 ? max_age : 1;
+    return 0;
+}
+
+void proc_fd_scans_free(proc_fd_scans_t *scans) {
+    for (int b = 0; b < scans->bucket_count; b++) {
+        proc_fd_scan_t *s = scans->buckets[b];
+        while (s) {
+            proc_fd_scan_t *next = s->next;
+            free(s->inodes);
+            free(s);
+            s = next;
+        }
+    }
+    free(scans->buckets);
+    memset(scans, 0, sizeof(*scans));
+}
+
+static void fd_scans_begin(proc_fd_scans_t *scans) {
+    scans->generation++;
+    scans->walked = 0;
+    scans->reused = 0;
+}
+
+static void fd_scans_sweep(proc_fd_scans_t *scans) {
+    for (int b = 0; b < scans->bucket_count; b++) {
+        proc_fd_scan_t **pp = &scans->buckets[b];
+        while (*pp) {
+            proc_fd_scan_t *s = *pp;
+            if (s->generation != scans->generation) {
+                *pp = s->next;
+                free(s->inodes);
+                free(s);
+            } else {
+                pp = &s->next;
+            }
+        }
+    }
+}
+
+static proc_fd_scan_t *find_fd_scan(proc_fd_scans_t *scans, pid_t pid) {
+    proc_fd_scan_t *s = scans->buckets[(unsigned int)pid % scans->bucket_count];
+    while (s && s->pid != pid) {
+        s = s->next;
+    }
+    return s;
+}
+
+/*
+ * Process table
+ */
+
+void proc_table_init(proc_table_t *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+void proc_table_free(proc_table_t *table) {
+    free(table->records);
+    intern_free(&table->names);
+    free(table->inodes);
+    memset(table, 0, sizeof(*table));
+}
+
+static proc_record_t *table_add_record(proc_table_t *table) {
+    if (table->count >= table->capacity) {
+        int cap = table->capacity ? table->capacity * 2 : 1024;
+        proc_record_t *records = realloc(table->records, cap * sizeof(*records));
+        if (!records) return NULL;
+        table->records = records;
+        table->capacity = cap;
+    }
+    
+    proc_record_t *rec = &table->records[table->count++];
+    memset(rec, 0, sizeof(*rec));
+    return rec;
+}
+
+static int table_add_inode(proc_table_t *table, uint32_t inode) {
+    if (table->inode_count >= table->inode_cap) {
+        size_t cap = table->inode_cap ? table->inode_cap * 2 : 4096;
+        uint32_t *inodes = realloc(table->inodes, cap * sizeof(*inodes));
+        if (!inodes) return -1;
+        table->inodes = inodes;
+        table->inode_cap = cap;
+    }
+    
+    table->inodes[table->inode_count++] = inode;
+    return 0;
+}
+
+/* Read a per-PID file, through the table's fd cache if it has one */
+static ssize_t table_read(const proc_table_t *table, pid_t pid, int slot,
+                          char *buf, size_t size) {
+    if (table->fd_cache) {
+        return proc_fd_cache_read(table->fd_cache, pid, slot, buf, size);
+    }
+    
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, fd_slot_names[slot]);
+    return proc_read_file(path, buf, size);
+}
+
+/* Parse /proc/<pid>/stat into record */
+static int read_pid_stat(const proc_table_t *table, pid_t pid, proc_record_t *rec) {
+    char buf[1024];
+    
+    if (table_read(table, pid, PROC_FD_SLOT_STAT, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    
+    /* comm may contain spaces and parentheses: use the last ')' */
+    char *open_paren = strchr(buf, '(');
+    char *close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return -1;
+    
+    size_t comm_len = close_paren - open_paren - 1;
+    if (comm_len >= sizeof(rec->comm)) comm_len = sizeof(rec->comm) - 1;
+    memcpy(rec->comm, open_paren + 1, comm_len);
+    rec->comm[comm_len] = '\0';
+    
+    /* Fields after comm start at 3 (state) */
+    char *p = close_paren + 2;
+    rec->state = *p;
+    
+    int field = 3;
+    while (*p && field < 22) {
+        while (*p && !isspace(*p)) p++;
+        while (*p && isspace(*p)) p++;
+        field++;
+        
+        switch (field) {
+            case 4:  rec->ppid = (pid_t)strtol(p, NULL, 10); break;
+            case 14: rec->utime = strtoul(p, NULL, 10); break;
+            case 15: rec->stime = strtoul(p, NULL, 10); break;
+            case 22: rec->starttime = strtoull(p, NULL, 10); break;
+        }
+    }
+    
+    return field == 22 ? 0 : -1;
+}
+
+/* Read all known /proc/<pid>/status fields in one pass */
+static int read_pid_status(const proc_table_t *table, pid_t pid, proc_record_t *rec) {
+    char buf[4096];
+    
+    if (table_read(table, pid, PROC_FD_SLOT_STATUS, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    
+    proc_parse_status(buf, PROC_STATUS_ALL, rec->status);
+    rec->rss_kb = rec->status[PROC_STATUS_VMRSS];
+    rec->data_kb = rec->status[PROC_STATUS_VMDATA];
+    return 0;
+}
+
+static int read_pid_statm(const proc_table_t *table, pid_t pid, proc_record_t *rec) {
+    char buf[128];
+    
+    if (table_read(table, pid, PROC_FD_SLOT_STATM, buf, sizeof(buf)) < 0 ||
+        parse_statm(buf, &rec->statm) < 0) {
+        return -1;
+    }
+    
+    /* Kernel threads have no mm: keep them absent, as in status */
+    if (rec->statm.size > 0 && rec->rss_kb < 0) {
+        rec->rss_kb = rec->statm.resident * proc_page_kb();
+        rec->data_kb = rec->statm.data * proc_page_kb();
+    }
+    return 0;
+}
+
+/* Count and classify open fds, collecting socket inodes */
+static int read_pid_fds(proc_table_t *table, pid_t pid, proc_record_t *rec,
+                        size_t *inode_start) {
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
+    
+    DIR *dir = opendir(fd_path);
+    if (!dir) return -1;
+    
+    *inode_start = table->inode_count;
+    
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!isdigit(ent->d_name[0])) continue;
+        rec->fd_count++;
+        
+        char link_path[320];
+        char target[256];
+        snprintf(link_path, sizeof(link_path), "%s/%s", fd_path, ent->d_name);
+        ssize_t len = readlink(link_path, target, sizeof(target) - 1);
+        if (len <= 0) continue;
+        target[len] = '\0';
+        
+        if (strncmp(target, "socket:[", 8) == 0) {
+            rec->fd_types.sockets++;
+            if (table_add_inode(table, (uint32_t)strtoul(target + 8, NULL, 10)) == 0) {
+                rec->socket_count++;
+            }
+        } else if (strncmp(target, "pipe:", 5) == 0) {
+            rec->fd_types.pipes++;
+        } else if (strncmp(target, "anon_inode:", 11) == 0) {
+            rec->fd_types.eventfds++;
+        } else if (target[0] == '/') {
+            rec->fd_types.files++;
+        } else {
+            rec->fd_types.other++;
+        }
+    }
+    
+    closedir(dir);
+    return 0;
+}
+
+/* Remember a fresh walk; on allocation failure the next pass walks again */
+static void store_fd_scan(proc_fd_scans_t *scans, proc_fd_scan_t *s, pid_t pid,
+                          const proc_record_t *rec, const uint32_t *inodes,
+                          unsigned long cpu_ticks, long long dir_size) {
+    if (!s) {
+        s = calloc(1, sizeof(*s));
+        if (!s) return;
+        s->pid = pid;
+        s->next = scans->buckets[(unsigned int)pid % scans->bucket_count];
+        scans->buckets[(unsigned int)pid % scans->bucket_count] = s;
+    }
+    
+    s->generation = scans->generation;
+    s->walked = scans->generation - scans->max_age;  /* Stale until complete */
+    
+    uint32_t *copy = NULL;
+    if (rec->socket_count > 0) {
+        copy = realloc(s->inodes, rec->socket_count * sizeof(*copy));
+        if (!copy) return;
+        memcpy(copy, inodes, rec->socket_count * sizeof(*copy));
+    } else {
+        free(s->inodes);
+    }
+    
+    s->inodes = copy;
+    s->socket_count = rec->socket_count;
+    s->starttime = rec->starttime;
+    s->cpu_ticks = cpu_ticks;
+    s->dir_size = dir_size;
+    s->fd_count = rec->fd_count;
+    s->fd_types = rec->fd_types;
+    s->walked = scans->generation;
+}
+
+/* Walk /proc/<pid>/fd, or reuse the last walk if the process has not run */
+static int scan_pid_fds(proc_table_t *table, pid_t pid, proc_record_t *rec,
+                        size_t *inode_start) {
+    proc_fd_scans_t *scans = table->fd_scans;
+    if (!scans || !(rec->fields & PROC_FIELD_STAT)) {
+        return read_pid_fds(table, pid, rec, inode_start);
+    }
+    
+    char fd_path[64];
+    struct stat st;
+    snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
+    if (stat(fd_path, &st) < 0) {
+        return -1;
+    }
+    
+    unsigned long cpu_ticks = rec->utime + rec->stime;
+    proc_fd_scan_t *s = find_fd_scan(scans, pid);
+    
+    if (s && s->starttime == rec->starttime && s->cpu_ticks == cpu_ticks &&
+        s->dir_size == (long long)st.st_size &&
+        scans->generation - s->walked < (unsigned int)scans->max_age) {
+        *inode_start = table->inode_count;
+        for (int k = 0; k < s->socket_count; k++) {
+            if (table_add_inode(table, s->inodes[k]) == 0) {
+                rec->socket_count++;
+            }
+        }
+        rec->fd_count = s->fd_count;
+        rec->fd_types = s->fd_types;
+        s->generation = scans->generation;
+        scans->reused++;
+        return 0;
+    }
+    
+    if (read_pid_fds(table, pid, rec, inode_start) < 0) {
+        return -1;
+    }
+    scans->walked++;
+    store_fd_scan(scans, s, pid, rec, table->inodes + *inode_start,
+                  cpu_ticks, (long long)st.st_size);
+    return 0;
+}
+
+/* Intern the command line of a process, reading it on first sight and after an exec */
+static const char *intern_cmdline(proc_table_t *table, pid_t pid, const proc_record_t *rec) {
+    const char *name = intern_lookup(&table->names, pid, rec->starttime, rec->comm);
+    if (name) {
+        return name;
+    }
+    
+    char cmd[PROC_CMDLINE_MAX];
+    ssize_t n = table_read(table, pid, PROC_FD_SLOT_CMDLINE, cmd, sizeof(cmd));
+    int len = n < 0 ? -1 : cmdline_to_string(cmd, n);
+    if (len <= 0) {
+        /* Kernel threads have an empty cmdline */
+        len = snprintf(cmd, sizeof(cmd), "%s", rec->comm);
+    }
+    
+    return intern_add(&table->names, pid, rec->starttime, rec->comm, cmd, (size_t)len);
+}
+
+int proc_table_build(proc_table_t *table, unsigned int fields) {
+    /* Command lines and fd scans are keyed by (pid, starttime) */
+    if (fields & PROC_FIELD_CMDLINE) {
+        fields |= PROC_FIELD_STAT;
+    }
+    if ((fields & PROC_FIELD_FD) && table->fd_scans) {
+        fields |= PROC_FIELD_STAT;
+    }
+    
+    table->count = 0;
+    table->inode_count = 0;
+    table->fields = fields;
+    
+    if (!table->names.buckets && intern_init(&table->names, 4096) < 0) {
+        return -1;
+    }
+    
+    DIR *dir = opendir("/proc");
+    if (!dir) {
+        return -1;
+    }
+    
+    if (table->fd_cache) {
+        proc_fd_cache_begin(table->fd_cache);
+    }
+    if (fields & PROC_FIELD_CMDLINE) {
+        intern_begin(&table->names);
+    }
+    if ((fields & PROC_FIELD_FD) && table->fd_scans) {
+        fd_scans_begin(table->fd_scans);
+    }
+    
+    size_t *inode_offsets = NULL;
+    int offsets_cap = 0;
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!isdigit(entry->d_name[0])) continue;
+        
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        proc_record_t *rec = table_add_record(table);
+        if (!rec) break;
+        
+        if (table->count > offsets_cap) {
+            int cap = table->capacity;
+            size_t *o = realloc(inode_offsets, cap * sizeof(*o));
+            if (!o) {
+                table->count--;
+                break;
+            }
+            inode_offsets = o;
+            offsets_cap = cap;
+        }
+        inode_offsets[table->count - 1] = 0;
+        
+        rec->pid = pid;
+        rec->fields = fields & PROC_FIELD_PID;
+        for (int i = 0; i < PROC_STATUS_COUNT; i++) rec->status[i] = -1;
+        rec->rss_kb = -1;
+        rec->data_kb = -1;
+        rec->fd_count = -1;
+        
+        if ((fields & PROC_FIELD_STAT) && read_pid_stat(table, pid, rec) == 0) {
+            rec->fields |= PROC_FIELD_STAT;
+        }
+        
+        if ((fields & PROC_FIELD_STATUS) && read_pid_status(table, pid, rec) == 0) {
+            rec->fields |= PROC_FIELD_STATUS;
+        }
+        
+        if ((fields & PROC_FIELD_STATM) && read_pid_statm(table, pid, rec) == 0) {
+            rec->fields |= PROC_FIELD_STATM;
+        }
+        
+        if ((fields & PROC_FIELD_CMDLINE) && (rec->fields & PROC_FIELD_STAT)) {
+            rec->cmdline = intern_cmdline(table, pid, rec);
+            if (rec->cmdline) rec->fields |= PROC_FIELD_CMDLINE;
+        }
+        
+        if (fields & PROC_FIELD_FD) {
+            rec->fd_count = 0;
+            if (scan_pid_fds(table, pid, rec, &inode_offsets[table->count - 1]) == 0) {
+                rec->fields |= PROC_FIELD_FD;
+            } else {
+                rec->fd_count = -1;
+            }
+        }
+        
+        /* Process vanished before anything could be read */
+        if ((rec->fields & ~PROC_FIELD_PID) == 0 && (fields & ~PROC_FIELD_PID) != 0) {
+            table->count--;
+        }
+    }
+    
+    closedir(dir);
+    
+    if (table->fd_cache) {
+        proc_fd_cache_sweep(table->fd_cache);
+    }
+    if (fields & PROC_FIELD_CMDLINE) {
+        intern_sweep(&table->names);
+    }
+    if ((fields & PROC_FIELD_FD) && table->fd_scans) {
+        fd_scans_sweep(table->fd_scans);
+    }
+    
+    /* Storage is stable now: resolve inode offsets */
+    for (int i = 0; i < table->count; i++) {
+        proc_record_t *rec = &table->records[i];
+        rec->socket_inodes = rec->socket_count > 0 ? table->inodes + inode_offsets[i] : NULL;
+    }
+    
+    free(inode_offsets);
+    return table->count;
+}
+
+/* Fallback table of this module, for services run outside the manager */
+static proc_table_t g_private_table;
+
+const proc_table_t *proc_table_get(const proc_table_t *shared, unsigned int fields) {
+    if (shared) {
+        return shared;
+    }
+    
+    if (proc_table_build(&g_private_table, fields) < 0) {
+        return NULL;
+    }
+    return &g_private_table;
+}
+
+int proc_table_foreach(const proc_table_t *table, proc_record_callback_t callback, void *userdata) {
+    int visited = 0;
+    
+    for (int i = 0; i < table->count; i++) {
+        visited++;
+        if (!callback(&table->records[i], userdata)) {
+            break;
+        }
+    }
+    
+    return visited;
+}
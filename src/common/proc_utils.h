@@ -8,6 +8,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include "intern.h"
 
 /*
  * Read entire file into buffer
@@ -21,6 +22,53 @@ ssize_t proc_read_file(const char *path, char *buf, size_t size);
  */
 int64_t proc_read_status_kb(pid_t pid, const char *field);
 
+/* Fields of /proc/<pid>/status extracted in one pass */
+typedef enum {
+    PROC_STATUS_VMSIZE,             /* kB */
+    PROC_STATUS_VMHWM,              /* kB */
+    PROC_STATUS_VMRSS,              /* kB */
+    PROC_STATUS_VMDATA,             /* kB */
+    PROC_STATUS_VMSWAP,             /* kB */
+    PROC_STATUS_THREADS,
+    PROC_STATUS_VOLUNTARY_CTXT,
+    PROC_STATUS_NONVOLUNTARY_CTXT,
+    PROC_STATUS_COUNT
+} proc_status_field_t;
+
+#define PROC_STATUS_MASK(field) (1u << (field))
+#define PROC_STATUS_ALL ((1u << PROC_STATUS_COUNT) - 1)
+
+/*
+ * Extract the fields in mask from status text with a single scan
+ * values[] is indexed by proc_status_field_t; missing fields are -1.
+ * Returns number of fields found
+ */
+int proc_parse_status(const char *buf, unsigned int mask, int64_t *values);
+
+/*
+ * Read /proc/<pid>/status once and extract the fields in mask
+ * Returns number of fields found, or -1 on error
+ */
+int proc_read_status(pid_t pid, unsigned int mask, int64_t *values);
+
+/* /proc/<pid>/statm, in pages */
+typedef struct {
+    int64_t size;
+    int64_t resident;
+    int64_t shared;
+    int64_t text;
+    int64_t data;                   /* Data + stack */
+} proc_statm_t;
+
+/*
+ * Read /proc/<pid>/statm, which is much cheaper to generate than status
+ * when only page counts are needed. Returns 0 on success, -1 on error
+ */
+int proc_read_statm(pid_t pid, proc_statm_t *statm);
+
+/* Page size in KB */
+int64_t proc_page_kb(void);
+
 /*
  * Read /proc/<pid>/cmdline
  * Returns length of command, or -1 on error
@@ -55,4 +103,206 @@ bool proc_pid_exists(pid_t pid);
  */
 int64_t proc_parse_kv_kb(const char *line, char *key_buf, size_t key_size);
 
+/*
+ * Per-tick process table
+ *
+ * One pass over /proc that reads each requested per-PID file once and
+ * stores the parsed values as records. Services subscribe by declaring
+ * the fields they need and iterate the shared table with callbacks
+ * instead of walking /proc themselves.
+ */
+
+/* Per-PID data sources */
+#define PROC_FIELD_STAT     (1u << 0)   /* /proc/<pid>/stat: comm, state, ppid, times */
+#define PROC_FIELD_STATUS   (1u << 1)   /* /proc/<pid>/status: VmRSS, VmData */
+#define PROC_FIELD_CMDLINE  (1u << 2)   /* /proc/<pid>/cmdline, comm fallback (implies STAT) */
+#define PROC_FIELD_FD       (1u << 3)   /* /proc/<pid>/fd: counts, socket inodes (with fd_scans, implies STAT) */
+#define PROC_FIELD_STATM    (1u << 4)   /* /proc/<pid>/statm: page counts */
+#define PROC_FIELD_PID      (1u << 5)   /* PID list only, no per-PID reads */
+
+#define PROC_COMM_MAX 16
+#define PROC_CMDLINE_MAX 128
+
+/* Open file descriptors by type */
+typedef struct {
+    int files;
+    int sockets;
+    int pipes;
+    int eventfds;                   /* anon_inode: eventfd, timerfd, ... */
+    int other;
+} proc_fd_types_t;
+
+/* One process */
+typedef struct {
+    pid_t pid;
+    unsigned int fields;            /* PROC_FIELD_* successfully read */
+    
+    /* PROC_FIELD_STAT */
+    pid_t ppid;
+    char state;
+    char comm[PROC_COMM_MAX];
+    unsigned long utime;            /* Clock ticks */
+    unsigned long stime;
+    unsigned long long starttime;   /* Clock ticks after boot */
+    
+    /* PROC_FIELD_STATUS (-1 if absent or not read, e.g. kernel threads) */
+    int64_t status[PROC_STATUS_COUNT];
+    
+    /* PROC_FIELD_STATM (all zero for kernel threads) */
+    proc_statm_t statm;
+    
+    /* From STATUS if read, else STATM (-1 if absent) */
+    int64_t rss_kb;
+    int64_t data_kb;
+    
+    /* PROC_FIELD_CMDLINE */
+    const char *cmdline;            /* Interned, intern_retain to keep past the pass */
+    
+    /* PROC_FIELD_FD */
+    int fd_count;
+    proc_fd_types_t fd_types;
+    const uint32_t *socket_inodes;  /* Points into the table */
+    int socket_count;
+} proc_record_t;
+
+/*
+ * Per-PID file descriptor cache
+ *
+ * Keeps /proc/<pid>/{stat,status,cmdline,statm} open across passes and
+ * re-reads them with pread() at offset 0, avoiding path lookup and fd
+ * allocation per read. A read on a cached fd fails once the process
+ * exits (also after PID reuse), which drops the entry. Entries not seen
+ * during a pass are closed by the sweep. Once the fd budget is used up,
+ * further reads fall back to open/read/close.
+ */
+#define PROC_FD_SLOT_STAT       0
+#define PROC_FD_SLOT_STATUS     1
+#define PROC_FD_SLOT_CMDLINE    2
+#define PROC_FD_SLOT_STATM      3
+#define PROC_FD_SLOTS           4
+
+typedef struct proc_fd_entry {
+    pid_t pid;
+    int fds[PROC_FD_SLOTS];         /* -1 if not open */
+    unsigned int generation;        /* Last pass that used this entry */
+    struct proc_fd_entry *next;
+} proc_fd_entry_t;
+
+typedef struct {
+    proc_fd_entry_t **buckets;
+    int bucket_count;
+    int open_fds;
+    int budget;                     /* Max open fds */
+    unsigned int generation;
+} proc_fd_cache_t;
+
+/* Initialize cache with an fd budget. Returns 0 on success, -1 on error */
+int proc_fd_cache_init(proc_fd_cache_t *cache, int budget);
+
+/* Close all cached fds and free the cache */
+void proc_fd_cache_free(proc_fd_cache_t *cache);
+
+/* Start a pass: entries not used until the next sweep are closed */
+void proc_fd_cache_begin(proc_fd_cache_t *cache);
+
+/* Close entries of processes not seen since proc_fd_cache_begin */
+void proc_fd_cache_sweep(proc_fd_cache_t *cache);
+
+/*
+ * Read /proc/<pid>/<slot file> through the cache (NUL-terminated)
+ * Returns bytes read or -1 on error
+ */
+ssize_t proc_fd_cache_read(proc_fd_cache_t *cache, pid_t pid, int slot,
+                           char *buf, size_t size);
+
+/*
+ * Incremental fd scans
+ *
+ * Remembers the last /proc/<pid>/fd walk of each process, keyed by
+ * (pid, starttime). A process whose CPU time and fd count have not
+ * changed since then has not run, so it cannot have opened or closed
+ * descriptors itself; its previous result is reused instead of
+ * readlink()ing every fd again. Each entry is still rewalked after
+ * max_age passes, bounding staleness from descriptors changed without
+ * the process running (e.g. pidfd_getfd) or within one clock tick. The
+ * fd count is the st_size of /proc/<pid>/fd (Linux 6.2+, 0 before).
+ */
+typedef struct proc_fd_scan {
+    pid_t pid;
+    unsigned long long starttime;
+    unsigned long cpu_ticks;        /* utime + stime at the walk */
+    long long dir_size;             /* st_size of /proc/<pid>/fd at the walk */
+    unsigned int walked;            /* Pass of the last walk */
+    unsigned int generation;        /* Last pass that saw the process */
+    int fd_count;
+    proc_fd_types_t fd_types;
+    uint32_t *inodes;
+    int socket_count;
+    struct proc_fd_scan *next;
+} proc_fd_scan_t;
+
+typedef struct {
+    proc_fd_scan_t **buckets;
+    int bucket_count;
+    unsigned int generation;
+    int max_age;                    /* Passes before a forced rewalk */
+    int walked;                     /* fd directories walked last pass */
+    int reused;                     /* Walks skipped last pass */
+} proc_fd_scans_t;
+
+/* Initialize scan memo. Returns 0 on success, -1 on error */
+int proc_fd_scans_init(proc_fd_scans_t *scans, int max_age);
+
+/* Free all remembered scans */
+void proc_fd_scans_free(proc_fd_scans_t *scans);
+
+typedef struct {
+    proc_record_t *records;
+    int count;
+    int capacity;
+    unsigned int fields;            /* Fields requested for this pass */
+    
+    /* Command lines, read once per process lifetime */
+    intern_cache_t names;
+    
+    /* Backing storage for record inode lists */
+    uint32_t *inodes;
+    size_t inode_count;
+    size_t inode_cap;
+    
+    proc_fd_cache_t *fd_cache;      /* Optional, not owned; NULL reads via open/close */
+    proc_fd_scans_t *fd_scans;      /* Optional, not owned; NULL walks every fd dir */
+} proc_table_t;
+
+/*
+ * Callback for iterating table records
+ * Returns false to stop iteration
+ */
+typedef bool (*proc_record_callback_t)(const proc_record_t *rec, void *userdata);
+
+/* Initialize an empty table */
+void proc_table_init(proc_table_t *table);
+
+/* Free table storage */
+void proc_table_free(proc_table_t *table);
+
+/*
+ * Walk /proc once and read the requested PROC_FIELD_* sources
+ * Reuses the table's storage. Returns record count, or -1 on error
+ */
+int proc_table_build(proc_table_t *table, unsigned int fields);
+
+/*
+ * Return shared if set, otherwise rebuild a module-private table
+ * Lets services run outside the manager (e.g. embedded in another
+ * plugin). The private table is not thread-safe. Returns NULL on error
+ */
+const proc_table_t *proc_table_get(const proc_table_t *shared, unsigned int fields);
+
+/*
+ * Invoke callback for each record
+ * Returns number of records visited
+ */
+int proc_table_foreach(const proc_table_t *table, proc_record_callback_t callback, void *userdata);
+
 #endif /* QMEM_PROC_UTILS_H */
@@ -0,0 +1,120 @@
+/*
+ * statefile.c - Fixed-size records kept in a memory-mapped file
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "statefile.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATEFILE_MAGIC 0x54534d51      /* "QMST" */
+#define BOOT_ID_SIZE 40                 /* UUID text, NUL padded */
+
+struct statefile_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t reserved;
+    char boot_id[BOOT_ID_SIZE];         /* Boot the records were written in */
+};
+
+/* Identify the running boot; empty if the kernel does not say */
+static void read_boot_id(char *boot_id) {
+    memset(boot_id, 0, BOOT_ID_SIZE);
+    
+    FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!fp) return;
+    if (!fgets(boot_id, BOOT_ID_SIZE, fp)) {
+        boot_id[0] = '\0';
+    }
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+    fclose(fp);
+}
+
+int statefile_open(statefile_t *sf, const char *dir, const char *name,
+                   uint32_t version, size_t record_size, int capacity) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    memset(sf, 0, sizeof(*sf));
+    sf->fd = -1;
+    
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        log_warn("Cannot open state file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        log_debug("State file %s is in use, keeping state in memory", path);
+        close(fd);
+        return -1;
+    }
+    
+    size_t size = sizeof(statefile_header_t) + record_size * (size_t)capacity;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != size && ftruncate(fd, (off_t)size) < 0)) {
+        log_warn("Cannot size state file %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_warn("Cannot map state file %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    /* Records name pids, which mean nothing after a reboot */
+    char boot_id[BOOT_ID_SIZE];
+    read_boot_id(boot_id);
+    
+    statefile_header_t *header = map;
+    if (header->magic != STATEFILE_MAGIC || header->version != version ||
+        header->record_size != record_size || header->capacity != (uint32_t)capacity ||
+        header->count > (uint32_t)capacity ||
+        memcmp(header->boot_id, boot_id, BOOT_ID_SIZE) != 0) {
+        memset(map, 0, size);
+        header->magic = STATEFILE_MAGIC;
+        header->version = version;
+        header->record_size = (uint32_t)record_size;
+        header->capacity = (uint32_t)capacity;
+        memcpy(header->boot_id, boot_id, BOOT_ID_SIZE);
+    }
+    
+    sf->fd = fd;
+    sf->map = map;
+    sf->map_size = size;
+    sf->header = header;
+    sf->records = header + 1;
+    sf->capacity = capacity;
+    return (int)header->count;
+}
+
+void statefile_set_count(statefile_t *sf, int count) {
+    if (!sf->header) return;
+    atomic_signal_fence(memory_order_release);  /* Records before the count */
+    sf->header->count = (uint32_t)count;
+}
+
+void statefile_close(statefile_t *sf) {
+    if (sf->map) {
+        msync(sf->map, sf->map_size, MS_SYNC);
+        munmap(sf->map, sf->map_size);
+    }
+    if (sf->fd >= 0) {
+        close(sf->fd);
+    }
+    memset(sf, 0, sizeof(*sf));
+    sf->fd = -1;
+}
@@ -0,0 +1,42 @@
+/*
+ * statefile.h - Fixed-size records kept in a memory-mapped file
+ *
+ * Lets a service keep state such as leak baselines across daemon
+ * restarts. The file is a header followed by an array of records; the
+ * header's count is bumped only after a record is written, so a crash
+ * never exposes a half-added one. Records left by an earlier boot are
+ * dropped, since the pids they name have been reused.
+ */
+#ifndef QMEM_STATEFILE_H
+#define QMEM_STATEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct statefile_header statefile_header_t;
+
+typedef struct {
+    int fd;
+    void *map;
+    size_t map_size;
+    statefile_header_t *header;
+    void *records;              /* capacity records, NULL if not open */
+    int capacity;
+} statefile_t;
+
+/*
+ * Map dir/name holding up to capacity records of record_size bytes. A file
+ * of another version, record layout or boot is emptied. The file is locked, so
+ * a second opener fails instead of sharing it.
+ * Returns the number of records held, or -1
+ */
+int statefile_open(statefile_t *sf, const char *dir, const char *name,
+                   uint32_t version, size_t record_size, int capacity);
+
+/* Publish the number of valid records (after writing them) */
+void statefile_set_count(statefile_t *sf, int count);
+
+/* Sync and unmap */
+void statefile_close(statefile_t *sf);
+
+#endif /* QMEM_STATEFILE_H */
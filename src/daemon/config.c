@@ -15,14 +15,16 @@ void config_init_defaults(qmem_config_t *cfg) {
     cfg->interval_sec = 10;
     cfg->foreground = false;
     strncpy(cfg->pidfile, "/run/qmem.pid", sizeof(cfg->pidfile) - 1);
+    strncpy(cfg->data_dir, "/var/lib/qmem", sizeof(cfg->data_dir) - 1);
     strncpy(cfg->socket_path, "/run/qmem.sock", sizeof(cfg->socket_path) - 1);
     cfg->log_level = QMEM_LOG_INFO;
+    cfg->collect_threads = 1;
     
     cfg->proc_min_delta_kb = 1024;
     cfg->slab_min_delta_kb = 512;
     cfg->proc_top_n = 12;
     cfg->slab_top_n = 20;
-    cfg->heap_scan_top_n = 12;
+    cfg->heap_scan_top_n = 32;
     
     cfg->svc_meminfo = true;
     cfg->svc_slabinfo = true;
@@ -36,11 +38,16 @@ void config_init_defaults(qmem_config_t *cfg) {
     cfg->web_enabled = true;
     strncpy(cfg->web_listen, "0.0.0.0", sizeof(cfg->web_listen) - 1);
     cfg->web_port = 8080;
+    cfg->web_threads = 2;
     
     cfg->enable_plugins = true;
     strncpy(cfg->plugin_dir, "/usr/lib/qmem/plugins", sizeof(cfg->plugin_dir) - 1);
     
     cfg->max_snapshots = 360;
+    cfg->history_memory_kb = 4096;
+    cfg->rollups[0] = (qmem_rollup_t){ 60, 24 * 3600 };
+    cfg->rollups[1] = (qmem_rollup_t){ 600, 30 * 24 * 3600 };
+    cfg->rollup_count = 2;
 }
 
 static char *trim(char *str) {
@@ -54,6 +61,103 @@ static bool parse_bool(const char *str) {
     return strcmp(str, "true") == 0 || strcmp(str, "1") == 0 || strcmp(str, "yes") == 0;
 }
 
+/*
+ * Parse a duration: "250ms", "30s", "2m", "1h", "30d" or a bare number of seconds.
+ * Returns milliseconds, or -1 if malformed.
+ */
+static int64_t parse_duration_ms(const char *str, char **end) {
+    char *p;
+    double value = strtod(str, &p);
+    if (p == str || value < 0) return -1;
+    
+    int64_t ms;
+    if (strncmp(p, "ms", 2) == 0) {
+        ms = (int64_t)value;
+        p += 2;
+    } else if (*p == 's') {
+        ms = (int64_t)(value * 1000.0);
+        p++;
+    } else if (*p == 'm') {
+        ms = (int64_t)(value * 60000.0);
+        p++;
+    } else if (*p == 'h') {
+        ms = (int64_t)(value * 3600000.0);
+        p++;
+    } else if (*p == 'd') {
+        ms = (int64_t)(value * 86400000.0);
+        p++;
+    } else {
+        ms = (int64_t)(value * 1000.0);
+    }
+    
+    if (end) *end = p;
+    return ms;
+}
+
+/* "<interval> [offset]", e.g. "30s 5s" */
+static void parse_schedule(qmem_config_t *cfg, const char *service, const char *val) {
+    char *p;
+    int64_t interval = parse_duration_ms(val, &p);
+    if (interval <= 0) {
+        log_warn("Invalid schedule for %s: %s", service, val);
+        return;
+    }
+    
+    int64_t offset = 0;
+    while (*p && isspace(*p)) p++;
+    if (*p) {
+        offset = parse_duration_ms(p, NULL);
+        if (offset < 0) offset = 0;
+    }
+    
+    qmem_schedule_t *sched = (qmem_schedule_t *)config_find_schedule(cfg, service);
+    if (!sched) {
+        if (cfg->schedule_count >= QMEM_MAX_SCHEDULES) {
+            log_warn("Too many schedules, ignoring %s", service);
+            return;
+        }
+        sched = &cfg->schedules[cfg->schedule_count++];
+        snprintf(sched->service, sizeof(sched->service), "%s", service);
+    }
+    
+    sched->interval_ms = interval;
+    sched->offset_ms = offset % interval;
+}
+
+/* "<step>:<retention>, ...", e.g. "1m:24h, 10m:30d"; "none" disables rollups */
+static void parse_rollups(qmem_config_t *cfg, const char *val) {
+    cfg->rollup_count = 0;
+    if (strcmp(val, "none") == 0) return;
+    
+    const char *p = val;
+    while (*p) {
+        char *end;
+        int64_t step = parse_duration_ms(p, &end) / 1000;
+        int64_t retention = *end == ':' ? parse_duration_ms(end + 1, &end) / 1000 : -1;
+        int64_t prev = cfg->rollup_count > 0 ? cfg->rollups[cfg->rollup_count - 1].step_sec : 0;
+    
+        if (step <= prev || retention <= 0 || cfg->rollup_count >= QMEM_MAX_ROLLUPS) {
+            log_warn("Invalid history tiers (need up to %d of step:retention, "
+                     "increasing step): %s", QMEM_MAX_ROLLUPS, val);
+            cfg->rollup_count = 0;
+            return;
+        }
+        cfg->rollups[cfg->rollup_count++] = (qmem_rollup_t){ step, retention };
+    
+        while (*end && (isspace(*end) || *end == ',')) end++;
+        p = end;
+    }
+}
+
+const qmem_schedule_t *config_find_schedule(const qmem_config_t *cfg, const char *service) {
+    for (int i = 0; i < cfg->schedule_count; i++) {
+        if (strcmp(cfg->schedules[i].service, service) == 0) {
+            return &cfg->schedules[i];
+        }
+    }
+    return NULL;
+}
+
 int config_load(qmem_config_t *cfg, const char *path) {
     FILE *f = fopen(path, "r");
     if (!f) {
@@ -93,7 +197,12 @@ int config_load(qmem_config_t *cfg, const char *path) {
             if (strcmp(key, "interval") == 0) cfg->interval_sec = atoi(val);
             else if (strcmp(key, "foreground") == 0) cfg->foreground = parse_bool(val);
             else if (strcmp(key, "pidfile") == 0) strncpy(cfg->pidfile, val, sizeof(cfg->pidfile) - 1);
+            else if (strcmp(key, "data_dir") == 0) snprintf(cfg->data_dir, sizeof(cfg->data_dir), "%s", val);
             else if (strcmp(key, "socket") == 0) strncpy(cfg->socket_path, val, sizeof(cfg->socket_path) - 1);
+            else if (strcmp(key, "collect_threads") == 0) cfg->collect_threads = atoi(val);
+            else if (strcmp(key, "proc_fd_cache") == 0) cfg->proc_fd_cache = atoi(val);
+            else if (strcmp(key, "proc_fd_rescan") == 0) cfg->proc_fd_rescan = atoi(val);
+            else if (strcmp(key, "taskstats") == 0) cfg->taskstats = parse_bool(val);
             else if (strcmp(key, "log_level") == 0) {
                 if (strcmp(val, "debug") == 0) cfg->log_level = QMEM_LOG_DEBUG;
                 else if (strcmp(val, "info") == 0) cfg->log_level = QMEM_LOG_INFO;
@@ -116,8 +225,13 @@ int config_load(qmem_config_t *cfg, const char *path) {
             if (strcmp(key, "enabled") == 0) cfg->web_enabled = parse_bool(val);
             else if (strcmp(key, "listen") == 0) strncpy(cfg->web_listen, val, sizeof(cfg->web_listen) - 1);
             else if (strcmp(key, "port") == 0) cfg->web_port = atoi(val);
+            else if (strcmp(key, "threads") == 0) cfg->web_threads = atoi(val);
         } else if (strcmp(section, "history") == 0) {
             if (strcmp(key, "max_snapshots") == 0) cfg->max_snapshots = atoi(val);
+            else if (strcmp(key, "memory_kb") == 0) cfg->history_memory_kb = atoi(val);
+            else if (strcmp(key, "tiers") == 0) parse_rollups(cfg, val);
+        } else if (strcmp(section, "schedule") == 0) {
+            parse_schedule(cfg, key, val);
         }
     }
     
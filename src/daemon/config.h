@@ -7,13 +7,34 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define QMEM_MAX_SCHEDULES 32
+#define QMEM_MAX_ROLLUPS 3
+
+/* History rollup tier ([history] tiers) */
+typedef struct {
+    int64_t step_sec;           /* Aggregation width */
+    int64_t retention_sec;      /* How long rollups are kept */
+} qmem_rollup_t;
+
+/* Per-service collection schedule ([schedule] section) */
+typedef struct {
+    char service[32];
+    int64_t interval_ms;        /* Collection period */
+    int64_t offset_ms;          /* Phase offset from daemon start */
+} qmem_schedule_t;
+
 typedef struct qmem_config {
     /* Daemon settings */
     int interval_sec;
     bool foreground;
     char pidfile[256];
     char socket_path[256];
+    char data_dir[256];         /* Persistent history and baselines ("" disables) */
     int log_level;
+    int collect_threads;        /* Collection worker threads (<= 1: serial) */
+    int proc_fd_cache;          /* Cached per-PID /proc fds (0: disabled) */
+    int proc_fd_rescan;         /* Passes between forced fd dir walks (0: every pass) */
+    bool taskstats;             /* cpuload: add taskstats delays and exits to /proc */
     
     /* Thresholds */
     int64_t proc_min_delta_kb;
@@ -36,13 +57,21 @@ typedef struct qmem_config {
     bool web_enabled;
     char web_listen[64];
     int web_port;
+    int web_threads;            /* HTTP worker threads */
     
     /* Plugins */
     bool enable_plugins;
     char plugin_dir[256];
     
     /* History */
-    int max_snapshots;
+    int max_snapshots;          /* Samples kept per series */
+    int history_memory_kb;      /* Block pool for all series */
+    qmem_rollup_t rollups[QMEM_MAX_ROLLUPS];    /* Coarser tiers, increasing step */
+    int rollup_count;
+    
+    /* Per-service schedules (services not listed use interval_sec) */
+    qmem_schedule_t schedules[QMEM_MAX_SCHEDULES];
+    int schedule_count;
 } qmem_config_t;
 
 /* Initialize config with defaults */
@@ -54,6 +83,9 @@ int config_load(qmem_config_t *cfg, const char *path);
 /* Parse command-line arguments (overrides file config) */
 int config_parse_args(qmem_config_t *cfg, int argc, char **argv);
 
+/* Find schedule for a service, or NULL if it uses the global interval */
+const qmem_schedule_t *config_find_schedule(const qmem_config_t *cfg, const char *service);
+
 /* Print usage */
 void config_print_usage(const char *prog);
 
@@ -6,7 +6,9 @@
 #include "daemon.h"
 #include "service_manager.h"
 #include "ipc_server.h"
-#include "ringbuffer.h"
+#include "history.h"
+#include "query.h"
+#include "snapshot.h"
 #include "common/log.h"
 #include "common/json.h"
 
@@ -39,12 +41,45 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <stdbool.h>
+#include <poll.h>
 
 static volatile int g_running = 0;
 static volatile int g_reload = 0;
 static qmem_config_t g_config;
-static ringbuf_t *g_history = NULL;
-static char g_current_snapshot[256 * 1024];
+static history_t *g_history = NULL;
+static int64_t g_history_wall = 0;      /* Timestamp of the last recorded sample */
+static int64_t g_history_mono = 0;      /* Monotonic seconds when it was taken */
+
+/* Initial capacity of each published snapshot (grown as needed) */
+#define SNAPSHOT_SIZE (256 * 1024)
+
+/* Upper bound on a single sleep so signals and plugin changes are noticed */
+#define MAX_SLEEP_MS 1000
+
+static void timespec_add_ms(struct timespec *ts, int64_t ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Milliseconds from now until ts, rounded up; 0 if already passed */
+static int timespec_until_ms(const struct timespec *ts) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!timespec_before(&now, ts)) {
+        return 0;
+    }
+    int64_t ns = (int64_t)(ts->tv_sec - now.tv_sec) * 1000000000 + (ts->tv_nsec - now.tv_nsec);
+    return (int)((ns + 999999) / 1000000);
+}
 
 static void signal_handler(int sig) {
     switch (sig) {
@@ -122,38 +157,39 @@ static int write_pidfile(const char *path) {
     return 0;
 }
 
-static const char *get_snapshot_callback(void) {
-    return g_current_snapshot;
+static const snapshot_t *get_snapshot_callback(void) {
+    return snapshot_acquire();
 }
 
-static const char *get_history_callback(int count) {
-    static char history_buf[1024 * 1024];
-    json_builder_t json;
-    json_init(&json, history_buf, sizeof(history_buf));
-    
-    json_object_start(&json);
-    json_key(&json, "history");
-    json_array_start(&json);
-    
-    int n = ringbuf_count(g_history);
-    if (count > n) count = n;
-    
-    for (int i = 0; i < count; i++) {
-        const ringbuf_entry_t *entry = ringbuf_get_recent(g_history, i);
-        if (entry && entry->data) {
-            /* Write raw JSON data */
-            json_object_start(&json);
-            json_kv_int(&json, "timestamp", (int64_t)entry->timestamp);
-            /* We can't embed raw JSON, so just note the offset */
-            json_kv_int(&json, "index", i);
-            json_object_end(&json);
-        }
+/* Assemble the current data into a slot no reader holds, then swap it in */
+static void publish_snapshot(void) {
+    snapshot_t *next = snapshot_begin();
+    if (!next) {
+        return;
     }
     
-    json_array_end(&json);
-    json_object_end(&json);
+    /* No reader holds the slot, so its buffer may be regrown */
+    json_builder_t json;
+    json_init_growable(&json, next->data, next->capacity, 0);
+    int rendered = svc_manager_snapshot_all(&json);
+    next->data = json.buf;
+    next->capacity = json.size;
+    if (json_error(&json)) {
+        log_warn("Out of memory assembling snapshot");
+        return;
+    }
+    snapshot_publish(next, json_length(&json));
     
-    return history_buf;
+    log_debug("Assembled snapshot (%zu bytes, %d services re-rendered)", next->len, rendered);
+}
+
+static int get_history_callback(int count, json_builder_t *json) {
+    if (count > g_config.max_snapshots) count = g_config.max_snapshots;
+    return query_recent(g_history, count, json);
+}
+
+static int get_query_callback(const char *query, json_builder_t *json) {
+    return query_run(g_history, query, json);
 }
 
 int daemon_init(const qmem_config_t *cfg) {
@@ -187,10 +223,34 @@ int daemon_init(const qmem_config_t *cfg) {
         write_pidfile(cfg->pidfile);
     }
     
-    /* Create history buffer */
-    g_history = ringbuf_create(cfg->max_snapshots);
+    /* Create history store: max_snapshots samples per series, then rollups */
+    g_history = history_create(cfg->history_memory_kb,
+                               (int64_t)cfg->max_snapshots * cfg->interval_sec);
     if (!g_history) {
-        log_error("Failed to create history buffer");
+        log_error("Failed to create history store");
+        return -1;
+    }
+    for (int i = 0; i < cfg->rollup_count; i++) {
+        if (history_add_tier(g_history, cfg->rollups[i].step_sec, cfg->rollups[i].retention_sec) < 0) {
+            log_warn("History: ignoring rollup tier %llds:%llds",
+                     (long long)cfg->rollups[i].step_sec, (long long)cfg->rollups[i].retention_sec);
+        }
+    }
+    
+    /* Resume history kept by a previous run */
+    if (cfg->data_dir[0]) {
+        if (mkdir(cfg->data_dir, 0750) < 0 && errno != EEXIST) {
+            log_warn("Cannot create data directory %s: %s", cfg->data_dir, strerror(errno));
+        } else {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/history.dat", cfg->data_dir);
+            history_attach(g_history, path);
+        }
+    }
+    
+    /* Published snapshots, shared with the IPC and HTTP threads */
+    if (snapshot_init(SNAPSHOT_SIZE) < 0) {
+        log_error("Failed to allocate snapshot buffers");
         return -1;
     }
     
@@ -217,6 +277,7 @@ int daemon_init(const qmem_config_t *cfg) {
     /* Start IPC server */
     ipc_set_snapshot_callback(get_snapshot_callback);
     ipc_set_history_callback(get_history_callback);
+    ipc_set_query_callback(get_query_callback);
     if (ipc_server_start(cfg) < 0) {
         log_warn("Failed to start IPC server");
     }
@@ -224,6 +285,7 @@ int daemon_init(const qmem_config_t *cfg) {
 #ifdef QMEM_WEB_ENABLED
     /* Start HTTP server */
     api_set_snapshot_callback(get_snapshot_callback);
+    api_set_query_callback(get_query_callback);
     api_init();
     if (http_server_start(cfg) < 0) {
         log_warn("Failed to start HTTP server");
@@ -241,24 +303,88 @@ int daemon_init(const qmem_config_t *cfg) {
     return 0;
 }
 
+/*
+ * Wall-clock time for a history sample. The store drops samples older
+ * than a series' last one, so if the clock is set back, keep counting on
+ * from the last sample with the monotonic clock until the wall clock
+ * catches up; steps forward are followed at once
+ */
+static int64_t history_time(void) {
+    struct timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    
+    int64_t wall = (int64_t)time(NULL);
+    if (g_history_wall > 0) {
+        int64_t expected = g_history_wall + (mono.tv_sec - g_history_mono);
+        if (wall < expected) {
+            wall = expected;
+        }
+    }
+    g_history_wall = wall;
+    g_history_mono = mono.tv_sec;
+    return wall;
+}
+
+/* Append the current snapshot's metrics to the history store */
+static void record_history(void) {
+    const snapshot_t *snap = snapshot_acquire();
+    if (!snap) {
+        return;
+    }
+    
+    int added = history_ingest(g_history, snap->data, snap->len, history_time());
+    snapshot_release(snap);
+    
+    if (added < 0) {
+        log_warn("History: malformed snapshot not recorded");
+        return;
+    }
+    
+    history_stats_t stats;
+    history_get_stats(g_history, &stats);
+    log_debug("History: %d samples added, %d series, %d/%d blocks",
+              added, stats.series, stats.blocks_used, stats.blocks_total);
+}
+
 int daemon_run(void) {
     g_running = 1;
     
     log_info("Starting monitoring loop");
     
+    struct timespec next_history;
+    clock_gettime(CLOCK_MONOTONIC, &next_history);
+    bool have_data = false;
+    
     while (g_running) {
-        /* Collect from all services */
-        svc_manager_collect_all();
+        /* Collect services whose period has elapsed */
+        int collected = svc_manager_collect_due();
+        if (collected > 0) {
+            have_data = true;
+        }
+        if (svc_manager_snapshot_stale()) {
+            snapshot_mark_stale();
+        }
         
-        /* Generate snapshot */
-        json_builder_t json;
-        json_init(&json, g_current_snapshot, sizeof(g_current_snapshot));
-        svc_manager_snapshot_all(&json);
+        /* History keeps the global interval cadence */
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        bool history_due = have_data && !timespec_before(&now, &next_history);
         
-        /* Store in history */
-        ringbuf_push(g_history, g_current_snapshot, json_length(&json));
+        /* Assemble a snapshot only when a reader, a subscriber or the history wants one */
+        bool demanded = snapshot_take_demand();
+        bool pushed = collected > 0 && snapshot_has_watchers();
+        if ((demanded || pushed || history_due) && snapshot_is_stale()) {
+            publish_snapshot();
+        }
         
-        log_debug("Collected snapshot (%zu bytes)", json_length(&json));
+        if (history_due) {
+            record_history();
+            timespec_add_ms(&next_history, (int64_t)g_config.interval_sec * 1000);
+            if (timespec_before(&next_history, &now)) {
+                next_history = now;
+                timespec_add_ms(&next_history, (int64_t)g_config.interval_sec * 1000);
+            }
+        }
         
         /* Handle reload request */
         if (g_reload) {
@@ -272,10 +398,21 @@ int daemon_run(void) {
             plugin_loader_check_updates();
         }
         
-        /* Sleep */
-        for (int i = 0; i < g_config.interval_sec && g_running; i++) {
-            sleep(1);
+        /* Sleep until the next service or history slot is due */
+        struct timespec deadline = now;
+        timespec_add_ms(&deadline, MAX_SLEEP_MS);
+        
+        struct timespec due;
+        if (svc_manager_next_due(&due) && timespec_before(&due, &deadline)) {
+            deadline = due;
         }
+        if (have_data && timespec_before(&next_history, &deadline)) {
+            deadline = next_history;
+        }
+        
+        /* Readers wake us for a fresh snapshot; signals interrupt with EINTR */
+        struct pollfd pfd = { .fd = snapshot_demand_fd(), .events = POLLIN };
+        poll(&pfd, 1, timespec_until_ms(&deadline));
     }
     
     return 0;
@@ -302,9 +439,12 @@ void daemon_shutdown(void) {
     /* Shutdown services */
     svc_manager_shutdown();
     
+    /* Readers are stopped: release the snapshot slots */
+    snapshot_shutdown();
+    
     /* Free history */
     if (g_history) {
-        ringbuf_destroy(g_history);
+        history_destroy(g_history);
         g_history = NULL;
     }
     
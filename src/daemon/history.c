@@ -0,0 +1,1456 @@
+/*
+ * history.c - Compressed time-series history
+ *
+ * Each series is a list of fixed-size blocks taken from one pool. A block
+ * holds its first timestamp and value verbatim; every later sample stores
+ * its timestamp as a delta-of-delta and its value XORed with the previous
+ * one, in variable-length bit fields (the Gorilla encoding). Samples taken
+ * at a steady cadence of slowly changing values cost a few bits each.
+ *
+ * Rollup tiers keep coarser history for longer: every raw sample is
+ * folded into the pending bucket of each tier, and a bucket (min, max,
+ * sum, count, last) is appended to the tier's stream once a sample lands
+ * past its end. Rollup blocks use the same encoding with one XOR column
+ * per aggregate.
+ *
+ * When the pool runs dry, blocks past their tier's retention window are
+ * reclaimed first, then the oldest block of the tier furthest over its
+ * share. A tier's share follows the blocks its retention needs, judged
+ * from the samples it holds, so the long rollup tiers neither crowd the
+ * raw samples out nor lose most of their span to them. Should the pool
+ * still fall short, the first eviction inside a retention is logged and
+ * each tier reports how far back its data is complete, so queries can
+ * move to a coarser tier. A series that holds no samples and
+ * has received none for the longest retention is dropped, its entry taken
+ * by the last series of the table.
+ *
+ * The header, series table and pool form one region that links blocks by
+ * index, so it can live in a shared file mapping and be adopted as-is on
+ * the next start. A sample is committed by bumping its block's count and
+ * a series by bumping the header's series count; everything else (free
+ * list, name index, encoder state) is rebuilt from the data when the
+ * file is attached.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "history.h"
+#include "common/log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE 256
+#define BLOCK_DATA_BYTES (BLOCK_SIZE - 24)
+#define BLOCK_BITS (BLOCK_DATA_BYTES * 8)
+#define MAX_SAMPLE_BITS(columns) (4 + 64 + (columns) * (2 + 5 + 6 + 64))  /* Worst case */
+#define ROLLUP_COLUMNS 5                        /* min, max, sum, count, last */
+#define MAX_SERIES 2048
+#define INDEX_SIZE (MAX_SERIES * 2)             /* Power of two */
+#define MAX_DEPTH 32
+#define NO_WINDOW 0xff
+#define NO_BLOCK (-1)
+
+#define HISTORY_MAGIC "QMHIST\0\0"
+#define HISTORY_VERSION 1
+
+typedef struct {
+    int64_t first_ts;
+    int64_t last_ts;
+    int32_t next;                       /* Block index, NO_BLOCK at the end */
+    uint16_t count;                     /* Samples; bumped last to commit one */
+    uint16_t bits;                      /* Bits used in data */
+    uint8_t data[BLOCK_DATA_BYTES];
+} hblock_t;
+
+_Static_assert(sizeof(hblock_t) == BLOCK_SIZE, "history block size");
+
+/* Block list of one tier of a series */
+typedef struct {
+    int32_t head;                       /* Oldest block */
+    int32_t tail;                       /* Block being appended to */
+    uint32_t points;
+    
+    /* Encoder state for the tail block, per column */
+    int64_t last_ts;
+    int64_t last_delta;
+    uint64_t last_bits[ROLLUP_COLUMNS];
+    uint8_t leading[ROLLUP_COLUMNS];    /* XOR window, NO_WINDOW if none yet */
+    uint8_t trailing[ROLLUP_COLUMNS];
+} stream_t;
+
+typedef struct {
+    char name[HISTORY_NAME_MAX];                /* First: "" marks an entry being refilled */
+    stream_t streams[HISTORY_MAX_TIERS];        /* [0]: raw samples */
+    history_bucket_t pending[HISTORY_MAX_TIERS]; /* Rollup being accumulated */
+} series_t;
+
+_Static_assert(offsetof(series_t, name) == 0, "series name first");
+
+typedef struct {
+    int64_t step;                       /* 0 for raw samples */
+    int64_t retention;                  /* 0: until the pool is full */
+    int columns;
+    int blocks;                         /* Blocks held by the tier's streams */
+    uint64_t points;                    /* Samples held by the tier's streams */
+    int64_t interval;                   /* Spacing of the latest samples */
+    int64_t horizon;                    /* Newest sample evicted for space */
+    bool short_logged;
+} tier_t;
+
+/* Start of the region; a file is adopted only if its layout matches */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t series_size;
+    uint32_t max_series;
+    uint32_t pool_size;
+    uint32_t tier_count;
+    int64_t tier_steps[HISTORY_MAX_TIERS];
+    uint32_t series_count;              /* Bumped last to commit a series */
+    uint32_t clean;                     /* Set on orderly close */
+} history_header_t;
+
+#define HEADER_SPACE 128
+_Static_assert(sizeof(history_header_t) <= HEADER_SPACE, "history header size");
+
+struct history {
+    pthread_rwlock_t lock;              /* Daemon loop writes, servers read */
+    
+    /* Header, series table and pool: heap memory or a file mapping */
+    void *region;
+    size_t region_size;
+    bool mapped;
+    int map_fd;
+    history_header_t *header;
+    
+    /* Block pool */
+    hblock_t *pool;
+    int pool_size;
+    int32_t free_list;
+    int blocks_used;
+    
+    /* Series and their name index */
+    series_t *series;
+    int series_count;
+    int16_t index[INDEX_SIZE];          /* Series number, -1 if empty */
+    bool series_full_logged;
+    
+    tier_t tiers[HISTORY_MAX_TIERS];
+    int tier_count;
+    int64_t newest;
+    uint64_t points;
+};
+
+/*
+ * Bit fields
+ */
+
+static void put_bits(hblock_t *b, uint64_t value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            b->data[b->bits >> 3] |= 0x80 >> (b->bits & 7);
+        }
+        b->bits++;
+    }
+}
+
+typedef struct {
+    const hblock_t *block;
+    unsigned int pos;
+} bit_reader_t;
+
+static uint64_t get_bits(bit_reader_t *r, int n) {
+    uint64_t value = 0;
+    if (r->pos + n > BLOCK_BITS) {
+        r->pos = BLOCK_BITS + 1;        /* Corrupt block: flag the overrun */
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        unsigned int pos = r->pos++;
+        value = (value << 1) | ((r->block->data[pos >> 3] >> (7 - (pos & 7))) & 1);
+    }
+    return value;
+}
+
+static int64_t get_signed(bit_reader_t *r, int n) {
+    int64_t value = (int64_t)get_bits(r, n);
+    if (n < 64 && (value & ((int64_t)1 << (n - 1)))) {
+        value -= (int64_t)1 << n;
+    }
+    return value;
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+ * Sample encoding
+ */
+
+static void encode_dod(hblock_t *b, int64_t dod) {
+    if (dod == 0) {
+        put_bits(b, 0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        put_bits(b, 0x2, 2);
+        put_bits(b, (uint64_t)dod, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        put_bits(b, 0x6, 3);
+        put_bits(b, (uint64_t)dod, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        put_bits(b, 0xe, 4);
+        put_bits(b, (uint64_t)dod, 12);
+    } else {
+        put_bits(b, 0xf, 4);
+        put_bits(b, (uint64_t)dod, 64);
+    }
+}
+
+static int64_t decode_dod(bit_reader_t *r) {
+    if (!get_bits(r, 1)) return 0;
+    if (!get_bits(r, 1)) return get_signed(r, 7);
+    if (!get_bits(r, 1)) return get_signed(r, 9);
+    if (!get_bits(r, 1)) return get_signed(r, 12);
+    return get_signed(r, 64);
+}
+
+static void encode_value(stream_t *s, int col, hblock_t *b, uint64_t bits) {
+    uint64_t xor = bits ^ s->last_bits[col];
+    s->last_bits[col] = bits;
+    
+    if (xor == 0) {
+        put_bits(b, 0, 1);
+        return;
+    }
+    put_bits(b, 1, 1);
+    
+    int leading = __builtin_clzll(xor);
+    int trailing = __builtin_ctzll(xor);
+    if (leading > 31) leading = 31;
+    
+    if (s->leading[col] != NO_WINDOW && leading >= s->leading[col] &&
+        trailing >= s->trailing[col]) {
+        /* Fits the previous window */
+        put_bits(b, 0, 1);
+        put_bits(b, xor >> s->trailing[col], 64 - s->leading[col] - s->trailing[col]);
+        return;
+    }
+    
+    int length = 64 - leading - trailing;
+    put_bits(b, 1, 1);
+    put_bits(b, (uint64_t)leading, 5);
+    put_bits(b, (uint64_t)(length & 63), 6);  /* 64 stored as 0 */
+    put_bits(b, xor >> trailing, length);
+    s->leading[col] = (uint8_t)leading;
+    s->trailing[col] = (uint8_t)trailing;
+}
+
+/* Decoder state mirroring the encoder */
+typedef struct {
+    bit_reader_t reader;
+    int columns;
+    int64_t ts;
+    int64_t delta;
+    uint64_t bits[ROLLUP_COLUMNS];
+    int leading[ROLLUP_COLUMNS];
+    int trailing[ROLLUP_COLUMNS];
+    int remaining;
+} block_cursor_t;
+
+static void cursor_init(block_cursor_t *c, const hblock_t *b, int columns) {
+    c->reader.block = b;
+    c->reader.pos = 0;
+    c->columns = columns;
+    c->remaining = b->count;
+    c->ts = b->first_ts;
+    c->delta = 0;
+    for (int i = 0; i < ROLLUP_COLUMNS; i++) {
+        c->bits[i] = 0;
+        c->leading[i] = NO_WINDOW;
+        c->trailing[i] = 0;
+    }
+}
+
+/* Decode the next sample; values receives one double per column */
+static bool cursor_next(block_cursor_t *c, int64_t *ts, double *values) {
+    if (c->remaining <= 0) return false;
+    
+    bool first = c->remaining == c->reader.block->count;
+    if (!first) {
+        c->delta += decode_dod(&c->reader);
+        c->ts += c->delta;
+    }
+    
+    for (int i = 0; i < c->columns; i++) {
+        if (first) {
+            c->bits[i] = get_bits(&c->reader, 64);
+        } else if (get_bits(&c->reader, 1)) {
+            if (get_bits(&c->reader, 1)) {
+                c->leading[i] = (int)get_bits(&c->reader, 5);
+                int length = (int)get_bits(&c->reader, 6);
+                if (length == 0) length = 64;
+                c->trailing[i] = 64 - c->leading[i] - length;
+            }
+            int length = 64 - c->leading[i] - c->trailing[i];
+            c->bits[i] ^= get_bits(&c->reader, length) << c->trailing[i];
+        }
+        values[i] = bits_double(c->bits[i]);
+    }
+    
+    c->remaining--;
+    *ts = c->ts;
+    return true;
+}
+
+/*
+ * Block pool
+ */
+
+static void free_head_block(history_t *h, int t, stream_t *s) {
+    int32_t index = s->head;
+    hblock_t *b = &h->pool[index];
+    s->head = b->next;
+    if (s->head == NO_BLOCK) s->tail = NO_BLOCK;
+    
+    s->points -= b->count;
+    h->points -= b->count;
+    h->tiers[t].points -= b->count;
+    b->next = h->free_list;
+    h->free_list = index;
+    h->blocks_used--;
+    h->tiers[t].blocks--;
+}
+
+/* Drop blocks whose newest sample is past their tier's retention window */
+static int expire_blocks(history_t *h) {
+    int freed = 0;
+    for (int t = 0; t < h->tier_count; t++) {
+        if (h->tiers[t].retention <= 0) continue;
+    
+        int64_t cutoff = h->newest - h->tiers[t].retention;
+        for (int i = 0; i < h->series_count; i++) {
+            stream_t *s = &h->series[i].streams[t];
+            while (s->head != NO_BLOCK && h->pool[s->head].last_ts < cutoff) {
+                free_head_block(h, t, s);
+                freed++;
+            }
+        }
+    }
+    return freed;
+}
+
+/*
+ * Blocks a tier needs to keep its retention for every series: samples per
+ * retention times the blocks each sample has cost so far. Unlimited
+ * tiers are weighed as if they kept the longest retention.
+ */
+static double tier_need(const history_t *h, const tier_t *tier, int64_t longest) {
+    int64_t spacing = tier->step > 0 ? tier->step : tier->interval;
+    int64_t want = tier->retention > 0 ? tier->retention : longest;
+    if (tier->points == 0 || spacing <= 0 || want <= 0) return 0;
+    
+    return (double)want / (double)spacing * h->series_count *
+           ((double)tier->blocks / (double)tier->points);
+}
+
+/*
+ * Drop the oldest block of the tier furthest over its share of the pool.
+ * Shares follow each tier's need, so a pool too small for the configured
+ * retentions shortens every tier by the same fraction.
+ */
+static void evict_oldest(history_t *h) {
+    int64_t longest = 0;
+    for (int t = 0; t < h->tier_count; t++) {
+        if (h->tiers[t].retention > longest) longest = h->tiers[t].retention;
+    }
+    
+    double need[HISTORY_MAX_TIERS];
+    double total = 0;
+    for (int t = 0; t < h->tier_count; t++) {
+        need[t] = tier_need(h, &h->tiers[t], longest);
+        total += need[t];
+    }
+    
+    int t = -1;
+    double over = 0;
+    for (int i = 0; i < h->tier_count; i++) {
+        if (h->tiers[i].blocks == 0) continue;
+    
+        double share = total > 0 ? h->pool_size * need[i] / total
+                                 : (double)h->pool_size / h->tier_count;
+        if (t < 0 || h->tiers[i].blocks - share > over) {
+            t = i;
+            over = h->tiers[i].blocks - share;
+        }
+    }
+    if (t < 0) return;
+    
+    stream_t *victim = NULL;
+    for (int i = 0; i < h->series_count; i++) {
+        stream_t *s = &h->series[i].streams[t];
+        if (s->head != NO_BLOCK &&
+            (!victim || h->pool[s->head].last_ts < h->pool[victim->head].last_ts)) {
+            victim = s;
+        }
+    }
+    if (!victim) return;
+    
+    tier_t *tier = &h->tiers[t];
+    int64_t last_ts = h->pool[victim->head].last_ts;
+    if (last_ts > tier->horizon) tier->horizon = last_ts;
+    if (tier->retention > 0 && !tier->short_logged) {
+        log_warn("history: tier %d keeps %llds of %llds retention, raise [history] memory_kb",
+                 t, (long long)(h->newest - last_ts), (long long)tier->retention);
+        tier->short_logged = true;
+    }
+    free_head_block(h, t, victim);
+}
+
+static int32_t alloc_block(history_t *h, int t) {
+    if (h->free_list == NO_BLOCK && expire_blocks(h) == 0) {
+        evict_oldest(h);
+    }
+    
+    int32_t index = h->free_list;
+    if (index == NO_BLOCK) return NO_BLOCK;
+    
+    hblock_t *b = &h->pool[index];
+    h->free_list = b->next;
+    h->blocks_used++;
+    h->tiers[t].blocks++;
+    memset(b, 0, sizeof(*b));
+    b->next = NO_BLOCK;
+    return index;
+}
+
+/*
+ * Series
+ */
+
+static unsigned int hash_name(const char *name) {
+    unsigned int hash = 2166136261u;    /* FNV-1a */
+    for (const char *p = name; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+static void index_insert(history_t *h, int i) {
+    unsigned int slot = hash_name(h->series[i].name) & (INDEX_SIZE - 1);
+    while (h->index[slot] >= 0) {
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+    h->index[slot] = (int16_t)i;
+}
+
+/*
+ * Move the last series into entry i, whose name has been cleared, and
+ * drop the last entry. The first byte of the name is copied last, so a
+ * crash leaves entry i either empty or a duplicate of the last one, and
+ * recovery finishes the move
+ */
+static void move_last_series(history_t *h, int i) {
+    series_t *dst = &h->series[i];
+    const series_t *src = &h->series[h->series_count - 1];
+    if (dst != src) {
+        memcpy((char *)dst + 1, (const char *)src + 1, sizeof(*dst) - 1);
+        atomic_signal_fence(memory_order_release);
+        dst->name[0] = src->name[0];
+    }
+    h->series_count--;
+    atomic_signal_fence(memory_order_release);
+    h->header->series_count = (uint32_t)h->series_count;
+}
+
+/* Drop series that hold no samples and received none for the longest retention */
+static int reclaim_series(history_t *h) {
+    int64_t longest = 0;
+    for (int t = 0; t < h->tier_count; t++) {
+        if (h->tiers[t].retention > longest) longest = h->tiers[t].retention;
+    }
+    
+    int reclaimed = 0;
+    for (int i = h->series_count - 1; i >= 0; i--) {
+        series_t *s = &h->series[i];
+        if (s->streams[0].last_ts >= h->newest - longest) continue;
+    
+        bool empty = true;
+        for (int t = 0; t < h->tier_count; t++) {
+            if (s->streams[t].head != NO_BLOCK) empty = false;
+        }
+        if (!empty) continue;
+    
+        s->name[0] = '\0';
+        move_last_series(h, i);
+        reclaimed++;
+    }
+    
+    if (reclaimed > 0) {
+        memset(h->index, 0xff, sizeof(h->index));
+        for (int i = 0; i < h->series_count; i++) {
+            index_insert(h, i);
+        }
+        h->series_full_logged = false;
+    }
+    return reclaimed;
+}
+
+static series_t *find_series(history_t *h, const char *name, bool create) {
+    unsigned int slot = hash_name(name) & (INDEX_SIZE - 1);
+    
+    while (h->index[slot] >= 0) {
+        series_t *s = &h->series[h->index[slot]];
+        if (strcmp(s->name, name) == 0) return s;
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+    
+    if (!create) return NULL;
+    if (h->series_count >= MAX_SERIES) {
+        expire_blocks(h);
+        if (reclaim_series(h) > 0) {
+            return find_series(h, name, true);
+        }
+        if (!h->series_full_logged) {
+            log_warn("History: series limit (%d) reached, dropping new series", MAX_SERIES);
+            h->series_full_logged = true;
+        }
+        return NULL;
+    }
+    
+    series_t *s = &h->series[h->series_count];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    for (int t = 0; t < HISTORY_MAX_TIERS; t++) {
+        s->streams[t].head = NO_BLOCK;
+        s->streams[t].tail = NO_BLOCK;
+    }
+    h->index[slot] = (int16_t)h->series_count++;
+    atomic_signal_fence(memory_order_release);
+    h->header->series_count = (uint32_t)h->series_count;
+    return s;
+}
+
+/* Append one sample of tier t (one value per column) to a stream */
+static int append_stream(history_t *h, int t, stream_t *s, int64_t ts, const double *values) {
+    const tier_t *tier = &h->tiers[t];
+    hblock_t *b = s->tail != NO_BLOCK ? &h->pool[s->tail] : NULL;
+    
+    if (b && b->bits + MAX_SAMPLE_BITS(tier->columns) <= BLOCK_BITS && b->count < UINT16_MAX) {
+        int64_t delta = ts - s->last_ts;
+        encode_dod(b, delta - s->last_delta);
+        for (int i = 0; i < tier->columns; i++) {
+            encode_value(s, i, b, double_bits(values[i]));
+        }
+        s->last_delta = delta;
+        if (delta > 0) h->tiers[t].interval = delta;
+    } else {
+        /* Start a block: first sample verbatim */
+        int32_t index = alloc_block(h, t);
+        if (index == NO_BLOCK) return -1;
+        b = &h->pool[index];
+    
+        /* Retire this stream's blocks that rolled out of retention */
+        while (tier->retention > 0 && s->head != NO_BLOCK &&
+               h->pool[s->head].last_ts < ts - tier->retention) {
+            free_head_block(h, t, s);
+        }
+    
+        b->first_ts = ts;
+        for (int i = 0; i < tier->columns; i++) {
+            s->last_bits[i] = double_bits(values[i]);
+            s->leading[i] = NO_WINDOW;
+            s->trailing[i] = 0;
+            put_bits(b, s->last_bits[i], 64);
+        }
+        if (s->tail != NO_BLOCK) {
+            h->pool[s->tail].next = index;
+        } else {
+            s->head = index;
+        }
+        s->tail = index;
+        s->last_delta = 0;
+    }
+    
+    b->last_ts = ts;
+    atomic_signal_fence(memory_order_release);  /* Data before the commit */
+    b->count++;
+    s->last_ts = ts;
+    s->points++;
+    h->points++;
+    h->tiers[t].points++;
+    if (ts > h->newest) h->newest = ts;
+    return 1;
+}
+
+static void bucket_add(history_bucket_t *b, double value) {
+    if (value < b->min) b->min = value;
+    if (value > b->max) b->max = value;
+    b->sum += value;
+    b->last = value;
+    b->count++;
+}
+
+/* Fold a raw sample into each tier's pending bucket, flushing finished ones */
+static void update_rollups(history_t *h, series_t *s, int64_t ts, double value) {
+    for (int t = 1; t < h->tier_count; t++) {
+        int64_t step = h->tiers[t].step;
+        int64_t start = ts - ((ts % step) + step) % step;
+        history_bucket_t *p = &s->pending[t];
+        if (p->count > 0 && start < p->timestamp) continue;  /* Raw data was evicted */
+    
+        if (p->count > 0 && p->timestamp != start) {
+            double columns[ROLLUP_COLUMNS] = { p->min, p->max, p->sum, p->count, p->last };
+            append_stream(h, t, &s->streams[t], p->timestamp, columns);
+            p->count = 0;
+        }
+        if (p->count == 0) {
+            *p = (history_bucket_t){ .timestamp = start, .min = value, .max = value };
+        }
+        bucket_add(p, value);
+    }
+}
+
+static int append_sample(history_t *h, series_t *s, int64_t ts, double value) {
+    stream_t *raw = &s->streams[0];
+    if (raw->points > 0 && ts <= raw->last_ts) {
+        return 0;  /* Out of order or duplicate */
+    }
+    
+    int ret = append_stream(h, 0, raw, ts, &value);
+    if (ret > 0) {
+        update_rollups(h, s, ts, value);
+    }
+    return ret;
+}
+
+/* Point the store at a region laid out as header, series table, pool */
+static void set_region(history_t *h, void *region, bool mapped) {
+    h->region = region;
+    h->mapped = mapped;
+    h->header = region;
+    h->series = (series_t *)((char *)region + HEADER_SPACE);
+    h->pool = (hblock_t *)(h->series + MAX_SERIES);
+}
+
+/* Write a fresh header describing the current layout and tiers */
+static void init_header(history_t *h) {
+    history_header_t *hdr = h->header;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic));
+    hdr->version = HISTORY_VERSION;
+    hdr->block_size = sizeof(hblock_t);
+    hdr->series_size = sizeof(series_t);
+    hdr->max_series = MAX_SERIES;
+    hdr->pool_size = (uint32_t)h->pool_size;
+    hdr->tier_count = (uint32_t)h->tier_count;
+    for (int t = 0; t < h->tier_count; t++) {
+        hdr->tier_steps[t] = h->tiers[t].step;
+    }
+}
+
+static bool header_matches(const history_t *h, const history_header_t *hdr) {
+    if (memcmp(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != HISTORY_VERSION || hdr->block_size != sizeof(hblock_t) ||
+        hdr->series_size != sizeof(series_t) || hdr->max_series != MAX_SERIES ||
+        hdr->pool_size != (uint32_t)h->pool_size || hdr->tier_count != (uint32_t)h->tier_count ||
+        hdr->series_count > MAX_SERIES) {
+        return false;
+    }
+    for (int t = 0; t < h->tier_count; t++) {
+        if (hdr->tier_steps[t] != h->tiers[t].step) return false;
+    }
+    return true;
+}
+
+history_t *history_create(size_t memory_kb, int64_t retention_sec) {
+    history_t *h = calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    
+    h->pool_size = (int)(memory_kb * 1024 / sizeof(hblock_t));
+    if (h->pool_size < 1) h->pool_size = 1;
+    h->region_size = HEADER_SPACE + MAX_SERIES * sizeof(series_t) +
+                     (size_t)h->pool_size * sizeof(hblock_t);
+    void *region = calloc(1, h->region_size);
+    if (!region) {
+        free(h);
+        return NULL;
+    }
+    set_region(h, region, false);
+    h->map_fd = -1;
+    
+    h->free_list = NO_BLOCK;
+    for (int i = h->pool_size - 1; i >= 0; i--) {
+        h->pool[i].next = h->free_list;
+        h->free_list = i;
+    }
+    memset(h->index, 0xff, sizeof(h->index));
+    h->tiers[0] = (tier_t){ .step = 0, .retention = retention_sec, .columns = 1 };
+    h->tier_count = 1;
+    init_header(h);
+    pthread_rwlock_init(&h->lock, NULL);
+    return h;
+}
+
+void history_destroy(history_t *h) {
+    if (!h) return;
+    
+    pthread_rwlock_destroy(&h->lock);
+    if (h->mapped) {
+        h->header->clean = 1;
+        msync(h->region, h->region_size, MS_SYNC);
+        munmap(h->region, h->region_size);
+        close(h->map_fd);
+    } else {
+        free(h->region);
+    }
+    free(h);
+}
+
+int history_add_tier(history_t *h, int64_t step, int64_t retention_sec) {
+    int ret = -1;
+    
+    pthread_rwlock_wrlock(&h->lock);
+    if (h->tier_count < HISTORY_MAX_TIERS && h->series_count == 0 && step > 0 &&
+        step > h->tiers[h->tier_count - 1].step) {
+        h->tiers[h->tier_count] = (tier_t){
+            .step = step, .retention = retention_sec, .columns = ROLLUP_COLUMNS,
+        };
+        ret = h->tier_count++;
+        h->header->tier_count = (uint32_t)h->tier_count;
+        h->header->tier_steps[ret] = step;
+    }
+    pthread_rwlock_unlock(&h->lock);
+    return ret;
+}
+
+/*
+ * Recovery of an adopted region
+ */
+
+/* Re-derive a stream's tail encoder state by decoding its tail block */
+static void replay_tail(history_t *h, stream_t *s, int columns) {
+    hblock_t *b = &h->pool[s->tail];
+    block_cursor_t cursor;
+    int64_t ts;
+    double values[ROLLUP_COLUMNS];
+    
+    cursor_init(&cursor, b, columns);
+    int good = 0;
+    unsigned int end = 0;
+    block_cursor_t state = cursor;
+    while (cursor_next(&cursor, &ts, values) && cursor.reader.pos <= BLOCK_BITS) {
+        good++;
+        end = cursor.reader.pos;
+        state = cursor;
+    }
+    
+    /* Drop any uncommitted or corrupt bits past the last good sample */
+    b->count = (uint16_t)good;
+    b->bits = (uint16_t)end;
+    b->last_ts = state.ts;
+    if (end & 7) {
+        b->data[end >> 3] &= (uint8_t)(0xff00 >> (end & 7));
+    }
+    size_t used = (end + 7) >> 3;
+    memset(b->data + used, 0, sizeof(b->data) - used);
+    
+    s->last_ts = state.ts;
+    s->last_delta = state.delta;
+    for (int i = 0; i < columns; i++) {
+        s->last_bits[i] = state.bits[i];
+        s->leading[i] = (uint8_t)state.leading[i];
+        s->trailing[i] = (uint8_t)state.trailing[i];
+    }
+}
+
+/* Walk a stream's chain, cutting it at the first invalid or shared block */
+static void recover_stream(history_t *h, int t, stream_t *s, uint8_t *used) {
+    int32_t prev = NO_BLOCK;
+    s->points = 0;
+    
+    for (int32_t i = s->head; i != NO_BLOCK; i = h->pool[i].next) {
+        if (i < 0 || i >= h->pool_size || used[i] || h->pool[i].count == 0 ||
+            h->pool[i].bits > BLOCK_BITS) {
+            if (prev == NO_BLOCK) {
+                s->head = NO_BLOCK;
+            } else {
+                h->pool[prev].next = NO_BLOCK;
+            }
+            break;
+        }
+        used[i] = 1;
+        prev = i;
+        h->tiers[t].blocks++;
+    }
+    
+    s->tail = prev;
+    if (prev != NO_BLOCK) {
+        replay_tail(h, s, h->tiers[t].columns);
+    }
+    for (int32_t i = s->head; i != NO_BLOCK; i = h->pool[i].next) {
+        s->points += h->pool[i].count;
+    }
+}
+
+/* Rebuild the name index, free list and counters from the region's data */
+static int recover_region(history_t *h) {
+    uint8_t *used = calloc((size_t)h->pool_size, 1);
+    if (!used) return -1;
+    
+    memset(h->index, 0xff, sizeof(h->index));
+    h->points = 0;
+    h->newest = 0;
+    for (int t = 0; t < h->tier_count; t++) {
+        h->tiers[t].blocks = 0;
+        h->tiers[t].points = 0;
+    }
+    
+    /* Finish moves of reclaimed series cut short */
+    h->series_count = (int)h->header->series_count;
+    for (int i = h->series_count - 1; i >= 0; i--) {
+        if (h->series[i].name[0] == '\0') {
+            move_last_series(h, i);
+        }
+    }
+    
+    int count = h->series_count;
+    h->series_count = 0;
+    for (int i = 0; i < count; i++) {
+        series_t *s = &h->series[i];
+        s->name[sizeof(s->name) - 1] = '\0';
+        if (find_series(h, s->name, false)) {
+            break;  /* Duplicate left by a move: keep the series before it */
+        }
+    
+        index_insert(h, i);
+        h->series_count++;
+    
+        for (int t = 0; t < HISTORY_MAX_TIERS; t++) {
+            stream_t *st = &s->streams[t];
+            if (t >= h->tier_count) {
+                st->head = NO_BLOCK;
+                st->tail = NO_BLOCK;
+                st->points = 0;
+                continue;
+            }
+            recover_stream(h, t, st, used);
+            h->points += st->points;
+            h->tiers[t].points += st->points;
+            if (st->points > 0 && st->last_ts > h->newest) h->newest = st->last_ts;
+    
+            /* A bucket already flushed before the crash is not flushed again */
+            history_bucket_t *p = &s->pending[t];
+            if (t == 0 || (p->count > 0 && st->points > 0 && p->timestamp <= st->last_ts)) {
+                memset(p, 0, sizeof(*p));
+            }
+        }
+    }
+    h->header->series_count = (uint32_t)h->series_count;
+    
+    h->free_list = NO_BLOCK;
+    h->blocks_used = h->pool_size;
+    for (int i = h->pool_size - 1; i >= 0; i--) {
+        if (!used[i]) {
+            h->pool[i].next = h->free_list;
+            h->free_list = i;
+            h->blocks_used--;
+        }
+    }
+    
+    free(used);
+    return 0;
+}
+
+int history_attach(history_t *h, const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        log_warn("History: cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        log_warn("History: %s is in use by another process", path);
+        close(fd);
+        return -1;
+    }
+    
+    struct stat st;
+    bool fresh = fstat(fd, &st) < 0 || (size_t)st.st_size != h->region_size;
+    if (fresh && ftruncate(fd, 0) < 0) {
+        log_warn("History: cannot reset %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    /* Back every page now: a hole the disk cannot fill later is a SIGBUS */
+    int err = posix_fallocate(fd, 0, (off_t)h->region_size);
+    if (err != 0) {
+        log_warn("History: cannot allocate %zu bytes for %s: %s",
+                 h->region_size, path, strerror(err));
+        if (fresh) {
+            unlink(path);
+        }
+        close(fd);
+        return -1;
+    }
+    
+    void *map = mmap(NULL, h->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_warn("History: cannot map %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_rwlock_wrlock(&h->lock);
+    
+    int ret = 0;
+    if (h->series_count > 0) {
+        ret = -1;  /* Too late: samples were already added in memory */
+    } else if (!fresh && header_matches(h, map)) {
+        bool clean = ((history_header_t *)map)->clean;
+        free(h->region);
+        set_region(h, map, true);
+        if (recover_region(h) < 0) {
+            ret = -1;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            log_info("History: resumed %d series (%d/%d blocks) from %s in %.1f ms%s",
+                     h->series_count, h->blocks_used, h->pool_size, path,
+                     (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+                     clean ? "" : " after unclean shutdown");
+        }
+    } else {
+        if (!fresh) {
+            log_info("History: layout of %s changed, starting over", path);
+        }
+        memcpy(map, h->region, h->region_size);
+        free(h->region);
+        set_region(h, map, true);
+    }
+    
+    if (h->mapped) {
+        h->map_fd = fd;
+        h->header->clean = 0;
+    } else {
+        munmap(map, h->region_size);
+        close(fd);
+    }
+    
+    pthread_rwlock_unlock(&h->lock);
+    return ret;
+}
+
+int history_add(history_t *h, const char *series, int64_t timestamp, double value) {
+    pthread_rwlock_wrlock(&h->lock);
+    
+    series_t *s = find_series(h, series, true);
+    int ret = s ? append_sample(h, s, timestamp, value) : -1;
+    
+    pthread_rwlock_unlock(&h->lock);
+    return ret;
+}
+
+/*
+ * Snapshot flattening
+ */
+
+typedef struct {
+    const char *p;
+    const char *end;
+    history_t *h;
+    int64_t ts;
+    char path[HISTORY_NAME_MAX];
+    int added;
+} flatten_t;
+
+static int parse_value(flatten_t *f, size_t path_len, bool keep, int depth);
+
+static void skip_ws(flatten_t *f) {
+    while (f->p < f->end && (*f->p == ' ' || *f->p == '\t' || *f->p == '\n' || *f->p == '\r')) {
+        f->p++;
+    }
+}
+
+static bool consume(flatten_t *f, char c) {
+    skip_ws(f);
+    if (f->p < f->end && *f->p == c) {
+        f->p++;
+        return true;
+    }
+    return false;
+}
+
+/* Parse a string, copying it (escapes kept as-is) if out is given */
+static int parse_string(flatten_t *f, char *out, size_t size, bool *truncated) {
+    if (!consume(f, '"')) return -1;
+    
+    size_t n = 0;
+    while (f->p < f->end && *f->p != '"') {
+        if (*f->p == '\\' && f->p + 1 < f->end) {
+            f->p++;
+        }
+        if (out && n + 1 < size) {
+            out[n++] = *f->p;
+        } else if (out && truncated) {
+            *truncated = true;
+        }
+        f->p++;
+    }
+    if (f->p >= f->end) return -1;
+    
+    f->p++;
+    if (out) out[n] = '\0';
+    return 0;
+}
+
+/* Deltas are derivable from the series itself */
+static bool is_delta_key(const char *key) {
+    return strcmp(key, "delta") == 0 || strncmp(key, "delta_", 6) == 0 ||
+           strstr(key, "_delta") != NULL;
+}
+
+/* Extend the path by a component. Returns the new length, or 0 if too long */
+static size_t push_path(flatten_t *f, size_t path_len, const char *name) {
+    int n = snprintf(f->path + path_len, sizeof(f->path) - path_len, "%s%s",
+                     path_len > 0 ? "." : "", name);
+    if (n < 0 || path_len + n >= sizeof(f->path)) {
+        f->path[path_len] = '\0';
+        return 0;
+    }
+    return path_len + n;
+}
+
+/* Parse object members after '{' (and after any already consumed member) */
+static int parse_members(flatten_t *f, size_t path_len, bool keep, int depth, bool first) {
+    if (first && consume(f, '}')) return 0;
+    
+    do {
+        char key[HISTORY_NAME_MAX];
+        bool truncated = false;
+        if (parse_string(f, key, sizeof(key), &truncated) < 0 || !consume(f, ':')) {
+            return -1;
+        }
+    
+        /* Members not kept still parse under the parent's path */
+        size_t member_len = 0;
+        if (keep && !truncated && !is_delta_key(key)) {
+            member_len = push_path(f, path_len, key);
+        }
+        bool kept = member_len > 0;
+        if (parse_value(f, kept ? member_len : path_len, kept, depth + 1) < 0) {
+            return -1;
+        }
+        f->path[path_len] = '\0';
+    } while (consume(f, ','));
+    
+    return consume(f, '}') ? 0 : -1;
+}
+
+/* Array element: kept only if it starts with a "name" member */
+static int parse_element(flatten_t *f, size_t path_len, bool keep, int depth) {
+    skip_ws(f);
+    const char *start = f->p;
+
+    if (keep && consume(f, '{')) {
+        char key[8];
+        char name[HISTORY_NAME_MAX];
+        bool truncated = false;
+        if (parse_string(f, key, sizeof(key), NULL) == 0 && strcmp(key, "name") == 0 &&
+            consume(f, ':') && parse_string(f, name, sizeof(name), &truncated) == 0 &&
+            !truncated) {
+            size_t elem_len = push_path(f, path_len, name);
+            bool kept = elem_len > 0;
+            int ret = consume(f, ',') ?
+                parse_members(f, kept ? elem_len : path_len, kept, depth + 1, false) :
+                (consume(f, '}') ? 0 : -1);
+            f->path[path_len] = '\0';
+            return ret;
+        }
+    }
+
+    f->p = start;
+    return parse_value(f, path_len, false, depth);
+}
+
+static int parse_value(flatten_t *f, size_t path_len, bool keep, int depth) {
+    if (depth > MAX_DEPTH) return -1;
+
+    skip_ws(f);
+    if (f->p >= f->end) return -1;
+
+    char c = *f->p;
+    if (c == '{') {
+        f->p++;
+        return parse_members(f, path_len, keep, depth, true);
+    }
+    if (c == '[') {
+        f->p++;
+        if (consume(f, ']')) return 0;
+        do {
+            if (parse_element(f, path_len, keep, depth + 1) < 0) return -1;
+        } while (consume(f, ','));
+        return consume(f, ']') ? 0 : -1;
+    }
+    if (c == '"') {
+        return parse_string(f, NULL, 0, NULL);
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        char num[40];
+        size_t n = 0;
+        while (f->p < f->end && n + 1 < sizeof(num) && strchr("+-.eE0123456789", *f->p)) {
+            num[n++] = *f->p++;
+        }
+        num[n] = '\0';
+    
+        if (keep) {
+            series_t *s = find_series(f->h, f->path, true);
+            if (s && append_sample(f->h, s, f->ts, strtod(num, NULL)) > 0) {
+                f->added++;
+            }
+        }
+        return 0;
+    }
+    
+    static const char *const literals[] = { "true", "false", "null" };
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        size_t len = strlen(literals[i]);
+        if ((size_t)(f->end - f->p) >= len && strncmp(f->p, literals[i], len) == 0) {
+            f->p += len;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int history_ingest(history_t *h, const char *json, size_t len, int64_t timestamp) {
+    flatten_t f = {
+        .p = json,
+        .end = json + len,
+        .h = h,
+        .ts = timestamp,
+    };
+    int ret = 0;
+    
+    pthread_rwlock_wrlock(&h->lock);
+    
+    /* Only the "services" member of the root object holds metrics */
+    if (!consume(&f, '{')) {
+        ret = -1;
+    } else if (!consume(&f, '}')) {
+        do {
+            char key[16];
+            bool truncated = false;
+            if (parse_string(&f, key, sizeof(key), &truncated) < 0 || !consume(&f, ':')) {
+                ret = -1;
+                break;
+            }
+            bool services = !truncated && strcmp(key, "services") == 0;
+            if (parse_value(&f, 0, services, 0) < 0) {
+                ret = -1;
+                break;
+            }
+        } while (consume(&f, ','));
+    }
+    
+    expire_blocks(h);
+    reclaim_series(h);
+    pthread_rwlock_unlock(&h->lock);
+    
+    return ret < 0 ? -1 : f.added;
+}
+
+/*
+ * Queries
+ */
+
+static void reverse_points(history_point_t *p, int n) {
+    for (int i = 0, j = n - 1; i < j; i++, j--) {
+        history_point_t tmp = p[i];
+        p[i] = p[j];
+        p[j] = tmp;
+    }
+}
+
+int history_query(history_t *h, const char *series, int64_t from, int64_t to,
+                  history_point_t *out, int max) {
+    pthread_rwlock_rdlock(&h->lock);
+    
+    series_t *s = find_series(h, series, false);
+    if (!s) {
+        pthread_rwlock_unlock(&h->lock);
+        return -1;
+    }
+    
+    /* Keep the newest max points in a ring over out */
+    long total = 0;
+    for (int32_t i = s->streams[0].head; i != NO_BLOCK && max > 0; i = h->pool[i].next) {
+        const hblock_t *b = &h->pool[i];
+        if (b->last_ts < from || b->first_ts > to) continue;
+    
+        block_cursor_t cursor;
+        history_point_t p;
+        cursor_init(&cursor, b, 1);
+        while (cursor_next(&cursor, &p.timestamp, &p.value)) {
+            if (p.timestamp < from || p.timestamp > to) continue;
+            out[total % max] = p;
+            total++;
+        }
+    }
+    
+    pthread_rwlock_unlock(&h->lock);
+    
+    if (total <= max) return (int)total;
+    
+    /* Rotate the ring so the oldest point comes first */
+    int start = (int)(total % max);
+    reverse_points(out, start);
+    reverse_points(out + start, max - start);
+    reverse_points(out, max);
+    return max;
+}
+
+static void reverse_buckets(history_bucket_t *b, int n) {
+    for (int i = 0, j = n - 1; i < j; i++, j--) {
+        history_bucket_t tmp = b[i];
+        b[i] = b[j];
+        b[j] = tmp;
+    }
+}
+
+int history_query_rollup(history_t *h, const char *series, int tier, int64_t from, int64_t to,
+                         history_bucket_t *out, int max) {
+    pthread_rwlock_rdlock(&h->lock);
+    
+    series_t *s = tier >= 1 && tier < h->tier_count ? find_series(h, series, false) : NULL;
+    if (!s) {
+        pthread_rwlock_unlock(&h->lock);
+        return -1;
+    }
+    
+    /* Same ring as history_query, then the bucket still being filled */
+    long total = 0;
+    for (int32_t i = s->streams[tier].head; i != NO_BLOCK && max > 0; i = h->pool[i].next) {
+        const hblock_t *b = &h->pool[i];
+        if (b->last_ts < from || b->first_ts > to) continue;
+    
+        block_cursor_t cursor;
+        int64_t ts;
+        double v[ROLLUP_COLUMNS];
+        cursor_init(&cursor, b, ROLLUP_COLUMNS);
+        while (cursor_next(&cursor, &ts, v)) {
+            if (ts < from || ts > to) continue;
+            out[total % max] = (history_bucket_t){
+                .timestamp = ts, .min = v[0], .max = v[1], .sum = v[2],
+                .count = (int)v[3], .last = v[4],
+            };
+            total++;
+        }
+    }
+    
+    const history_bucket_t *pending = &s->pending[tier];
+    if (max > 0 && pending->count > 0 && pending->timestamp >= from && pending->timestamp <= to) {
+        out[total % max] = *pending;
+        total++;
+    }
+    
+    pthread_rwlock_unlock(&h->lock);
+    
+    if (total <= max) return (int)total;
+    
+    int start = (int)(total % max);
+    reverse_buckets(out, start);
+    reverse_buckets(out + start, max - start);
+    reverse_buckets(out, max);
+    return max;
+}
+
+int history_count(history_t *h, const char *series, int tier, int64_t from, int64_t to) {
+    pthread_rwlock_rdlock(&h->lock);
+    
+    series_t *s = tier >= 0 && tier < h->tier_count ? find_series(h, series, false) : NULL;
+    if (!s) {
+        pthread_rwlock_unlock(&h->lock);
+        return -1;
+    }
+    
+    long total = tier > 0 ? 1 : 0;      /* The bucket still being filled */
+    for (int32_t i = s->streams[tier].head; i != NO_BLOCK; i = h->pool[i].next) {
+        const hblock_t *b = &h->pool[i];
+        if (b->last_ts < from || b->first_ts > to) continue;
+        total += b->count;
+    }
+    
+    pthread_rwlock_unlock(&h->lock);
+    return total > INT32_MAX ? INT32_MAX : (int)total;
+}
+
+int history_downsample(const history_point_t *points, int n, int64_t step,
+                       history_bucket_t *out, int max) {
+    int count = 0;
+    if (step < 1) step = 1;
+    
+    for (int i = 0; i < n; i++) {
+        int64_t ts = points[i].timestamp;
+        int64_t start = ts - ((ts % step) + step) % step;
+        double v = points[i].value;
+    
+        if (count > 0 && out[count - 1].timestamp == start) {
+            bucket_add(&out[count - 1], v);
+            continue;
+        }
+        if (count >= max) break;
+    
+        out[count++] = (history_bucket_t){
+            .timestamp = start, .count = 1, .min = v, .max = v, .sum = v, .last = v,
+        };
+    }
+    return count;
+}
+
+int history_merge_buckets(const history_bucket_t *buckets, int n, int64_t step,
+                          history_bucket_t *out, int max) {
+    int count = 0;
+    if (step < 1) step = 1;
+    
+    for (int i = 0; i < n; i++) {
+        const history_bucket_t *in = &buckets[i];
+        int64_t start = in->timestamp - ((in->timestamp % step) + step) % step;
+    
+        if (count > 0 && out[count - 1].timestamp == start) {
+            history_bucket_t *b = &out[count - 1];
+            if (in->min < b->min) b->min = in->min;
+            if (in->max > b->max) b->max = in->max;
+            b->sum += in->sum;
+            b->count += in->count;
+            b->last = in->last;
+            continue;
+        }
+        if (count >= max) break;
+    
+        out[count] = *in;
+        out[count++].timestamp = start;
+    }
+    return count;
+}
+
+int history_lttb(const history_point_t *points, int n, history_point_t *out, int threshold) {
+    if (threshold >= n || threshold < 3) {
+        memcpy(out, points, (size_t)n * sizeof(*out));
+        return n;
+    }
+    
+    /* First and last points are kept; the rest split into threshold - 2 buckets */
+    double every = (double)(n - 2) / (threshold - 2);
+    int count = 0;
+    int a = 0;
+    out[count++] = points[0];
+    
+    for (int i = 0; i < threshold - 2; i++) {
+        /* Average of the next bucket */
+        int next_start = (int)((i + 1) * every) + 1;
+        int next_end = (int)((i + 2) * every) + 1;
+        if (next_end > n) next_end = n;
+        double avg_t = 0, avg_v = 0;
+        for (int k = next_start; k < next_end; k++) {
+            avg_t += (double)points[k].timestamp;
+            avg_v += points[k].value;
+        }
+        if (next_end > next_start) {
+            avg_t /= next_end - next_start;
+            avg_v /= next_end - next_start;
+        }
+    
+        /* Point of this bucket forming the largest triangle */
+        int start = (int)(i * every) + 1;
+        int end = (int)((i + 1) * every) + 1;
+        double at = (double)points[a].timestamp, av = points[a].value;
+        double best_area = -1;
+        int best = start;
+        for (int k = start; k < end; k++) {
+            double area = (at - avg_t) * (points[k].value - av) -
+                          (at - (double)points[k].timestamp) * (avg_v - av);
+            if (area < 0) area = -area;
+            if (area > best_area) {
+                best_area = area;
+                best = k;
+            }
+        }
+    
+        out[count++] = points[best];
+        a = best;
+    }
+    
+    out[count++] = points[n - 1];
+    return count;
+}
+
+int history_tier_count(history_t *h) {
+    pthread_rwlock_rdlock(&h->lock);
+    int count = h->tier_count;
+    pthread_rwlock_unlock(&h->lock);
+    return count;
+}
+
+int history_get_tier(history_t *h, int tier, history_tier_t *out) {
+    int ret = -1;
+    
+    pthread_rwlock_rdlock(&h->lock);
+    if (tier >= 0 && tier < h->tier_count) {
+        out->step = h->tiers[tier].step;
+        out->retention = h->tiers[tier].retention;
+        out->oldest = h->tiers[tier].horizon;
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&h->lock);
+    return ret;
+}
+
+int history_series_count(history_t *h) {
+    pthread_rwlock_rdlock(&h->lock);
+    int count = h->series_count;
+    pthread_rwlock_unlock(&h->lock);
+    return count;
+}
+
+int history_series_name(history_t *h, int index, char *name, size_t size) {
+    int ret = -1;
+    
+    pthread_rwlock_rdlock(&h->lock);
+    if (index >= 0 && index < h->series_count) {
+        snprintf(name, size, "%s", h->series[index].name);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&h->lock);
+    return ret;
+}
+
+void history_get_stats(history_t *h, history_stats_t *stats) {
+    pthread_rwlock_rdlock(&h->lock);
+    stats->series = h->series_count;
+    stats->blocks_used = h->blocks_used;
+    stats->blocks_total = h->pool_size;
+    stats->points = h->points;
+    stats->memory_bytes = (size_t)h->pool_size * sizeof(hblock_t);
+    pthread_rwlock_unlock(&h->lock);
+}
@@ -0,0 +1,142 @@
+/*
+ * history.h - Compressed time-series history
+ *
+ * Every numeric field of the snapshot is kept as its own series, named
+ * by its path ("meminfo.memory.available_kb.value"). Samples are packed
+ * into fixed-size blocks with delta-of-delta timestamps and XOR-encoded
+ * values, drawn from a pool sized at creation. Optional rollup tiers keep
+ * per-step aggregates of every series for longer than the raw samples.
+ */
+#ifndef QMEM_HISTORY_H
+#define QMEM_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_NAME_MAX 96
+#define HISTORY_MAX_TIERS 4             /* Raw samples + 3 rollup tiers */
+
+typedef struct history history_t;
+
+typedef struct {
+    int64_t timestamp;          /* Seconds since the epoch */
+    double value;
+} history_point_t;
+
+/* Aggregate of the samples falling in one step */
+typedef struct {
+    int64_t timestamp;          /* Bucket start, a multiple of the step */
+    int count;
+    double min;
+    double max;
+    double sum;
+    double last;
+} history_bucket_t;
+
+typedef struct {
+    int64_t step;               /* Rollup width in seconds, 0 for raw samples */
+    int64_t retention;          /* Seconds kept, 0 until the pool is full */
+    int64_t oldest;             /* Complete after this, 0 if nothing evicted early */
+} history_tier_t;
+
+typedef struct {
+    int series;
+    int blocks_used;
+    int blocks_total;
+    uint64_t points;
+    size_t memory_bytes;        /* Pool size */
+} history_stats_t;
+
+/*
+ * Create a store using up to memory_kb for samples. Samples older than
+ * retention_sec behind the newest are dropped (0: keep until the pool is full)
+ */
+history_t *history_create(size_t memory_kb, int64_t retention_sec);
+
+/*
+ * Add a rollup tier aggregating every series over step seconds, kept for
+ * retention_sec. Tiers must be added before any sample, in increasing step.
+ * Returns the tier number (raw samples are tier 0), or -1
+ */
+int history_add_tier(history_t *h, int64_t step, int64_t retention_sec);
+
+/*
+ * Keep the store in a memory-mapped file so it survives restarts. A file
+ * with a matching layout (pool size, tier steps) is adopted as-is after
+ * its chains are checked; otherwise it is rewritten with the empty store.
+ * Call after adding tiers and before any sample. Returns -1 (the store
+ * stays in memory) if the file cannot be used
+ */
+int history_attach(history_t *h, const char *path);
+
+/* Destroy store (an attached file is synced and marked clean) */
+void history_destroy(history_t *h);
+
+/* Append one sample. Samples not newer than the series' last are ignored */
+int history_add(history_t *h, const char *series, int64_t timestamp, double value);
+
+/*
+ * Append every numeric field under "services" of a snapshot document.
+ * Delta fields ("delta", "delta_*", "*_delta*") are skipped; array elements are kept
+ * only when their first member is a "name" string, which names them.
+ * Returns the number of samples added, or -1 if the JSON is malformed
+ */
+int history_ingest(history_t *h, const char *json, size_t len, int64_t timestamp);
+
+/*
+ * Get the newest max samples of a series within [from, to], oldest first
+ * Returns the number of points, or -1 if the series is unknown
+ */
+int history_query(history_t *h, const char *series, int64_t from, int64_t to,
+                  history_point_t *out, int max);
+
+/*
+ * Get the newest max rollups of a series within [from, to], oldest first,
+ * including the bucket still being filled
+ * Returns the number of buckets, or -1 if the series or tier is unknown
+ */
+int history_query_rollup(history_t *h, const char *series, int tier, int64_t from, int64_t to,
+                         history_bucket_t *out, int max);
+
+/*
+ * Upper bound on what history_query (tier 0) or history_query_rollup
+ * returns for [from, to], counted from whole blocks without decoding them
+ * Returns the bound, or -1 if the series or tier is unknown
+ */
+int history_count(history_t *h, const char *series, int tier, int64_t from, int64_t to);
+
+/*
+ * Aggregate time-ordered points into step-aligned buckets; empty buckets
+ * are omitted. Returns the number of buckets (at most max)
+ */
+int history_downsample(const history_point_t *points, int n, int64_t step,
+                       history_bucket_t *out, int max);
+
+/* Merge time-ordered buckets into coarser step-aligned ones, like history_downsample */
+int history_merge_buckets(const history_bucket_t *buckets, int n, int64_t step,
+                          history_bucket_t *out, int max);
+
+/*
+ * Reduce time-ordered points to threshold points that keep the visual
+ * shape (Largest-Triangle-Three-Buckets). Points are copied unchanged if
+ * there are no more than threshold (or threshold < 3), so out must hold n.
+ * Returns the number of points
+ */
+int history_lttb(const history_point_t *points, int n, history_point_t *out, int threshold);
+
+/* Number of tiers, including raw samples */
+int history_tier_count(history_t *h);
+
+/* Get a tier's step and retention. Returns -1 if out of range */
+int history_get_tier(history_t *h, int tier, history_tier_t *out);
+
+/* Number of series */
+int history_series_count(history_t *h);
+
+/* Copy the name of a series by index. Returns -1 if out of range */
+int history_series_name(history_t *h, int index, char *name, size_t size);
+
+/* Get store statistics */
+void history_get_stats(history_t *h, history_stats_t *stats);
+
+#endif /* QMEM_HISTORY_H */
@@ -1,28 +1,133 @@
 /*
  * ipc_server.c - Unix socket IPC server implementation
+ *
+ * One thread runs an epoll loop over non-blocking sockets. Connections
+ * stay open and may pipeline requests; every response echoes the seq of
+ * its request and responses leave in request order. Whatever the socket
+ * does not take at once is copied to a per-connection output queue, and
+ * while that queue is over its bound no further requests are read from
+ * the connection, so a slow reader only stalls itself.
+ *
+ * A subscribed connection is pushed a frame after every publication. Only
+ * one frame is in flight per subscriber: publications arriving while the
+ * previous frame is still queued are coalesced into the next frame, which
+ * is built from the newest snapshot once the queue drains. The collector
+ * never waits for a subscriber.
+ *
+ * A request for a stale snapshot never blocks the loop: the daemon is
+ * asked for a rebuild and the connection is set aside, reading nothing
+ * further, until the publication wakes the loop (or SNAPSHOT_DEMAND_WAIT_MS
+ * passes); the request is then answered from what is published.
+ *
+ * QMEM_REQ_SHARED passes a read-only descriptor of the shared snapshot
+ * region with its response (SCM_RIGHTS), after which clients read
+ * snapshots straight from memory.
+ *
+ * Requests whose type carries QMEM_MSG_BINARY are answered in CBOR (see
+ * common/cbor.h) instead of JSON; snapshots are encoded once per
+ * publication however many clients ask.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "ipc_server.h"
 #include "common/log.h"
 #include "common/json.h"
+#include "common/cbor.h"
 #include <qmem/protocol.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <poll.h>
+#include <sys/uio.h>
+
+#define QMEM_QUERY_MAX 2048
+#define MAX_CONNECTIONS 256
+#define MAX_EVENTS 64
+#define MAX_REQUEST_PAYLOAD 4096
+#define OUTPUT_QUEUE_MAX (1024 * 1024)  /* Queued response bytes per connection */
+#define IN_BUF_SIZE (sizeof(qmem_msg_header_t) + MAX_REQUEST_PAYLOAD)
+#define FIELDS_MAX SNAPSHOT_FIELDS_MAX
+#define MAX_PAYLOAD (QMEM_MSG_MAX_SIZE - sizeof(qmem_msg_header_t))   /* Per frame */
+#define RESPONSE_LIMIT (64 * 1024 * 1024)  /* Largest response built */
+#define HELD_POLL_MS 50                 /* Loop timeout while requests are held back */
+
+/* Response bytes the socket has not taken yet */
+typedef struct out_chunk {
+    struct out_chunk *next;
+    size_t len;
+    size_t sent;
+    int pass_fd;                        /* Passed with the first byte, -1 for none */
+    char data[];
+} out_chunk_t;
+
+typedef struct ipc_conn {
+    struct ipc_conn *prev;
+    struct ipc_conn *next;
+    int fd;
+    uint32_t events;                    /* Registered epoll events */
+    bool eof;                           /* Peer shut down its side */
+    
+    /* Received bytes not yet handled */
+    char in[IN_BUF_SIZE];
+    size_t in_len;
+    
+    /* Output queue */
+    out_chunk_t *out_head;
+    out_chunk_t *out_tail;
+    size_t out_bytes;
+    
+    /* Request held back until a requested rebuild is published */
+    bool held;
+    bool rebuilt;                       /* Waited once: answer from what is published */
+    uint64_t held_since;                /* Monotonic ms */
+    
+    /* Subscription */
+    bool subscribed;
+    bool changes;                       /* Push merge patches after the first frame */
+    bool binary;                        /* Push CBOR frames */
+    bool frame_pending;                 /* A publication waits to be pushed */
+    uint32_t sub_seq;                   /* Seq of the SUBSCRIBE request */
+    char fields[FIELDS_MAX];            /* Projection (see snapshot_write_fields), empty for all */
+    char *last;                         /* Last frame pushed, for patches */
+    size_t last_len;
+    uint64_t last_generation;           /* Publication it was rendered from */
+} ipc_conn_t;
 
 static int g_server_fd = -1;
+static int g_epoll_fd = -1;
 static pthread_t g_server_thread;
 static volatile int g_running = 0;
 static char g_socket_path[256];
+static ipc_conn_t *g_conns = NULL;     /* Open connections */
+static int g_conn_count = 0;
+static int g_held_count = 0;            /* Connections waiting for a rebuild */
+
+/* Scratch buffers, grown on demand and kept for the next response */
+static char *g_response;                /* Response being built (one at a time) */
+static size_t g_response_size;
+static uint8_t *g_binary;               /* CBOR encoding of a response */
+static size_t g_binary_size;
+static uint8_t *g_snapshot_cbor;        /* CBOR encoding of a snapshot, by generation */
+static size_t g_snapshot_cbor_size;
+static size_t g_snapshot_cbor_len;
+static uint64_t g_snapshot_cbor_gen = 0;
+static snapshot_views_t g_views = { .limit = RESPONSE_LIMIT };  /* Subscription frames */
+static char g_publish_tag;              /* epoll tag of the publication eventfd */
+static int g_publish_fd = -1;
+static bool g_shared_watched = false;   /* Shared region handed out: publish eagerly */
 
 static ipc_snapshot_callback_t g_snapshot_cb = NULL;
 static ipc_history_callback_t g_history_cb = NULL;
+static ipc_query_callback_t g_query_cb = NULL;
 
 void ipc_set_snapshot_callback(ipc_snapshot_callback_t cb) {
     g_snapshot_cb = cb;
@@ -32,67 +137,493 @@ void ipc_set_history_callback(ipc_history_callback_t cb) {
     g_history_cb = cb;
 }
 
-static void handle_client(int client_fd) {
-    qmem_msg_header_t header;
+void ipc_set_query_callback(ipc_query_callback_t cb) {
+    g_query_cb = cb;
+}
+
+/*
+ * Connections
+ */
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void conn_close(ipc_conn_t *conn) {
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    
+    if (conn->prev) conn->prev->next = conn->next;
+    else g_conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    
+    if (conn->subscribed) {
+        snapshot_unwatch();
+    }
+    if (conn->held) {
+        g_held_count--;
+    }
+    free(conn->last);
+    
+    out_chunk_t *c = conn->out_head;
+    while (c) {
+        out_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(conn);
+    g_conn_count--;
+}
+
+/* Read while the queue is under its bound and nothing is held back, write while it is not empty */
+static int conn_update_events(ipc_conn_t *conn) {
+    uint32_t events = 0;
+    if (!conn->eof && !conn->held && conn->out_bytes < OUTPUT_QUEUE_MAX) events |= EPOLLIN;
+    if (conn->out_head) events |= EPOLLOUT;
+    
+    if (events == conn->events) return 0;
+    
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+        return -1;
+    }
+    conn->events = events;
+    return 0;
+}
+
+/* sendmsg() that attaches a descriptor (SCM_RIGHTS) unless pass_fd is -1 */
+static ssize_t send_iov(int fd, const struct iovec *iov, int iovcnt, int pass_fd) {
+    struct msghdr msg = { .msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    
+    if (pass_fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+    
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/* Queue bytes from offset skip of iov */
+static int conn_queue(ipc_conn_t *conn, const struct iovec *iov, int iovcnt, size_t skip,
+                      int pass_fd) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (skip >= total) return 0;
+    
+    out_chunk_t *chunk = malloc(sizeof(*chunk) + total - skip);
+    if (!chunk) return -1;
+    chunk->next = NULL;
+    chunk->len = total - skip;
+    chunk->sent = 0;
+    chunk->pass_fd = pass_fd;
+    
+    size_t pos = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const char *base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        memcpy(chunk->data + pos, base + skip, len - skip);
+        pos += len - skip;
+        skip = 0;
+    }
+    
+    if (conn->out_tail) {
+        conn->out_tail->next = chunk;
+    } else {
+        conn->out_head = chunk;
+    }
+    conn->out_tail = chunk;
+    conn->out_bytes += chunk->len;
+    return 0;
+}
+
+/*
+ * Send a response, queueing what the socket does not take now. A pass_fd
+ * other than -1 travels with the first byte and must stay open until the
+ * connection is closed
+ */
+static int conn_send(ipc_conn_t *conn, const struct iovec *iov, int iovcnt, int pass_fd) {
+    size_t sent = 0;
+    
+    if (!conn->out_head) {
+        ssize_t n = send_iov(conn->fd, iov, iovcnt, pass_fd);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            n = 0;
+        }
+        sent = (size_t)n;
+        if (sent > 0) pass_fd = -1;
+    }
+    return conn_queue(conn, iov, iovcnt, sent, pass_fd);
+}
+
+/* Write queued output. Returns -1 if the connection failed */
+static int conn_flush(ipc_conn_t *conn) {
+    while (conn->out_head) {
+        out_chunk_t *c = conn->out_head;
+        struct iovec iov = { .iov_base = c->data + c->sent, .iov_len = c->len - c->sent };
+        ssize_t n = send_iov(conn->fd, &iov, 1, c->pass_fd);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+    
+        c->sent += (size_t)n;
+        c->pass_fd = -1;
+        conn->out_bytes -= (size_t)n;
+        if (c->sent < c->len) return 0;
+    
+        conn->out_head = c->next;
+        if (!conn->out_head) conn->out_tail = NULL;
+        free(c);
+    }
+    return 0;
+}
+
+/* Encode JSON as CBOR into a buffer grown to fit. Returns 0 if it cannot be */
+static size_t encode_cbor(const char *json, size_t len, uint8_t **buf, size_t *size) {
+    /* A number can triple ("0.1" becomes a 9 byte double), nothing else grows */
+    size_t bound = len * 3 + 16;
+    
+    for (;;) {
+        if (*buf) {
+            size_t n = cbor_from_json(json, len, *buf, *size);
+            if (n > 0 || *size >= bound) return n;
+        }
+    
+        size_t size_new = *size ? *size * 2 : len + 64;
+        if (size_new > bound) size_new = bound;
+        uint8_t *grown = realloc(*buf, size_new);
+        if (!grown) return 0;
+        *buf = grown;
+        *size = size_new;
+    }
+}
+
+/* CBOR encoding of a published snapshot, made once per publication */
+static size_t snapshot_cbor(const snapshot_t *snap) {
+    if (g_snapshot_cbor_gen != snap->generation) {
+        g_snapshot_cbor_len = encode_cbor(snap->data, snap->len,
+                                          &g_snapshot_cbor, &g_snapshot_cbor_size);
+        g_snapshot_cbor_gen = snap->generation;
+    }
+    return g_snapshot_cbor_len;
+}
+
+/*
+ * Send a JSON payload, as CBOR if the type carries QMEM_MSG_BINARY (the
+ * flag is dropped if it cannot be encoded), in frames of at most
+ * QMEM_MSG_MAX_SIZE; all but the last carry QMEM_MSG_MORE. snap is the
+ * snapshot json comes straight from, if any; pass_fd goes with the first
+ * frame as for conn_send()
+ */
+static int send_payload(ipc_conn_t *conn, uint16_t type, uint32_t seq, const char *json,
+                        size_t len, const snapshot_t *snap, int pass_fd) {
+    const void *payload = json;
+    
+    if (type & QMEM_MSG_BINARY) {
+        size_t n = snap ? snapshot_cbor(snap) : encode_cbor(json, len, &g_binary, &g_binary_size);
+        if (n > 0) {
+            payload = snap ? g_snapshot_cbor : g_binary;
+            len = n;
+        } else {
+            type &= ~QMEM_MSG_BINARY;
+        }
+    }
+    
+    size_t offset = 0;
+    do {
+        size_t n = len - offset < MAX_PAYLOAD ? len - offset : MAX_PAYLOAD;
+        bool more = offset + n < len;
+    
+        qmem_msg_header_t header;
+        qmem_msg_header_init(&header, type | (more ? QMEM_MSG_MORE : 0), n);
+        header.seq = seq;
+    
+        struct iovec iov[2] = {
+            { .iov_base = &header, .iov_len = sizeof(header) },
+            { .iov_base = (char *)payload + offset, .iov_len = n },
+        };
+        if (conn_send(conn, iov, 2, offset == 0 ? pass_fd : -1) < 0) {
+            return -1;
+        }
+        offset += n;
+    } while (offset < len);
+    
+    return 0;
+}
+
+/*
+ * Subscriptions
+ */
+
+/*
+ * Copy the value of key from a "key=value&key=value" payload into out
+ * Returns false if the key is missing
+ */
+static bool request_param(const char *payload, size_t len, const char *key,
+                          char *out, size_t size) {
+    size_t key_len = strlen(key);
+    const char *end = payload + len;
+    
+    for (const char *p = payload; p < end; ) {
+        const char *amp = memchr(p, '&', (size_t)(end - p));
+        const char *tok_end = amp ? amp : end;
+    
+        if ((size_t)(tok_end - p) > key_len && memcmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char *val = p + key_len + 1;
+            size_t n = (size_t)(tok_end - val);
+            if (n >= size) n = size - 1;
+            memcpy(out, val, n);
+            out[n] = '\0';
+            return true;
+        }
+        p = tok_end + 1;
+    }
+    return false;
+}
+
+/*
+ * Parse "fields=PATH,PATH&changes=1" ("services=NAME,NAME" is the older
+ * spelling of a projection of whole services); an empty payload
+ * subscribes to everything
+ */
+static void parse_subscription(ipc_conn_t *conn, const char *payload, size_t len) {
+    char changes[8];
+    
+    if (!request_param(payload, len, "fields", conn->fields, sizeof(conn->fields)) &&
+        !request_param(payload, len, "services", conn->fields, sizeof(conn->fields))) {
+        conn->fields[0] = '\0';
+    }
+    conn->changes = request_param(payload, len, "changes", changes, sizeof(changes)) &&
+                    (strcmp(changes, "1") == 0 || strcmp(changes, "true") == 0);
+}
+
+/*
+ * Push a snapshot to a subscriber, as a patch against its last frame if
+ * asked; whole snapshots are flagged QMEM_MSG_FULL
+ */
+static int push_frame(ipc_conn_t *conn, const snapshot_t *snap) {
+    conn->frame_pending = false;
+    
+    /* Subscribers holding the same frame share its rendering and patch */
+    uint64_t base = conn->changes && conn->last ? conn->last_generation : 0;
+    const snapshot_view_t *view = snapshot_view(&g_views, snap, conn->fields, base,
+                                                conn->last, conn->last_len);
+    const char *payload = view->patch ? view->patch : view->frame;
+    size_t payload_len = view->patch ? view->patch_len : view->frame_len;
+    bool unchanged = view->patch && !view->changed;
+    
+    /* Keep what the client now holds, to patch the next frame against */
+    if (conn->changes) {
+        char *last = realloc(conn->last, view->frame_len);
+        if (last) {
+            memcpy(last, view->frame, view->frame_len);
+            conn->last = last;
+            conn->last_len = view->frame_len;
+            conn->last_generation = snap->generation;
+        }
+    }
+    
+    if (unchanged) {
+        return 0;                       /* An empty patch: nothing to push */
+    }
+    
+    uint16_t type = QMEM_REQ_SUBSCRIBE | (conn->binary ? QMEM_MSG_BINARY : 0) |
+                    (view->patch ? 0 : QMEM_MSG_FULL);
+    return send_payload(conn, type, conn->sub_seq, payload, payload_len,
+                        payload == snap->data ? snap : NULL, -1);
+}
+
+/* Latest snapshot to every subscriber not still busy with a frame */
+static void push_publication(void) {
+    const snapshot_t *snap = snapshot_acquire();
+    if (!snap) return;
+    
+    ipc_conn_t *next;
+    for (ipc_conn_t *conn = g_conns; conn; conn = next) {
+        next = conn->next;
+        if (!conn->subscribed) continue;
     
-    /* Read header */
-    ssize_t n = recv(client_fd, &header, sizeof(header), MSG_WAITALL);
-    if (n != sizeof(header)) {
-        log_debug("Failed to read IPC header");
-        return;
+        conn->frame_pending = true;
+        if (conn->out_head) continue;   /* Pushed once the queue drains */
+    
+        if (push_frame(conn, snap) < 0 || conn_update_events(conn) < 0) {
+            conn_close(conn);
+        }
     }
     
-    /* Validate magic */
-    if (header.magic != QMEM_MSG_MAGIC) {
-        log_warn("Invalid IPC magic: 0x%x", header.magic);
-        return;
+    snapshot_release(snap);
+}
+
+/*
+ * Requests
+ */
+
+/*
+ * Hold the request back if the snapshot it reads is stale: a rebuild is
+ * requested and the request is handled again after the next publication
+ * or SNAPSHOT_DEMAND_WAIT_MS, whichever comes first
+ */
+static bool hold_for_rebuild(ipc_conn_t *conn) {
+    if (conn->rebuilt) {
+        conn->rebuilt = false;
+        return false;
     }
+    if (g_publish_fd < 0 || !snapshot_request_fresh()) {
+        return false;
+    }
+    
+    conn->held = true;
+    conn->held_since = now_ms();
+    g_held_count++;
+    return true;
+}
+
+/* Send the response built in json, keeping its buffer for the next one */
+static int send_response(ipc_conn_t *conn, const qmem_msg_header_t *req,
+                         json_builder_t *json, int pass_fd) {
+    g_response = json->buf;
+    g_response_size = json->size;
     
-    /* Handle request */
-    char response[QMEM_MSG_MAX_SIZE];
+    if (json_error(json)) {
+        json_init_growable(json, g_response, g_response_size, 0);
+        json_object_start(json);
+        json_kv_string(json, "error", "response too large");
+        json_object_end(json);
+        g_response = json->buf;
+        g_response_size = json->size;
+    }
+    return send_payload(conn, req->type, req->seq, json->buf, json_length(json), NULL, pass_fd);
+}
+
+/* Returns 0 once answered, 1 if held back for a rebuild, -1 on failure */
+static int handle_request(ipc_conn_t *conn, const qmem_msg_header_t *header,
+                          const char *payload) {
     json_builder_t json;
-    json_init(&json, response + sizeof(qmem_msg_header_t), 
-              sizeof(response) - sizeof(qmem_msg_header_t));
+    json_init_growable(&json, g_response, g_response_size, RESPONSE_LIMIT);
+    g_response = json.buf;
+    g_response_size = json.size;
     
-    switch (header.type) {
+    switch (header->type & ~(QMEM_MSG_BINARY | QMEM_MSG_MORE)) {
         case QMEM_REQ_STATUS:
         case QMEM_REQ_SNAPSHOT:
+            if (hold_for_rebuild(conn)) {
+                return 1;
+            }
             if (g_snapshot_cb) {
-                const char *snapshot = g_snapshot_cb();
-                if (snapshot) {
-                    size_t len = strlen(snapshot);
-                    if (len < sizeof(response) - sizeof(qmem_msg_header_t)) {
-                        memcpy(response + sizeof(qmem_msg_header_t), snapshot, len);
-                        json.pos = len;
-                    }
+                const snapshot_t *snap = g_snapshot_cb();
+                char fields[FIELDS_MAX];
+                if (snap && request_param(payload, header->length, "fields", fields, sizeof(fields)) &&
+                    fields[0]) {
+                    /* Narrow pollers get only what they asked for */
+                    snapshot_write_fields(&json, snap, fields);
+                    snapshot_release(snap);
+                    return send_response(conn, header, &json, -1);
+                }
+                if (snap) {
+                    /* Whatever is queued is a copy, so the slot is released now */
+                    int ret = send_payload(conn, header->type, header->seq,
+                                           snap->data, snap->len, snap, -1);
+                    snapshot_release(snap);
+                    return ret;
                 }
             }
             break;
-            
+    
         case QMEM_REQ_HISTORY:
             if (g_history_cb) {
                 /* Read count from payload if present */
                 int count = 10;
-                if (header.length >= sizeof(int)) {
-                    recv(client_fd, &count, sizeof(int), MSG_WAITALL);
+                if (header->length >= sizeof(int)) {
+                    memcpy(&count, payload, sizeof(int));
+                }
+                g_history_cb(count, &json);
+            }
+            break;
+    
+        case QMEM_REQ_QUERY:
+            if (g_query_cb) {
+                char query[QMEM_QUERY_MAX];
+                size_t len = header->length < sizeof(query) ? header->length : sizeof(query) - 1;
+                memcpy(query, payload, len);
+                query[len] = '\0';
+                g_query_cb(query, &json);
+            }
+            break;
+    
+        case QMEM_REQ_SUBSCRIBE:
+            if (hold_for_rebuild(conn)) {
+                return 1;
+            }
+            parse_subscription(conn, payload, header->length);
+            if (!conn->subscribed) {
+                snapshot_watch();
+                conn->subscribed = true;
+            }
+            conn->sub_seq = header->seq;
+            conn->binary = (header->type & QMEM_MSG_BINARY) != 0;
+            free(conn->last);
+            conn->last = NULL;
+    
+            /* The first frame is the full current snapshot */
+            if (g_snapshot_cb) {
+                const snapshot_t *snap = g_snapshot_cb();
+                if (snap) {
+                    int ret = push_frame(conn, snap);
+                    snapshot_release(snap);
+                    return ret;
                 }
-                const char *history = g_history_cb(count);
-                if (history) {
-                    size_t len = strlen(history);
-                    if (len < sizeof(response) - sizeof(qmem_msg_header_t)) {
-                        memcpy(response + sizeof(qmem_msg_header_t), history, len);
-                        json.pos = len;
-                    }
+            }
+            break;
+    
+        case QMEM_REQ_SHARED:
+            if (snapshot_shared_fd() >= 0) {
+                /* Clients poll the region rather than asking, so keep it current */
+                if (!g_shared_watched) {
+                    snapshot_watch();
+                    g_shared_watched = true;
                 }
+                snapshot_request_fresh();
+    
+                json_object_start(&json);
+                json_kv_string(&json, "status", "ok");
+                json_object_end(&json);
+                return send_response(conn, header, &json, snapshot_shared_fd());
             }
+            json_object_start(&json);
+            json_kv_string(&json, "error", "shared snapshot unavailable");
+            json_object_end(&json);
             break;
-            
+    
         case QMEM_REQ_SERVICES:
             json_object_start(&json);
             json_kv_string(&json, "status", "ok");
             json_object_end(&json);
             break;
-            
+    
         default:
             json_object_start(&json);
             json_kv_string(&json, "error", "unknown request");
@@ -100,43 +631,190 @@ static void handle_client(int client_fd) {
             break;
     }
     
-    /* Send response */
-    qmem_msg_header_t *resp_header = (qmem_msg_header_t *)response;
-    qmem_msg_header_init(resp_header, header.type, json_length(&json));
-    resp_header->seq = header.seq;
+    return send_response(conn, header, &json, -1);
+}
+
+/* Handle every complete request received, in order, while output fits and none is held */
+static int process_requests(ipc_conn_t *conn) {
+    size_t pos = 0;
+    int ret = 0;
+    
+    while (!conn->held && conn->out_bytes < OUTPUT_QUEUE_MAX &&
+           conn->in_len - pos >= sizeof(qmem_msg_header_t)) {
+        qmem_msg_header_t header;
+        memcpy(&header, conn->in + pos, sizeof(header));
+    
+        if (header.magic != QMEM_MSG_MAGIC) {
+            log_warn("Invalid IPC magic: 0x%x", header.magic);
+            ret = -1;
+            break;
+        }
+        if (header.length > MAX_REQUEST_PAYLOAD) {
+            log_warn("IPC request too large (%u bytes)", header.length);
+            ret = -1;
+            break;
+        }
+        if (conn->in_len - pos < sizeof(header) + header.length) {
+            break;  /* Rest of the payload still to come */
+        }
+    
+        int handled = handle_request(conn, &header, conn->in + pos + sizeof(header));
+        if (handled < 0) {
+            ret = -1;
+            break;
+        }
+        if (handled > 0) {
+            break;  /* Handled again once rebuilt */
+        }
+        pos += sizeof(header) + header.length;
+    }
     
-    send(client_fd, response, sizeof(qmem_msg_header_t) + json_length(&json), 0);
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return ret;
+}
+
+static int conn_read(ipc_conn_t *conn) {
+    while (conn->in_len < sizeof(conn->in)) {
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            conn->eof = true;
+            break;
+        }
+        conn->in_len += (size_t)n;
+    
+        if (process_requests(conn) < 0) return -1;
+        if (conn->out_bytes >= OUTPUT_QUEUE_MAX) break;
+    }
+    return 0;
+}
+
+/* Close the connection if it failed or is done, else update its events */
+static void conn_settle(ipc_conn_t *conn, int ret) {
+    /* A peer that shut down its side still gets the responses owed to it */
+    if (ret < 0 || (conn->eof && !conn->out_head && !conn->held) ||
+        conn_update_events(conn) < 0) {
+        conn_close(conn);
+    }
+}
+
+static void conn_event(ipc_conn_t *conn, uint32_t events) {
+    int ret = 0;
+    
+    if (events & EPOLLOUT) {
+        /* Drained: push the newest frame, then requests held back meanwhile */
+        ret = conn_flush(conn);
+        if (ret == 0 && !conn->out_head && conn->frame_pending) {
+            const snapshot_t *snap = snapshot_acquire();
+            if (snap) {
+                ret = push_frame(conn, snap);
+                snapshot_release(snap);
+            }
+        }
+        if (ret == 0) ret = process_requests(conn);
+    }
+    if (ret == 0 && (events & EPOLLIN)) {
+        ret = conn_read(conn);
+    }
+    if (ret == 0 && (events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        ret = -1;
+    }
+    conn_settle(conn, ret);
+}
+    
+/* Answer held requests: all after a publication, else those that waited long enough */
+static void resume_held(bool published) {
+    uint64_t now = now_ms();
+    
+    ipc_conn_t *next;
+    for (ipc_conn_t *conn = g_conns; conn; conn = next) {
+        next = conn->next;
+        if (!conn->held || (!published && now - conn->held_since < SNAPSHOT_DEMAND_WAIT_MS)) {
+            continue;
+        }
+    
+        conn->held = false;
+        conn->rebuilt = true;
+        g_held_count--;
+        conn_settle(conn, process_requests(conn));
+    }
+}
+
+static void accept_connections(void) {
+    for (;;) {
+        int fd = accept(g_server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_warn("accept() failed: %s", strerror(errno));
+            }
+            return;
+        }
+    
+        if (g_conn_count >= MAX_CONNECTIONS) {
+            log_warn("IPC connection limit (%d) reached", MAX_CONNECTIONS);
+            close(fd);
+            continue;
+        }
+    
+        ipc_conn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn || set_nonblocking(fd) < 0) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+    
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->next = g_conns;
+        if (g_conns) g_conns->prev = conn;
+        g_conns = conn;
+        g_conn_count++;
+    }
 }
 
 static void *server_thread(void *arg) {
     (void)arg;
     
-    struct pollfd pfd;
-    pfd.fd = g_server_fd;
-    pfd.events = POLLIN;
+    struct epoll_event events[MAX_EVENTS];
     
     log_info("IPC server started on %s", g_socket_path);
     
     while (g_running) {
-        int ret = poll(&pfd, 1, 1000);  /* 1 second timeout */
-        
-        if (ret < 0) {
+        int n = epoll_wait(g_epoll_fd, events, MAX_EVENTS, g_held_count > 0 ? HELD_POLL_MS : 1000);
+    
+        if (n < 0) {
             if (errno == EINTR) continue;
-            log_error("poll() failed: %s", strerror(errno));
+            log_error("epoll_wait() failed: %s", strerror(errno));
             break;
         }
-        
-        if (ret == 0) continue;  /* Timeout */
-        
-        if (pfd.revents & POLLIN) {
-            int client_fd = accept(g_server_fd, NULL, NULL);
-            if (client_fd < 0) {
-                log_warn("accept() failed: %s", strerror(errno));
-                continue;
+    
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_connections();
+            } else if (events[i].data.ptr == &g_publish_tag) {
+                if (snapshot_take_published(g_publish_fd)) {
+                    resume_held(true);
+                    push_publication();
+                }
+            } else {
+                conn_event(events[i].data.ptr, events[i].events);
             }
-            
-            handle_client(client_fd);
-            close(client_fd);
+        }
+    
+        /* Rebuilds that never came: answer from what is published */
+        if (g_held_count > 0) {
+            resume_held(false);
         }
     }
     
@@ -171,17 +849,40 @@ int ipc_server_start(const qmem_config_t *cfg) {
     }
     
     /* Listen */
-    if (listen(g_server_fd, 5) < 0) {
+    if (listen(g_server_fd, SOMAXCONN) < 0 || set_nonblocking(g_server_fd) < 0) {
         log_error("Failed to listen: %s", strerror(errno));
         close(g_server_fd);
         g_server_fd = -1;
         return -1;
     }
     
+    /* Event loop: the listening socket is the entry without a connection */
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (g_epoll_fd < 0 || epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_server_fd, &ev) < 0) {
+        log_error("Failed to set up epoll: %s", strerror(errno));
+        if (g_epoll_fd >= 0) close(g_epoll_fd);
+        g_epoll_fd = -1;
+        close(g_server_fd);
+        g_server_fd = -1;
+        return -1;
+    }
+    
+    /* Publications wake the loop to answer held requests and push to subscribers */
+    ev.data.ptr = &g_publish_tag;
+    g_publish_fd = snapshot_publish_fd_open();
+    if (g_publish_fd >= 0 && epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_publish_fd, &ev) < 0) {
+        log_warn("Subscriptions get no updates: %s", strerror(errno));
+    }
+    
     /* Start thread */
     g_running = 1;
     if (pthread_create(&g_server_thread, NULL, server_thread, NULL) != 0) {
         log_error("Failed to create server thread");
+        snapshot_publish_fd_close(g_publish_fd);
+        g_publish_fd = -1;
+        close(g_epoll_fd);
+        g_epoll_fd = -1;
         close(g_server_fd);
         g_server_fd = -1;
         g_running = 0;
@@ -195,14 +896,35 @@ void ipc_server_stop(void) {
     if (!g_running) return;
     
     g_running = 0;
+    pthread_join(g_server_thread, NULL);
+    
+    while (g_conns) {
+        conn_close(g_conns);
+    }
     
     if (g_server_fd >= 0) {
-        shutdown(g_server_fd, SHUT_RDWR);
         close(g_server_fd);
         g_server_fd = -1;
     }
-    
-    pthread_join(g_server_thread, NULL);
+    snapshot_publish_fd_close(g_publish_fd);
+    g_publish_fd = -1;
+    close(g_epoll_fd);
+    g_epoll_fd = -1;
+    free(g_response);
+    g_response = NULL;
+    g_response_size = 0;
+    snapshot_views_free(&g_views);
+    free(g_binary);
+    g_binary = NULL;
+    g_binary_size = 0;
+    free(g_snapshot_cbor);
+    g_snapshot_cbor = NULL;
+    g_snapshot_cbor_size = 0;
+    g_snapshot_cbor_gen = 0;
+    if (g_shared_watched) {
+        snapshot_unwatch();
+        g_shared_watched = false;
+    }
     
     unlink(g_socket_path);
 }
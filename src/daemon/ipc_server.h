@@ -5,6 +5,8 @@
 #define QMEM_IPC_SERVER_H
 
 #include "config.h"
+#include "snapshot.h"
+#include "common/json.h"
 
 /* Start IPC server (creates thread) */
 int ipc_server_start(const qmem_config_t *cfg);
@@ -15,12 +17,16 @@ void ipc_server_stop(void);
 /* Check if server is running */
 int ipc_server_is_running(void);
 
-/* Set callback for getting current snapshot */
-typedef const char *(*ipc_snapshot_callback_t)(void);
+/* Set callback for acquiring the current snapshot (released after sending) */
+typedef const snapshot_t *(*ipc_snapshot_callback_t)(void);
 void ipc_set_snapshot_callback(ipc_snapshot_callback_t cb);
 
-/* Set callback for getting history */
-typedef const char *(*ipc_history_callback_t)(int count);
+/* Set callback for writing the newest count history samples */
+typedef int (*ipc_history_callback_t)(int count, json_builder_t *json);
 void ipc_set_history_callback(ipc_history_callback_t cb);
 
+/* Set callback for running a history query (URL query string syntax) */
+typedef int (*ipc_query_callback_t)(const char *query, json_builder_t *json);
+void ipc_set_query_callback(ipc_query_callback_t cb);
+
 #endif /* QMEM_IPC_SERVER_H */
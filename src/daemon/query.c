@@ -0,0 +1,426 @@
+/*
+ * query.c - History queries shared by the IPC and HTTP servers
+ *
+ * Points are decoded straight from the history store and reduced on the
+ * server, so a client drawing hours of data receives a few hundred
+ * points per series instead of every sample. Ranges reaching past the raw
+ * retention are answered from the finest rollup tier that covers them.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#define MAX_QUERY_METRICS 16
+#define MAX_QUERY_POINTS 65536          /* Most samples decoded per series */
+#define DEFAULT_RANGE_SEC 3600
+#define DEFAULT_POINTS 300
+#define MAX_POINTS 10000
+
+typedef enum {
+    QUERY_BUCKETS,
+    QUERY_LTTB,
+    QUERY_RAW,
+} query_mode_t;
+
+typedef struct {
+    char metrics[MAX_QUERY_METRICS][HISTORY_NAME_MAX];
+    int metric_count;
+    int64_t from;
+    int64_t to;
+    int64_t step;
+    int points;
+    query_mode_t mode;
+} query_params_t;
+
+/* Decode %XX escapes and '+' in place */
+static void url_decode(char *s) {
+    char *out = s;
+    for (char *p = s; *p; p++) {
+        if (*p == '%' && p[1] && p[2]) {
+            char hex[3] = { p[1], p[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            p += 2;
+        } else {
+            *out++ = *p == '+' ? ' ' : *p;
+        }
+    }
+    *out = '\0';
+}
+
+static int parse_params(const char *query, query_params_t *params, const char **error) {
+    char buf[2048];
+    snprintf(buf, sizeof(buf), "%s", query ? query : "");
+    
+    memset(params, 0, sizeof(*params));
+    params->from = -DEFAULT_RANGE_SEC;
+    params->points = DEFAULT_POINTS;
+    params->mode = QUERY_BUCKETS;
+    
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, "&", &save); tok; tok = strtok_r(NULL, "&", &save)) {
+        char *val = strchr(tok, '=');
+        if (!val) continue;
+        *val++ = '\0';
+        url_decode(val);
+    
+        if (strcmp(tok, "metric") == 0) {
+            if (params->metric_count >= MAX_QUERY_METRICS) {
+                *error = "too many metrics";
+                return -1;
+            }
+            snprintf(params->metrics[params->metric_count++], HISTORY_NAME_MAX, "%s", val);
+        } else if (strcmp(tok, "from") == 0) {
+            params->from = strtoll(val, NULL, 10);
+        } else if (strcmp(tok, "to") == 0) {
+            params->to = strtoll(val, NULL, 10);
+        } else if (strcmp(tok, "step") == 0) {
+            params->step = strtoll(val, NULL, 10);
+        } else if (strcmp(tok, "points") == 0) {
+            params->points = atoi(val);
+        } else if (strcmp(tok, "mode") == 0) {
+            if (strcmp(val, "buckets") == 0) params->mode = QUERY_BUCKETS;
+            else if (strcmp(val, "lttb") == 0) params->mode = QUERY_LTTB;
+            else if (strcmp(val, "raw") == 0) params->mode = QUERY_RAW;
+            else {
+                *error = "mode must be buckets, lttb or raw";
+                return -1;
+            }
+        }
+    }
+    
+    int64_t now = (int64_t)time(NULL);
+    if (params->to <= 0) params->to += now;
+    if (params->from <= 0) params->from += now;
+    if (params->from > params->to) {
+        *error = "from is after to";
+        return -1;
+    }
+    if (params->points < 1) params->points = DEFAULT_POINTS;
+    if (params->points > MAX_POINTS) params->points = MAX_POINTS;
+    if (params->step <= 0) {
+        /* Enough buckets to cover the range with at most points of them */
+        params->step = (params->to - params->from + params->points - 1) / params->points;
+        if (params->step < 1) params->step = 1;
+    }
+    return 0;
+}
+
+/* Write a sample value, keeping integral values exact; JSON has no NaN */
+static void json_sample_value(json_builder_t *json, double value) {
+    if (!isfinite(value)) {
+        json_null(json);
+    } else if (value >= -0x1p63 && value < 0x1p63 && value == (double)(int64_t)value) {
+        json_int(json, (int64_t)value);
+    } else {
+        json_double(json, value);
+    }
+}
+
+static bool metric_matches(const query_params_t *params, const char *name) {
+    for (int i = 0; i < params->metric_count; i++) {
+        const char *pattern = params->metrics[i];
+        size_t len = strlen(pattern);
+        if (len > 0 && pattern[len - 1] == '*') {
+            if (strncmp(name, pattern, len - 1) == 0) return true;
+        } else if (strcmp(name, pattern) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Write buckets; returns true if the oldest had to be left out */
+static bool write_buckets(json_builder_t *json, const query_params_t *params,
+                          const history_bucket_t *buckets, int count) {
+    json_array_start(json);
+    
+    /* Keep the newest buckets if the step was too fine */
+    int first = count > params->points ? count - params->points : 0;
+    for (int i = first; i < count; i++) {
+        json_array_start(json);
+        json_int(json, buckets[i].timestamp);
+        json_sample_value(json, buckets[i].min);
+        json_sample_value(json, buckets[i].max);
+        json_sample_value(json, buckets[i].sum / buckets[i].count);
+        json_sample_value(json, buckets[i].last);
+        json_array_end(json);
+    }
+    
+    json_array_end(json);
+    return first > 0;
+}
+
+/* Buckets or LTTB points write_series and write_rollups need for n inputs */
+static int scratch_count(const query_params_t *params, int n) {
+    if (params->mode == QUERY_BUCKETS) {
+        int64_t buckets = (params->to - params->from) / params->step + 2;
+        return buckets < n ? (int)buckets : n;
+    }
+    if (params->mode == QUERY_LTTB && params->points >= 3 && params->points < n) {
+        return params->points;
+    }
+    return n;
+}
+
+/* Write a series of points; returns true if the oldest had to be left out */
+static bool write_series(json_builder_t *json, const query_params_t *params,
+                         const history_point_t *points, int n, void *scratch) {
+    if (params->mode == QUERY_BUCKETS) {
+        history_bucket_t *buckets = scratch;
+        int count = history_downsample(points, n, params->step, buckets,
+                                       scratch_count(params, n));
+        return write_buckets(json, params, buckets, count);
+    }
+    
+    history_point_t *reduced = scratch;
+    int count = n;
+    if (params->mode == QUERY_LTTB) {
+        count = history_lttb(points, n, reduced, params->points);
+        points = reduced;
+    }
+    
+    json_array_start(json);
+    int first = count > params->points ? count - params->points : 0;
+    for (int i = first; i < count; i++) {
+        json_array_start(json);
+        json_int(json, points[i].timestamp);
+        json_sample_value(json, points[i].value);
+        json_array_end(json);
+    }
+    json_array_end(json);
+    return first > 0;
+}
+
+/* Write a series from rollups; LTTB runs over their averages */
+static bool write_rollups(json_builder_t *json, const query_params_t *params,
+                          const history_bucket_t *rollups, int n,
+                          history_point_t *points, void *scratch) {
+    if (params->mode == QUERY_BUCKETS) {
+        history_bucket_t *buckets = scratch;
+        int count = history_merge_buckets(rollups, n, params->step, buckets,
+                                          scratch_count(params, n));
+        return write_buckets(json, params, buckets, count);
+    }
+    
+    for (int i = 0; i < n; i++) {
+        points[i].timestamp = rollups[i].timestamp;
+        points[i].value = rollups[i].sum / rollups[i].count;
+    }
+    return write_series(json, params, points, n, scratch);
+}
+
+/* Per-query buffers, grown to the largest series queried so far */
+typedef struct {
+    history_point_t *points;
+    history_bucket_t *rollups;
+    void *scratch;
+    int capacity;
+} query_buffers_t;
+
+static int reserve_buffers(query_buffers_t *buf, const query_params_t *params, int tier, int n) {
+    if (n <= buf->capacity) return 0;
+    
+    /* Decoded points or rollups, and room for their buckets or LTTB subset */
+    size_t scratch_size = sizeof(history_bucket_t) > sizeof(history_point_t) ?
+                          sizeof(history_bucket_t) : sizeof(history_point_t);
+    history_point_t *points = realloc(buf->points, (size_t)n * sizeof(*points));
+    if (!points) return -1;
+    buf->points = points;
+    
+    if (tier > 0) {
+        history_bucket_t *rollups = realloc(buf->rollups, (size_t)n * sizeof(*rollups));
+        if (!rollups) return -1;
+        buf->rollups = rollups;
+    }
+    
+    int scratch = scratch_count(params, n);
+    void *p = realloc(buf->scratch, (size_t)scratch * scratch_size);
+    if (!p) return -1;
+    buf->scratch = p;
+    buf->capacity = n;
+    return 0;
+}
+
+/*
+ * Finest tier still holding data back to from (the coarsest if none does),
+ * judged by what the pool has kept rather than the configured retention
+ */
+static int pick_tier(history_t *h, const query_params_t *params, history_tier_t *tier) {
+    int64_t now = (int64_t)time(NULL);
+    int count = history_tier_count(h);
+    
+    for (int t = 0; t < count; t++) {
+        history_get_tier(h, t, tier);
+        if ((tier->retention <= 0 || params->from >= now - tier->retention) &&
+            params->from > tier->oldest) {
+            return t;
+        }
+    }
+    return count - 1;
+}
+
+static int write_error(json_builder_t *json, const char *error) {
+    json_object_start(json);
+    json_kv_string(json, "error", error);
+    json_object_end(json);
+    return -1;
+}
+
+/* List the names of all series */
+static void write_metrics(history_t *h, json_builder_t *json) {
+    json_object_start(json);
+    json_key(json, "metrics");
+    json_array_start(json);
+    
+    int series = history_series_count(h);
+    for (int i = 0; i < series; i++) {
+        char name[HISTORY_NAME_MAX];
+        if (history_series_name(h, i, name, sizeof(name)) == 0) {
+            json_string(json, name);
+        }
+    }
+    
+    json_array_end(json);
+    json_object_end(json);
+}
+
+int query_run(history_t *h, const char *query, json_builder_t *json) {
+    query_params_t params;
+    const char *error = NULL;
+    
+    if (!h) {
+        return write_error(json, "history disabled");
+    }
+    if (parse_params(query, &params, &error) < 0) {
+        return write_error(json, error);
+    }
+    if (params.metric_count == 0) {
+        write_metrics(h, json);
+        return 0;
+    }
+    
+    /* Raw samples unless the range reaches past what they still hold */
+    history_tier_t tier = { 0, 0, 0 };
+    int t = params.mode == QUERY_RAW ? 0 : pick_tier(h, &params, &tier);
+    if (t > 0 && params.step % tier.step != 0) {
+        params.step += tier.step - params.step % tier.step;
+    }
+    
+    query_buffers_t buf = { NULL, NULL, NULL, 0 };
+    
+    json_object_start(json);
+    json_kv_int(json, "from", params.from);
+    json_kv_int(json, "to", params.to);
+    if (params.mode == QUERY_BUCKETS) {
+        json_kv_int(json, "step", params.step);
+    }
+    json_kv_int(json, "resolution", tier.step);
+    
+    json_key(json, "columns");
+    json_array_start(json);
+    json_string(json, "t");
+    if (params.mode == QUERY_BUCKETS) {
+        json_string(json, "min");
+        json_string(json, "max");
+        json_string(json, "avg");
+        json_string(json, "last");
+    } else {
+        json_string(json, "value");
+    }
+    json_array_end(json);
+    
+    json_key(json, "series");
+    json_object_start(json);
+    
+    int series = history_series_count(h);
+    int truncated = 0;                  /* Series cut to their newest points */
+    for (int i = 0; i < series && !json_error(json); i++) {
+        char name[HISTORY_NAME_MAX];
+        if (history_series_name(h, i, name, sizeof(name)) < 0 || !metric_matches(&params, name)) {
+            continue;
+        }
+    
+        /* Size the buffers from the series; a sample added since pushes out the oldest */
+        int max = history_count(h, name, t, params.from, params.to);
+        if (max < 0) continue;
+        if (max < 1) max = 1;
+        bool clipped = max > MAX_QUERY_POINTS;
+        if (clipped) max = MAX_QUERY_POINTS;
+        if (reserve_buffers(&buf, &params, t, max) < 0) {
+            json_key(json, name);
+            json_null(json);
+            continue;
+        }
+    
+        if (t > 0) {
+            int n = history_query_rollup(h, name, t, params.from, params.to, buf.rollups, max);
+            if (n < 0) continue;
+            json_key(json, name);
+            clipped |= write_rollups(json, &params, buf.rollups, n, buf.points, buf.scratch);
+        } else {
+            int n = history_query(h, name, params.from, params.to, buf.points, max);
+            if (n < 0) continue;
+            json_key(json, name);
+            clipped |= write_series(json, &params, buf.points, n, buf.scratch);
+        }
+        if (clipped) truncated++;
+    }
+    
+    json_object_end(json);  /* series */
+    json_kv_int(json, "truncated", truncated);
+    json_object_end(json);
+    
+    free(buf.points);
+    free(buf.scratch);
+    free(buf.rollups);
+    return 0;
+}
+
+int query_recent(history_t *h, int count, json_builder_t *json) {
+    if (!h) {
+        return write_error(json, "history disabled");
+    }
+    if (count < 1) count = 1;
+    if (count > MAX_QUERY_POINTS) count = MAX_QUERY_POINTS;
+    
+    history_point_t *points = malloc((size_t)count * sizeof(*points));
+    if (!points) {
+        return write_error(json, "out of memory");
+    }
+    
+    json_object_start(json);
+    json_key(json, "series");
+    json_object_start(json);
+    
+    int series = history_series_count(h);
+    for (int i = 0; i < series && !json_error(json); i++) {
+        char name[HISTORY_NAME_MAX];
+        if (history_series_name(h, i, name, sizeof(name)) < 0) continue;
+    
+        int n = history_query(h, name, INT64_MIN, INT64_MAX, points, count);
+        if (n <= 0) continue;
+    
+        json_key(json, name);
+        json_array_start(json);
+        for (int k = 0; k < n; k++) {
+            json_array_start(json);
+            json_int(json, points[k].timestamp);
+            json_sample_value(json, points[k].value);
+            json_array_end(json);
+        }
+        json_array_end(json);
+    }
+    
+    json_object_end(json);  /* series */
+    json_object_end(json);
+    
+    free(points);
+    return 0;
+}
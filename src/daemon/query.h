@@ -0,0 +1,31 @@
+/*
+ * query.h - History queries shared by the IPC and HTTP servers
+ */
+#ifndef QMEM_QUERY_H
+#define QMEM_QUERY_H
+
+#include "history.h"
+#include "common/json.h"
+
+/*
+ * Run a range query given as URL query parameters:
+ *   metric=NAME   Series to return; repeatable, a trailing '*' matches a
+ *                 prefix. Without any metric the series names are listed
+ *   from=, to=    Epoch seconds; values <= 0 are relative to now
+ *                 (defaults: from=-3600, to=0)
+ *   step=SEC      Bucket width (default: range / points)
+ *   points=N      Maximum points per series (default 300)
+ *   mode=MODE     "buckets" (min/max/avg/last per step, default),
+ *                 "lttb" (shape-preserving subset) or "raw"
+ * Ranges older than the raw retention are read from the finest rollup tier
+ * covering from, with step rounded up to a multiple of its width. Series
+ * with more than points values (or samples than can be decoded) keep the
+ * newest; "truncated" counts them. Values that are not finite are null
+ * Returns 0, or -1 after writing an {"error": ...} object
+ */
+int query_run(history_t *h, const char *query, json_builder_t *json);
+
+/* Write the newest count samples of every series */
+int query_recent(history_t *h, int count, json_builder_t *json);
+
+#endif /* QMEM_QUERY_H */
@@ -1,20 +1,275 @@
 /*
  * service_manager.c - Service registry and lifecycle management
+ *
+ * Every enabled service due this round is a task. Services do not read
+ * each other's results, so tasks are run in any order, either inline on
+ * the main loop or by a pool of worker threads (collect_threads > 1).
+ *
+ * Each service has its own period and phase offset ([schedule] section).
+ * Due times are slots offset + k * interval on the monotonic clock, counted
+ * from service manager init, so phases stay fixed and missed slots are
+ * skipped rather than collected in a burst.
+ *
+ * Per-process services declare the PROC_FIELD_* sources they need. Each
+ * round walks /proc once for the union of the due services' fields and
+ * hands the resulting table to every task, so no service scans /proc on
+ * its own. With proc_fd_cache set, the walk keeps per-PID files open
+ * between rounds; with proc_fd_rescan set, it skips fd directories of
+ * processes that have not run since their last walk.
+ *
+ * Each service's snapshot JSON is cached as a fragment tagged with the
+ * collect_count it was rendered at. Assembling the full document only
+ * re-renders services collected since, and copies the rest verbatim.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "service_manager.h"
 #include "common/log.h"
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define MAX_COLLECT_THREADS MAX_SERVICES
+#define FRAGMENT_MIN_SIZE 4096
+#define FRAGMENT_MAX_SIZE (64 * 1024 * 1024)   /* Bound on a runaway service */
+
+/* One service collection within a round */
+typedef struct {
+    qmem_service_t *svc;
+    int result;
+} collect_task_t;
+
+/* Worker pool state, guarded by lock */
+typedef struct {
+    pthread_t threads[MAX_COLLECT_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;       /* Workers wait for ready tasks */
+    pthread_cond_t done_cond;       /* Collector waits for round end */
+    collect_task_t tasks[MAX_SERVICES];
+    int task_count;
+    int ready[MAX_SERVICES];
+    int ready_count;
+    int remaining;
+    bool shutdown;
+} collect_pool_t;
+
+/* Collection schedule of a registered service */
+typedef struct {
+    int64_t interval_ms;
+    int64_t offset_ms;
+    int64_t next_due_ms;            /* Relative to g_epoch */
+    bool due;
+} svc_schedule_t;
+
+/* Cached snapshot JSON of a registered service */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    int generation;                 /* collect_count rendered at, -1 if none */
+} svc_fragment_t;
 
 static qmem_service_t *g_services[MAX_SERVICES];
+static svc_schedule_t g_schedules[MAX_SERVICES];   /* Parallel to g_services */
+static svc_fragment_t g_fragments[MAX_SERVICES];   /* Parallel to g_services */
+static bool g_layout_changed = true;    /* Service set changed since last assembly */
+static struct timespec g_epoch;
 static int g_service_count = 0;
 static const qmem_config_t *g_config = NULL;
+static proc_table_t g_proc_table;       /* Shared per-round process walk */
+static proc_fd_cache_t g_fd_cache;
+static proc_fd_scans_t g_fd_scans;
+static collect_pool_t g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int run_task(collect_task_t *task) {
+    qmem_service_t *svc = task->svc;
+    
+    int ret = svc->ops->collect(svc);
+    if (ret < 0) {
+        log_warn("Service %s collect failed: %d", svc->name, ret);
+    } else {
+        svc->collect_count++;
+    }
+    return ret;
+}
+
+static void *collect_worker(void *arg) {
+    collect_pool_t *pool = (collect_pool_t *)arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        if (pool->ready_count == 0) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+            continue;
+        }
+        
+        int idx = pool->ready[--pool->ready_count];
+        pthread_mutex_unlock(&pool->lock);
+        
+        int ret = run_task(&pool->tasks[idx]);
+        
+        pthread_mutex_lock(&pool->lock);
+        pool->tasks[idx].result = ret;
+        if (--pool->remaining == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return NULL;
+}
+
+/* Queue this round's tasks. Returns the number of tasks */
+static int build_tasks(collect_pool_t *pool, bool due_only) {
+    pool->task_count = 0;
+    pool->ready_count = 0;
+    
+    for (int i = 0; i < g_service_count; i++) {
+        qmem_service_t *svc = g_services[i];
+        
+        if (!svc->enabled || !svc->ops || !svc->ops->collect) continue;
+        if (due_only && !g_schedules[i].due) continue;
+        
+        collect_task_t *task = &pool->tasks[pool->task_count];
+        memset(task, 0, sizeof(*task));
+        task->svc = svc;
+        pool->task_count++;
+    }
+    
+    /* Seed ready list in reverse so registration order is popped first */
+    for (int t = pool->task_count - 1; t >= 0; t--) {
+        pool->ready[pool->ready_count++] = t;
+    }
+    
+    pool->remaining = pool->task_count;
+    return pool->task_count;
+}
+
+static void start_workers(int count) {
+    if (count > MAX_COLLECT_THREADS) count = MAX_COLLECT_THREADS;
+    
+    g_pool.shutdown = false;
+    g_pool.thread_count = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&g_pool.threads[i], NULL, collect_worker, &g_pool) != 0) {
+            log_warn("Failed to create collect worker %d", i);
+            break;
+        }
+        g_pool.thread_count++;
+    }
+    
+    if (g_pool.thread_count > 0) {
+        log_info("Parallel collection enabled (%d workers)", g_pool.thread_count);
+    }
+}
+
+static void stop_workers(void) {
+    if (g_pool.thread_count == 0) return;
+    
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.shutdown = true;
+    pthread_cond_broadcast(&g_pool.work_cond);
+    pthread_mutex_unlock(&g_pool.lock);
+    
+    for (int i = 0; i < g_pool.thread_count; i++) {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+    g_pool.thread_count = 0;
+}
+
+/* Reserve fds for sockets, clients and plugins */
+#define FD_CACHE_HEADROOM 256
+
+static void init_fd_cache(int budget) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        int limit = (int)rl.rlim_cur - FD_CACHE_HEADROOM;
+        if (budget > limit) {
+            log_warn("proc_fd_cache %d exceeds open file limit, using %d", budget, limit);
+            budget = limit;
+        }
+    }
+    if (budget <= 0) return;
+    
+    if (proc_fd_cache_init(&g_fd_cache, budget) < 0) {
+        log_warn("Failed to allocate /proc fd cache");
+        return;
+    }
+    g_proc_table.fd_cache = &g_fd_cache;
+    log_info("/proc fd cache enabled (%d fds)", budget);
+}
+
+static void init_fd_scans(int max_age) {
+    if (proc_fd_scans_init(&g_fd_scans, max_age) < 0) {
+        log_warn("Failed to allocate fd scan memo");
+        return;
+    }
+    g_proc_table.fd_scans = &g_fd_scans;
+    log_info("Incremental fd scans enabled (full walk every %d passes)", max_age);
+}
+
+static int64_t elapsed_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - g_epoch.tv_sec) * 1000 +
+           (now.tv_nsec - g_epoch.tv_nsec) / 1000000;
+}
+
+/* First slot (offset + k * interval) at or after now_ms */
+static int64_t next_slot(const svc_schedule_t *sched, int64_t now_ms) {
+    if (now_ms <= sched->offset_ms) {
+        return sched->offset_ms;
+    }
+    int64_t k = (now_ms - sched->offset_ms + sched->interval_ms - 1) / sched->interval_ms;
+    return sched->offset_ms + k * sched->interval_ms;
+}
+
+static void init_schedule(svc_schedule_t *sched, const qmem_service_t *svc) {
+    const qmem_schedule_t *cfg_sched = g_config ? config_find_schedule(g_config, svc->name) : NULL;
+    
+    if (cfg_sched) {
+        sched->interval_ms = cfg_sched->interval_ms;
+        sched->offset_ms = cfg_sched->offset_ms;
+    } else {
+        int interval_sec = (g_config && g_config->interval_sec > 0) ? g_config->interval_sec : 10;
+        sched->interval_ms = (int64_t)interval_sec * 1000;
+        sched->offset_ms = 0;
+    }
+    
+    /* Unphased services sample right away; phased ones wait for their slot */
+    int64_t now_ms = elapsed_ms();
+    sched->next_due_ms = sched->offset_ms > 0 ? next_slot(sched, now_ms) : now_ms;
+    sched->due = false;
+}
 
 int svc_manager_init(const qmem_config_t *cfg) {
     g_service_count = 0;
     g_config = cfg;
     
     memset(g_services, 0, sizeof(g_services));
+    memset(g_schedules, 0, sizeof(g_schedules));
+    memset(g_fragments, 0, sizeof(g_fragments));
+    g_layout_changed = true;
+    clock_gettime(CLOCK_MONOTONIC, &g_epoch);
+    proc_table_init(&g_proc_table);
+    if (cfg && cfg->proc_fd_cache > 0) {
+        init_fd_cache(cfg->proc_fd_cache);
+    }
+    if (cfg && cfg->proc_fd_rescan > 0) {
+        init_fd_scans(cfg->proc_fd_rescan);
+    }
+    
+    if (cfg && cfg->collect_threads > 1) {
+        start_workers(cfg->collect_threads);
+    }
     
     log_info("Service manager initialized");
     return 0;
@@ -35,8 +290,12 @@ int svc_manager_register(qmem_service_t *svc) {
         }
     }
     
+    init_schedule(&g_schedules[g_service_count], svc);
+    g_fragments[g_service_count] = (svc_fragment_t){ .generation = -1 };
     g_services[g_service_count++] = svc;
-    log_info("Registered service: %s (%s)", svc->name, svc->description);
+    g_layout_changed = true;
+    log_info("Registered service: %s (%s, every %ld ms)", svc->name, svc->description,
+             (long)g_schedules[g_service_count - 1].interval_ms);
     
     return 0;
 }
@@ -61,10 +320,14 @@ int svc_manager_unregister(qmem_service_t *svc) {
     }
     
     /* Remove from array by shifting */
+    free(g_fragments[idx].buf);
     for (int i = idx; i < g_service_count - 1; i++) {
         g_services[i] = g_services[i + 1];
+        g_schedules[i] = g_schedules[i + 1];
+        g_fragments[i] = g_fragments[i + 1];
     }
     g_service_count--;
+    g_layout_changed = true;
     
     log_info("Unregistered service: %s", svc->name);
     return 0;
@@ -90,29 +353,166 @@ qmem_service_t *svc_manager_get_index(int index) {
     return g_services[index];
 }
 
-int svc_manager_collect_all(void) {
+/* Run one collection round. Returns the number of services collected. */
+static int collect_round(bool due_only) {
+    collect_pool_t *pool = &g_pool;
+    struct timespec start, end;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    pthread_mutex_lock(&pool->lock);
+    if (build_tasks(pool, due_only) == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    
+    /* One /proc walk for everything this round's services asked for */
+    unsigned int proc_fields = 0;
+    for (int t = 0; t < pool->task_count; t++) {
+        proc_fields |= pool->tasks[t].svc->proc_fields;
+    }
+    
+    const proc_table_t *table = NULL;
+    if (proc_fields) {
+        if (proc_table_build(&g_proc_table, proc_fields) >= 0) {
+            table = &g_proc_table;
+            if (g_proc_table.fd_scans && (proc_fields & PROC_FIELD_FD)) {
+                log_debug("fd dirs: %d walked, %d reused",
+                          g_fd_scans.walked, g_fd_scans.reused);
+            }
+        } else {
+            log_warn("Process table build failed");
+        }
+    }
+    for (int t = 0; t < pool->task_count; t++) {
+        qmem_service_t *svc = pool->tasks[t].svc;
+        svc->proc_table = svc->proc_fields ? table : NULL;
+    }
+    
+    if (pool->thread_count > 0) {
+        /* Hand the round to the workers and wait for it to drain */
+        pthread_cond_broadcast(&pool->work_cond);
+        while (pool->remaining > 0) {
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+    } else {
+        /* Serial mode: run inline in registration order */
+        while (pool->ready_count > 0) {
+            int idx = pool->ready[--pool->ready_count];
+            pool->tasks[idx].result = run_task(&pool->tasks[idx]);
+            pool->remaining--;
+        }
+    }
+    
     int errors = 0;
+    for (int t = 0; t < pool->task_count; t++) {
+        if (pool->tasks[t].result < 0) errors++;
+        pool->tasks[t].svc->proc_table = NULL;
+    }
+    int task_count = pool->task_count;
+    pthread_mutex_unlock(&pool->lock);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long round_ms = (end.tv_sec - start.tv_sec) * 1000 +
+                    (end.tv_nsec - start.tv_nsec) / 1000000;
+    log_debug("Collected %d services in %ld ms (%d errors, %d procs)",
+              task_count, round_ms, errors, proc_fields ? g_proc_table.count : 0);
+    
+    return task_count;
+}
+
+int svc_manager_collect_all(void) {
+    return collect_round(false);
+}
+
+int svc_manager_collect_due(void) {
+    int64_t now_ms = elapsed_ms();
+    bool any_due = false;
     
     for (int i = 0; i < g_service_count; i++) {
-        qmem_service_t *svc = g_services[i];
-        
-        if (!svc->enabled) continue;
-        
-        if (svc->ops && svc->ops->collect) {
-            int ret = svc->ops->collect(svc);
-            if (ret < 0) {
-                log_warn("Service %s collect failed: %d", svc->name, ret);
-                errors++;
-            } else {
-                svc->collect_count++;
-            }
+        svc_schedule_t *sched = &g_schedules[i];
+        sched->due = g_services[i]->enabled && sched->next_due_ms <= now_ms;
+        if (sched->due) {
+            any_due = true;
+            /* Advance past now so overruns skip slots instead of bursting */
+            sched->next_due_ms = next_slot(sched, now_ms + 1);
         }
     }
     
-    return errors;
+    return any_due ? collect_round(true) : 0;
+}
+
+bool svc_manager_next_due(struct timespec *deadline) {
+    int64_t earliest = -1;
+    
+    for (int i = 0; i < g_service_count; i++) {
+        if (!g_services[i]->enabled) continue;
+        if (earliest < 0 || g_schedules[i].next_due_ms < earliest) {
+            earliest = g_schedules[i].next_due_ms;
+        }
+    }
+    
+    if (earliest < 0) return false;
+    
+    deadline->tv_sec = g_epoch.tv_sec + earliest / 1000;
+    deadline->tv_nsec = g_epoch.tv_nsec + (earliest % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+static bool fragment_stale(int i) {
+    return g_fragments[i].generation != g_services[i]->collect_count;
+}
+
+/* Re-render a service's fragment, growing its buffer as needed */
+static void render_fragment(int i) {
+    qmem_service_t *svc = g_services[i];
+    svc_fragment_t *frag = &g_fragments[i];
+    
+    json_builder_t json;
+    json_init_growable(&json, frag->buf, frag->buf ? frag->size : FRAGMENT_MIN_SIZE,
+                       FRAGMENT_MAX_SIZE);
+    if (svc->ops && svc->ops->snapshot) {
+        svc->ops->snapshot(svc, &json);
+    } else {
+        json_null(&json);
+    }
+    frag->buf = json.buf;
+    frag->size = frag->buf ? json.size : 0;
+    
+    if (!json_error(&json)) {
+        frag->len = json_length(&json);
+        frag->generation = svc->collect_count;
+        return;
+    }
+    
+    log_warn("Snapshot of service %s does not fit, omitting it", svc->name);
+    if (frag->buf && frag->size >= 5) {
+        memcpy(frag->buf, "null", 5);
+        frag->len = 4;
+    } else {
+        frag->len = 0;
+    }
+    frag->generation = svc->collect_count;
+}
+
+bool svc_manager_snapshot_stale(void) {
+    if (g_layout_changed) return true;
+    
+    for (int i = 0; i < g_service_count; i++) {
+        if (g_services[i]->enabled && fragment_stale(i)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 int svc_manager_snapshot_all(json_builder_t *json) {
+    int rendered = 0;
+    
     json_object_start(json);
     
     /* Add timestamp */
@@ -128,10 +528,14 @@ int svc_manager_snapshot_all(json_builder_t *json) {
         
         if (!svc->enabled) continue;
         
-        json_key(json, svc->name);
+        if (fragment_stale(i)) {
+            render_fragment(i);
+            rendered++;
+        }
         
-        if (svc->ops && svc->ops->snapshot) {
-            svc->ops->snapshot(svc, json);
+        json_key(json, svc->name);
+        if (g_fragments[i].len > 0) {
+            json_raw(json, g_fragments[i].buf, g_fragments[i].len);
         } else {
             json_null(json);
         }
@@ -140,18 +544,30 @@ int svc_manager_snapshot_all(json_builder_t *json) {
     json_object_end(json);  /* services */
     json_object_end(json);  /* root */
     
-    return 0;
+    g_layout_changed = false;
+    return rendered;
 }
 
 void svc_manager_shutdown(void) {
+    stop_workers();
+    
     for (int i = 0; i < g_service_count; i++) {
         qmem_service_t *svc = g_services[i];
         
         if (svc->ops && svc->ops->destroy) {
             svc->ops->destroy(svc);
         }
+        free(g_fragments[i].buf);
+        g_fragments[i].buf = NULL;
     }
     
     g_service_count = 0;
+    proc_table_free(&g_proc_table);
+    if (g_fd_cache.buckets) {
+        proc_fd_cache_free(&g_fd_cache);
+    }
+    if (g_fd_scans.buckets) {
+        proc_fd_scans_free(&g_fd_scans);
+    }
     log_info("Service manager shutdown");
 }
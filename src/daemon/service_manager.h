@@ -7,6 +7,8 @@
 #include "services/service.h"
 #include "config.h"
 #include "common/json.h"
+#include <stdbool.h>
+#include <time.h>
 
 #define MAX_SERVICES 16
 
@@ -28,10 +30,19 @@ qmem_service_t *svc_manager_get(const char *name);
 /* Get service by index */
 qmem_service_t *svc_manager_get_index(int index);
 
-/* Collect from all services */
+/* Collect from all services, ignoring schedules (returns services collected) */
 int svc_manager_collect_all(void);
 
-/* Generate full snapshot JSON */
+/* Collect services whose schedule slot has arrived (returns services collected) */
+int svc_manager_collect_due(void);
+
+/* Get absolute CLOCK_MONOTONIC time the next service is due; false if none */
+bool svc_manager_next_due(struct timespec *deadline);
+
+/* True if a service was collected or (un)registered since the last snapshot */
+bool svc_manager_snapshot_stale(void);
+
+/* Generate full snapshot JSON from cached fragments (returns fragments re-rendered) */
 int svc_manager_snapshot_all(json_builder_t *json);
 
 /* Shutdown all services */
@@ -0,0 +1,417 @@
+/*
+ * snapshot.c - Reference-counted snapshot publication
+ *
+ * A small pool of slots is rotated by the single writer. A reader bumps
+ * the reference count of the slot it found published and then checks the
+ * slot is still current; if the writer swapped it out meanwhile, the
+ * reader backs off and retries. The writer only reuses a slot that is
+ * neither current nor referenced, so it never overwrites data a reader
+ * holds, and a reader never keeps a slot that is being rewritten.
+ *
+ * Readers request a rebuild of a stale snapshot through an eventfd the
+ * daemon loop sleeps on, without waiting for it. Every publication is
+ * signalled through an eventfd per reader thread, which then answers the
+ * requests it held back and pushes to its watchers. Fresh snapshots are
+ * taken without any locking.
+ *
+ * Each publication is also copied into a sealed memfd under a seqlock, so
+ * local clients holding a read-only mapping read snapshots without any
+ * system call or round trip to the daemon.
+ */
+#define _GNU_SOURCE
+
+#include "snapshot.h"
+#include "common/log.h"
+#include "common/json_patch.h"
+#include <qmem/protocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+/* Current + previous + one being rendered, plus one for slow readers */
+#define SNAPSHOT_SLOTS 4
+
+/* Shared region size; pages are only allocated as snapshots fill them */
+#define SHARED_CAPACITY (64 * 1024 * 1024)
+
+/* Threads that may wait for publications (IPC server, HTTP workers) */
+#define MAX_PUBLISH_FDS 32
+
+static snapshot_t g_slots[SNAPSHOT_SLOTS];
+static _Atomic(snapshot_t *) g_current = NULL;
+static atomic_bool g_stale = true;
+static int g_demand_fd = -1;
+static atomic_int g_watchers = 0;
+
+/* Shared mirror of the current snapshot */
+static qmem_shm_header_t *g_shm = NULL;
+static size_t g_shm_size = 0;
+static int g_shm_fd = -1;               /* Read-only descriptor for clients */
+
+/* Create the shared region; without it clients must ask over the socket */
+static void shm_create(size_t capacity) {
+    int fd = memfd_create("qmem-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        log_warn("memfd_create() failed, no shared snapshot: %s", strerror(errno));
+        return;
+    }
+    
+    size_t size = sizeof(qmem_shm_header_t) + capacity;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        log_warn("Failed to map shared snapshot: %s", strerror(errno));
+        close(fd);
+        return;
+    }
+    
+    g_shm = map;
+    g_shm_size = size;
+    memset(g_shm, 0, sizeof(*g_shm));
+    g_shm->magic = QMEM_SHM_MAGIC;
+    g_shm->version = QMEM_SHM_VERSION;
+    g_shm->capacity = capacity;
+    
+    /* Clients cannot resize the region, nor map it writable */
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+    fcntl(fd, F_ADD_SEALS, seals);
+    
+    /* Hand out a read-only descriptor for the same file */
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    g_shm_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (g_shm_fd >= 0) {
+        close(fd);
+    } else {
+        g_shm_fd = fd;
+    }
+}
+
+/* Copy a publication into the shared region (writer only) */
+static void shm_store(const char *data, size_t len) {
+    if (!g_shm) return;
+    if (len > g_shm->capacity) {
+        log_debug("Snapshot of %zu bytes does not fit the shared region", len);
+        return;
+    }
+    
+    uint64_t seq = g_shm->seq;
+    __atomic_store_n(&g_shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    memcpy(g_shm + 1, data, len);
+    __atomic_store_n(&g_shm->len, len, __ATOMIC_RELAXED);
+    
+    __atomic_store_n(&g_shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Reader threads to notify of publications */
+static pthread_mutex_t g_publish_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_publish_fds[MAX_PUBLISH_FDS];      /* Under g_publish_lock */
+static atomic_int g_publish_fd_count = 0;
+static uint64_t g_generation = 0;       /* Publications so far (writer only) */
+
+int snapshot_init(size_t capacity) {
+    for (int i = 0; i < SNAPSHOT_SLOTS; i++) {
+        g_slots[i].data = malloc(capacity);
+        if (!g_slots[i].data) {
+            snapshot_shutdown();
+            return -1;
+        }
+        g_slots[i].data[0] = '\0';
+        g_slots[i].capacity = capacity;
+        g_slots[i].len = 0;
+        atomic_init(&g_slots[i].refs, 0);
+    }
+    atomic_store(&g_current, NULL);
+    atomic_store(&g_stale, true);
+    
+    /* Without it readers get whatever was last published */
+    g_demand_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_demand_fd < 0) {
+        log_warn("eventfd() failed, snapshots will not be rebuilt on demand");
+    }
+    shm_create(SHARED_CAPACITY);
+    return 0;
+}
+
+void snapshot_shutdown(void) {
+    atomic_store(&g_current, NULL);
+    for (int i = 0; i < SNAPSHOT_SLOTS; i++) {
+        free(g_slots[i].data);
+        g_slots[i].data = NULL;
+        g_slots[i].capacity = 0;
+    }
+    if (g_demand_fd >= 0) {
+        close(g_demand_fd);
+        g_demand_fd = -1;
+    }
+    pthread_mutex_lock(&g_publish_lock);
+    for (int i = 0; i < atomic_load(&g_publish_fd_count); i++) {
+        close(g_publish_fds[i]);
+    }
+    atomic_store(&g_publish_fd_count, 0);
+    pthread_mutex_unlock(&g_publish_lock);
+    if (g_shm) {
+        munmap(g_shm, g_shm_size);
+        g_shm = NULL;
+    }
+    if (g_shm_fd >= 0) {
+        close(g_shm_fd);
+        g_shm_fd = -1;
+    }
+}
+
+void snapshot_mark_stale(void) {
+    atomic_store(&g_stale, true);
+}
+
+bool snapshot_is_stale(void) {
+    return atomic_load(&g_stale);
+}
+
+int snapshot_demand_fd(void) {
+    return g_demand_fd;
+}
+
+bool snapshot_take_demand(void) {
+    uint64_t count;
+    return g_demand_fd >= 0 && read(g_demand_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+void snapshot_watch(void) {
+    atomic_fetch_add(&g_watchers, 1);
+}
+
+void snapshot_unwatch(void) {
+    atomic_fetch_sub(&g_watchers, 1);
+}
+
+bool snapshot_has_watchers(void) {
+    return atomic_load(&g_publish_fd_count) > 0 && atomic_load(&g_watchers) > 0;
+}
+
+int snapshot_publish_fd_open(void) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        log_warn("eventfd() failed, publications will not be pushed");
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_publish_lock);
+    int count = atomic_load(&g_publish_fd_count);
+    if (count < MAX_PUBLISH_FDS) {
+        g_publish_fds[count] = fd;
+        atomic_store(&g_publish_fd_count, count + 1);
+    } else {
+        log_warn("Too many publication watchers (%d)", MAX_PUBLISH_FDS);
+        close(fd);
+        fd = -1;
+    }
+    pthread_mutex_unlock(&g_publish_lock);
+    return fd;
+}
+
+void snapshot_publish_fd_close(int fd) {
+    if (fd < 0) return;
+    
+    pthread_mutex_lock(&g_publish_lock);
+    int count = atomic_load(&g_publish_fd_count);
+    for (int i = 0; i < count; i++) {
+        if (g_publish_fds[i] == fd) {
+            g_publish_fds[i] = g_publish_fds[count - 1];
+            atomic_store(&g_publish_fd_count, count - 1);
+            close(fd);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_publish_lock);
+}
+
+bool snapshot_take_published(int fd) {
+    uint64_t count;
+    return fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count);
+}
+
+snapshot_t *snapshot_begin(void) {
+    snapshot_t *current = atomic_load(&g_current);
+    
+    for (int i = 0; i < SNAPSHOT_SLOTS; i++) {
+        snapshot_t *snap = &g_slots[i];
+        if (snap != current && snap->data && atomic_load(&snap->refs) == 0) {
+            return snap;
+        }
+    }
+    
+    log_debug("All snapshot slots held by readers, skipping publication");
+    return NULL;
+}
+
+int snapshot_shared_fd(void) {
+    return g_shm_fd;
+}
+
+void snapshot_publish(snapshot_t *snap, size_t len) {
+    snap->len = len;
+    snap->generation = ++g_generation;
+    shm_store(snap->data, len);
+    atomic_store(&g_current, snap);
+    atomic_store(&g_stale, false);
+    
+    /* Watchers and requests held back for a rebuild wait for this */
+    pthread_mutex_lock(&g_publish_lock);
+    uint64_t one = 1;
+    for (int i = 0; i < atomic_load(&g_publish_fd_count); i++) {
+        if (write(g_publish_fds[i], &one, sizeof(one)) < 0) {
+            /* Counter saturated: a notification is pending anyway */
+        }
+    }
+    pthread_mutex_unlock(&g_publish_lock);
+}
+
+const snapshot_t *snapshot_acquire(void) {
+    for (;;) {
+        snapshot_t *snap = atomic_load(&g_current);
+        if (!snap) {
+            return NULL;
+        }
+    
+        atomic_fetch_add(&snap->refs, 1);
+        if (atomic_load(&g_current) == snap) {
+            return snap;
+        }
+    
+        /* Swapped out before our reference was visible: it may be reused */
+        atomic_fetch_sub(&snap->refs, 1);
+    }
+}
+
+bool snapshot_request_fresh(void) {
+    if (g_demand_fd < 0 || !atomic_load(&g_stale)) {
+        return false;
+    }
+    
+    uint64_t one = 1;
+    return write(g_demand_fd, &one, sizeof(one)) == sizeof(one);
+}
+
+void snapshot_release(const snapshot_t *snap) {
+    if (snap) {
+        atomic_fetch_sub(&((snapshot_t *)snap)->refs, 1);
+    }
+}
+
+void snapshot_write_fields(json_builder_t *json, const snapshot_t *snap, const char *fields) {
+    size_t len;
+    
+    json_object_start(json);
+    
+    const char *ts = json_object_find(snap->data, snap->len, "timestamp", &len);
+    if (ts) {
+        json_key(json, "timestamp");
+        json_raw(json, ts, len);
+    }
+    
+    /* Only the requested subtrees are copied out of the published text */
+    const char *services = json_object_find(snap->data, snap->len, "services", &len);
+    json_key(json, "services");
+    if (services) {
+        json_project(json, services, len, fields);
+    } else {
+        json_null(json);
+    }
+    
+    json_object_end(json);
+}
+
+/*
+ * Subscriber views
+ */
+
+void snapshot_views_init(snapshot_views_t *views, size_t limit) {
+    memset(views, 0, sizeof(*views));
+    views->limit = limit;
+}
+
+void snapshot_views_free(snapshot_views_t *views) {
+    for (int i = 0; i < SNAPSHOT_VIEWS; i++) {
+        free(views->views[i].doc_buf);
+        free(views->views[i].patch_buf);
+    }
+    snapshot_views_init(views, views->limit);
+}
+
+static void render_view(snapshot_views_t *views, snapshot_view_t *view, const snapshot_t *snap,
+                        const char *base_doc, size_t base_len) {
+    json_builder_t json;
+    
+    view->frame = snap->data;
+    view->frame_len = snap->len;
+    if (view->fields[0]) {
+        json_init_growable(&json, view->doc_buf, view->doc_size, views->limit);
+        snapshot_write_fields(&json, snap, view->fields);
+        view->doc_buf = json.buf;
+        view->doc_size = json.size;
+        if (!json_error(&json)) {
+            view->frame = view->doc_buf;
+            view->frame_len = json_length(&json);
+        }
+    }
+    
+    view->patch = NULL;
+    view->patch_len = 0;
+    view->changed = true;
+    if (view->base) {
+        json_init_growable(&json, view->patch_buf, view->patch_size, views->limit);
+        view->changed = json_merge_diff(&json, base_doc, base_len, view->frame, view->frame_len);
+        view->patch_buf = json.buf;
+        view->patch_size = json.size;
+        if (!json_error(&json)) {
+            view->patch = view->patch_buf;
+            view->patch_len = json_length(&json);
+        }
+    }
+}
+
+const snapshot_view_t *snapshot_view(snapshot_views_t *views, const snapshot_t *snap,
+                                     const char *fields, uint64_t base,
+                                     const char *base_doc, size_t base_len) {
+    /* Views of an older publication are of no more use */
+    if (views->generation != snap->generation) {
+        views->generation = snap->generation;
+        views->count = 0;
+        views->next = 0;
+    }
+    
+    for (int i = 0; i < views->count; i++) {
+        snapshot_view_t *view = &views->views[i];
+        if (view->base == base && strcmp(view->fields, fields) == 0) {
+            return view;
+        }
+    }
+    
+    snapshot_view_t *view;
+    if (views->count < SNAPSHOT_VIEWS) {
+        view = &views->views[views->count++];
+    } else {
+        view = &views->views[views->next];
+        views->next = (views->next + 1) % SNAPSHOT_VIEWS;
+    }
+    snprintf(view->fields, sizeof(view->fields), "%s", fields);
+    view->base = base;
+    render_view(views, view, snap, base_doc, base_len);
+    return view;
+}
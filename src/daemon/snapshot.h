@@ -0,0 +1,153 @@
+/*
+ * snapshot.h - Reference-counted snapshot publication
+ *
+ * The daemon loop renders each snapshot into a slot that no reader holds
+ * and publishes it with an atomic pointer swap. Readers take a reference
+ * to the current snapshot without locking and see immutable data until
+ * they release it.
+ *
+ * Snapshots are assembled lazily: the daemon marks the published one
+ * stale when services produce new data, and a reader that finds it stale
+ * asks the daemon for a fresh one. Reader threads never block on it: they
+ * hold the request back and answer it after the next publication, or
+ * after SNAPSHOT_DEMAND_WAIT_MS from whatever is published. Every thread
+ * that opened a publication descriptor is notified of each publication;
+ * while anyone watches, the daemon publishes after every collection.
+ * Publications are mirrored into shared memory for local clients.
+ */
+#ifndef QMEM_SNAPSHOT_H
+#define QMEM_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "common/json.h"
+
+/* How long a request held back for a rebuild waits before being answered */
+#define SNAPSHOT_DEMAND_WAIT_MS 250
+
+typedef struct {
+    atomic_uint refs;       /* Readers holding this snapshot */
+    uint64_t generation;    /* Publication number, from 1 */
+    size_t len;             /* JSON length, excluding the terminator */
+    size_t capacity;
+    char *data;             /* NUL-terminated JSON */
+} snapshot_t;
+
+/* Allocate the snapshot slots (capacity bytes each, to begin with) */
+int snapshot_init(size_t capacity);
+
+/* Free the slots; no reader may hold a snapshot */
+void snapshot_shutdown(void);
+
+/* Note that newer data exists than the published snapshot (writer only) */
+void snapshot_mark_stale(void);
+
+/* True if the published snapshot is missing or out of date */
+bool snapshot_is_stale(void);
+
+/* Descriptor that becomes readable when a reader wants a fresh snapshot */
+int snapshot_demand_fd(void);
+
+/* Consume pending reader requests; true if there were any (writer only) */
+bool snapshot_take_demand(void);
+
+/* Register or drop interest in every publication (reader threads) */
+void snapshot_watch(void);
+void snapshot_unwatch(void);
+
+/* True if any reader watches publications */
+bool snapshot_has_watchers(void);
+
+/*
+ * Open a descriptor, for one thread, that becomes readable after every
+ * publication. -1 if unavailable
+ */
+int snapshot_publish_fd_open(void);
+
+/* Close a descriptor from snapshot_publish_fd_open() */
+void snapshot_publish_fd_close(int fd);
+
+/* Consume publication notifications on fd; true if there were any */
+bool snapshot_take_published(int fd);
+
+/* Read-only memfd mirroring every publication (see qmem_shm_header_t), -1 if unavailable */
+int snapshot_shared_fd(void);
+
+/*
+ * Get a slot to render the next snapshot into (writer only). NULL if all
+ * are held. Its data may be realloc()ed, updating capacity, until published
+ */
+snapshot_t *snapshot_begin(void);
+
+/* Publish a rendered slot as the current snapshot (writer only) */
+void snapshot_publish(snapshot_t *snap, size_t len);
+
+/* Take a reference to the current snapshot. NULL if none published yet */
+const snapshot_t *snapshot_acquire(void);
+
+/*
+ * Ask the daemon to rebuild a stale snapshot, without waiting for it.
+ * True if one was requested: the caller's publication descriptor fires
+ * once it is published. False if the published snapshot is current
+ */
+bool snapshot_request_fresh(void);
+
+/* Drop a reference taken with snapshot_acquire() */
+void snapshot_release(const snapshot_t *snap);
+
+/*
+ * Write a projection of a snapshot: its timestamp and the services, or
+ * members of them, named by fields ("meminfo,procmem.top_rss")
+ */
+void snapshot_write_fields(json_builder_t *json, const snapshot_t *snap, const char *fields);
+
+/*
+ * Frames pushed to subscribers. Those asking for the same projection and
+ * holding the same publication share one rendering and one merge patch,
+ * computed by the first of them. A cache is used by one thread at a time
+ */
+#define SNAPSHOT_VIEWS 8
+#define SNAPSHOT_FIELDS_MAX 512
+
+typedef struct {
+    const char *frame;                  /* Projection, or the snapshot's own data */
+    size_t frame_len;
+    const char *patch;                  /* NULL without a base or if it failed */
+    size_t patch_len;
+    bool changed;                       /* Patch is not empty */
+    
+    char fields[SNAPSHOT_FIELDS_MAX];   /* Empty for everything */
+    uint64_t base;                      /* Publication patched from, 0 if none */
+    char *doc_buf;
+    size_t doc_size;
+    char *patch_buf;
+    size_t patch_size;
+} snapshot_view_t;
+
+typedef struct {
+    uint64_t generation;                /* Publication the views are of */
+    size_t limit;                       /* Largest document or patch */
+    snapshot_view_t views[SNAPSHOT_VIEWS];
+    int count;
+    int next;                           /* View replaced when all are used */
+} snapshot_views_t;
+
+/* Initialize a view cache writing documents of at most limit bytes */
+void snapshot_views_init(snapshot_views_t *views, size_t limit);
+
+/* Free a view cache's buffers */
+void snapshot_views_free(snapshot_views_t *views);
+
+/*
+ * Get the projection of snap onto fields (empty for the whole snapshot)
+ * and, if base is not 0, a merge patch to it from base_doc, the same
+ * projection of publication base. The view stays valid until the next
+ * call, and its frame while snap is held
+ */
+const snapshot_view_t *snapshot_view(snapshot_views_t *views, const snapshot_t *snap,
+                                     const char *fields, uint64_t base,
+                                     const char *base_doc, size_t base_len);
+
+#endif /* QMEM_SNAPSHOT_H */
@@ -1,24 +1,43 @@
 /*
  * cpuload.c - Per-process CPU load monitor implementation
- * 
+ *
  * Reads /proc/stat for system-wide CPU stats
- * Reads /proc/<pid>/stat for per-process CPU usage
+ * Reads /proc/<pid>/stat for per-process CPU usage. With taskstats
+ * enabled, the TASKSTATS generic netlink family adds delay accounting per
+ * process, and exit notifications account the CPU, delays and I/O bytes
+ * of tasks that exited between two samples. CPU time still comes from
+ * /proc: a thread group query carries no ac_utime/ac_stime, and its
+ * cpu_run_real_total stays zero unless delay accounting is switched on.
+ *
+ * Taskstats is an extra signal, not a cheaper path: the /proc walk is
+ * unchanged and every process costs one more netlink query per round.
  */
+#define _POSIX_C_SOURCE 200809L
 #include "cpuload.h"
 #include "common/log.h"
 #include "common/proc_utils.h"
 #include "common/json.h"
+#include "daemon/config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <qmem/plugin.h>
 #include <string.h>
-#include <dirent.h>
-#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
 
 #define MAX_PROCS 4096
 #define TOP_N 20
 #define HASH_SIZE 8192
+#define TS_BUF_SIZE 8192
+#define TS_EXIT_RCVBUF (4 * 1024 * 1024)
+#define TS_BATCH 256                    /* Queries sent before their replies are read */
+#define TS_QUERY_RCVBUF (1024 * 1024)   /* Holds the replies to one batch */
+#define EXIT_GROUPS 4096                /* Thread groups with exits per sample */
 
 /* Per-process CPU data */
 typedef struct proc_cpu {
@@ -26,10 +45,21 @@ typedef struct proc_cpu {
     unsigned long utime;
     unsigned long stime;
     unsigned long total_time;
-    char cmd[128];
+    double cpu_percent;
+    const char *comm;           /* Points into the process table, this round only */
+    cpuload_delays_t totals;    /* Taskstats cumulative counters */
+    cpuload_delays_t deltas;
     struct proc_cpu *next;
 } proc_cpu_t;
 
+/* Exit records of one thread group within a sample */
+typedef struct {
+    pid_t tgid;                 /* 0: free slot */
+    bool leader_exited;         /* The whole process is gone */
+    unsigned long ticks;        /* CPU time of its exited threads */
+    cpuload_delays_t totals;
+} exit_group_t;
+
 /* System CPU counters */
 typedef struct {
     unsigned long user;
@@ -56,13 +86,23 @@ typedef struct {
     /* Results */
     cpuload_entry_t top_consumers[TOP_N];
     int top_count;
+    cpuload_exited_t exited;    /* Tasks that exited since the last sample */
+    exit_group_t exit_groups[EXIT_GROUPS];  /* Open-addressed by tgid */
     
-    /* Memory pool */
-    proc_cpu_t pool[MAX_PROCS * 2];
-    int pool_idx;
+    /* Memory pool: one half per sample, current and previous */
+    proc_cpu_t pool[2][MAX_PROCS];
+    int pool_count[2];
+    int pool_half;
     
     /* Clock ticks per second */
     long clock_ticks;
+    
+    /* Taskstats netlink (-1 when reading /proc) */
+    int ts_fd;
+    int ts_exit_fd;             /* Exit notifications, -1 if not registered */
+    uint16_t ts_family;
+    uint32_t ts_seq;
+    char ts_cpumask[32];
 } cpuload_priv_t;
 
 static cpuload_priv_t g_cpuload;
@@ -72,8 +112,9 @@ static unsigned int hash_pid(pid_t pid) {
 }
 
 static proc_cpu_t *alloc_entry(cpuload_priv_t *priv) {
-    if (priv->pool_idx >= MAX_PROCS * 2) return NULL;
-    return &priv->pool[priv->pool_idx++];
+    int half = priv->pool_half;
+    if (priv->pool_count[half] >= MAX_PROCS) return NULL;
+    return &priv->pool[half][priv->pool_count[half]++];
 }
 
 static void clear_hash(proc_cpu_t **hash) {
@@ -96,16 +137,366 @@ static void insert_hash(proc_cpu_t **hash, proc_cpu_t *entry) {
     hash[idx] = entry;
 }
 
-static int cpuload_init(qmem_service_t *svc, const qmem_config_t *cfg) {
-    (void)cfg;
+/*
+ * Taskstats backend
+ */
+
+typedef struct {
+    struct nlmsghdr n;
+    struct genlmsghdr g;
+    char attrs[256];
+} genl_msg_t;
+
+static void genl_init(genl_msg_t *msg, uint16_t type, uint8_t cmd, uint32_t seq) {
+    memset(msg, 0, sizeof(*msg));
+    msg->n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    msg->n.nlmsg_type = type;
+    msg->n.nlmsg_flags = NLM_F_REQUEST;
+    msg->n.nlmsg_seq = seq;
+    msg->g.cmd = cmd;
+    msg->g.version = 1;
+}
+
+static void genl_add_attr(genl_msg_t *msg, uint16_t type, const void *data, size_t len) {
+    struct nlattr *na = (struct nlattr *)((char *)msg + NLMSG_ALIGN(msg->n.nlmsg_len));
+    na->nla_type = type;
+    na->nla_len = NLA_HDRLEN + len;
+    memcpy((char *)na + NLA_HDRLEN, data, len);
+    msg->n.nlmsg_len = NLMSG_ALIGN(msg->n.nlmsg_len) + NLA_ALIGN(na->nla_len);
+}
+
+/* Find an attribute of the given type in a run of attributes */
+static const struct nlattr *genl_find_attr(const void *attrs, int len, uint16_t type) {
+    const struct nlattr *na = (const struct nlattr *)attrs;
+    
+    while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= len) {
+        if ((na->nla_type & NLA_TYPE_MASK) == type) {
+            return na;
+        }
+        int step = NLA_ALIGN(na->nla_len);
+        len -= step;
+        na = (const struct nlattr *)((const char *)na + step);
+    }
+    return NULL;
+}
+
+static const void *nla_payload(const struct nlattr *na) {
+    return (const char *)na + NLA_HDRLEN;
+}
+
+static int nla_payload_len(const struct nlattr *na) {
+    return na->nla_len - NLA_HDRLEN;
+}
+
+/*
+ * Receive the reply to seq into buf
+ * Returns the message, or NULL with errno set on error
+ */
+static const struct nlmsghdr *genl_recv(int fd, uint32_t seq, uint64_t *buf, size_t size) {
+    for (;;) {
+        ssize_t n = recv(fd, buf, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+    
+        int len = (int)n;
+        for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+             NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len)) {
+            if (h->nlmsg_seq != seq) continue;
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = NLMSG_DATA(h);
+                errno = err->error ? -err->error : EPROTO;
+                return NULL;
+            }
+            return h;
+        }
+    }
+}
+
+static int genl_resolve_family(cpuload_priv_t *priv, const char *name) {
+    genl_msg_t msg;
+    genl_init(&msg, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, ++priv->ts_seq);
+    genl_add_attr(&msg, CTRL_ATTR_FAMILY_NAME, name, strlen(name) + 1);
+    if (send(priv->ts_fd, &msg, msg.n.nlmsg_len, 0) < 0) {
+        return -1;
+    }
+    
+    uint64_t buf[TS_BUF_SIZE / sizeof(uint64_t)];
+    const struct nlmsghdr *h = genl_recv(priv->ts_fd, priv->ts_seq, buf, sizeof(buf));
+    if (!h) {
+        return -1;
+    }
+    
+    const char *attrs = (const char *)NLMSG_DATA(h) + GENL_HDRLEN;
+    const struct nlattr *id = genl_find_attr(attrs, h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                                             CTRL_ATTR_FAMILY_ID);
+    if (!id) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    uint16_t family;
+    memcpy(&family, nla_payload(id), sizeof(family));
+    priv->ts_family = family;
+    return 0;
+}
+
+/* Extract the stats nested under aggr (TASKSTATS_TYPE_AGGR_PID/TGID) */
+static int parse_taskstats(const struct nlmsghdr *h, uint16_t aggr_type, struct taskstats *ts) {
+    const char *attrs = (const char *)NLMSG_DATA(h) + GENL_HDRLEN;
+    int len = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    
+    const struct nlattr *aggr = genl_find_attr(attrs, len, aggr_type);
+    if (!aggr) {
+        return -1;
+    }
     
+    const struct nlattr *stats = genl_find_attr(nla_payload(aggr), nla_payload_len(aggr),
+                                                TASKSTATS_TYPE_STATS);
+    if (!stats) {
+        return -1;
+    }
+    
+    /* Older kernels send a shorter struct; missing fields stay zero */
+    size_t n = (size_t)nla_payload_len(stats);
+    memset(ts, 0, sizeof(*ts));
+    memcpy(ts, nla_payload(stats), n < sizeof(*ts) ? n : sizeof(*ts));
+    return 0;
+}
+
+static int taskstats_query(cpuload_priv_t *priv, pid_t tgid, struct taskstats *ts) {
+    genl_msg_t msg;
+    uint32_t id = (uint32_t)tgid;
+    genl_init(&msg, priv->ts_family, TASKSTATS_CMD_GET, ++priv->ts_seq);
+    genl_add_attr(&msg, TASKSTATS_CMD_ATTR_TGID, &id, sizeof(id));
+    if (send(priv->ts_fd, &msg, msg.n.nlmsg_len, 0) < 0) {
+        return -1;
+    }
+    
+    uint64_t buf[TS_BUF_SIZE / sizeof(uint64_t)];
+    const struct nlmsghdr *h = genl_recv(priv->ts_fd, priv->ts_seq, buf, sizeof(buf));
+    return h ? parse_taskstats(h, TASKSTATS_TYPE_AGGR_TGID, ts) : -1;
+}
+
+static unsigned long usec_to_ticks(const cpuload_priv_t *priv, uint64_t usec) {
+    return (unsigned long)(usec * (uint64_t)priv->clock_ticks / 1000000);
+}
+
+static void fill_totals(cpuload_delays_t *d, const struct taskstats *ts) {
+    d->cpu_delay_ns = ts->cpu_delay_total;
+    d->blkio_delay_ns = ts->blkio_delay_total;
+    d->swapin_delay_ns = ts->swapin_delay_total;
+    d->freepages_delay_ns = ts->freepages_delay_total;
+    d->read_bytes = ts->read_bytes;
+    d->write_bytes = ts->write_bytes;
+}
+
+/* Counter growth, 0 where a counter went back */
+static uint64_t counter_delta(uint64_t cur, uint64_t prev) {
+    return cur > prev ? cur - prev : 0;
+}
+
+static void diff_totals(cpuload_delays_t *out, const cpuload_delays_t *cur,
+                        const cpuload_delays_t *prev) {
+    out->cpu_delay_ns = counter_delta(cur->cpu_delay_ns, prev->cpu_delay_ns);
+    out->blkio_delay_ns = counter_delta(cur->blkio_delay_ns, prev->blkio_delay_ns);
+    out->swapin_delay_ns = counter_delta(cur->swapin_delay_ns, prev->swapin_delay_ns);
+    out->freepages_delay_ns = counter_delta(cur->freepages_delay_ns, prev->freepages_delay_ns);
+    out->read_bytes = counter_delta(cur->read_bytes, prev->read_bytes);
+    out->write_bytes = counter_delta(cur->write_bytes, prev->write_bytes);
+}
+
+static void add_totals(cpuload_delays_t *sum, const cpuload_delays_t *d) {
+    sum->cpu_delay_ns += d->cpu_delay_ns;
+    sum->blkio_delay_ns += d->blkio_delay_ns;
+    sum->swapin_delay_ns += d->swapin_delay_ns;
+    sum->freepages_delay_ns += d->freepages_delay_ns;
+    sum->read_bytes += d->read_bytes;
+    sum->write_bytes += d->write_bytes;
+}
+
+/* Exit notifications go to a second socket so they never interleave with queries */
+static void taskstats_register_exits(cpuload_priv_t *priv) {
+    priv->ts_exit_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (priv->ts_exit_fd < 0) {
+        return;
+    }
+    
+    int rcvbuf = TS_EXIT_RCVBUF;
+    setsockopt(priv->ts_exit_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    snprintf(priv->ts_cpumask, sizeof(priv->ts_cpumask), "0-%ld", cpus > 0 ? cpus - 1 : 0);
+    
+    genl_msg_t msg;
+    genl_init(&msg, priv->ts_family, TASKSTATS_CMD_GET, 0);
+    genl_add_attr(&msg, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, priv->ts_cpumask,
+                  strlen(priv->ts_cpumask) + 1);
+    if (send(priv->ts_exit_fd, &msg, msg.n.nlmsg_len, 0) < 0) {
+        log_warn("cpuload: taskstats exit registration failed: %s", strerror(errno));
+        close(priv->ts_exit_fd);
+        priv->ts_exit_fd = -1;
+    }
+}
+
+static int taskstats_open(cpuload_priv_t *priv) {
+    priv->ts_exit_fd = -1;
+    priv->ts_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (priv->ts_fd < 0) {
+        return -1;
+    }
+    
+    /* Setup waits for its replies; collections never block on this socket */
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(priv->ts_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int rcvbuf = TS_QUERY_RCVBUF;
+    setsockopt(priv->ts_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    
+    /* Resolve the family and check we may query (CAP_NET_ADMIN) */
+    struct taskstats ts;
+    if (genl_resolve_family(priv, TASKSTATS_GENL_NAME) < 0 ||
+        taskstats_query(priv, getpid(), &ts) < 0) {
+        int saved = errno;
+        close(priv->ts_fd);
+        priv->ts_fd = -1;
+        errno = saved;
+        return -1;
+    }
+    
+    taskstats_register_exits(priv);
+    return 0;
+}
+
+static void taskstats_close(cpuload_priv_t *priv) {
+    if (priv->ts_exit_fd >= 0) {
+        genl_msg_t msg;
+        genl_init(&msg, priv->ts_family, TASKSTATS_CMD_GET, 0);
+        genl_add_attr(&msg, TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, priv->ts_cpumask,
+                      strlen(priv->ts_cpumask) + 1);
+        send(priv->ts_exit_fd, &msg, msg.n.nlmsg_len, 0);
+        close(priv->ts_exit_fd);
+        priv->ts_exit_fd = -1;
+    }
+    if (priv->ts_fd >= 0) {
+        close(priv->ts_fd);
+        priv->ts_fd = -1;
+    }
+}
+
+/* Group of tgid in this sample's exit table, NULL if the table is full */
+static exit_group_t *exit_group(cpuload_priv_t *priv, pid_t tgid) {
+    unsigned int idx = hash_pid(tgid) % EXIT_GROUPS;
+    for (int probe = 0; probe < EXIT_GROUPS; probe++) {
+        exit_group_t *g = &priv->exit_groups[(idx + probe) % EXIT_GROUPS];
+        if (g->tgid == tgid) return g;
+        if (g->tgid == 0) {
+            g->tgid = tgid;
+            return g;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Book a process that exited since the last sample: the CPU time and
+ * delays of its threads past what the previous sample already saw. Those
+ * counters cover the whole group, exited threads included. If they are
+ * ahead of the exit records the PID was reused or records were lost, and
+ * nothing is booked rather than the lifetime totals
+ */
+static void book_exit(cpuload_priv_t *priv, const exit_group_t *g) {
+    unsigned long ticks = g->ticks;
+    cpuload_delays_t delta = g->totals;
+    
+    proc_cpu_t *prev = find_in_hash(priv->previous, g->tgid);
+    priv->exited.tasks++;
+    if (prev) {
+        if (ticks < prev->total_time) return;
+        ticks -= prev->total_time;
+        diff_totals(&delta, &g->totals, &prev->totals);
+    }
+    
+    priv->exited.cpu_ticks += ticks;
+    add_totals(&priv->exited.delays, &delta);
+}
+
+/*
+ * Account processes that exited since the last sample. Exit records are
+ * per thread; they are summed by thread group, and a group is booked once
+ * its leader has exited. Threads that exit from a live process stay in
+ * its /proc counters and are not booked here
+ */
+static void drain_exits(cpuload_priv_t *priv) {
+    memset(&priv->exited, 0, sizeof(priv->exited));
+    if (priv->ts_exit_fd < 0) return;
+    
+    memset(priv->exit_groups, 0, sizeof(priv->exit_groups));
+    uint64_t buf[TS_BUF_SIZE / sizeof(uint64_t)];
+    
+    for (;;) {
+        ssize_t n = recv(priv->ts_exit_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                priv->exited.dropped++;
+                continue;
+            }
+            break;  /* EAGAIN: drained */
+        }
+    
+        int len = (int)n;
+        for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+             NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len)) {
+            /* Per-task stats: the group aggregate carries no CPU time */
+            struct taskstats ts;
+            if (h->nlmsg_type != priv->ts_family ||
+                parse_taskstats(h, TASKSTATS_TYPE_AGGR_PID, &ts) < 0) {
+                continue;
+            }
+    
+            /* ac_tgid is 0 before taskstats v12: every task is its own group */
+            pid_t tgid = (pid_t)(ts.ac_tgid ? ts.ac_tgid : ts.ac_pid);
+            exit_group_t *g = exit_group(priv, tgid);
+            if (!g) {
+                priv->exited.dropped++;
+                continue;
+            }
+    
+            cpuload_delays_t totals;
+            fill_totals(&totals, &ts);
+            g->ticks += usec_to_ticks(priv, ts.ac_utime + ts.ac_stime);
+            add_totals(&g->totals, &totals);
+            g->leader_exited |= (pid_t)ts.ac_pid == tgid;
+        }
+    }
+    
+    for (int i = 0; i < EXIT_GROUPS; i++) {
+        if (priv->exit_groups[i].tgid && priv->exit_groups[i].leader_exited) {
+            book_exit(priv, &priv->exit_groups[i]);
+        }
+    }
+}
+
+static int cpuload_init(qmem_service_t *svc, const qmem_config_t *cfg) {
     memset(&g_cpuload, 0, sizeof(g_cpuload));
     g_cpuload.clock_ticks = sysconf(_SC_CLK_TCK);
     if (g_cpuload.clock_ticks <= 0) {
         g_cpuload.clock_ticks = 100;  /* Default */
     }
+    g_cpuload.ts_fd = -1;
+    g_cpuload.ts_exit_fd = -1;
     svc->priv = &g_cpuload;
     
+    if (cfg && cfg->taskstats) {
+        if (taskstats_open(&g_cpuload) == 0) {
+            log_info("cpuload: using taskstats%s",
+                     g_cpuload.ts_exit_fd >= 0 ? " with exit notifications" : "");
+        } else {
+            log_warn("cpuload: taskstats unavailable (%s), no delay accounting", strerror(errno));
+        }
+    }
+    
     log_debug("cpuload service initialized (clock_ticks=%ld)", g_cpuload.clock_ticks);
     return 0;
 }
@@ -132,55 +523,154 @@ static int parse_proc_stat(cpu_counters_t *counters) {
     return 0;
 }
 
-static int parse_pid_stat(pid_t pid, unsigned long *utime, unsigned long *stime, char *cmd, size_t cmd_size) {
-    char path[64];
-    char buf[1024];
+static int compare_cpu(const void *a, const void *b) {
+    const proc_cpu_t *ea = *(const proc_cpu_t *const *)a;
+    const proc_cpu_t *eb = *(const proc_cpu_t *const *)b;
+    if (eb->cpu_percent > ea->cpu_percent) return 1;
+    if (eb->cpu_percent < ea->cpu_percent) return -1;
+    return 0;
+}
+
+typedef struct {
+    cpuload_priv_t *priv;
+    unsigned long total_delta;
+    proc_cpu_t **entries;
+    int entry_count;
+    proc_cpu_t **pending;       /* Taskstats: sampled from /proc, awaiting delays */
+    int pending_count;
+} collect_ctx_t;
+
+/* Store a sample and rank it against the previous one */
+static void add_sample(collect_ctx_t *ctx, proc_cpu_t *entry) {
+    cpuload_priv_t *priv = ctx->priv;
     
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    if (proc_read_file(path, buf, sizeof(buf)) < 0) {
-        return -1;
+    entry->total_time = entry->utime + entry->stime;
+    entry->cpu_percent = 0;
+    memset(&entry->deltas, 0, sizeof(entry->deltas));
+    insert_hash(priv->current, entry);
+    
+    /* Calculate CPU percentage if we have previous data */
+    if (priv->has_previous && ctx->total_delta > 0) {
+        proc_cpu_t *prev = find_in_hash(priv->previous, entry->pid);
+        if (prev) {
+            unsigned long proc_delta = entry->total_time - prev->total_time;
+            entry->cpu_percent = 100.0 * proc_delta / ctx->total_delta;
+            diff_totals(&entry->deltas, &entry->totals, &prev->totals);
+    
+            if (entry->cpu_percent > 0.01) {  /* Filter out near-zero */
+                ctx->entries[ctx->entry_count++] = entry;
+            }
+        }
     }
+}
+
+static bool collect_callback(const proc_record_t *rec, void *userdata) {
+    collect_ctx_t *ctx = (collect_ctx_t *)userdata;
+    cpuload_priv_t *priv = ctx->priv;
     
-    /* Format: pid (comm) state ppid pgrp session tty_nr tpgid flags
-     *         minflt cminflt majflt cmajflt utime stime cutime cstime ...
-     * Fields 14 and 15 are utime and stime
-     */
+    if (!(rec->fields & PROC_FIELD_STAT)) {
+        return true;
+    }
+    if (ctx->entry_count >= MAX_PROCS) {
+        return false;
+    }
     
-    /* Find comm (in parentheses) */
-    char *open_paren = strchr(buf, '(');
-    char *close_paren = strrchr(buf, ')');
-    if (!open_paren || !close_paren) return -1;
+    /* Store current data */
+    proc_cpu_t *entry = alloc_entry(priv);
+    if (!entry) return false;
     
-    /* Extract command name */
-    size_t comm_len = close_paren - open_paren - 1;
-    if (comm_len >= cmd_size) comm_len = cmd_size - 1;
-    memcpy(cmd, open_paren + 1, comm_len);
-    cmd[comm_len] = '\0';
+    entry->pid = rec->pid;
+    entry->utime = rec->utime;
+    entry->stime = rec->stime;
+    entry->comm = rec->comm;
+    memset(&entry->totals, 0, sizeof(entry->totals));
+    add_sample(ctx, entry);
     
-    /* Parse after the comm field */
-    char *p = close_paren + 2;  /* Skip ") " */
+    return true;
+}
+
+static bool taskstats_callback(const proc_record_t *rec, void *userdata) {
+    collect_ctx_t *ctx = (collect_ctx_t *)userdata;
+    cpuload_priv_t *priv = ctx->priv;
     
-    /* Skip to field 14 (utime) - fields after comm are 3..52 */
-    int field = 3;
-    while (*p && field < 14) {
-        while (*p && !isspace(*p)) p++;
-        while (*p && isspace(*p)) p++;
-        field++;
+    if (!(rec->fields & PROC_FIELD_STAT)) {
+        return true;
+    }
+    if (ctx->pending_count >= MAX_PROCS) {
+        return false;
     }
     
-    *utime = strtoul(p, &p, 10);
-    while (*p && isspace(*p)) p++;
-    *stime = strtoul(p, NULL, 10);
+    proc_cpu_t *entry = alloc_entry(priv);
+    if (!entry) return false;
     
-    return 0;
+    entry->pid = rec->pid;
+    entry->utime = rec->utime;
+    entry->stime = rec->stime;
+    entry->comm = rec->comm;
+    memset(&entry->totals, 0, sizeof(entry->totals));
+    ctx->pending[ctx->pending_count++] = entry;
+    
+    return true;
 }
 
-static int compare_cpu(const void *a, const void *b) {
-    const cpuload_entry_t *ea = (const cpuload_entry_t *)a;
-    const cpuload_entry_t *eb = (const cpuload_entry_t *)b;
-    if (eb->cpu_percent > ea->cpu_percent) return 1;
-    if (eb->cpu_percent < ea->cpu_percent) return -1;
-    return 0;
+/* Read the queued replies to one batch; entries answered are sampled */
+static void taskstats_drain(collect_ctx_t *ctx, proc_cpu_t **batch, int count, uint32_t base) {
+    cpuload_priv_t *priv = ctx->priv;
+    uint64_t buf[TS_BUF_SIZE / sizeof(uint64_t)];
+    
+    for (;;) {
+        ssize_t n = recv(priv->ts_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR || errno == ENOBUFS) continue;
+            break;  /* EAGAIN: drained */
+        }
+    
+        int len = (int)n;
+        for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+             NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len)) {
+            /* Errors are processes that exited since the walk */
+            uint32_t idx = h->nlmsg_seq - base;
+            struct taskstats ts;
+            if (idx >= (uint32_t)count || h->nlmsg_type != priv->ts_family ||
+                parse_taskstats(h, TASKSTATS_TYPE_AGGR_TGID, &ts) < 0) {
+                continue;
+            }
+            fill_totals(&batch[idx]->totals, &ts);
+            add_sample(ctx, batch[idx]);
+        }
+    }
+}
+
+/*
+ * Query the delays of the pending entries. The kernel answers a query
+ * while handling its send, so a whole batch is sent first and the
+ * replies already queued are then drained without waiting; no single
+ * process can stall the collection
+ */
+static void taskstats_sample(collect_ctx_t *ctx) {
+    cpuload_priv_t *priv = ctx->priv;
+    
+    for (int start = 0; start < ctx->pending_count; start += TS_BATCH) {
+        int count = ctx->pending_count - start;
+        if (count > TS_BATCH) count = TS_BATCH;
+        proc_cpu_t **batch = ctx->pending + start;
+        uint32_t base = priv->ts_seq + 1;
+    
+        int sent = 0;
+        while (sent < count) {
+            genl_msg_t msg;
+            uint32_t id = (uint32_t)batch[sent]->pid;
+            genl_init(&msg, priv->ts_family, TASKSTATS_CMD_GET, base + (uint32_t)sent);
+            genl_add_attr(&msg, TASKSTATS_CMD_ATTR_TGID, &id, sizeof(id));
+            if (send(priv->ts_fd, &msg, msg.n.nlmsg_len, MSG_DONTWAIT) < 0) {
+                break;
+            }
+            sent++;
+        }
+        priv->ts_seq = base + (uint32_t)count - 1;
+    
+        taskstats_drain(ctx, batch, sent, base);
+    }
 }
 
 static int cpuload_collect(qmem_service_t *svc) {
@@ -197,86 +687,88 @@ static int cpuload_collect(qmem_service_t *svc) {
     /* Calculate system percentages */
     unsigned long total_delta = priv->curr_sys.total - priv->prev_sys.total;
     if (total_delta > 0 && priv->has_previous) {
-        priv->system_stats.user_percent = 
+        priv->system_stats.user_percent =
             100.0 * (priv->curr_sys.user - priv->prev_sys.user) / total_delta;
-        priv->system_stats.system_percent = 
+        priv->system_stats.system_percent =
             100.0 * (priv->curr_sys.system - priv->prev_sys.system) / total_delta;
-        priv->system_stats.idle_percent = 
+        priv->system_stats.idle_percent =
             100.0 * (priv->curr_sys.idle - priv->prev_sys.idle) / total_delta;
-        priv->system_stats.iowait_percent = 
+        priv->system_stats.iowait_percent =
             100.0 * (priv->curr_sys.iowait - priv->prev_sys.iowait) / total_delta;
     }
     
     /* Swap current to previous process data */
     memcpy(priv->previous, priv->current, sizeof(priv->previous));
     clear_hash(priv->current);
-    priv->pool_idx = 0;
+    priv->pool_half ^= 1;
+    priv->pool_count[priv->pool_half] = 0;
+    
+    /* Exits are measured against the previous sample */
+    drain_exits(priv);
+    if (priv->has_previous && total_delta > 0) {
+        priv->exited.cpu_percent = 100.0 * priv->exited.cpu_ticks / total_delta;
+    }
     
     /* Collect all processes */
-    cpuload_entry_t all_entries[MAX_PROCS];
-    int entry_count = 0;
-    
-    DIR *dir = opendir("/proc");
-    if (!dir) return -1;
-    
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL && entry_count < MAX_PROCS) {
-        /* Skip non-numeric entries */
-        if (!isdigit(ent->d_name[0])) continue;
-        
-        pid_t pid = atoi(ent->d_name);
-        unsigned long utime, stime;
-        char cmd[128];
-        
-        if (parse_pid_stat(pid, &utime, &stime, cmd, sizeof(cmd)) < 0) {
-            continue;
-        }
-        
-        /* Store current data */
-        proc_cpu_t *entry = alloc_entry(priv);
-        if (!entry) break;
-        
-        entry->pid = pid;
-        entry->utime = utime;
-        entry->stime = stime;
-        entry->total_time = utime + stime;
-        snprintf(entry->cmd, sizeof(entry->cmd), "%s", cmd);
-        insert_hash(priv->current, entry);
-        
-        /* Calculate CPU percentage if we have previous data */
-        if (priv->has_previous && total_delta > 0) {
-            proc_cpu_t *prev = find_in_hash(priv->previous, pid);
-            if (prev) {
-                unsigned long proc_delta = entry->total_time - prev->total_time;
-                double cpu_pct = 100.0 * proc_delta / total_delta;
-                
-                if (cpu_pct > 0.01) {  /* Filter out near-zero */
-                    cpuload_entry_t *e = &all_entries[entry_count++];
-                    e->pid = pid;
-                    snprintf(e->cmd, sizeof(e->cmd), "%s", cmd);
-                    e->cpu_percent = cpu_pct;
-                    e->utime = utime;
-                    e->stime = stime;
-                }
-            }
-        }
+    proc_cpu_t *all_entries[MAX_PROCS];
+    proc_cpu_t *pending[MAX_PROCS];
+    collect_ctx_t ctx = {
+        .priv = priv,
+        .total_delta = total_delta,
+        .entries = all_entries,
+        .entry_count = 0,
+        .pending = pending,
+        .pending_count = 0,
+    };
+    
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) return -1;
+    
+    if (priv->ts_fd >= 0) {
+        proc_table_foreach(table, taskstats_callback, &ctx);
+        taskstats_sample(&ctx);
+    } else {
+        proc_table_foreach(table, collect_callback, &ctx);
     }
-    closedir(dir);
+    int entry_count = ctx.entry_count;
     
     /* Sort and take top N */
-    qsort(all_entries, entry_count, sizeof(cpuload_entry_t), compare_cpu);
+    qsort(all_entries, entry_count, sizeof(proc_cpu_t *), compare_cpu);
     priv->top_count = entry_count > TOP_N ? TOP_N : entry_count;
-    memcpy(priv->top_consumers, all_entries, priv->top_count * sizeof(cpuload_entry_t));
+    for (int i = 0; i < priv->top_count; i++) {
+        const proc_cpu_t *pc = all_entries[i];
+        cpuload_entry_t *e = &priv->top_consumers[i];
+        e->pid = pc->pid;
+        snprintf(e->cmd, sizeof(e->cmd), "%s", pc->comm);
+        e->cpu_percent = pc->cpu_percent;
+        e->utime = pc->utime;
+        e->stime = pc->stime;
+        e->delays = pc->deltas;
+    }
     
     priv->has_previous = true;
     return 0;
 }
 
+static void write_delays(json_builder_t *j, const cpuload_delays_t *d, bool io) {
+    json_kv_double(j, "cpu_delay_ms", d->cpu_delay_ns / 1e6);
+    json_kv_double(j, "blkio_delay_ms", d->blkio_delay_ns / 1e6);
+    json_kv_double(j, "swapin_delay_ms", d->swapin_delay_ns / 1e6);
+    json_kv_double(j, "freepages_delay_ms", d->freepages_delay_ns / 1e6);
+    if (io) {
+        json_kv_uint(j, "read_bytes", d->read_bytes);
+        json_kv_uint(j, "write_bytes", d->write_bytes);
+    }
+}
+
 static int cpuload_snapshot(qmem_service_t *svc, json_builder_t *j) {
     cpuload_priv_t *priv = (cpuload_priv_t *)svc->priv;
+    bool taskstats = priv->ts_fd >= 0;
     
     json_object_start(j);
     
+    json_kv_string(j, "backend", taskstats ? "taskstats" : "proc");
+    
     /* System CPU */
     json_key(j, "system");
     json_object_start(j);
@@ -297,16 +789,35 @@ static int cpuload_snapshot(qmem_service_t *svc, json_builder_t *j) {
         json_kv_double(j, "cpu_percent", e->cpu_percent);
         json_kv_uint(j, "utime", e->utime);
         json_kv_uint(j, "stime", e->stime);
+        if (taskstats) {
+            /* Group queries carry no I/O accounting */
+            write_delays(j, &e->delays, false);
+        }
         json_object_end(j);
     }
     json_array_end(j);
     
+    /* Tasks that came and went between samples */
+    if (priv->ts_exit_fd >= 0) {
+        json_key(j, "exited");
+        json_object_start(j);
+        json_kv_uint(j, "tasks", priv->exited.tasks);
+        json_kv_double(j, "cpu_percent", priv->exited.cpu_percent);
+        write_delays(j, &priv->exited.delays, true);
+        json_kv_uint(j, "dropped", priv->exited.dropped);
+        json_object_end(j);
+    }
+    
     json_object_end(j);
     return 0;
 }
 
 static void cpuload_destroy(qmem_service_t *svc) {
-    (void)svc;
+    cpuload_priv_t *priv = (cpuload_priv_t *)svc->priv;
+    
+    if (priv) {
+        taskstats_close(priv);
+    }
     log_debug("cpuload service destroyed");
 }
 
@@ -319,13 +830,18 @@ static const qmem_service_ops_t cpuload_ops = {
 
 qmem_service_t cpuload_service = {
     .name = "cpuload",
-    .description = "Per-process CPU load from /proc/pid/stat",
+    .description = "Per-process CPU load from /proc/pid/stat, taskstats delays",
     .ops = &cpuload_ops,
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STAT,
 };
 
+#ifndef NO_PLUGIN_DEFINE
+QMEM_PLUGIN_DEFINE("cpuload", "1.0", "Per-process CPU load", cpuload_service);
+#endif
+
 int cpuload_get_top(cpuload_entry_t *entries, int max_entries) {
     int n = g_cpuload.top_count;
     if (n > max_entries) n = max_entries;
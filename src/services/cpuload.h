@@ -9,6 +9,16 @@
 
 extern qmem_service_t cpuload_service;
 
+/* Taskstats counters (zero without taskstats; I/O only for exited tasks) */
+typedef struct {
+    uint64_t cpu_delay_ns;         /* Waiting for a CPU */
+    uint64_t blkio_delay_ns;       /* Waiting for block I/O */
+    uint64_t swapin_delay_ns;      /* Waiting for swap-in */
+    uint64_t freepages_delay_ns;   /* Direct reclaim */
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+} cpuload_delays_t;
+
 /* CPU load entry for a process */
 typedef struct {
     pid_t pid;
@@ -17,8 +27,18 @@ typedef struct {
     double cpu_delta;          /* Change since last sample */
     unsigned long utime;       /* User time (jiffies) */
     unsigned long stime;       /* System time (jiffies) */
+    cpuload_delays_t delays;   /* Since last sample */
 } cpuload_entry_t;
 
+/* Tasks that exited between samples (taskstats exit notifications) */
+typedef struct {
+    uint64_t tasks;
+    unsigned long cpu_ticks;
+    double cpu_percent;
+    cpuload_delays_t delays;
+    uint64_t dropped;          /* Notification overruns */
+} cpuload_exited_t;
+
 /* Get top N CPU consumers */
 int cpuload_get_top(cpuload_entry_t *entries, int max_entries);
 
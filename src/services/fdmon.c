@@ -2,28 +2,30 @@
  * fdmon.c - File descriptor monitoring implementation
  *
  * Tracks per-process FD counts via /proc/PID/fd
- * Detects potential FD leaks by tracking FD growth over time
+ * Detects potential FD leaks by tracking FD growth over time; baselines
+ * are kept in a state file under data_dir so they survive restarts
  */
 #define _POSIX_C_SOURCE 200809L
 #include "fdmon.h"
 #include "common/log.h"
 #include "common/proc_utils.h"
 #include "common/json.h"
+#include "common/statefile.h"
+#include "daemon/config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <unistd.h>
-#include <sys/stat.h>
 #include <qmem/plugin.h>
-#include <ctype.h>
 
 #define MAX_PROCS 100
 #define TOP_COUNT 25
+#define MAX_BASELINES (MAX_PROCS * 2)
+#define BASELINE_VERSION 1
 
 typedef struct {
     pid_t pid;
     int fd_count;
+    unsigned long long starttime;   /* Tells a reused PID apart (baselines) */
 } fd_data_t;
 
 typedef struct {
@@ -35,8 +37,10 @@ typedef struct {
     bool has_previous;
     
     /* Initial/baseline FD data (first seen values) */
-    fd_data_t initial[MAX_PROCS * 2];
+    fd_data_t initial_mem[MAX_BASELINES];
+    fd_data_t *initial;             /* initial_mem, or the mapped state file */
     int initial_count;
+    statefile_t state;
     
     /* Results: top consumers and leakers */
     fdmon_entry_t top_consumers[TOP_COUNT];
@@ -50,60 +54,65 @@ typedef struct {
 
 static fdmon_priv_t g_fdmon;
 
-static int fdmon_init(qmem_service_t *svc, const qmem_config_t *cfg) {
-    (void)cfg;
-    
-    memset(&g_fdmon, 0, sizeof(g_fdmon));
-    svc->priv = &g_fdmon;
-    
-    log_debug("fdmon service initialized");
-    return 0;
+typedef struct {
+    fdmon_priv_t *priv;
+    bool live[MAX_BASELINES];
+} prune_ctx_t;
+
+static bool mark_live_callback(const proc_record_t *rec, void *userdata) {
+    prune_ctx_t *ctx = (prune_ctx_t *)userdata;
+    for (int i = 0; i < ctx->priv->initial_count; i++) {
+        if (ctx->priv->initial[i].pid == rec->pid) {
+            ctx->live[i] = true;
+            break;
+        }
+    }
+    return true;
 }
 
-/* Count FDs for a process and classify by type */
-static int count_fds(pid_t pid, fdmon_fd_types_t *types) {
-    char fd_path[128];
-    snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
-    
-    DIR *dir = opendir(fd_path);
-    if (!dir) return -1;
+/*
+ * Drop baselines of processes that are gone, judged by table if given
+ * (else one existence check each). Returns the number left
+ */
+static int prune_baselines(fdmon_priv_t *priv, const proc_table_t *table) {
+    prune_ctx_t ctx = { .priv = priv };
+    if (table) {
+        proc_table_foreach(table, mark_live_callback, &ctx);
+    } else {
+        for (int i = 0; i < priv->initial_count; i++) {
+            ctx.live[i] = proc_pid_exists(priv->initial[i].pid);
+        }
+    }
     
-    int count = 0;
-    if (types) {
-        memset(types, 0, sizeof(*types));
+    int kept = 0;
+    for (int i = 0; i < priv->initial_count; i++) {
+        if (ctx.live[i]) {
+            priv->initial[kept++] = priv->initial[i];
+        }
     }
+    priv->initial_count = kept;
+    statefile_set_count(&priv->state, kept);
+    return kept;
+}
+
+static int fdmon_init(qmem_service_t *svc, const qmem_config_t *cfg) {
+    memset(&g_fdmon, 0, sizeof(g_fdmon));
+    svc->priv = &g_fdmon;
     
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        if (!isdigit(ent->d_name[0])) continue;
-        count++;
-        
-        if (types) {
-            /* Read link to classify FD type */
-            char link_path[512];
-            char target[512];
-            snprintf(link_path, sizeof(link_path), "/proc/%d/fd/%s", pid, ent->d_name);
-            ssize_t len = readlink(link_path, target, sizeof(target) - 1);
-            if (len > 0) {
-                target[len] = '\0';
-                
-                if (strncmp(target, "socket:", 7) == 0) {
-                    types->sockets++;
-                } else if (strncmp(target, "pipe:", 5) == 0) {
-                    types->pipes++;
-                } else if (strncmp(target, "anon_inode:", 11) == 0) {
-                    types->eventfds++;
-                } else if (target[0] == '/') {
-                    types->files++;
-                } else {
-                    types->other++;
-                }
-            }
+    /* Resume baselines saved by a previous run */
+    g_fdmon.initial = g_fdmon.initial_mem;
+    if (cfg && cfg->data_dir[0]) {
+        int count = statefile_open(&g_fdmon.state, cfg->data_dir, "fdmon.state",
+                                   BASELINE_VERSION, sizeof(fd_data_t), MAX_BASELINES);
+        if (count >= 0) {
+            g_fdmon.initial = g_fdmon.state.records;
+            g_fdmon.initial_count = count;
+            prune_baselines(&g_fdmon, NULL);
         }
     }
     
-    closedir(dir);
-    return count;
+    log_debug("fdmon service initialized (%d baselines)", g_fdmon.initial_count);
+    return 0;
 }
 
 /* Find previous FD count for a PID */
@@ -116,23 +125,35 @@ static fd_data_t *find_previous(fdmon_priv_t *priv, pid_t pid) {
     return NULL;
 }
 
-/* Find or create initial baseline entry */
-static fd_data_t *find_or_create_initial(fdmon_priv_t *priv, pid_t pid, int fd_count) {
+/* Find or create initial baseline entry; a reused PID starts a new one */
+static fd_data_t *find_or_create_initial(fdmon_priv_t *priv, pid_t pid,
+                                         unsigned long long starttime, int fd_count) {
+    fd_data_t *init = NULL;
     for (int i = 0; i < priv->initial_count; i++) {
         if (priv->initial[i].pid == pid) {
-            return &priv->initial[i];
+            if (priv->initial[i].starttime == starttime) {
+                return &priv->initial[i];
+            }
+            init = &priv->initial[i];
+            break;
         }
     }
     
-    /* Create new baseline */
-    if (priv->initial_count < MAX_PROCS * 2) {
-        fd_data_t *init = &priv->initial[priv->initial_count++];
+    /* Create new baseline; the table is pruned once per collect, not here */
+    if (!init && priv->initial_count < MAX_BASELINES) {
+        init = &priv->initial[priv->initial_count];
         init->pid = pid;
         init->fd_count = fd_count;
+        init->starttime = starttime;
+        statefile_set_count(&priv->state, ++priv->initial_count);
         return init;
     }
     
-    return NULL;
+    if (init) {
+        init->fd_count = fd_count;
+        init->starttime = starttime;
+    }
+    return init;
 }
 
 /* Compare function for sorting by FD count (descending) */
@@ -149,6 +170,61 @@ static int cmp_fd_change_desc(const void *a, const void *b) {
     return eb->fd_change - ea->fd_change;
 }
 
+typedef struct {
+    fdmon_priv_t *priv;
+    fdmon_entry_t *entries;
+    int count;
+} collect_ctx_t;
+
+static bool collect_callback(const proc_record_t *rec, void *userdata) {
+    collect_ctx_t *ctx = (collect_ctx_t *)userdata;
+    fdmon_priv_t *priv = ctx->priv;
+    
+    if (!(rec->fields & PROC_FIELD_FD)) {
+        return true;
+    }
+    if (ctx->count >= MAX_PROCS) {
+        return false;
+    }
+    
+    pid_t pid = rec->pid;
+    int fd_count = rec->fd_count;
+    
+    /* Store in current array */
+    if (priv->current_count < MAX_PROCS) {
+        priv->current[priv->current_count].pid = pid;
+        priv->current[priv->current_count].fd_count = fd_count;
+        priv->current_count++;
+    }
+    
+    /* Build entry */
+    fdmon_entry_t *e = &ctx->entries[ctx->count++];
+    e->pid = pid;
+    e->fd_count = fd_count;
+    e->types = rec->fd_types;
+    
+    /* Get command */
+    snprintf(e->cmd, sizeof(e->cmd), "%s", rec->cmdline ? rec->cmdline : rec->comm);
+    
+    /* Calculate delta from previous sample */
+    fd_data_t *prev = find_previous(priv, pid);
+    e->fd_delta = prev ? (fd_count - prev->fd_count) : 0;
+    
+    /* Get or create initial baseline */
+    fd_data_t *init = find_or_create_initial(priv, pid, rec->starttime, fd_count);
+    e->initial_fd_count = init ? init->fd_count : fd_count;
+    e->fd_change = fd_count - e->initial_fd_count;
+    
+    /* Update summary */
+    priv->summary.total_fds += fd_count;
+    priv->summary.proc_count++;
+    if (e->fd_change > 0) {
+        priv->summary.potential_leaks++;
+    }
+    
+    return true;
+}
+
 static int fdmon_collect(qmem_service_t *svc) {
     fdmon_priv_t *priv = (fdmon_priv_t *)svc->priv;
     
@@ -164,57 +240,22 @@ static int fdmon_collect(qmem_service_t *svc) {
     
     /* Temporary array for all processes */
     fdmon_entry_t all_procs[MAX_PROCS];
-    int all_count = 0;
-    
-    DIR *proc_dir = opendir("/proc");
-    if (!proc_dir) return -1;
-    
-    struct dirent *ent;
-    while ((ent = readdir(proc_dir)) != NULL && all_count < MAX_PROCS) {
-        if (!isdigit(ent->d_name[0])) continue;
-        
-        pid_t pid = atoi(ent->d_name);
-        
-        fdmon_fd_types_t types;
-        int fd_count = count_fds(pid, &types);
-        if (fd_count < 0) continue;
-        
-        /* Store in current array */
-        if (priv->current_count < MAX_PROCS) {
-            priv->current[priv->current_count].pid = pid;
-            priv->current[priv->current_count].fd_count = fd_count;
-            priv->current_count++;
-        }
-        
-        /* Build entry */
-        fdmon_entry_t *e = &all_procs[all_count++];
-        e->pid = pid;
-        e->fd_count = fd_count;
-        e->types = types;
-        
-        /* Get command */
-        if (proc_read_cmdline(pid, e->cmd, sizeof(e->cmd)) < 0) {
-            proc_read_comm(pid, e->cmd, sizeof(e->cmd));
-        }
-        
-        /* Calculate delta from previous sample */
-        fd_data_t *prev = find_previous(priv, pid);
-        e->fd_delta = prev ? (fd_count - prev->fd_count) : 0;
-        
-        /* Get or create initial baseline */
-        fd_data_t *init = find_or_create_initial(priv, pid, fd_count);
-        e->initial_fd_count = init ? init->fd_count : fd_count;
-        e->fd_change = fd_count - e->initial_fd_count;
-        
-        /* Update summary */
-        priv->summary.total_fds += fd_count;
-        priv->summary.proc_count++;
-        if (e->fd_change > 0) {
-            priv->summary.potential_leaks++;
-        }
+    
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) return -1;
+    
+    /* Make room for new processes' baselines from this round's walk */
+    if (priv->initial_count >= MAX_BASELINES) {
+        prune_baselines(priv, table);
     }
     
-    closedir(proc_dir);
+    collect_ctx_t ctx = {
+        .priv = priv,
+        .entries = all_procs,
+        .count = 0,
+    };
+    proc_table_foreach(table, collect_callback, &ctx);
+    int all_count = ctx.count;
     
     /* Sort by FD count for top consumers */
     qsort(all_procs, all_count, sizeof(fdmon_entry_t), cmp_fd_count_desc);
@@ -291,7 +332,13 @@ static int fdmon_snapshot(qmem_service_t *svc, json_builder_t *j) {
 }
 
 static void fdmon_destroy(qmem_service_t *svc) {
-    (void)svc;
+    fdmon_priv_t *priv = (fdmon_priv_t *)svc->priv;
+    
+    if (priv) {
+        statefile_close(&priv->state);
+        priv->initial = priv->initial_mem;
+        priv->initial_count = 0;
+    }
     log_debug("fdmon service destroyed");
 }
 
@@ -309,6 +356,7 @@ qmem_service_t fdmon_service = {
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_FD | PROC_FIELD_CMDLINE,
 };
 
 QMEM_PLUGIN_DEFINE("fdmon", "1.0", "FD monitor and leak detection", fdmon_service);
@@ -10,14 +10,8 @@
 
 extern qmem_service_t fdmon_service;
 
-/* FD types */
-typedef struct {
-    int files;      /* Regular files */
-    int sockets;    /* Network sockets */
-    int pipes;      /* Pipes/FIFOs */
-    int eventfds;   /* eventfd, signalfd, timerfd, etc. */
-    int other;      /* Other types */
-} fdmon_fd_types_t;
+/* FD types, as classified by the shared process table */
+typedef proc_fd_types_t fdmon_fd_types_t;
 
 /* Per-process FD entry */
 typedef struct {
@@ -1,28 +1,70 @@
 /*
  * heapmon.c - Heap monitoring via /proc/pid/smaps
+ *
+ * Targets are the top RSS growers and consumers from the shared process
+ * table. Whole-process totals come from /proc/<pid>/smaps_rollup; the
+ * [heap] breakdown is read from /proc/<pid>/smaps in fixed-size chunks,
+ * stopping as soon as the heap mappings have been passed.
+ *
+ * Baselines (first-seen sizes) are keyed by PID and start time and kept
+ * in a state file under data_dir, so growth is still measured from the
+ * original values after a daemon restart.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "heapmon.h"
-#include "procmem.h"
 #include "common/log.h"
 #include "common/proc_utils.h"
+#include "common/statefile.h"
+#include "daemon/config.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include "services/procmem.h"
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <qmem/plugin.h>
 
-#define MAX_TARGETS 12
+#define MAX_TARGETS 256
+#define DEFAULT_TARGETS 32
+#define SMAPS_CHUNK 16384
+#define MAX_BASELINES (MAX_TARGETS * 4)
+#define BASELINE_VERSION 1
 
 typedef struct {
     pid_t pid;
+    unsigned long long starttime;   /* Tells a reused PID apart */
     int64_t heap_size_kb;
     int64_t heap_rss_kb;
     int64_t heap_pd_kb;
     int64_t rss_kb;  /* Total RSS for initial tracking */
 } heap_data_t;
 
+/* Whole-process totals from smaps_rollup */
+typedef struct {
+    int64_t rss_kb;
+    int64_t pss_kb;
+    int64_t anon_kb;
+    int64_t swap_kb;
+} rollup_t;
+
+/* RSS of one process at the previous collection */
 typedef struct {
-    /* Targets from procmem (top RSS growers) */
+    pid_t pid;
+    int index;                      /* Record in the table it was taken from */
+    int64_t rss_kb;
+} rss_sample_t;
+
+/* Target selection candidate */
+typedef struct {
+    const proc_record_t *rec;
+    int64_t rss_delta_kb;
+} candidate_t;
+
+typedef struct {
+    int max_targets;
+    
+    /* Targets for the next scan (explicit or top RSS growers/consumers) */
     pid_t targets[MAX_TARGETS];
     int target_count;
     
@@ -34,69 +76,204 @@ typedef struct {
     bool has_previous;
     
     /* Initial/baseline heap data (first seen values) */
-    heap_data_t initial[MAX_TARGETS * 4]; /* Larger pool for history */
+    heap_data_t initial_mem[MAX_BASELINES];
+    heap_data_t *initial;           /* initial_mem, or the mapped state file */
     int initial_count;
+    statefile_t state;
     
     /* Results */
     heapmon_entry_t results[MAX_TARGETS];
     int result_count;
+    
+    /* RSS of every process last round, sorted by PID; also indexes the table */
+    rss_sample_t *samples;
+    int sample_count;
 } heapmon_priv_t;
 
 static heapmon_priv_t g_heapmon;
 
+/* Drop baselines of processes that are gone. Returns the number left */
+static int prune_baselines(heapmon_priv_t *priv) {
+    int kept = 0;
+    for (int i = 0; i < priv->initial_count; i++) {
+        if (proc_pid_exists(priv->initial[i].pid)) {
+            priv->initial[kept++] = priv->initial[i];
+        }
+    }
+    priv->initial_count = kept;
+    statefile_set_count(&priv->state, kept);
+    return kept;
+}
+
 static int heapmon_init(qmem_service_t *svc, const qmem_config_t *cfg) {
-    (void)cfg;
-    
     memset(&g_heapmon, 0, sizeof(g_heapmon));
+    
+    g_heapmon.max_targets = (cfg && cfg->heap_scan_top_n > 0) ? cfg->heap_scan_top_n : DEFAULT_TARGETS;
+    if (g_heapmon.max_targets > MAX_TARGETS) {
+        g_heapmon.max_targets = MAX_TARGETS;
+    }
     svc->priv = &g_heapmon;
     
-    log_debug("heapmon service initialized");
+    /* Resume baselines saved by a previous run */
+    g_heapmon.initial = g_heapmon.initial_mem;
+    if (cfg && cfg->data_dir[0]) {
+        int count = statefile_open(&g_heapmon.state, cfg->data_dir, "heapmon.state",
+                                   BASELINE_VERSION, sizeof(heap_data_t), MAX_BASELINES);
+        if (count >= 0) {
+            g_heapmon.initial = g_heapmon.state.records;
+            g_heapmon.initial_count = count;
+            prune_baselines(&g_heapmon);
+        }
+    }
+    
+    log_debug("heapmon service initialized (%d targets, %d baselines)",
+              g_heapmon.max_targets, g_heapmon.initial_count);
     return 0;
 }
 
+/* Parse "Key:   123 kB" lines of smaps/smaps_rollup */
+static bool match_kb(const char *line, const char *key, size_t key_len, int64_t *value) {
+    if (strncmp(line, key, key_len) != 0) {
+        return false;
+    }
+    *value = strtoll(line + key_len, NULL, 10);
+    return true;
+}
+
+static int read_smaps_rollup(pid_t pid, rollup_t *rollup) {
+    char path[64];
+    char buf[4096];
+    
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+    if (proc_read_file(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    
+    rollup->rss_kb = -1;
+    rollup->pss_kb = -1;
+    rollup->anon_kb = -1;
+    rollup->swap_kb = -1;
+    
+    for (char *line = buf; line && *line; ) {
+        if (!match_kb(line, "Rss:", 4, &rollup->rss_kb) &&
+            !match_kb(line, "Pss:", 4, &rollup->pss_kb) &&
+            !match_kb(line, "Anonymous:", 10, &rollup->anon_kb)) {
+            match_kb(line, "Swap:", 5, &rollup->swap_kb);
+        }
+    
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    
+    return rollup->rss_kb >= 0 ? 0 : -1;
+}
+
+/* Streaming [heap] parser state */
+typedef struct {
+    bool in_heap;
+    bool seen_heap;
+    int64_t size_kb;
+    int64_t rss_kb;
+    int64_t pd_kb;
+} heap_scan_t;
+
+/* Handle one smaps line. Returns false once the heap mappings are done */
+static bool heap_scan_line(heap_scan_t *scan, const char *line) {
+    /* Mapping line (starts with hex address) */
+    if ((line[0] >= '0' && line[0] <= '9') ||
+        (line[0] >= 'a' && line[0] <= 'f')) {
+        bool is_heap = strstr(line, "[heap]") != NULL;
+    
+        /* Mappings are address-ordered and [heap] is contiguous */
+        if (scan->seen_heap && !is_heap) {
+            return false;
+        }
+        scan->in_heap = is_heap;
+        scan->seen_heap |= is_heap;
+        return true;
+    }
+    
+    if (scan->in_heap) {
+        int64_t value;
+        if (match_kb(line, "Size:", 5, &value)) {
+            scan->size_kb += value;
+        } else if (match_kb(line, "Rss:", 4, &value)) {
+            scan->rss_kb += value;
+        } else if (match_kb(line, "Private_Dirty:", 14, &value)) {
+            scan->pd_kb += value;
+        }
+    }
+    
+    return true;
+}
+
+/* Sum [heap] mappings from /proc/<pid>/smaps without reading it whole */
 static int parse_heap_smaps(pid_t pid, int64_t *size_kb, int64_t *rss_kb, int64_t *pd_kb) {
     char path[64];
-    char buf[65536];
+    char buf[SMAPS_CHUNK + 1];
     
     snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
-    
-    if (proc_read_file(path, buf, sizeof(buf)) < 0) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return -1;
     }
     
-    *size_kb = 0;
-    *rss_kb = 0;
-    *pd_kb = 0;
+    heap_scan_t scan = {0};
+    size_t have = 0;
+    bool done = false;
+    bool skip = false;              /* Dropping the tail of an overlong line */
+    int ret = 0;
     
-    bool in_heap = false;
-    char *line = buf;
+    while (!done) {
+        ssize_t n = read(fd, buf + have, SMAPS_CHUNK - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        if (n == 0) {
+            /* Final line without newline */
+            if (have > 0 && !skip) {
+                buf[have] = '\0';
+                heap_scan_line(&scan, buf);
+            }
+            break;
+        }
+        have += n;
+        buf[have] = '\0';
     
-    while (*line) {
-        /* Check for mapping line (starts with hex address) */
-        if ((line[0] >= '0' && line[0] <= '9') ||
-            (line[0] >= 'a' && line[0] <= 'f')) {
-            /* Check if this is a [heap] mapping */
-            in_heap = (strstr(line, "[heap]") != NULL);
+        char *line = buf;
+        char *nl;
+        while ((nl = memchr(line, '\n', buf + have - line)) != NULL) {
+            *nl = '\0';
+            if (!skip && !heap_scan_line(&scan, line)) {
+                done = true;
+                break;
+            }
+            skip = false;
+            line = nl + 1;
         }
-        
-        if (in_heap) {
-            /* Parse Size, Rss, Private_Dirty */
-            if (strncmp(line, "Size:", 5) == 0) {
-                *size_kb += strtoll(line + 5, NULL, 10);
-            } else if (strncmp(line, "Rss:", 4) == 0) {
-                *rss_kb += strtoll(line + 4, NULL, 10);
-            } else if (strncmp(line, "Private_Dirty:", 14) == 0) {
-                *pd_kb += strtoll(line + 14, NULL, 10);
+    
+        /* Carry the partial line over to the next chunk */
+        have = buf + have - line;
+        memmove(buf, line, have);
+        if (have == SMAPS_CHUNK) {
+            /* Overlong line (huge path): scan its start, drop the rest */
+            buf[have] = '\0';
+            if (!skip && !heap_scan_line(&scan, buf)) {
+                done = true;
             }
+            skip = true;
+            have = 0;
         }
-        
-        /* Next line */
-        line = strchr(line, '\n');
-        if (!line) break;
-        line++;
     }
     
-    return 0;
+    close(fd);
+    
+    *size_kb = scan.size_kb;
+    *rss_kb = scan.rss_kb;
+    *pd_kb = scan.pd_kb;
+    return ret;
 }
 
 static heap_data_t *find_previous(heapmon_priv_t *priv, pid_t pid) {
@@ -108,70 +285,161 @@ static heap_data_t *find_previous(heapmon_priv_t *priv, pid_t pid) {
     return NULL;
 }
 
-/* Find or create initial (baseline) entry for a PID */
+/* Find or create initial (baseline) entry for a process */
 static heap_data_t *find_or_create_initial(heapmon_priv_t *priv, pid_t pid,
+                                            unsigned long long starttime,
                                             int64_t size_kb, int64_t heap_rss_kb, int64_t pd_kb,
                                             int64_t total_rss_kb) {
-    /* Search for existing entry */
+    heap_data_t *init = NULL;
+    
+    /* Search for existing entry; a reused PID starts a new baseline */
     for (int i = 0; i < priv->initial_count; i++) {
         if (priv->initial[i].pid == pid) {
-            return &priv->initial[i];
+            if (priv->initial[i].starttime == starttime) {
+                return &priv->initial[i];
+            }
+            init = &priv->initial[i];
+            break;
         }
     }
     
     /* Not found - create new baseline entry */
-    if (priv->initial_count < MAX_TARGETS * 4) {
-        heap_data_t *init = &priv->initial[priv->initial_count++];
+    if (!init && (priv->initial_count < MAX_BASELINES || prune_baselines(priv) < MAX_BASELINES)) {
+        init = &priv->initial[priv->initial_count];
         init->pid = pid;
+        init->starttime = starttime;
         init->heap_size_kb = size_kb;
         init->heap_rss_kb = heap_rss_kb;
         init->heap_pd_kb = pd_kb;
         init->rss_kb = total_rss_kb;
+        statefile_set_count(&priv->state, ++priv->initial_count);
         return init;
     }
     
-    return NULL;
+    if (init) {
+        init->starttime = starttime;
+        init->heap_size_kb = size_kb;
+        init->heap_rss_kb = heap_rss_kb;
+        init->heap_pd_kb = pd_kb;
+        init->rss_kb = total_rss_kb;
+    }
+    return init;
+}
+
+static int compare_sample_pid(const void *a, const void *b) {
+    const rss_sample_t *sa = (const rss_sample_t *)a;
+    const rss_sample_t *sb = (const rss_sample_t *)b;
+    return (sa->pid > sb->pid) - (sa->pid < sb->pid);
+}
+
+static int compare_candidate_delta(const void *a, const void *b) {
+    const candidate_t *ca = (const candidate_t *)a;
+    const candidate_t *cb = (const candidate_t *)b;
+    return (cb->rss_delta_kb > ca->rss_delta_kb) - (cb->rss_delta_kb < ca->rss_delta_kb);
+}
+
+static int compare_candidate_rss(const void *a, const void *b) {
+    const candidate_t *ca = (const candidate_t *)a;
+    const candidate_t *cb = (const candidate_t *)b;
+    return (cb->rec->rss_kb > ca->rec->rss_kb) - (cb->rec->rss_kb < ca->rec->rss_kb);
+}
+
+static bool has_target(const heapmon_priv_t *priv, pid_t pid) {
+    for (int k = 0; k < priv->target_count; k++) {
+        if (priv->targets[k] == pid) return true;
+    }
+    return false;
+}
+
+/*
+ * Pick half the targets from the top RSS growers and the rest from the
+ * top RSS consumers, and remember every process's RSS for next round
+ */
+static void select_targets(heapmon_priv_t *priv, const proc_table_t *table) {
+    candidate_t *candidates = malloc(table->count * sizeof(*candidates));
+    rss_sample_t *samples = malloc(table->count * sizeof(*samples));
+    if (!candidates || !samples) {
+        free(candidates);
+        free(samples);
+        free(priv->samples);        /* Would index a stale table */
+        priv->samples = NULL;
+        priv->sample_count = 0;
+        return;
+    }
+    
+    int count = 0;
+    for (int i = 0; i < table->count; i++) {
+        const proc_record_t *rec = &table->records[i];
+        samples[i].pid = rec->pid;
+        samples[i].index = i;
+        samples[i].rss_kb = rec->rss_kb;
+        if (rec->rss_kb < 0) continue;  /* Kernel thread or gone */
+    
+        rss_sample_t key = { .pid = rec->pid };
+        const rss_sample_t *prev = priv->samples ?
+            bsearch(&key, priv->samples, priv->sample_count, sizeof(key), compare_sample_pid) : NULL;
+    
+        candidates[count].rec = rec;
+        candidates[count].rss_delta_kb = prev && prev->rss_kb >= 0 ? rec->rss_kb - prev->rss_kb : 0;
+        count++;
+    }
+    
+    bool explicit_targets = priv->target_count > 0;
+    if (!explicit_targets) {
+        /* 1. Top growers */
+        qsort(candidates, count, sizeof(*candidates), compare_candidate_delta);
+        for (int i = 0; i < count && priv->target_count < priv->max_targets / 2; i++) {
+            if (candidates[i].rss_delta_kb <= 0) break;
+            priv->targets[priv->target_count++] = candidates[i].rec->pid;
+        }
+    
+        /* 2. Top absolute RSS (deduplicate) */
+        qsort(candidates, count, sizeof(*candidates), compare_candidate_rss);
+        for (int i = 0; i < count && priv->target_count < priv->max_targets; i++) {
+            if (!has_target(priv, candidates[i].rec->pid)) {
+                priv->targets[priv->target_count++] = candidates[i].rec->pid;
+            }
+        }
+    }
+    
+    qsort(samples, table->count, sizeof(*samples), compare_sample_pid);
+    free(priv->samples);
+    priv->samples = samples;
+    priv->sample_count = table->count;
+    free(candidates);
+}
+
+/* Look a target up in the table select_targets just sampled */
+static const proc_record_t *find_record(const heapmon_priv_t *priv, const proc_table_t *table,
+                                        pid_t pid) {
+    rss_sample_t key = { .pid = pid };
+    const rss_sample_t *sample = priv->samples ?
+        bsearch(&key, priv->samples, priv->sample_count, sizeof(key), compare_sample_pid) : NULL;
+    return sample ? &table->records[sample->index] : NULL;
+}
+
+static int compare_rss_increase(const void *a, const void *b) {
+    const heapmon_entry_t *ea = (const heapmon_entry_t *)a;
+    const heapmon_entry_t *eb = (const heapmon_entry_t *)b;
+    int64_t change_a = ea->rss_kb - ea->initial_rss_kb;
+    int64_t change_b = eb->rss_kb - eb->initial_rss_kb;
+    return (change_b > change_a) - (change_b < change_a);
 }
 
 static int heapmon_collect(qmem_service_t *svc) {
     heapmon_priv_t *priv = (heapmon_priv_t *)svc->priv;
     
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) {
+        return -1;
+    }
+    
     /* Save previous */
     memcpy(priv->previous, priv->current, sizeof(priv->previous));
     priv->previous_count = priv->current_count;
     
-    /* If no targets set, get them from procmem */
-    /* Always refresh targets from procmem to catch new top consumers */
-    {
-        /* 1. Get Top Growers */
-        procmem_entry_t growers[MAX_TARGETS];
-        int n_growers = procmem_get_top_growers(growers, MAX_TARGETS / 2);
-        
-        /* 2. Get Top Absolute RSS */
-        procmem_entry_t top_rss[MAX_TARGETS];
-        int n_rss = procmem_get_top_rss(top_rss, MAX_TARGETS / 2);
-
-        priv->target_count = 0;
-        
-        /* Add Growers */
-        for (int i = 0; i < n_growers; i++) {
-            priv->targets[priv->target_count++] = growers[i].pid;
-        }
-        
-        /* Add Top RSS (deduplicate) */
-        for (int i = 0; i < n_rss; i++) {
-            bool found = false;
-            for (int k = 0; k < priv->target_count; k++) {
-                if (priv->targets[k] == top_rss[i].pid) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found && priv->target_count < MAX_TARGETS) {
-                priv->targets[priv->target_count++] = top_rss[i].pid;
-            }
-        }
-    }
+    /* Use targets set since last round, else refresh from the process table */
+    select_targets(priv, table);
     
     /* Scan heap for each target */
     priv->current_count = 0;
@@ -180,52 +448,64 @@ static int heapmon_collect(qmem_service_t *svc) {
     for (int i = 0; i < priv->target_count; i++) {
         pid_t pid = priv->targets[i];
         heap_data_t *cur = &priv->current[priv->current_count];
-        
+    
         int64_t size_kb, rss_kb, pd_kb;
         if (parse_heap_smaps(pid, &size_kb, &rss_kb, &pd_kb) < 0) {
             continue;  /* Process may have exited */
         }
-        
+    
+        const proc_record_t *rec = find_record(priv, table, pid);
+    
+        /* Whole-process totals */
+        rollup_t rollup;
+        if (read_smaps_rollup(pid, &rollup) < 0) {
+            rollup.rss_kb = rec ? rec->rss_kb : 0;
+            rollup.pss_kb = -1;
+            rollup.anon_kb = -1;
+            rollup.swap_kb = -1;
+        }
+    
         cur->pid = pid;
+        cur->starttime = rec ? rec->starttime : 0;
         cur->heap_size_kb = size_kb;
         cur->heap_rss_kb = rss_kb;
         cur->heap_pd_kb = pd_kb;
+        cur->rss_kb = rollup.rss_kb;
         priv->current_count++;
-        
+    
         /* Build result entry */
         heapmon_entry_t *res = &priv->results[priv->result_count++];
         res->pid = pid;
         res->heap_size_kb = size_kb;
         res->heap_rss_kb = rss_kb;
         res->heap_private_dirty_kb = pd_kb;
-        
+        res->rss_kb = rollup.rss_kb;
+        res->pss_kb = rollup.pss_kb;
+        res->anon_kb = rollup.anon_kb;
+        res->swap_kb = rollup.swap_kb;
+    
         /* Get command name */
-        if (proc_read_cmdline(pid, res->cmd, sizeof(res->cmd)) < 0) {
+        if (rec && rec->cmdline) {
+            snprintf(res->cmd, sizeof(res->cmd), "%s", rec->cmdline);
+        } else if (proc_read_cmdline(pid, res->cmd, sizeof(res->cmd)) <= 0) {
             proc_read_comm(pid, res->cmd, sizeof(res->cmd));
         }
-        
+    
         /* Calculate deltas */
         heap_data_t *prev = find_previous(priv, pid);
         if (prev) {
             res->heap_rss_delta_kb = rss_kb - prev->heap_rss_kb;
             res->heap_pd_delta_kb = pd_kb - prev->heap_pd_kb;
+            res->rss_delta_kb = res->rss_kb - prev->rss_kb;
         } else {
             res->heap_rss_delta_kb = 0;
             res->heap_pd_delta_kb = 0;
+            res->rss_delta_kb = 0;
         }
-        
-        /* Get RSS info from procmem */
-        res->rss_delta_kb = 0;
-        res->rss_kb = 0;
-        
-        procmem_entry_t pe;
-        if (procmem_get_pid_info(pid, &pe) == 0) {
-            res->rss_kb = pe.rss_kb;
-            res->rss_delta_kb = pe.rss_delta_kb;
-        }
-        
+    
         /* Get or create initial baseline - pass total RSS too */
-        heap_data_t *init = find_or_create_initial(priv, pid, size_kb, rss_kb, pd_kb, res->rss_kb);
+        heap_data_t *init = find_or_create_initial(priv, pid, rec ? rec->starttime : 0,
+                                                   size_kb, rss_kb, pd_kb, res->rss_kb);
         if (init) {
             res->initial_heap_rss_kb = init->heap_rss_kb;
             res->initial_rss_kb = init->rss_kb;
@@ -236,17 +516,7 @@ static int heapmon_collect(qmem_service_t *svc) {
     }
     
     /* Sort results by total memory increase (rss - initial_rss, descending) */
-    for (int i = 0; i < priv->result_count - 1; i++) {
-        for (int j = i + 1; j < priv->result_count; j++) {
-            int64_t change_i = priv->results[i].rss_kb - priv->results[i].initial_rss_kb;
-            int64_t change_j = priv->results[j].rss_kb - priv->results[j].initial_rss_kb;
-            if (change_j > change_i) {
-                heapmon_entry_t tmp = priv->results[i];
-                priv->results[i] = priv->results[j];
-                priv->results[j] = tmp;
-            }
-        }
-    }
+    qsort(priv->results, priv->result_count, sizeof(heapmon_entry_t), compare_rss_increase);
     
     /* Clear targets for next round */
     priv->target_count = 0;
@@ -268,10 +538,13 @@ static int heapmon_snapshot(qmem_service_t *svc, json_builder_t *j) {
         json_object_start(j);
         json_kv_int(j, "pid", e->pid);
         json_kv_string(j, "cmd", e->cmd);
-
+    
         json_kv_int(j, "rss_kb", e->rss_kb);
         json_kv_int(j, "rss_delta_kb", e->rss_delta_kb);
         json_kv_int(j, "initial_rss_kb", e->initial_rss_kb);
+        json_kv_int(j, "pss_kb", e->pss_kb);
+        json_kv_int(j, "anon_kb", e->anon_kb);
+        json_kv_int(j, "swap_kb", e->swap_kb);
         json_kv_int(j, "heap_size_kb", e->heap_size_kb);
         json_kv_int(j, "heap_rss_kb", e->heap_rss_kb);
         json_kv_int(j, "initial_heap_rss_kb", e->initial_heap_rss_kb);
@@ -288,7 +561,16 @@ static int heapmon_snapshot(qmem_service_t *svc, json_builder_t *j) {
 }
 
 static void heapmon_destroy(qmem_service_t *svc) {
-    (void)svc;
+    heapmon_priv_t *priv = (heapmon_priv_t *)svc->priv;
+    
+    if (priv) {
+        free(priv->samples);
+        priv->samples = NULL;
+        priv->sample_count = 0;
+        statefile_close(&priv->state);
+        priv->initial = priv->initial_mem;
+        priv->initial_count = 0;
+    }
     log_debug("heapmon service destroyed");
 }
 
@@ -304,8 +586,9 @@ qmem_service_t heapmon_service = {
     .description = "Heap analysis via /proc/pid/smaps",
     .ops = &heapmon_ops,
     .priv = NULL,
-    .enabled = false,  // Disabled by default as it's expensive
+    .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STATM | PROC_FIELD_CMDLINE,
 };
 
 #ifndef NO_PLUGIN_DEFINE
@@ -332,55 +615,21 @@ static int compare_consumers(const void *a, const void *b) {
 int heapmon_get_top_consumers(heapmon_entry_t *entries, int max_entries) {
     heapmon_priv_t *priv = &g_heapmon;
     
-    /* Convert current raw data to export format */
-    heapmon_entry_t all_entries[MAX_TARGETS];
-    int count = 0;
-    
-    for (int i = 0; i < priv->current_count; i++) {
-        heap_data_t *cur = &priv->current[i];
-        
-        heapmon_entry_t *e = &all_entries[count++];
-        e->pid = cur->pid;
-        
-        /* Find cmd */
-        procmem_entry_t pe;
-        if (procmem_get_pid_info(cur->pid, &pe) == 0) {
-             snprintf(e->cmd, sizeof(e->cmd), "%s", pe.cmd);
-             e->rss_kb = pe.rss_kb;
-        } else {
-             snprintf(e->cmd, sizeof(e->cmd), "(unknown)");
-             e->rss_kb = cur->heap_rss_kb; /* Fallback */
-        }
-        
-        e->heap_size_kb = cur->heap_size_kb;
-        e->heap_rss_kb = cur->heap_rss_kb;
-        e->heap_private_dirty_kb = cur->heap_pd_kb;
-        
-        /* Deltas */
-        e->heap_rss_delta_kb = 0;
-        e->heap_pd_delta_kb = 0;
-        e->rss_delta_kb = 0;
-        
-        /* Find in previous */
-        for (int k = 0; k < priv->previous_count; k++) {
-            if (priv->previous[k].pid == cur->pid) {
-                e->heap_rss_delta_kb = cur->heap_rss_kb - priv->previous[k].heap_rss_kb;
-                e->heap_pd_delta_kb = cur->heap_pd_kb - priv->previous[k].heap_pd_kb;
-                /* Note: rss_delta requires procmem history which we don't have here easily, 
-                   but we can use procmem_get_pid_info's delta if available? 
-                   Actually procmem_get_pid_info fills rss_delta_kb. Use it. */
-                if (procmem_get_pid_info(cur->pid, &pe) == 0) {
-                    e->rss_delta_kb = pe.rss_delta_kb;
-                }
-                break;
-            }
+    /* Results already carry command, totals and deltas; insert the top ones */
+    int n = 0;
+    for (int i = 0; i < priv->result_count; i++) {
+        const heapmon_entry_t *e = &priv->results[i];
+        int pos = n;
+        while (pos > 0 && compare_consumers(e, &entries[pos - 1]) < 0) {
+            pos--;
         }
-    }
+        if (pos >= max_entries) continue;
     
-    qsort(all_entries, count, sizeof(heapmon_entry_t), compare_consumers);
-    
-    int n = count > max_entries ? max_entries : count;
-    memcpy(entries, all_entries, n * sizeof(heapmon_entry_t));
+        int moved = n < max_entries ? n - pos : n - pos - 1;
+        memmove(&entries[pos + 1], &entries[pos], moved * sizeof(*entries));
+        entries[pos] = *e;
+        if (n < max_entries) n++;
+    }
     return n;
 }
 
@@ -16,8 +16,11 @@ typedef struct {
     int64_t heap_size_kb;
     int64_t heap_rss_kb;
     int64_t heap_private_dirty_kb;
-    int64_t rss_kb;                 /* From procmem/status */
-    int64_t rss_delta_kb;           /* From procmem */
+    int64_t rss_kb;                 /* From smaps_rollup */
+    int64_t rss_delta_kb;
+    int64_t pss_kb;                 /* -1 without smaps_rollup */
+    int64_t anon_kb;
+    int64_t swap_kb;
     int64_t heap_rss_delta_kb;
     int64_t heap_pd_delta_kb;
     /* Initial/baseline values (when process was first tracked) */
@@ -25,11 +28,13 @@ typedef struct {
     int64_t initial_heap_rss_kb;
 } heapmon_entry_t;
 
-/* Set top RSS growers to scan (called by procmem) */
+/* Set PIDs to scan next round instead of the top RSS growers */
 void heapmon_set_targets(pid_t *pids, int count);
 
 /* Get heap info for scanned processes */
 int heapmon_get_entries(heapmon_entry_t *entries, int max_entries);
+
+/* Copy the max_entries largest heap users into entries, largest first */
 int heapmon_get_top_consumers(heapmon_entry_t *entries, int max_entries);
 
 #endif /* QMEM_HEAPMON_H */
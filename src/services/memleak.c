@@ -9,6 +9,7 @@
 #include "services/slabinfo.h"
 #include "services/heapmon.h"
 #include "services/meminfo.h"
+#include "daemon/config.h"
 #include <qmem/plugin.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,13 @@ static int memleak_init(qmem_service_t *svc, const qmem_config_t *cfg) {
     
     /* Initialize subsystems */
     /* We pass the main config to them, though they might not use it effectively if not main service */
+    /* The embedded copies keep baselines in memory; the state files belong to the plugins */
+    static qmem_config_t embedded_cfg;
+    if (cfg) {
+        embedded_cfg = *cfg;
+        embedded_cfg.data_dir[0] = '\0';
+        cfg = &embedded_cfg;
+    }
     if (procmem_service.ops->init) procmem_service.ops->init(&procmem_service, cfg);
     if (slabinfo_service.ops->init) slabinfo_service.ops->init(&slabinfo_service, cfg);
     if (heapmon_service.ops->init) heapmon_service.ops->init(&heapmon_service, cfg);
@@ -37,7 +45,9 @@ static int memleak_init(qmem_service_t *svc, const qmem_config_t *cfg) {
 }
 
 static int memleak_collect(qmem_service_t *svc) {
-    (void)svc;
+    /* Embedded services share this round's process table */
+    procmem_service.proc_table = svc->proc_table;
+    heapmon_service.proc_table = svc->proc_table;
     
     /* Collect data from all sources */
     if (procmem_service.ops->collect) procmem_service.ops->collect(&procmem_service);
@@ -45,6 +55,9 @@ static int memleak_collect(qmem_service_t *svc) {
     if (heapmon_service.ops->collect) heapmon_service.ops->collect(&heapmon_service);
     if (meminfo_service.ops->collect) meminfo_service.ops->collect(&meminfo_service);
     
+    procmem_service.proc_table = NULL;
+    heapmon_service.proc_table = NULL;
+    
     return 0;
 }
 
@@ -170,6 +183,7 @@ qmem_service_t memleak_service = {
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STATM | PROC_FIELD_CMDLINE,
 };
 
 QMEM_PLUGIN_DEFINE("memleak", "1.0", "Unified Memory Leak Detector", memleak_service);
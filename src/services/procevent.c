@@ -1,9 +1,18 @@
 /*
  * procevent.c - Process event monitor
- * 
+ *
  * Uses proc connector (netlink) to monitor fork/exec/exit events.
- * Falls back to /proc scanning if netlink is unavailable.
+ * A listener thread receives the events as they happen and feeds a
+ * single-producer single-consumer ring that collect drains, so
+ * processes living shorter than one tick are still seen. The listener
+ * reads each process's comm as its event arrives, while the process is
+ * still there to read; full command lines wait until collect drains the
+ * ring, so a slow /proc read never backs up the socket. Names of
+ * processes whose exit was lost are pruned every PRUNE_ROUNDS collects
+ * against the shared /proc walk. Falls back to diffing /proc scans if
+ * the connector is unavailable (it needs CAP_NET_ADMIN) or fails later.
  */
+#define _POSIX_C_SOURCE 200809L
 #include "procevent.h"
 #include "common/log.h"
 #include "common/proc_utils.h"
@@ -11,21 +20,84 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
 #include <qmem/plugin.h>
 #include <time.h>
 
 #define MAX_EVENTS 100
 #define HASH_SIZE 4096
+#define RING_SIZE 8192                  /* Power of two */
+#define LISTENER_POLL_MS 250
+#define LISTENER_RCVBUF (4 * 1024 * 1024)
+#define PRUNE_ROUNDS 60                 /* Collects between name table prunes */
+
+/*
+ * Proc connector ABI. linux/cn_proc.h is not included because its
+ * PROC_EVENT_* enumerators clash with ours.
+ */
+#define CN_PROC_MCAST_LISTEN    1
+#define CN_PROC_MCAST_IGNORE    2
+#define CN_PROC_WHAT_FORK       0x00000001u
+#define CN_PROC_WHAT_EXEC       0x00000002u
+#define CN_PROC_WHAT_EXIT       0x80000000u
+
+typedef struct {
+    uint32_t what;
+    uint32_t cpu;
+    _Alignas(8) uint64_t timestamp_ns;
+    union {
+        struct {
+            pid_t parent_pid;
+            pid_t parent_tgid;
+            pid_t child_pid;
+            pid_t child_tgid;
+        } fork;
+        struct {
+            pid_t process_pid;
+            pid_t process_tgid;
+        } exec;
+        struct {
+            pid_t process_pid;
+            pid_t process_tgid;
+            uint32_t exit_code;
+            uint32_t exit_signal;
+        } exit;
+    } event_data;
+} cn_proc_event_t;
 
 /* Simple hash table for tracking PIDs */
 typedef struct pid_entry {
     pid_t pid;
     char cmd[64];
+    bool seen;                          /* In the latest /proc walk */
     struct pid_entry *next;
 } pid_entry_t;
 
+/* Event as received by the listener thread */
+typedef struct {
+    proc_event_type_t type;
+    pid_t pid;
+    pid_t ppid;
+    int exit_code;
+    int exit_signal;
+    uint64_t timestamp;
+    char comm[16];                      /* Read as the event arrived, "" if gone */
+} raw_event_t;
+
+/* Single-producer (listener) single-consumer (collect) ring */
+typedef struct {
+    raw_event_t slots[RING_SIZE];
+    atomic_uint head;                   /* Next slot to write */
+    atomic_uint tail;                   /* Next slot to read */
+} event_ring_t;
+
 typedef struct {
     proc_event_counters_t counters;
     proc_event_t events[MAX_EVENTS];
@@ -38,6 +110,21 @@ typedef struct {
     pid_entry_t pool[8192];
     int pool_idx;
     bool has_previous;
+    
+    /* Proc connector */
+    int nl_fd;                          /* -1 when scanning */
+    pthread_t listener;
+    atomic_bool running;
+    atomic_bool listener_failed;
+    atomic_ulong forks;                 /* Counted as events arrive, so an */
+    atomic_ulong execs;                 /* overrun ring loses detail only */
+    atomic_ulong exits;
+    atomic_ulong dropped;               /* Ring full or socket overrun */
+    event_ring_t ring;
+    
+    /* Names of live processes, for exit events (connector mode) */
+    pid_entry_t *names[HASH_SIZE];
+    int rounds;                         /* Collects since the last prune */
 } procevent_priv_t;
 
 static procevent_priv_t g_procevent;
@@ -71,13 +158,92 @@ static void insert_pid(pid_entry_t **hash, pid_entry_t *entry) {
     hash[idx] = entry;
 }
 
-static void add_event(procevent_priv_t *priv, proc_event_type_t type, 
-                      pid_t pid, pid_t ppid, const char *cmd, int exit_code) {
+/* Record the name of a live process (heap entries, connector mode) */
+static void names_put(procevent_priv_t *priv, pid_t pid, const char *cmd) {
+    pid_entry_t *e = find_pid(priv->names, pid);
+    if (!e) {
+        e = malloc(sizeof(*e));
+        if (!e) return;
+        e->pid = pid;
+        insert_pid(priv->names, e);
+    }
+    snprintf(e->cmd, sizeof(e->cmd), "%s", cmd);
+}
+
+/* Remove a process's name, copying it out. Returns false if unknown */
+static bool names_take(procevent_priv_t *priv, pid_t pid, char *cmd, size_t size) {
+    pid_entry_t **pp = &priv->names[hash_pid(pid)];
+    while (*pp) {
+        pid_entry_t *e = *pp;
+        if (e->pid == pid) {
+            snprintf(cmd, size, "%s", e->cmd);
+            *pp = e->next;
+            free(e);
+            return true;
+        }
+        pp = &e->next;
+    }
+    return false;
+}
+
+static bool mark_seen_callback(const proc_record_t *rec, void *userdata) {
+    pid_entry_t *e = find_pid((pid_entry_t **)userdata, rec->pid);
+    if (e) e->seen = true;
+    return true;
+}
+
+/*
+ * Drop names of processes whose exit event was lost. An entry missing
+ * from the walk is checked once more, since it may have forked after it
+ */
+static void names_prune(procevent_priv_t *priv, const proc_table_t *table) {
+    for (int i = 0; i < HASH_SIZE; i++) {
+        for (pid_entry_t *e = priv->names[i]; e; e = e->next) {
+            e->seen = false;
+        }
+    }
+    proc_table_foreach(table, mark_seen_callback, priv->names);
+    
+    int pruned = 0;
+    for (int i = 0; i < HASH_SIZE; i++) {
+        pid_entry_t **pp = &priv->names[i];
+        while (*pp) {
+            pid_entry_t *e = *pp;
+            if (!e->seen && !proc_pid_exists(e->pid)) {
+                *pp = e->next;
+                free(e);
+                pruned++;
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+    if (pruned > 0) {
+        log_debug("procevent: pruned %d names of processes gone unseen", pruned);
+    }
+}
+
+static void names_clear(procevent_priv_t *priv) {
+    for (int i = 0; i < HASH_SIZE; i++) {
+        pid_entry_t *e = priv->names[i];
+        while (e) {
+            pid_entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    clear_hash(priv->names);
+}
+
+static void add_event(procevent_priv_t *priv, proc_event_type_t type,
+                      pid_t pid, pid_t ppid, const char *cmd, int exit_code,
+                      int exit_signal, uint64_t timestamp) {
     proc_event_t *e = &priv->events[priv->event_head];
     e->type = type;
     e->pid = pid;
     e->parent_pid = ppid;
     e->exit_code = exit_code;
+    e->exit_signal = exit_signal;
     if (cmd) {
         size_t len = strlen(cmd);
         if (len >= sizeof(e->cmd)) len = sizeof(e->cmd) - 1;
@@ -86,67 +252,323 @@ static void add_event(procevent_priv_t *priv, proc_event_type_t type,
     } else {
         e->cmd[0] = '\0';
     }
-    e->timestamp = (uint64_t)time(NULL);
+    e->timestamp = timestamp;
     
     priv->event_head = (priv->event_head + 1) % MAX_EVENTS;
     if (priv->event_count < MAX_EVENTS) priv->event_count++;
+}
     
+/* Count an event; in connector mode the listener does, before queueing it */
+static void count_event(procevent_priv_t *priv, proc_event_type_t type) {
+    atomic_ulong *counter = NULL;
     switch (type) {
-        case PROC_EVENT_FORK: priv->counters.forks++; break;
-        case PROC_EVENT_EXEC: priv->counters.execs++; break;
-        case PROC_EVENT_EXIT: priv->counters.exits++; break;
+        case PROC_EVENT_FORK: counter = &priv->forks; break;
+        case PROC_EVENT_EXEC: counter = &priv->execs; break;
+        case PROC_EVENT_EXIT: counter = &priv->exits; break;
+    }
+    if (counter) {
+        atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+    }
+}
+
+static void publish_counters(procevent_priv_t *priv) {
+    priv->counters.forks = atomic_load(&priv->forks);
+    priv->counters.execs = atomic_load(&priv->execs);
+    priv->counters.exits = atomic_load(&priv->exits);
+    priv->counters.dropped = atomic_load(&priv->dropped);
+}
+
+/*
+ * Event ring
+ */
+
+static bool ring_push(event_ring_t *ring, const raw_event_t *ev) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    
+    if (head - tail >= RING_SIZE) {
+        return false;
+    }
+    ring->slots[head & (RING_SIZE - 1)] = *ev;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+static bool ring_pop(event_ring_t *ring, raw_event_t *ev) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    
+    if (tail == head) {
+        return false;
     }
+    *ev = ring->slots[tail & (RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+ * Proc connector listener
+ */
+
+static int connector_send_op(int fd, uint32_t op) {
+    uint64_t buf[(NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op)) + 7) / 8];
+    memset(buf, 0, sizeof(buf));
+    
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    
+    struct cn_msg *cn = NLMSG_DATA(nlh);
+    cn->id.idx = CN_IDX_PROC;
+    cn->id.val = CN_VAL_PROC;
+    cn->len = sizeof(op);
+    memcpy(cn->data, &op, sizeof(op));
+    
+    return send(fd, buf, nlh->nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+static int connector_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = CN_IDX_PROC,
+    };
+    int rcvbuf = LISTENER_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        connector_send_op(fd, CN_PROC_MCAST_LISTEN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Convert one connector event; thread events are skipped */
+static bool decode_event(const cn_proc_event_t *ev, raw_event_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->timestamp = (uint64_t)time(NULL);
+    
+    switch (ev->what) {
+        case CN_PROC_WHAT_FORK:
+            if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid) return false;
+            out->type = PROC_EVENT_FORK;
+            out->pid = ev->event_data.fork.child_tgid;
+            out->ppid = ev->event_data.fork.parent_tgid;
+            return true;
+        case CN_PROC_WHAT_EXEC:
+            out->type = PROC_EVENT_EXEC;
+            out->pid = ev->event_data.exec.process_tgid;
+            return true;
+        case CN_PROC_WHAT_EXIT:
+            if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid) return false;
+            out->type = PROC_EVENT_EXIT;
+            out->pid = ev->event_data.exit.process_tgid;
+            /* exit_code is a wait status */
+            out->exit_code = (int)((ev->event_data.exit.exit_code >> 8) & 0xff);
+            out->exit_signal = (int)(ev->event_data.exit.exit_code & 0x7f);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void *listener_main(void *arg) {
+    procevent_priv_t *priv = (procevent_priv_t *)arg;
+    uint64_t buf[1024];                 /* Aligned for nlmsghdr */
+    struct pollfd pfd = { .fd = priv->nl_fd, .events = POLLIN };
+    
+    while (atomic_load(&priv->running)) {
+        int ready = poll(&pfd, 1, LISTENER_POLL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+    
+        ssize_t n = recv(priv->nl_fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno == ENOBUFS) {
+                /* Kernel dropped events: keep going */
+                atomic_fetch_add(&priv->dropped, 1);
+                continue;
+            }
+            break;
+        }
+    
+        int len = (int)n;
+        for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+             NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len)) {
+            const struct cn_msg *cn = NLMSG_DATA(h);
+            if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+    
+            raw_event_t ev;
+            if (!decode_event((const cn_proc_event_t *)cn->data, &ev)) continue;
+            count_event(priv, ev.type);
+    
+            /* A short-lived child is gone by the time collect drains it */
+            if (proc_read_comm(ev.pid, ev.comm, sizeof(ev.comm)) < 0) {
+                ev.comm[0] = '\0';
+            }
+            if (!ring_push(&priv->ring, &ev)) {
+                atomic_fetch_add(&priv->dropped, 1);
+            }
+        }
+    }
+    
+    if (atomic_load(&priv->running)) {
+        atomic_store(&priv->listener_failed, true);
+    }
+    return NULL;
+}
+
+static bool seed_names_callback(const proc_record_t *rec, void *userdata) {
+    names_put((procevent_priv_t *)userdata, rec->pid, rec->comm);
+    return true;
+}
+
+static int start_listener(procevent_priv_t *priv) {
+    priv->nl_fd = connector_open();
+    if (priv->nl_fd < 0) {
+        return -1;
+    }
+    
+    /* Name the processes that already run, for their exit events */
+    const proc_table_t *table = proc_table_get(NULL, PROC_FIELD_STAT);
+    if (table) {
+        proc_table_foreach(table, seed_names_callback, priv);
+    }
+    
+    atomic_store(&priv->running, true);
+    if (pthread_create(&priv->listener, NULL, listener_main, priv) != 0) {
+        atomic_store(&priv->running, false);
+        close(priv->nl_fd);
+        priv->nl_fd = -1;
+        names_clear(priv);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_listener(procevent_priv_t *priv) {
+    if (priv->nl_fd < 0) return;
+    
+    atomic_store(&priv->running, false);
+    pthread_join(priv->listener, NULL);
+    connector_send_op(priv->nl_fd, CN_PROC_MCAST_IGNORE);
+    close(priv->nl_fd);
+    priv->nl_fd = -1;
+    names_clear(priv);
 }
 
 static int procevent_init(qmem_service_t *svc, const qmem_config_t *cfg) {
     (void)cfg;
     memset(&g_procevent, 0, sizeof(g_procevent));
     svc->priv = &g_procevent;
-    log_debug("procevent service initialized (using /proc scan fallback)");
+    
+    if (start_listener(&g_procevent) == 0) {
+        /* Events come from the listener: /proc is walked only to prune */
+        svc->proc_fields = 0;
+        log_debug("procevent service initialized (using proc connector)");
+    } else {
+        log_debug("procevent service initialized (using /proc scan fallback: %s)", strerror(errno));
+    }
     return 0;
 }
 
+/* Move queued connector events into the event history, naming them */
+static void drain_events(procevent_priv_t *priv) {
+    raw_event_t ev;
+    char cmd[64];
+    
+    while (ring_pop(&priv->ring, &ev)) {
+        cmd[0] = '\0';
+        switch (ev.type) {
+            case PROC_EVENT_FORK: {
+                /* A child runs its parent's image until it execs */
+                pid_entry_t *parent = find_pid(priv->names, ev.ppid);
+                snprintf(cmd, sizeof(cmd), "%s", parent ? parent->cmd : ev.comm);
+                names_put(priv, ev.pid, cmd);
+                break;
+            }
+            case PROC_EVENT_EXEC:
+                if (proc_read_cmdline(ev.pid, cmd, sizeof(cmd)) > 0 ||
+                    proc_read_comm(ev.pid, cmd, sizeof(cmd)) > 0) {
+                    names_put(priv, ev.pid, cmd);
+                } else {
+                    /* Already gone: name it by the image it ran */
+                    pid_entry_t *e = find_pid(priv->names, ev.pid);
+                    snprintf(cmd, sizeof(cmd), "%s", ev.comm[0] || !e ? ev.comm : e->cmd);
+                    names_put(priv, ev.pid, cmd);
+                }
+                break;
+            case PROC_EVENT_EXIT:
+                if (!names_take(priv, ev.pid, cmd, sizeof(cmd))) {
+                    snprintf(cmd, sizeof(cmd), "%s", ev.comm);
+                }
+                break;
+        }
+        add_event(priv, ev.type, ev.pid, ev.ppid, cmd, ev.exit_code,
+                  ev.exit_signal, ev.timestamp);
+    }
+}
+
+static bool collect_callback(const proc_record_t *rec, void *userdata) {
+    procevent_priv_t *priv = (procevent_priv_t *)userdata;
+    
+    pid_entry_t *e = alloc_entry(priv);
+    if (!e) return false;
+    
+    e->pid = rec->pid;
+    snprintf(e->cmd, sizeof(e->cmd), "%s", rec->comm);
+    insert_pid(priv->curr_pids, e);
+    
+    /* Check if new process */
+    if (priv->has_previous && !find_pid(priv->prev_pids, rec->pid)) {
+        add_event(priv, PROC_EVENT_FORK, rec->pid, rec->ppid, e->cmd, 0, 0, (uint64_t)time(NULL));
+        count_event(priv, PROC_EVENT_FORK);
+    }
+    
+    return true;
+}
+
 static int procevent_collect(qmem_service_t *svc) {
     procevent_priv_t *priv = (procevent_priv_t *)svc->priv;
     
+    if (priv->nl_fd >= 0) {
+        if (!atomic_load(&priv->listener_failed)) {
+            drain_events(priv);
+            publish_counters(priv);
+    
+            /* Now and then join the shared /proc walk to drop leaked names */
+            if (svc->proc_table) {
+                names_prune(priv, svc->proc_table);
+                svc->proc_fields = 0;
+                priv->rounds = 0;
+            } else if (++priv->rounds >= PRUNE_ROUNDS) {
+                svc->proc_fields = PROC_FIELD_STAT;
+            }
+            return 0;
+        }
+    
+        /* Keep what was queued, then scan from now on */
+        drain_events(priv);
+        stop_listener(priv);
+        svc->proc_fields = PROC_FIELD_STAT;
+        log_warn("procevent: proc connector failed, falling back to /proc scan");
+    }
+    
     /* Swap current to previous */
     memcpy(priv->prev_pids, priv->curr_pids, sizeof(priv->prev_pids));
     clear_hash(priv->curr_pids);
     priv->pool_idx = 0;
     
-    /* Scan /proc for current PIDs */
-    DIR *dir = opendir("/proc");
-    if (!dir) return -1;
-    
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        if (!isdigit(ent->d_name[0])) continue;
-        
-        pid_t pid = atoi(ent->d_name);
-        pid_entry_t *e = alloc_entry(priv);
-        if (!e) break;
-        
-        e->pid = pid;
-        
-        /* Get command name */
-        char path[64];
-        snprintf(path, sizeof(path), "/proc/%d/comm", pid);
-        char cmd[64];
-        if (proc_read_file(path, cmd, sizeof(cmd)) > 0) {
-            /* Trim newline */
-            char *nl = strchr(cmd, '\n');
-            if (nl) *nl = '\0';
-            snprintf(e->cmd, sizeof(e->cmd), "%s", cmd);
-        }
-        
-        insert_pid(priv->curr_pids, e);
-        
-        /* Check if new process */
-        if (priv->has_previous && !find_pid(priv->prev_pids, pid)) {
-            add_event(priv, PROC_EVENT_FORK, pid, 0, e->cmd, 0);
-        }
-    }
-    closedir(dir);
+    const proc_table_t *table = proc_table_get(svc->proc_table, PROC_FIELD_STAT);
+    if (!table) return -1;
+    
+    proc_table_foreach(table, collect_callback, priv);
     
     /* Find exited processes */
     if (priv->has_previous) {
@@ -154,7 +576,8 @@ static int procevent_collect(qmem_service_t *svc) {
             pid_entry_t *e = priv->prev_pids[i];
             while (e) {
                 if (!find_pid(priv->curr_pids, e->pid)) {
-                    add_event(priv, PROC_EVENT_EXIT, e->pid, 0, e->cmd, 0);
+                    add_event(priv, PROC_EVENT_EXIT, e->pid, 0, e->cmd, 0, 0, (uint64_t)time(NULL));
+                    count_event(priv, PROC_EVENT_EXIT);
                 }
                 e = e->next;
             }
@@ -162,6 +585,7 @@ static int procevent_collect(qmem_service_t *svc) {
     }
     
     priv->has_previous = true;
+    publish_counters(priv);
     return 0;
 }
 
@@ -170,11 +594,14 @@ static int procevent_snapshot(qmem_service_t *svc, json_builder_t *j) {
     
     json_object_start(j);
     
+    json_kv_string(j, "source", priv->nl_fd >= 0 ? "connector" : "scan");
+    
     json_key(j, "counters");
     json_object_start(j);
     json_kv_uint(j, "forks", priv->counters.forks);
     json_kv_uint(j, "execs", priv->counters.execs);
     json_kv_uint(j, "exits", priv->counters.exits);
+    json_kv_uint(j, "dropped", priv->counters.dropped);
     json_object_end(j);
     
     json_key(j, "recent_events");
@@ -185,11 +612,11 @@ static int procevent_snapshot(qmem_service_t *svc, json_builder_t *j) {
     for (int i = 0; i < count; i++) {
         int idx = (priv->event_head - 1 - i + MAX_EVENTS) % MAX_EVENTS;
         proc_event_t *e = &priv->events[idx];
-        
+    
         json_object_start(j);
         json_kv_int(j, "pid", e->pid);
         json_kv_string(j, "cmd", e->cmd);
-        
+    
         const char *type_str = "unknown";
         switch (e->type) {
             case PROC_EVENT_FORK: type_str = "fork"; break;
@@ -197,6 +624,13 @@ static int procevent_snapshot(qmem_service_t *svc, json_builder_t *j) {
             case PROC_EVENT_EXIT: type_str = "exit"; break;
         }
         json_kv_string(j, "type", type_str);
+        if (e->type == PROC_EVENT_FORK && e->parent_pid > 0) {
+            json_kv_int(j, "ppid", e->parent_pid);
+        }
+        if (e->type == PROC_EVENT_EXIT && priv->nl_fd >= 0) {
+            json_kv_int(j, "exit_code", e->exit_code);
+            json_kv_int(j, "signal", e->exit_signal);
+        }
         json_kv_uint(j, "timestamp", e->timestamp);
         json_object_end(j);
     }
@@ -207,7 +641,11 @@ static int procevent_snapshot(qmem_service_t *svc, json_builder_t *j) {
 }
 
 static void procevent_destroy(qmem_service_t *svc) {
-    (void)svc;
+    procevent_priv_t *priv = (procevent_priv_t *)svc->priv;
+    
+    if (priv) {
+        stop_listener(priv);
+    }
     log_debug("procevent service destroyed");
 }
 
@@ -220,11 +658,12 @@ static const qmem_service_ops_t procevent_ops = {
 
 qmem_service_t procevent_service = {
     .name = "procevent",
-    .description = "Process fork/exit events via /proc scanning",
+    .description = "Process fork/exec/exit events via proc connector or /proc scanning",
     .ops = &procevent_ops,
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STAT,
 };
 
 QMEM_PLUGIN_DEFINE("procevent", "1.0", "Process event monitor", procevent_service);
@@ -22,6 +22,7 @@ typedef struct {
     pid_t pid;
     pid_t parent_pid;
     int exit_code;                 /* For exit events */
+    int exit_signal;               /* Terminating signal, 0 if exited */
     char cmd[128];
     uint64_t timestamp;
 } proc_event_t;
@@ -31,6 +32,7 @@ typedef struct {
     uint64_t forks;
     uint64_t execs;
     uint64_t exits;
+    uint64_t dropped;              /* Events lost to overruns; counted above if the ring overran */
 } proc_event_counters_t;
 
 /* Get event counters */
@@ -21,7 +21,9 @@ typedef struct proc_entry {
     pid_t pid;
     int64_t rss_kb;
     int64_t data_kb;
-    char cmd[128];
+    int64_t rss_delta_kb;
+    int64_t data_delta_kb;
+    const char *cmd;            /* Interned, referenced while in the pool */
     struct proc_entry *next;
 } proc_entry_t;
 
@@ -38,9 +40,10 @@ typedef struct {
     int shrinker_count;
     int top_rss_count;
     
-    /* Memory pool for entries */
-    proc_entry_t pool[MAX_PROCS * 2];
-    int pool_idx;
+    /* Memory pool for entries: one half per sample, current and previous */
+    proc_entry_t pool[2][MAX_PROCS];
+    int pool_count[2];
+    int pool_half;
 } procmem_priv_t;
 
 static procmem_priv_t g_procmem;
@@ -50,10 +53,19 @@ static unsigned int hash_pid(pid_t pid) {
 }
 
 static proc_entry_t *alloc_entry(procmem_priv_t *priv) {
-    if (priv->pool_idx >= MAX_PROCS * 2) {
+    int half = priv->pool_half;
+    if (priv->pool_count[half] >= MAX_PROCS) {
         return NULL;
     }
-    return &priv->pool[priv->pool_idx++];
+    return &priv->pool[half][priv->pool_count[half]++];
+}
+
+/* Drop the references held by one pool half and empty it */
+static void reset_pool_half(procmem_priv_t *priv, int half) {
+    for (int i = 0; i < priv->pool_count[half]; i++) {
+        intern_release(priv->pool[half][i].cmd);
+    }
+    priv->pool_count[half] = 0;
 }
 
 static void clear_hash(proc_entry_t **hash) {
@@ -76,6 +88,15 @@ static void insert_hash(proc_entry_t **hash, proc_entry_t *entry) {
     hash[idx] = entry;
 }
 
+static void fill_entry(procmem_entry_t *out, const proc_entry_t *e) {
+    out->pid = e->pid;
+    snprintf(out->cmd, sizeof(out->cmd), "%s", e->cmd ? e->cmd : "");
+    out->rss_kb = e->rss_kb;
+    out->data_kb = e->data_kb;
+    out->rss_delta_kb = e->rss_delta_kb;
+    out->data_delta_kb = e->data_delta_kb;
+}
+
 static int procmem_init(qmem_service_t *svc, const qmem_config_t *cfg) {
     (void)cfg;
     
@@ -88,18 +109,19 @@ static int procmem_init(qmem_service_t *svc, const qmem_config_t *cfg) {
 
 typedef struct {
     procmem_priv_t *priv;
-    procmem_entry_t *changes;
+    proc_entry_t **changes;
     int change_count;
     int max_changes;
 } collect_ctx_t;
 
-static bool collect_callback(pid_t pid, void *userdata) {
+static bool collect_callback(const proc_record_t *rec, void *userdata) {
     collect_ctx_t *ctx = (collect_ctx_t *)userdata;
     procmem_priv_t *priv = ctx->priv;
+    pid_t pid = rec->pid;
     
     /* Read memory info */
-    int64_t rss_kb = proc_read_status_kb(pid, "VmRSS");
-    int64_t data_kb = proc_read_status_kb(pid, "VmData");
+    int64_t rss_kb = rec->rss_kb;
+    int64_t data_kb = rec->data_kb;
     
     if (rss_kb < 0 || data_kb < 0) {
         return true;  /* Process may have exited, continue */
@@ -114,60 +136,49 @@ static bool collect_callback(pid_t pid, void *userdata) {
     entry->pid = pid;
     entry->rss_kb = rss_kb;
     entry->data_kb = data_kb;
+    entry->rss_delta_kb = 0;
+    entry->data_delta_kb = 0;
+    entry->cmd = intern_retain(rec->cmdline);
     entry->next = NULL;
     
-    /* Get command */
-    if (proc_read_cmdline(pid, entry->cmd, sizeof(entry->cmd)) < 0) {
-        proc_read_comm(pid, entry->cmd, sizeof(entry->cmd));
-    }
-    
     insert_hash(priv->current, entry);
     
-    int64_t rss_delta = 0;
-    int64_t data_delta = 0;
-    
     /* Calculate delta if we have previous data */
     if (priv->has_previous) {
         proc_entry_t *prev = find_in_hash(priv->previous, pid);
         if (prev) {
-            rss_delta = rss_kb - prev->rss_kb;
-            data_delta = data_kb - prev->data_kb;
+            entry->rss_delta_kb = rss_kb - prev->rss_kb;
+            entry->data_delta_kb = data_kb - prev->data_kb;
         }
     }
 
     /* Always add to changes list (limited by max_changes) */
     if (ctx->change_count < ctx->max_changes) {
-        procmem_entry_t *e = &ctx->changes[ctx->change_count++];
-        e->pid = pid;
-        snprintf(e->cmd, sizeof(e->cmd), "%s", entry->cmd);
-        e->rss_kb = rss_kb;
-        e->data_kb = data_kb;
-        e->rss_delta_kb = rss_delta;
-        e->data_delta_kb = data_delta;
+        ctx->changes[ctx->change_count++] = entry;
     }
     
     return true;
 }
 
 static int compare_rss_grower(const void *a, const void *b) {
-    const procmem_entry_t *ea = (const procmem_entry_t *)a;
-    const procmem_entry_t *eb = (const procmem_entry_t *)b;
+    const proc_entry_t *ea = *(const proc_entry_t *const *)a;
+    const proc_entry_t *eb = *(const proc_entry_t *const *)b;
     if (eb->rss_delta_kb > ea->rss_delta_kb) return 1;
     if (eb->rss_delta_kb < ea->rss_delta_kb) return -1;
     return 0;
 }
 
 static int compare_rss_shrinker(const void *a, const void *b) {
-    const procmem_entry_t *ea = (const procmem_entry_t *)a;
-    const procmem_entry_t *eb = (const procmem_entry_t *)b;
+    const proc_entry_t *ea = *(const proc_entry_t *const *)a;
+    const proc_entry_t *eb = *(const proc_entry_t *const *)b;
     if (ea->rss_delta_kb < eb->rss_delta_kb) return -1;
     if (ea->rss_delta_kb > eb->rss_delta_kb) return 1;
     return 0;
 }
 
 static int compare_rss_abs(const void *a, const void *b) {
-    const procmem_entry_t *ea = (const procmem_entry_t *)a;
-    const procmem_entry_t *eb = (const procmem_entry_t *)b;
+    const proc_entry_t *ea = *(const proc_entry_t *const *)a;
+    const proc_entry_t *eb = *(const proc_entry_t *const *)b;
     if (eb->rss_kb > ea->rss_kb) return 1;
     if (eb->rss_kb < ea->rss_kb) return -1;
     return 0;
@@ -176,13 +187,19 @@ static int compare_rss_abs(const void *a, const void *b) {
 static int procmem_collect(qmem_service_t *svc) {
     procmem_priv_t *priv = (procmem_priv_t *)svc->priv;
     
-    /* Swap current to previous */
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) {
+        return -1;
+    }
+    
+    /* Swap current to previous; the older half is reused for this sample */
     memcpy(priv->previous, priv->current, sizeof(priv->previous));
     clear_hash(priv->current);
-    priv->pool_idx = 0;
+    priv->pool_half ^= 1;
+    reset_pool_half(priv, priv->pool_half);
     
     /* Collect all processes */
-    procmem_entry_t all_changes[MAX_PROCS];
+    proc_entry_t *all_changes[MAX_PROCS];
     collect_ctx_t ctx = {
         .priv = priv,
         .changes = all_changes,
@@ -190,31 +207,31 @@ static int procmem_collect(qmem_service_t *svc) {
         .max_changes = MAX_PROCS,
     };
     
-    proc_iterate_pids(collect_callback, &ctx);
+    proc_table_foreach(table, collect_callback, &ctx);
     
     /* Sort and take top growers */
-    qsort(all_changes, ctx.change_count, sizeof(procmem_entry_t), compare_rss_grower);
+    qsort(all_changes, ctx.change_count, sizeof(proc_entry_t *), compare_rss_grower);
     priv->grower_count = 0;
     for (int i = 0; i < ctx.change_count && priv->grower_count < TOP_N; i++) {
-        if (all_changes[i].rss_delta_kb > 0) {
-            priv->growers[priv->grower_count++] = all_changes[i];
+        if (all_changes[i]->rss_delta_kb > 0) {
+            fill_entry(&priv->growers[priv->grower_count++], all_changes[i]);
         }
     }
     
     /* Sort and take top shrinkers */
-    qsort(all_changes, ctx.change_count, sizeof(procmem_entry_t), compare_rss_shrinker);
+    qsort(all_changes, ctx.change_count, sizeof(proc_entry_t *), compare_rss_shrinker);
     priv->shrinker_count = 0;
     for (int i = 0; i < ctx.change_count && priv->shrinker_count < TOP_N; i++) {
-        if (all_changes[i].rss_delta_kb < 0) {
-            priv->shrinkers[priv->shrinker_count++] = all_changes[i];
+        if (all_changes[i]->rss_delta_kb < 0) {
+            fill_entry(&priv->shrinkers[priv->shrinker_count++], all_changes[i]);
         }
     }
     
     /* Sort and take top absolute RSS (Using simple descending sort on rss_kb) */
-    qsort(all_changes, ctx.change_count, sizeof(procmem_entry_t), compare_rss_abs);
+    qsort(all_changes, ctx.change_count, sizeof(proc_entry_t *), compare_rss_abs);
     priv->top_rss_count = 0;
     for (int i = 0; i < ctx.change_count && priv->top_rss_count < TOP_N; i++) {
-        priv->top_rss[priv->top_rss_count++] = all_changes[i];
+        fill_entry(&priv->top_rss[priv->top_rss_count++], all_changes[i]);
     }
     
     priv->has_previous = true;
@@ -276,7 +293,12 @@ static int procmem_snapshot(qmem_service_t *svc, json_builder_t *j) {
 }
 
 static void procmem_destroy(qmem_service_t *svc) {
-    (void)svc;
+    procmem_priv_t *priv = (procmem_priv_t *)svc->priv;
+    
+    if (priv) {
+        reset_pool_half(priv, 0);
+        reset_pool_half(priv, 1);
+    }
     log_debug("procmem service destroyed");
 }
 
@@ -294,6 +316,7 @@ qmem_service_t procmem_service = {
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STATM | PROC_FIELD_CMDLINE,
 };
 
 #ifndef NO_PLUGIN_DEFINE
@@ -323,24 +346,9 @@ int procmem_get_top_rss(procmem_entry_t *entries, int max_entries) {
 
 int procmem_get_pid_info(pid_t pid, procmem_entry_t *info) {
     if (!info) return -1;
-    procmem_priv_t *priv = &g_procmem;
-    proc_entry_t *e = find_in_hash(priv->current, pid);
+    proc_entry_t *e = find_in_hash(g_procmem.current, pid);
     if (!e) return -1;
     
-    info->pid = e->pid;
-    snprintf(info->cmd, sizeof(info->cmd), "%s", e->cmd);
-    info->rss_kb = e->rss_kb;
-    info->data_kb = e->data_kb;
-    
-    /* Calculate delta */
-    info->rss_delta_kb = 0;
-    info->data_delta_kb = 0;
-    if (priv->has_previous) {
-        proc_entry_t *prev = find_in_hash(priv->previous, pid);
-        if (prev) {
-            info->rss_delta_kb = e->rss_kb - prev->rss_kb;
-            info->data_delta_kb = e->data_kb - prev->data_kb;
-        }
-    }
+    fill_entry(info, e);
     return 0;
 }
@@ -109,85 +109,84 @@ static int read_wchan(pid_t pid, pid_t tid, char *wchan, size_t size) {
     return 0;
 }
 
-static int procstat_collect(qmem_service_t *svc) {
-    procstat_priv_t *priv = (procstat_priv_t *)svc->priv;
+static bool collect_callback(const proc_record_t *rec, void *userdata) {
+    procstat_priv_t *priv = (procstat_priv_t *)userdata;
     
-    /* Reset counters */
-    memset(&priv->summary, 0, sizeof(priv->summary));
-    priv->blocked_count = 0;
+    if (!(rec->fields & PROC_FIELD_STAT)) {
+        return true;
+    }
     
-    DIR *proc_dir = opendir("/proc");
-    if (!proc_dir) return -1;
+    pid_t pid = rec->pid;
+    char state = rec->state;
     
-    struct dirent *ent;
-    while ((ent = readdir(proc_dir)) != NULL) {
-        /* Skip non-numeric entries */
-        if (!isdigit(ent->d_name[0])) continue;
-        
-        pid_t pid = atoi(ent->d_name);
-        char state;
-        char cmd[128];
-        
-        if (read_proc_state(pid, 0, &state, cmd, sizeof(cmd)) < 0) {
-            continue;
-        }
-        
-        priv->summary.total++;
+    priv->summary.total++;
+    
+    switch (state) {
+        case 'R': priv->summary.running++; break;
+        case 'S': priv->summary.sleeping++; break;
+        case 'D': priv->summary.disk_sleep++; break;
+        case 'Z': priv->summary.zombie++; break;
+        case 'T':
+        case 't': priv->summary.stopped++; break;
+    }
+    
+    /* Track blocked (D state) processes with details */
+    if (state == 'D' && priv->blocked_count < MAX_BLOCKED) {
+        procstat_entry_t *e = &priv->blocked[priv->blocked_count++];
+        e->pid = pid;
+        e->tid = pid;
+        snprintf(e->cmd, sizeof(e->cmd), "%s", rec->comm);
+        e->state = state;
+        e->state_desc = state_to_desc(state);
+        e->is_blocked = true;
         
-        switch (state) {
-            case 'R': priv->summary.running++; break;
-            case 'S': priv->summary.sleeping++; break;
-            case 'D': priv->summary.disk_sleep++; break;
-            case 'Z': priv->summary.zombie++; break;
-            case 'T':
-            case 't': priv->summary.stopped++; break;
-        }
+        read_wchan(pid, 0, e->wchan, sizeof(e->wchan));
         
-        /* Track blocked (D state) processes with details */
-        if (state == 'D' && priv->blocked_count < MAX_BLOCKED) {
-            procstat_entry_t *e = &priv->blocked[priv->blocked_count++];
-            e->pid = pid;
-            e->tid = pid;
-            snprintf(e->cmd, sizeof(e->cmd), "%s", cmd);
-            e->state = state;
-            e->state_desc = state_to_desc(state);
-            e->is_blocked = true;
-            
-            read_wchan(pid, 0, e->wchan, sizeof(e->wchan));
-            
-            /* Also check threads for this process */
-            char task_path[128];
-            snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
-            DIR *task_dir = opendir(task_path);
-            if (task_dir) {
-                struct dirent *task_ent;
-                while ((task_ent = readdir(task_dir)) != NULL) {
-                    if (!isdigit(task_ent->d_name[0])) continue;
-                    
-                    pid_t tid = atoi(task_ent->d_name);
-                    if (tid == pid) continue;  /* Skip main thread, already counted */
-                    
-                    char thread_state;
-                    char thread_cmd[128];
-                    if (read_proc_state(pid, tid, &thread_state, thread_cmd, sizeof(thread_cmd)) == 0) {
-                        if (thread_state == 'D' && priv->blocked_count < MAX_BLOCKED) {
-                            procstat_entry_t *te = &priv->blocked[priv->blocked_count++];
-                            te->pid = pid;
-                            te->tid = tid;
-                            snprintf(te->cmd, sizeof(te->cmd), "%s", thread_cmd);
-                            te->state = thread_state;
-                            te->state_desc = state_to_desc(thread_state);
-                            te->is_blocked = true;
-                            read_wchan(pid, tid, te->wchan, sizeof(te->wchan));
-                        }
+        /* Also check threads for this process */
+        char task_path[128];
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+        DIR *task_dir = opendir(task_path);
+        if (task_dir) {
+            struct dirent *task_ent;
+            while ((task_ent = readdir(task_dir)) != NULL) {
+                if (!isdigit(task_ent->d_name[0])) continue;
+                
+                pid_t tid = atoi(task_ent->d_name);
+                if (tid == pid) continue;  /* Skip main thread, already counted */
+                
+                char thread_state;
+                char thread_cmd[128];
+                if (read_proc_state(pid, tid, &thread_state, thread_cmd, sizeof(thread_cmd)) == 0) {
+                    if (thread_state == 'D' && priv->blocked_count < MAX_BLOCKED) {
+                        procstat_entry_t *te = &priv->blocked[priv->blocked_count++];
+                        te->pid = pid;
+                        te->tid = tid;
+                        snprintf(te->cmd, sizeof(te->cmd), "%s", thread_cmd);
+                        te->state = thread_state;
+                        te->state_desc = state_to_desc(thread_state);
+                        te->is_blocked = true;
+                        read_wchan(pid, tid, te->wchan, sizeof(te->wchan));
                     }
                 }
-                closedir(task_dir);
             }
+            closedir(task_dir);
         }
     }
     
-    closedir(proc_dir);
+    return true;
+}
+
+static int procstat_collect(qmem_service_t *svc) {
+    procstat_priv_t *priv = (procstat_priv_t *)svc->priv;
+    
+    /* Reset counters */
+    memset(&priv->summary, 0, sizeof(priv->summary));
+    priv->blocked_count = 0;
+    
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) return -1;
+    
+    proc_table_foreach(table, collect_callback, priv);
     return 0;
 }
 
@@ -245,6 +244,7 @@ qmem_service_t procstat_service = {
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_STAT,
 };
 
 QMEM_PLUGIN_DEFINE("procstat", "1.0", "Process status monitor", procstat_service);
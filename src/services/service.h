@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include "common/json.h"
+#include "common/proc_utils.h"
 
 /* Forward declarations */
 typedef struct qmem_config qmem_config_t;
@@ -41,6 +42,8 @@ struct qmem_service {
     void *priv;                 /* Service-private data */
     bool enabled;
     int collect_count;          /* Number of collections performed */
+    unsigned int proc_fields;   /* PROC_FIELD_* needed from the shared walk */
+    const proc_table_t *proc_table; /* Shared table, valid during collect */
 };
 
 /* Macro to define a service */
@@ -52,6 +55,8 @@ struct qmem_service {
         .priv = NULL, \
         .enabled = true, \
         .collect_count = 0, \
+        .proc_fields = 0, \
+        .proc_table = NULL, \
     }
 
 /* Service initialization helpers */
@@ -1,5 +1,12 @@
 /*
  * sockstat.c - Socket statistics monitor
+ *
+ * Sockets are dumped over NETLINK_SOCK_DIAG (inet_diag for TCP/UDP over
+ * IPv4 and IPv6, unix_diag for Unix sockets). If the kernel lacks
+ * sock_diag support, /proc/net/{tcp,tcp6,udp,udp6,unix} are parsed
+ * instead. Other dump failures (a timeout, an overrun) use /proc/net for
+ * a few collections and then try sock_diag again, backing off while the
+ * failures repeat.
  */
 #define _POSIX_C_SOURCE 200809L
 #include "sockstat.h"
@@ -9,13 +16,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
 #include <qmem/plugin.h>
 
 #define MAX_SOCKETS 1024
+#define INODE_HASH_SIZE (MAX_SOCKETS * 2)   /* Power of two, load <= 0.5 */
+#define DIAG_BUF_SIZE 32768
+#define DIAG_BACKOFF_MAX 64                 /* Collections */
+
+/* TCP states to dump: ESTABLISHED..CLOSING plus NEW_SYN_RECV requests */
+#define DIAG_TCP_STATES (((1u << SOCK_CLOSING) - 1) << 1 | (1u << (SOCK_CLOSING + 1)))
+#define DIAG_ALL_STATES 0xffffffffu
 
 typedef struct {
     sockstat_summary_t summary;
@@ -23,103 +43,267 @@ typedef struct {
     socket_entry_t sockets[MAX_SOCKETS];
     int socket_count;
     bool has_previous;
+    
+    /* Socket inode -> sockets[] index + 1 (0: empty), rebuilt each collect */
+    uint16_t inode_index[INODE_HASH_SIZE];
+    
+    /* sock_diag socket, -1 when falling back to /proc */
+    int diag_fd;
+    uint32_t diag_seq;
+    int diag_backoff;                   /* Collections to skip per failure, 0 if healthy */
+    int diag_skip;                      /* Collections left before retrying */
 } sockstat_priv_t;
 
 static sockstat_priv_t g_sockstat;
 
+static int diag_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    /* Never stall a collection on a missing reply */
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+/* Drop sock_diag for good if the kernel refuses it, else retry later */
+static void diag_failed(sockstat_priv_t *priv, const char *what) {
+    int err = errno;
+    
+    if (err == EPROTONOSUPPORT || err == EOPNOTSUPP || err == ENOENT ||
+        err == EPERM || err == EACCES) {
+        log_warn("sockstat: sock_diag %s dump failed (%s), using /proc/net", what, strerror(err));
+        close(priv->diag_fd);
+        priv->diag_fd = -1;
+        return;
+    }
+    
+    if (priv->diag_backoff == 0) {
+        log_warn("sockstat: sock_diag %s dump failed (%s), using /proc/net until it recovers",
+                 what, strerror(err));
+    }
+    priv->diag_backoff = priv->diag_backoff ? priv->diag_backoff * 2 : 1;
+    if (priv->diag_backoff > DIAG_BACKOFF_MAX) priv->diag_backoff = DIAG_BACKOFF_MAX;
+    priv->diag_skip = priv->diag_backoff;
+}
+
 static int sockstat_init(qmem_service_t *svc, const qmem_config_t *cfg) {
     (void)cfg;
     memset(&g_sockstat, 0, sizeof(g_sockstat));
+    g_sockstat.diag_fd = diag_open();
     svc->priv = &g_sockstat;
-    log_debug("sockstat service initialized");
+    log_debug("sockstat service initialized (%s backend)",
+              g_sockstat.diag_fd >= 0 ? "sock_diag" : "/proc");
+    return 0;
+}
+
+static void count_tcp_state(sockstat_priv_t *priv, unsigned int state) {
+    priv->summary.tcp_total++;
+    switch (state) {
+        case SOCK_ESTABLISHED: priv->summary.tcp_established++; break;
+        case SOCK_TIME_WAIT: priv->summary.tcp_time_wait++; break;
+        case SOCK_CLOSE_WAIT: priv->summary.tcp_close_wait++; break;
+        case SOCK_LISTEN: priv->summary.tcp_listen++; break;
+    }
+}
+
+/* Store a detailed TCP entry, or NULL once the list is full */
+static socket_entry_t *add_socket(sockstat_priv_t *priv) {
+    if (priv->socket_count >= MAX_SOCKETS) return NULL;
+    
+    socket_entry_t *s = &priv->sockets[priv->socket_count++];
+    s->pid = 0;
+    s->cmd[0] = '\0';
+    return s;
+}
+
+static void format_endpoint(int family, const void *addr, uint16_t port,
+                            char *out_buf, size_t size) {
+    char ip[INET6_ADDRSTRLEN];
+    
+    if (!inet_ntop(family, addr, ip, sizeof(ip))) {
+        snprintf(out_buf, size, "?:%u", port);
+    } else if (family == AF_INET6) {
+        snprintf(out_buf, size, "[%s]:%u", ip, port);
+    } else {
+        snprintf(out_buf, size, "%s:%u", ip, port);
+    }
+}
+
+/*
+ * sock_diag backend
+ */
+
+typedef void (*diag_handler_t)(sockstat_priv_t *priv, const struct nlmsghdr *h);
+
+/* Send one dump request and feed every reply message to handler */
+static int diag_dump(sockstat_priv_t *priv, const void *req, size_t req_len,
+                     diag_handler_t handler) {
+    struct nlmsghdr nlh = {
+        .nlmsg_len = NLMSG_LENGTH(req_len),
+        .nlmsg_type = SOCK_DIAG_BY_FAMILY,
+        .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+        .nlmsg_seq = ++priv->diag_seq,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &nlh, .iov_len = sizeof(nlh) },
+        { .iov_base = (void *)req, .iov_len = req_len },
+    };
+    struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+    struct msghdr msg = {
+        .msg_name = &nladdr,
+        .msg_namelen = sizeof(nladdr),
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+    
+    if (sendmsg(priv->diag_fd, &msg, 0) < 0) {
+        return -1;
+    }
+    
+    static uint32_t buf[DIAG_BUF_SIZE / sizeof(uint32_t)];
+    
+    for (;;) {
+        ssize_t n = recv(priv->diag_fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        
+        int len = (int)n;
+        for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+             NLMSG_OK(h, (unsigned int)len); h = NLMSG_NEXT(h, len)) {
+            if (h->nlmsg_seq != priv->diag_seq) continue;
+            
+            if (h->nlmsg_type == NLMSG_DONE) {
+                return 0;
+            }
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = NLMSG_DATA(h);
+                errno = err->error ? -err->error : EPROTO;
+                return -1;
+            }
+            handler(priv, h);
+        }
+    }
+}
+
+static void tcp_handler(sockstat_priv_t *priv, const struct nlmsghdr *h) {
+    const struct inet_diag_msg *m = NLMSG_DATA(h);
+    
+    count_tcp_state(priv, m->idiag_state);
+    
+    socket_entry_t *s = add_socket(priv);
+    if (!s) return;
+    
+    format_endpoint(m->idiag_family, m->id.idiag_src, ntohs(m->id.idiag_sport),
+                    s->local_addr, sizeof(s->local_addr));
+    format_endpoint(m->idiag_family, m->id.idiag_dst, ntohs(m->id.idiag_dport),
+                    s->rem_addr, sizeof(s->rem_addr));
+    s->state = m->idiag_state;
+    s->tx_queue = m->idiag_wqueue;
+    s->rx_queue = m->idiag_rqueue;
+    s->uid = m->idiag_uid;
+    s->inode = m->idiag_inode;
+}
+
+static void udp_handler(sockstat_priv_t *priv, const struct nlmsghdr *h) {
+    (void)h;
+    priv->summary.udp_total++;
+}
+
+static void unix_handler(sockstat_priv_t *priv, const struct nlmsghdr *h) {
+    (void)h;
+    priv->summary.unix_total++;
+}
+
+static int diag_dump_inet(sockstat_priv_t *priv, int family, int protocol,
+                          uint32_t states, diag_handler_t handler) {
+    struct inet_diag_req_v2 req = {
+        .sdiag_family = family,
+        .sdiag_protocol = protocol,
+        .idiag_states = states,
+    };
+    return diag_dump(priv, &req, sizeof(req), handler);
+}
+
+static int diag_collect(sockstat_priv_t *priv) {
+    if (diag_dump_inet(priv, AF_INET, IPPROTO_TCP, DIAG_TCP_STATES, tcp_handler) < 0 ||
+        diag_dump_inet(priv, AF_INET6, IPPROTO_TCP, DIAG_TCP_STATES, tcp_handler) < 0) {
+        diag_failed(priv, "tcp");
+        return -1;
+    }
+    
+    if (diag_dump_inet(priv, AF_INET, IPPROTO_UDP, DIAG_ALL_STATES, udp_handler) < 0 ||
+        diag_dump_inet(priv, AF_INET6, IPPROTO_UDP, DIAG_ALL_STATES, udp_handler) < 0) {
+        diag_failed(priv, "udp");
+        return -1;
+    }
+    
+    struct unix_diag_req req = {
+        .sdiag_family = AF_UNIX,
+        .udiag_states = DIAG_ALL_STATES,
+    };
+    if (diag_dump(priv, &req, sizeof(req), unix_handler) < 0) {
+        diag_failed(priv, "unix");
+        return -1;
+    }
+    
     return 0;
 }
 
+/*
+ * /proc/net fallback
+ */
+
 static int count_lines(const char *path, int skip_header) {
-    char buf[65536];
-    if (proc_read_file(path, buf, sizeof(buf)) < 0) return 0;
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
     
+    char line[512];
     int count = 0;
     int skipped = 0;
-    char *line = buf;
     
-    while (*line) {
+    while (fgets(line, sizeof(line), f)) {
+        /* Count each line once, however long */
+        if (!strchr(line, '\n') && !feof(f)) continue;
+        
         if (skipped >= skip_header) {
             count++;
         } else {
             skipped++;
         }
-        char *nl = strchr(line, '\n');
-        if (!nl) break;
-        line = nl + 1;
     }
+    
+    fclose(f);
     return count;
 }
 
+/* Decode "0100007F:0016" (IPv4) or 32-hex-digit (IPv6) /proc/net addresses */
 static void parse_address(const char *hex_addr, char *out_buf, size_t size) {
-    unsigned int addr, port;
-    if (sscanf(hex_addr, "%X:%X", &addr, &port) == 2) {
-        struct in_addr in;
-        in.s_addr = addr;
-        snprintf(out_buf, size, "%s:%u", inet_ntoa(in), port);
-    } else {
-        /* Try IPv6? For now just copy raw */
-        strncpy(out_buf, hex_addr, size - 1);
-        out_buf[size - 1] = '\0';
-    }
-}
-
-static void map_inodes_to_pids(sockstat_priv_t *priv) {
-    DIR *proc = opendir("/proc");
-    if (!proc) return;
+    unsigned int words[4], port;
     
-    struct dirent *ent;
-    while ((ent = readdir(proc)) != NULL) {
-        if (!isdigit(ent->d_name[0])) continue;
-        
-        pid_t pid = atoi(ent->d_name);
-        char fd_path[64];
-        snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
-        
-        DIR *fd_dir = opendir(fd_path);
-        if (!fd_dir) continue;
-        
-        struct dirent *fd_ent;
-        while ((fd_ent = readdir(fd_dir)) != NULL) {
-            if (fd_ent->d_name[0] == '.') continue;
-            
-            char link_path[512];
-            snprintf(link_path, sizeof(link_path), "%s/%s", fd_path, fd_ent->d_name);
-            
-            char target[128];
-            ssize_t len = readlink(link_path, target, sizeof(target) - 1);
-            if (len > 0) {
-                target[len] = '\0';
-                if (strncmp(target, "socket:[", 8) == 0) {
-                    uint32_t inode = (uint32_t)strtoul(target + 8, NULL, 10);
-                    
-                    /* Check if this inode is in our list */
-                    for (int i = 0; i < priv->socket_count; i++) {
-                        if (priv->sockets[i].inode == inode) {
-                            priv->sockets[i].pid = pid;
-                            
-                            /* Get command name */
-                            char cmd_path[64];
-                            snprintf(cmd_path, sizeof(cmd_path), "/proc/%d/comm", pid);
-                            char cmd[16];
-                            if (proc_read_file(cmd_path, cmd, sizeof(cmd)) > 0) {
-                                char *nl = strchr(cmd, '\n');
-                                if (nl) *nl = '\0';
-                                snprintf(priv->sockets[i].cmd, sizeof(priv->sockets[i].cmd), "%s", cmd);
-                            }
-                        }
-                    }
-                }
-            }
+    if (sscanf(hex_addr, "%8X%8X%8X%8X:%X", &words[0], &words[1], &words[2], &words[3], &port) == 5) {
+        /* Each 32-bit word is printed in host byte order */
+        struct in6_addr in6;
+        for (int i = 0; i < 4; i++) {
+            uint32_t w = words[i];
+            memcpy(&in6.s6_addr[i * 4], &w, sizeof(w));
         }
-        closedir(fd_dir);
+        format_endpoint(AF_INET6, &in6, port, out_buf, size);
+    } else if (sscanf(hex_addr, "%X:%X", &words[0], &port) == 2) {
+        struct in_addr in;
+        in.s_addr = words[0];
+        format_endpoint(AF_INET, &in, port, out_buf, size);
+    } else {
+        snprintf(out_buf, size, "%s", hex_addr);
     }
-    closedir(proc);
 }
 
 static int parse_tcp_detailed(const char *path, sockstat_priv_t *priv) {
@@ -133,7 +317,7 @@ static int parse_tcp_detailed(const char *path, sockstat_priv_t *priv) {
         return -1;
     }
     
-    while (fgets(line, sizeof(line), f) && priv->socket_count < MAX_SOCKETS) {
+    while (fgets(line, sizeof(line), f)) {
         unsigned int sl, state, tx_q, rx_q, timer_active, timer_len, uid, timeout, inode;
         char local_addr_hex[64], rem_addr_hex[64];
         unsigned long retrans;
@@ -148,24 +332,19 @@ static int parse_tcp_detailed(const char *path, sockstat_priv_t *priv) {
                    &tx_q, &rx_q, &timer_active, &timer_len, &retrans, &uid, &timeout, &inode) >= 12) {
             
             /* Update summary */
-            priv->summary.tcp_total++;
-            switch (state) {
-                case SOCK_ESTABLISHED: priv->summary.tcp_established++; break;
-                case SOCK_TIME_WAIT: priv->summary.tcp_time_wait++; break;
-                case SOCK_CLOSE_WAIT: priv->summary.tcp_close_wait++; break;
-                case SOCK_LISTEN: priv->summary.tcp_listen++; break;
-            }
+            count_tcp_state(priv, state);
             
             /* Store detailed info */
-            socket_entry_t *s = &priv->sockets[priv->socket_count++];
+            socket_entry_t *s = add_socket(priv);
+            if (!s) continue;
+            
             parse_address(local_addr_hex, s->local_addr, sizeof(s->local_addr));
             parse_address(rem_addr_hex, s->rem_addr, sizeof(s->rem_addr));
             s->state = state;
             s->tx_queue = tx_q;
             s->rx_queue = rx_q;
+            s->uid = uid;
             s->inode = inode;
-            s->pid = 0;
-            s->cmd[0] = '\0';
         }
     }
     
@@ -173,6 +352,74 @@ static int parse_tcp_detailed(const char *path, sockstat_priv_t *priv) {
     return 0;
 }
 
+static void proc_collect(sockstat_priv_t *priv) {
+    /* Parse TCP sockets */
+    parse_tcp_detailed("/proc/net/tcp", priv);
+    parse_tcp_detailed("/proc/net/tcp6", priv);
+    
+    /* Count others */
+    priv->summary.udp_total = count_lines("/proc/net/udp", 1) + 
+                              count_lines("/proc/net/udp6", 1);
+    
+    priv->summary.unix_total = count_lines("/proc/net/unix", 1);
+}
+
+static unsigned int inode_slot(uint32_t inode) {
+    return (inode * 2654435761u) & (INODE_HASH_SIZE - 1);
+}
+
+static void build_inode_index(sockstat_priv_t *priv) {
+    memset(priv->inode_index, 0, sizeof(priv->inode_index));
+    
+    for (int i = 0; i < priv->socket_count; i++) {
+        /* TIME_WAIT and orphaned sockets have no inode and no owner */
+        if (priv->sockets[i].inode == 0) continue;
+    
+        unsigned int slot = inode_slot(priv->sockets[i].inode);
+        while (priv->inode_index[slot]) {
+            slot = (slot + 1) & (INODE_HASH_SIZE - 1);
+        }
+        priv->inode_index[slot] = (uint16_t)(i + 1);
+    }
+}
+
+static socket_entry_t *find_socket(sockstat_priv_t *priv, uint32_t inode) {
+    if (inode == 0) return NULL;
+    
+    unsigned int slot = inode_slot(inode);
+    
+    while (priv->inode_index[slot]) {
+        socket_entry_t *s = &priv->sockets[priv->inode_index[slot] - 1];
+        if (s->inode == inode) {
+            return s;
+        }
+        slot = (slot + 1) & (INODE_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+static bool map_inodes_callback(const proc_record_t *rec, void *userdata) {
+    sockstat_priv_t *priv = (sockstat_priv_t *)userdata;
+    
+    for (int k = 0; k < rec->socket_count; k++) {
+        socket_entry_t *s = find_socket(priv, rec->socket_inodes[k]);
+        if (s) {
+            s->pid = rec->pid;
+            snprintf(s->cmd, sizeof(s->cmd), "%s", rec->comm);
+        }
+    }
+    
+    return true;
+}
+
+static void map_inodes_to_pids(qmem_service_t *svc, sockstat_priv_t *priv) {
+    const proc_table_t *table = proc_table_get(svc->proc_table, svc->proc_fields);
+    if (!table) return;
+    
+    build_inode_index(priv);
+    proc_table_foreach(table, map_inodes_callback, priv);
+}
+
 static int sockstat_collect(qmem_service_t *svc) {
     sockstat_priv_t *priv = (sockstat_priv_t *)svc->priv;
     
@@ -183,17 +430,26 @@ static int sockstat_collect(qmem_service_t *svc) {
     memset(&priv->summary, 0, sizeof(priv->summary));
     priv->socket_count = 0;
     
-    /* Parse TCP sockets */
-    parse_tcp_detailed("/proc/net/tcp", priv);
-    
-    /* Map IDs */
-    map_inodes_to_pids(priv);
+    bool diag_ok = false;
+    if (priv->diag_fd >= 0) {
+        if (priv->diag_skip > 0) {
+            priv->diag_skip--;
+        } else if (diag_collect(priv) == 0) {
+            if (priv->diag_backoff) log_info("sockstat: sock_diag recovered");
+            priv->diag_backoff = 0;
+            diag_ok = true;
+        }
+    }
     
-    /* Count others */
-    priv->summary.udp_total = count_lines("/proc/net/udp", 1) + 
-                              count_lines("/proc/net/udp6", 1);
+    if (!diag_ok) {
+        /* Discard any partial netlink results */
+        memset(&priv->summary, 0, sizeof(priv->summary));
+        priv->socket_count = 0;
+        proc_collect(priv);
+    }
     
-    priv->summary.unix_total = count_lines("/proc/net/unix", 1);
+    /* Map IDs */
+    map_inodes_to_pids(svc, priv);
     
     return 0;
 }
@@ -219,6 +475,7 @@ static int sockstat_snapshot(qmem_service_t *svc, json_builder_t *j) {
     json_kv_int(j, "udp_total_delta", priv->summary.udp_total - priv->previous_summary.udp_total);
     json_kv_int(j, "unix_total", priv->summary.unix_total);
     json_kv_int(j, "unix_total_delta", priv->summary.unix_total - priv->previous_summary.unix_total);
+    json_kv_string(j, "backend", priv->diag_fd >= 0 && priv->diag_backoff == 0 ? "sock_diag" : "proc");
     
     /* Add detailed sockets list */
     json_key(j, "sockets");
@@ -231,6 +488,7 @@ static int sockstat_snapshot(qmem_service_t *svc, json_builder_t *j) {
         json_kv_int(j, "state", s->state);
         json_kv_uint(j, "tx_q", s->tx_queue);
         json_kv_uint(j, "rx_q", s->rx_queue);
+        json_kv_uint(j, "uid", s->uid);
         json_kv_uint(j, "inode", s->inode);
         if (s->pid > 0) {
             json_kv_int(j, "pid", s->pid);
@@ -245,7 +503,12 @@ static int sockstat_snapshot(qmem_service_t *svc, json_builder_t *j) {
 }
 
 static void sockstat_destroy(qmem_service_t *svc) {
-    (void)svc;
+    sockstat_priv_t *priv = (sockstat_priv_t *)svc->priv;
+    
+    if (priv && priv->diag_fd >= 0) {
+        close(priv->diag_fd);
+        priv->diag_fd = -1;
+    }
     log_debug("sockstat service destroyed");
 }
 
@@ -258,11 +521,12 @@ static const qmem_service_ops_t sockstat_ops = {
 
 qmem_service_t sockstat_service = {
     .name = "sockstat",
-    .description = "Socket statistics from /proc/net/tcp,udp,unix",
+    .description = "Socket statistics via sock_diag or /proc/net",
     .ops = &sockstat_ops,
     .priv = NULL,
     .enabled = true,
     .collect_count = 0,
+    .proc_fields = PROC_FIELD_FD | PROC_FIELD_STAT,
 };
 
 QMEM_PLUGIN_DEFINE("sockstat", "1.0", "Socket statistics", sockstat_service);
@@ -41,6 +41,7 @@ typedef struct {
     uint32_t state;
     uint32_t tx_queue;
     uint32_t rx_queue;
+    uint32_t uid;
     uint32_t inode;
     pid_t pid;
     char cmd[16];
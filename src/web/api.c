@@ -4,22 +4,101 @@
 #include "api.h"
 #include "static_files.h"
 #include "common/log.h"
+#include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#define QUERY_BODY_SIZE (64 * 1024)            /* Initial capacity */
+#define QUERY_BODY_LIMIT (16 * 1024 * 1024)
+#define FIELDS_MAX SNAPSHOT_FIELDS_MAX
+#define PROJECTION_SIZE (16 * 1024)            /* Initial capacity */
+#define STREAM_FRAME_LIMIT (64 * 1024 * 1024)
 
 static api_snapshot_callback_t g_snapshot_cb = NULL;
+static api_query_callback_t g_query_cb = NULL;
 
 void api_set_snapshot_callback(api_snapshot_callback_t cb) {
     g_snapshot_cb = cb;
 }
 
-static void handle_api_status(const http_request_t *req, http_response_t *resp) {
-    (void)req;
+void api_set_query_callback(api_query_callback_t cb) {
+    g_query_cb = cb;
+}
+
+static void release_snapshot(const void *ref) {
+    snapshot_release((const snapshot_t *)ref);
+}
+
+static void release_buffer(const void *ref) {
+    free((void *)ref);
+}
+
+/* Copy a parameter of the query string into out, decoding %XX. False if absent */
+static bool query_param(const char *query, const char *key, char *out, size_t size) {
+    size_t key_len = strlen(key);
+    
+    const char *p = query;
+    while (p && *p) {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            size_t n = 0;
+            for (p += key_len + 1; *p && *p != '&' && n + 1 < size; p++) {
+                if (*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+                    char hex[3] = { p[1], p[2], '\0' };
+                    out[n++] = (char)strtol(hex, NULL, 16);
+                    p += 2;
+                } else {
+                    out[n++] = *p;
+                }
+            }
+            out[n] = '\0';
+            return true;
+        }
+        p = strchr(p, '&');
+        if (p) p++;
+    }
+    return false;
+}
+
+/* Only the requested parts of a snapshot, copied into a buffer of their own */
+static void send_projection(const snapshot_t *snap, const char *fields, http_response_t *resp) {
+    json_builder_t json;
+    json_init_growable(&json, NULL, PROJECTION_SIZE, QUERY_BODY_LIMIT);
+    snapshot_write_fields(&json, snap, fields);
     
+    if (json_error(&json)) {
+        free(json.buf);
+        resp->body = "{\"error\":\"Projection unavailable\"}";
+        resp->body_len = strlen(resp->body);
+        resp->content_type = "application/json";
+        resp->status_code = 503;
+        return;
+    }
+    
+    resp->body = json.buf;
+    resp->body_len = json_length(&json);
+    resp->body_release = release_buffer;
+    resp->body_ref = json.buf;
+    resp->content_type = "application/json";
+    resp->status_code = 200;
+}
+
+static void handle_api_status(const http_request_t *req, http_response_t *resp) {
     if (g_snapshot_cb) {
-        const char *snapshot = g_snapshot_cb();
-        if (snapshot) {
-            resp->body = snapshot;
-            resp->body_len = strlen(snapshot);
+        const snapshot_t *snap = g_snapshot_cb();
+        char fields[FIELDS_MAX];
+        if (snap && query_param(req->query, "fields", fields, sizeof(fields)) && fields[0]) {
+            send_projection(snap, fields, resp);
+            snapshot_release(snap);
+            return;
+        }
+        if (snap) {
+            /* Sent straight from the published buffer */
+            resp->body = snap->data;
+            resp->body_len = snap->len;
+            resp->body_release = release_snapshot;
+            resp->body_ref = snap;
             resp->content_type = "application/json";
             resp->status_code = 200;
             return;
@@ -31,6 +110,125 @@ static void handle_api_status(const http_request_t *req, http_response_t *resp)
     resp->status_code = 503;
 }
 
+static void handle_api_query(const http_request_t *req, http_response_t *resp) {
+    if (!g_query_cb) {
+        resp->body = "{\"error\":\"Query unavailable\"}";
+        resp->body_len = strlen(resp->body);
+        resp->content_type = "application/json";
+        resp->status_code = 503;
+        return;
+    }
+    
+    /* The body grows with the result instead of reserving the worst case */
+    json_builder_t json;
+    json_init_growable(&json, NULL, QUERY_BODY_SIZE, QUERY_BODY_LIMIT);
+    int ret = g_query_cb(req->query, &json);
+    
+    if (json_error(&json)) {
+        free(json.buf);
+        resp->body = "{\"error\":\"Result too large, narrow the range or lower points\"}";
+        resp->body_len = strlen(resp->body);
+        resp->content_type = "application/json";
+        resp->status_code = 413;
+        return;
+    }
+    
+    resp->body = json.buf;
+    resp->body_len = json_length(&json);
+    resp->body_release = release_buffer;
+    resp->body_ref = json.buf;
+    resp->content_type = "application/json";
+    resp->status_code = ret < 0 ? 400 : 200;
+}
+
+/*
+ * Event stream: a "snapshot" event with the whole (or projected) snapshot,
+ * then a "patch" event with a JSON merge patch (RFC 7396) after every
+ * publication that changed it. changes=0 sends snapshots throughout
+ */
+typedef struct {
+    char fields[FIELDS_MAX];            /* Projection, empty for everything */
+    bool changes;
+    uint64_t generation;                /* Last publication seen */
+    char *last;                         /* Document the client holds */
+    size_t last_len;
+    uint64_t last_generation;           /* Publication it was rendered from */
+} api_stream_t;
+
+/* Renderings shared by the streams of every HTTP worker */
+static snapshot_views_t g_stream_views = { .limit = STREAM_FRAME_LIMIT };
+static pthread_mutex_t g_stream_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stream_close(void *state) {
+    api_stream_t *st = state;
+    free(st->last);
+    free(st);
+}
+
+static int stream_update(http_stream_t *stream, void *state) {
+    api_stream_t *st = state;
+    const snapshot_t *snap = g_snapshot_cb ? g_snapshot_cb() : NULL;
+    if (!snap || snap->generation == st->generation) {
+        snapshot_release(snap);
+        return 0;
+    }
+    st->generation = snap->generation;
+    
+    /* Streams holding the same document share its rendering and patch */
+    pthread_mutex_lock(&g_stream_lock);
+    uint64_t base = st->changes && st->last ? st->last_generation : 0;
+    const snapshot_view_t *view = snapshot_view(&g_stream_views, snap, st->fields, base,
+                                                st->last, st->last_len);
+    
+    int ret = 0;
+    if (base && view->patch) {
+        if (view->changed) {
+            ret = http_stream_send(stream, "patch", view->patch, view->patch_len);
+        }
+    } else {
+        ret = http_stream_send(stream, "snapshot", view->frame, view->frame_len);
+    }
+    
+    /* Keep what the client now holds, to patch the next event against */
+    if (st->changes) {
+        char *last = realloc(st->last, view->frame_len);
+        if (last) {
+            memcpy(last, view->frame, view->frame_len);
+            st->last = last;
+            st->last_len = view->frame_len;
+            st->last_generation = snap->generation;
+        }
+    }
+    pthread_mutex_unlock(&g_stream_lock);
+    
+    snapshot_release(snap);
+    return ret;
+}
+
+static const http_stream_ops_t g_stream_ops = {
+    .update = stream_update,
+    .close = stream_close,
+};
+
+static void handle_api_stream(const http_request_t *req, http_response_t *resp) {
+    api_stream_t *st = calloc(1, sizeof(*st));
+    if (!st) {
+        resp->body = "{\"error\":\"Stream unavailable\"}";
+        resp->body_len = strlen(resp->body);
+        resp->content_type = "application/json";
+        resp->status_code = 503;
+        return;
+    }
+    
+    char changes[8];
+    query_param(req->query, "fields", st->fields, sizeof(st->fields));
+    st->changes = !query_param(req->query, "changes", changes, sizeof(changes)) ||
+                  strcmp(changes, "0") != 0;
+    
+    resp->stream = &g_stream_ops;
+    resp->stream_state = st;
+}
+
 static void handle_api_health(const http_request_t *req, http_response_t *resp) {
     (void)req;
     
@@ -41,9 +239,11 @@ static void handle_api_health(const http_request_t *req, http_response_t *resp)
 }
 
 void api_init(void) {
-    http_register_handler("/api/status", handle_api_status);
-    http_register_handler("/api/snapshot", handle_api_status);
+    http_register_snapshot_handler("/api/status", handle_api_status);
+    http_register_snapshot_handler("/api/snapshot", handle_api_status);
     http_register_handler("/api/health", handle_api_health);
+    http_register_handler("/api/query", handle_api_query);
+    http_register_snapshot_handler("/api/stream", handle_api_stream);
     
     /* Set static file handler as default */
     http_set_default_handler(static_files_handler);
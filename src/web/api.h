@@ -5,12 +5,18 @@
 #define QMEM_API_H
 
 #include "http_server.h"
+#include "daemon/snapshot.h"
+#include "common/json.h"
 
 /* Initialize API routes */
 void api_init(void);
 
-/* Set callback to get current snapshot */
-typedef const char *(*api_snapshot_callback_t)(void);
+/* Set callback to acquire current snapshot (released after the response is sent) */
+typedef const snapshot_t *(*api_snapshot_callback_t)(void);
 void api_set_snapshot_callback(api_snapshot_callback_t cb);
 
+/* Set callback to run a history query. Returns -1 on a bad query */
+typedef int (*api_query_callback_t)(const char *query, json_builder_t *json);
+void api_set_query_callback(api_query_callback_t cb);
+
 #endif /* QMEM_API_H */
@@ -1,37 +1,140 @@
 /*
  * http_server.c - Minimal embedded HTTP server implementation
+ *
+ * A few worker threads each run an epoll loop over non-blocking sockets.
+ * The listening socket is registered with every worker (EPOLLEXCLUSIVE),
+ * so a new connection wakes one of them, and that worker serves it until
+ * it closes; workers share nothing but the routes.
+ *
+ * Connections are kept alive (HTTP/1.1, or HTTP/1.0 asking for it) and
+ * may pipeline requests. Requests are parsed from a per-connection buffer
+ * as their bytes arrive and answered in order. Whatever the socket does
+ * not take at once is copied to a per-connection output queue, and while
+ * that queue is over its bound no further requests are read from the
+ * connection, so a slow reader only stalls itself. Idle connections are
+ * closed after a while, and so are those whose queued output the peer
+ * stopped taking.
+ *
+ * A handler may turn its connection into an event stream: every worker
+ * holds a publication descriptor (see snapshot.h), and after each
+ * publication the streams it serves are asked for their events. As with
+ * IPC subscriptions, a stream still sending its previous events is only
+ * updated once its queue drains, so slow readers skip publications.
+ *
+ * Routes registered as reading the snapshot never block a worker on a
+ * stale one either: the rebuild is requested and the connection is set
+ * aside until the publication wakes the worker (or
+ * SNAPSHOT_DEMAND_WAIT_MS passes), then the request is handled.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "http_server.h"
+#include "daemon/snapshot.h"
 #include "common/log.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <poll.h>
 
 #define MAX_ROUTES 32
-#define MAX_REQUEST_SIZE 65536
-#define MAX_RESPONSE_SIZE (1024 * 1024)
+#define MAX_WORKERS 16
+#define MAX_CONNECTIONS 1024            /* Across all workers */
+#define MAX_EVENTS 64
+#define MAX_REQUEST_SIZE 65536          /* Request line, headers and body */
+#define IN_BUF_SIZE 4096                /* Initial receive buffer, grown as needed */
+#define OUTPUT_QUEUE_MAX (1024 * 1024)  /* Queued response bytes per connection */
+#define IDLE_TIMEOUT 60                 /* Seconds a kept-alive connection may idle */
+#define STREAM_HEARTBEAT 15             /* Seconds between comments on a quiet stream */
+#define HELD_POLL_MS 50                 /* Loop timeout while requests are held back */
 
 typedef struct {
     char path[128];
     http_handler_t handler;
+    bool fresh;                         /* Reads the snapshot: wait for a stale one's rebuild */
 } route_t;
 
+/* Response bytes the socket has not taken yet */
+typedef struct out_chunk {
+    struct out_chunk *next;
+    size_t len;
+    size_t sent;
+    char data[];
+} out_chunk_t;
+
+struct http_worker;
+
+typedef struct http_conn {
+    struct http_conn *prev;
+    struct http_conn *next;
+    struct http_worker *worker;
+    int fd;
+    uint32_t events;                    /* Registered epoll events */
+    bool eof;                           /* Peer shut down its side */
+    bool closing;                       /* Close once the queue drains */
+    time_t last_active;
+    
+    /* Received bytes not yet handled */
+    char *in;
+    size_t in_len;
+    size_t in_size;
+    
+    out_chunk_t *out_head;
+    out_chunk_t *out_tail;
+    size_t out_bytes;
+    time_t out_progress;                /* Output last queued into an empty queue or sent */
+    
+    /* Request held back until a requested rebuild is published */
+    bool held;
+    bool rebuilt;                       /* Waited once: handle it with what is published */
+    uint64_t held_since;                /* Monotonic ms */
+    
+    /* Event stream, once a handler opened one */
+    const http_stream_ops_t *stream;
+    void *stream_state;
+    bool stream_pending;                /* A publication waits to be sent */
+} http_conn_t;
+
+typedef struct http_worker {
+    pthread_t thread;
+    int epoll_fd;
+    int publish_fd;                     /* Publications, tagged with the worker */
+    http_conn_t *conns;                 /* Open connections */
+    int held_count;                     /* Connections waiting for a rebuild */
+} http_worker_t;
+
+/* Parsed request line and headers, valid while the request is handled */
+typedef struct {
+    char method[16];
+    char path[1024];
+    char query[1024];
+    size_t header_len;                  /* Up to and including the blank line */
+    size_t content_length;
+    bool keep_alive;
+} request_head_t;
+
 static int g_server_fd = -1;
-static pthread_t g_server_thread;
 static volatile int g_running = 0;
+static http_worker_t g_workers[MAX_WORKERS];
+static int g_worker_count = 0;
+static atomic_int g_conn_count = 0;
 static route_t g_routes[MAX_ROUTES];
 static int g_route_count = 0;
 static http_handler_t g_default_handler = NULL;
 
-void http_register_handler(const char *path, http_handler_t handler) {
+static void add_route(const char *path, http_handler_t handler, bool fresh) {
     if (g_route_count >= MAX_ROUTES) {
         log_warn("Max routes reached");
         return;
@@ -40,21 +143,33 @@ void http_register_handler(const char *path, http_handler_t handler) {
     route_t *r = &g_routes[g_route_count++];
     strncpy(r->path, path, sizeof(r->path) - 1);
     r->handler = handler;
+    r->fresh = fresh;
+}
+
+void http_register_handler(const char *path, http_handler_t handler) {
+    add_route(path, handler, false);
+}
+
+void http_register_snapshot_handler(const char *path, http_handler_t handler) {
+    add_route(path, handler, true);
 }
 
 void http_set_default_handler(http_handler_t handler) {
     g_default_handler = handler;
 }
 
-static http_handler_t find_handler(const char *path) {
+static http_handler_t find_handler(const char *path, bool *fresh) {
+    *fresh = false;
     for (int i = 0; i < g_route_count; i++) {
         if (strcmp(g_routes[i].path, path) == 0) {
+            *fresh = g_routes[i].fresh;
             return g_routes[i].handler;
         }
         /* Check prefix match for api wildcard patterns */
         size_t len = strlen(g_routes[i].path);
         if (len > 0 && g_routes[i].path[len-1] == '*') {
             if (strncmp(path, g_routes[i].path, len - 1) == 0) {
+                *fresh = g_routes[i].fresh;
                 return g_routes[i].handler;
             }
         }
@@ -62,48 +177,197 @@ static http_handler_t find_handler(const char *path) {
     return g_default_handler;
 }
 
-static int parse_request(const char *buf, size_t len, http_request_t *req) {
-    static char method[16];
-    static char path[1024];
-    static char query[1024];
+/*
+ * Connections
+ */
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void conn_close(http_conn_t *conn) {
+    http_worker_t *w = conn->worker;
     
-    memset(req, 0, sizeof(*req));
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
     
-    /* Parse request line */
-    const char *line_end = strstr(buf, "\r\n");
-    if (!line_end) return -1;
+    if (conn->prev) conn->prev->next = conn->next;
+    else w->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    
+    if (conn->stream) {
+        conn->stream->close(conn->stream_state);
+        snapshot_unwatch();
+    }
+    if (conn->held) {
+        w->held_count--;
+    }
     
-    if (sscanf(buf, "%15s %1023s", method, path) != 2) {
+    out_chunk_t *c = conn->out_head;
+    while (c) {
+        out_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(conn->in);
+    free(conn);
+    atomic_fetch_sub(&g_conn_count, 1);
+}
+
+/* Read while requests are accepted, none is held back and the queue is under its bound */
+static int conn_update_events(http_conn_t *conn) {
+    uint32_t events = 0;
+    if (!conn->eof && !conn->closing && !conn->held && conn->out_bytes < OUTPUT_QUEUE_MAX) {
+        events |= EPOLLIN;
+    }
+    if (conn->out_head) events |= EPOLLOUT;
+    
+    if (events == conn->events) return 0;
+    
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    if (epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
         return -1;
     }
+    conn->events = events;
+    return 0;
+}
+
+/* Queue bytes from offset skip of iov */
+static int conn_queue(http_conn_t *conn, const struct iovec *iov, int iovcnt, size_t skip) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (skip >= total) return 0;
     
-    req->method = method;
+    out_chunk_t *chunk = malloc(sizeof(*chunk) + total - skip);
+    if (!chunk) return -1;
+    chunk->next = NULL;
+    chunk->len = total - skip;
+    chunk->sent = 0;
     
-    /* Split path and query */
-    char *q = strchr(path, '?');
-    if (q) {
-        *q = '\0';
-        strncpy(query, q + 1, sizeof(query) - 1);
-        req->query = query;
+    size_t pos = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const char *base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        memcpy(chunk->data + pos, base + skip, len - skip);
+        pos += len - skip;
+        skip = 0;
+    }
+    
+    if (conn->out_tail) {
+        conn->out_tail->next = chunk;
     } else {
-        query[0] = '\0';
-        req->query = query;
+        conn->out_head = chunk;
+        conn->out_progress = time(NULL);
     }
+    conn->out_tail = chunk;
+    conn->out_bytes += chunk->len;
+    return 0;
+}
+
+/* Send a response, queueing what the socket does not take now */
+static int conn_send(http_conn_t *conn, const struct iovec *iov, int iovcnt) {
+    size_t sent = 0;
     
-    req->path = path;
+    if (!conn->out_head) {
+        struct msghdr msg = { .msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt };
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            n = 0;
+        }
+        sent = (size_t)n;
+    }
+    return conn_queue(conn, iov, iovcnt, sent);
+}
+
+/* Write queued output. Returns -1 if the connection failed */
+static int conn_flush(http_conn_t *conn) {
+    while (conn->out_head) {
+        out_chunk_t *c = conn->out_head;
+        ssize_t n = send(conn->fd, c->data + c->sent, c->len - c->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+    
+        c->sent += (size_t)n;
+        conn->out_bytes -= (size_t)n;
+        conn->out_progress = time(NULL);
+        if (c->sent < c->len) return 0;
     
-    /* Find body (after \r\n\r\n) */
-    const char *body_start = strstr(buf, "\r\n\r\n");
-    if (body_start) {
-        body_start += 4;
-        req->body = body_start;
-        req->body_len = len - (body_start - buf);
+        conn->out_head = c->next;
+        if (!conn->out_head) conn->out_tail = NULL;
+        free(c);
+    }
+    return 0;
+}
+
+/*
+ * Event streams
+ */
+
+int http_stream_send(http_stream_t *stream, const char *name, const char *data, size_t len) {
+    char head[64] = "";
+    if (name) {
+        snprintf(head, sizeof(head), "event: %s\n", name);
     }
     
+    struct iovec iov[4] = {
+        { .iov_base = head, .iov_len = strlen(head) },
+        { .iov_base = "data: ", .iov_len = 6 },
+        { .iov_base = (void *)data, .iov_len = len },
+        { .iov_base = "\n\n", .iov_len = 2 },
+    };
+    stream->last_active = time(NULL);
+    return conn_send(stream, iov, 4);
+}
+
+/* Let the stream send what is due; a stream that ends closes once drained */
+static int stream_update(http_conn_t *conn) {
+    conn->stream_pending = false;
+    if (conn->stream->update(conn, conn->stream_state) < 0) {
+        conn->closing = true;
+    }
     return 0;
 }
 
-static void send_response(int client_fd, const http_response_t *resp) {
+/* Answer with an event stream and send its first events */
+static int stream_open(http_conn_t *conn, const http_response_t *resp) {
+    static const char head[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n";
+    
+    struct iovec iov = { .iov_base = (void *)head, .iov_len = sizeof(head) - 1 };
+    conn->stream = resp->stream;
+    conn->stream_state = resp->stream_state;
+    snapshot_watch();
+    
+    if (conn_send(conn, &iov, 1) < 0) return -1;
+    return stream_update(conn);
+}
+
+/*
+ * Requests
+ */
+
+static int send_response(http_conn_t *conn, const http_response_t *resp, bool keep_alive) {
     char header[1024];
     const char *status_text;
     
@@ -112,7 +376,11 @@ static void send_response(int client_fd, const http_response_t *resp) {
         case 201: status_text = "Created"; break;
         case 400: status_text = "Bad Request"; break;
         case 404: status_text = "Not Found"; break;
+        case 413: status_text = "Payload Too Large"; break;
+        case 431: status_text = "Request Header Fields Too Large"; break;
         case 500: status_text = "Internal Server Error"; break;
+        case 501: status_text = "Not Implemented"; break;
+        case 503: status_text = "Service Unavailable"; break;
         default: status_text = "Unknown"; break;
     }
     
@@ -120,84 +388,464 @@ static void send_response(int client_fd, const http_response_t *resp) {
         "HTTP/1.1 %d %s\r\n"
         "Content-Type: %s\r\n"
         "Content-Length: %zu\r\n"
-        "Connection: close\r\n"
+        "Connection: %s\r\n"
         "Access-Control-Allow-Origin: *\r\n"
         "\r\n",
         resp->status_code, status_text,
         resp->content_type ? resp->content_type : "text/plain",
-        resp->body_len);
+        resp->body_len,
+        keep_alive ? "keep-alive" : "close");
     
-    send(client_fd, header, header_len, 0);
-    if (resp->body && resp->body_len > 0) {
-        send(client_fd, resp->body, resp->body_len, 0);
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = (size_t)header_len },
+        { .iov_base = (void *)resp->body, .iov_len = resp->body ? resp->body_len : 0 },
+    };
+    if (!keep_alive) {
+        conn->closing = true;
     }
+    return conn_send(conn, iov, 2);
 }
 
-static void handle_client(int client_fd) {
-    char buf[MAX_REQUEST_SIZE];
-    ssize_t n = recv(client_fd, buf, sizeof(buf) - 1, 0);
-    if (n <= 0) return;
-    buf[n] = '\0';
+/* Answer with an error and stop reading: the rest of the input cannot be trusted */
+static int send_error(http_conn_t *conn, int status, const char *text) {
+    http_response_t resp = {status, "text/plain", text, strlen(text), NULL, NULL, NULL, NULL};
+    return send_response(conn, &resp, false);
+}
+
+/* Offset just past the blank line ending the headers, 0 if not received yet */
+static size_t find_header_end(const char *buf, size_t len) {
+    /* Lines end in CR LF, or a bare LF from lax clients */
+    for (size_t i = 1; i < len; i++) {
+        if (buf[i] == '\n' &&
+            (buf[i - 1] == '\n' || (i >= 2 && buf[i - 1] == '\r' && buf[i - 2] == '\n'))) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* Length of a line ending at the LF at eol, without its CR */
+static size_t line_length(const char *line, const char *eol) {
+    if (eol > line && eol[-1] == '\r') eol--;
+    return (size_t)(eol - line);
+}
+
+/* True if a comma-separated header value lists token */
+static bool header_has_token(const char *value, size_t len, const char *token) {
+    size_t token_len = strlen(token);
+    const char *end = value + len;
     
-    http_request_t req;
-    if (parse_request(buf, n, &req) < 0) {
-        http_response_t resp = {400, "text/plain", "Bad Request", 11};
-        send_response(client_fd, &resp);
-        return;
+    for (const char *p = value; p < end; ) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *start = p;
+        while (p < end && *p != ',' && *p != ' ' && *p != '\t') p++;
+        if ((size_t)(p - start) == token_len && strncasecmp(start, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Parse the request line and headers at the start of buf
+ * Returns 0 when parsed, or the status code to fail the request with
+ */
+static int parse_head(const char *buf, size_t header_len, request_head_t *head) {
+    char version[16];
+    char target[1024];
+    
+    memset(head, 0, sizeof(*head));
+    head->header_len = header_len;
+    
+    /* Request line */
+    const char *line_end = memchr(buf, '\n', header_len);
+    char line[2048];
+    size_t line_len = line_length(buf, line_end);
+    if (line_len >= sizeof(line)) return 431;
+    memcpy(line, buf, line_len);
+    line[line_len] = '\0';
+    
+    if (sscanf(line, "%15s %1023s %15s", head->method, target, version) != 3 ||
+        strncmp(version, "HTTP/1.", 7) != 0) {
+        return 400;
+    }
+    head->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+    
+    /* Split path and query */
+    char *q = strchr(target, '?');
+    if (q) {
+        *q = '\0';
+        snprintf(head->query, sizeof(head->query), "%s", q + 1);
+    }
+    snprintf(head->path, sizeof(head->path), "%s", target);
+    
+    /* Headers, up to the blank line */
+    const char *end = buf + header_len;
+    for (const char *p = line_end + 1; p < end; ) {
+        const char *lf = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = p + line_length(p, lf);
+        if (eol == p) break;
+    
+        const char *colon = memchr(p, ':', (size_t)(eol - p));
+        if (colon) {
+            size_t name_len = (size_t)(colon - p);
+            const char *value = colon + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) value++;
+            size_t value_len = (size_t)(eol - value);
+    
+            if (name_len == 14 && strncasecmp(p, "Content-Length", 14) == 0) {
+                char num[24];
+                if (value_len == 0 || value_len >= sizeof(num)) return 400;
+                memcpy(num, value, value_len);
+                num[value_len] = '\0';
+                char *num_end;
+                unsigned long long n = strtoull(num, &num_end, 10);
+                if (*num_end != '\0' && *num_end != ' ' && *num_end != '\t') return 400;
+                if (n > MAX_REQUEST_SIZE) return 413;
+                head->content_length = (size_t)n;
+            } else if (name_len == 17 && strncasecmp(p, "Transfer-Encoding", 17) == 0) {
+                return 501;
+            } else if (name_len == 10 && strncasecmp(p, "Connection", 10) == 0) {
+                if (header_has_token(value, value_len, "close")) head->keep_alive = false;
+                if (header_has_token(value, value_len, "keep-alive")) head->keep_alive = true;
+            }
+        }
+        p = lf + 1;
+    }
+    
+    if (header_len + head->content_length > MAX_REQUEST_SIZE) return 413;
+    return 0;
+}
+
+/*
+ * Hold the request back if the snapshot it reads is stale: a rebuild is
+ * requested and the request is handled again after the next publication
+ * or SNAPSHOT_DEMAND_WAIT_MS, whichever comes first
+ */
+static bool hold_for_rebuild(http_conn_t *conn) {
+    if (conn->rebuilt) {
+        conn->rebuilt = false;
+        return false;
+    }
+    if (conn->worker->publish_fd < 0 || !snapshot_request_fresh()) {
+        return false;
     }
     
+    conn->held = true;
+    conn->held_since = now_ms();
+    conn->worker->held_count++;
+    return true;
+}
+
+/* Returns 0 once answered, 1 if held back for a rebuild, -1 on failure */
+static int handle_request(http_conn_t *conn, const request_head_t *head, const char *body) {
+    http_request_t req = {
+        .method = head->method,
+        .path = head->path,
+        .query = head->query,
+        .body = head->content_length > 0 ? body : NULL,
+        .body_len = head->content_length,
+    };
+    
     log_debug("HTTP %s %s", req.method, req.path);
     
-    http_handler_t handler = find_handler(req.path);
+    bool fresh;
+    http_handler_t handler = find_handler(req.path, &fresh);
     if (!handler) {
-        http_response_t resp = {404, "text/plain", "Not Found", 9};
-        send_response(client_fd, &resp);
-        return;
+        http_response_t resp = {404, "text/plain", "Not Found", 9, NULL, NULL, NULL, NULL};
+        return send_response(conn, &resp, head->keep_alive);
+    }
+    if (fresh && hold_for_rebuild(conn)) {
+        return 1;
     }
     
-    static char response_buf[MAX_RESPONSE_SIZE];
-    http_response_t resp = {200, "application/json", response_buf, 0};
-    
+    http_response_t resp = {200, "application/json", NULL, 0, NULL, NULL, NULL, NULL};
     handler(&req, &resp);
-    send_response(client_fd, &resp);
+    
+    /* Whatever is queued is a copy, so the body is released now */
+    int ret = resp.stream ? stream_open(conn, &resp) : send_response(conn, &resp, head->keep_alive);
+    if (resp.body_release) {
+        resp.body_release(resp.body_ref);
+    }
+    return ret;
 }
 
-static void *server_thread(void *arg) {
-    (void)arg;
+/* Handle every complete request received, in order, while output fits and none is held */
+static int process_requests(http_conn_t *conn) {
+    size_t pos = 0;
+    int ret = 0;
     
-    struct pollfd pfd;
-    pfd.fd = g_server_fd;
-    pfd.events = POLLIN;
+    while (!conn->closing && !conn->stream && !conn->held && conn->out_bytes < OUTPUT_QUEUE_MAX &&
+           pos < conn->in_len) {
+        const char *buf = conn->in + pos;
+        size_t avail = conn->in_len - pos;
     
-    log_info("HTTP server started");
+        size_t header_len = find_header_end(buf, avail);
+        if (header_len == 0) {
+            if (avail >= MAX_REQUEST_SIZE) {
+                ret = send_error(conn, 431, "Request Header Fields Too Large");
+            }
+            break;  /* Rest of the headers still to come */
+        }
     
-    while (g_running) {
-        int ret = poll(&pfd, 1, 1000);
-        
-        if (ret < 0) {
+        request_head_t head;
+        int status = parse_head(buf, header_len, &head);
+        if (status != 0) {
+            ret = send_error(conn, status, status == 413 ? "Payload Too Large" :
+                                           status == 431 ? "Request Header Fields Too Large" :
+                                           status == 501 ? "Not Implemented" : "Bad Request");
+            break;
+        }
+        if (avail < header_len + head.content_length) {
+            break;  /* Rest of the body still to come */
+        }
+    
+        int handled = handle_request(conn, &head, buf + header_len);
+        if (handled < 0) {
+            ret = -1;
+            break;
+        }
+        if (handled > 0) {
+            break;  /* Handled again once rebuilt */
+        }
+        pos += header_len + head.content_length;
+    }
+    
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return ret;
+}
+
+static int conn_read(http_conn_t *conn) {
+    while (!conn->closing) {
+        /* Grow the buffer up to the largest request; a full one fails the request */
+        if (conn->in_len == conn->in_size) {
+            if (conn->in_size >= MAX_REQUEST_SIZE) break;
+            size_t size = conn->in_size * 2 < MAX_REQUEST_SIZE ? conn->in_size * 2 : MAX_REQUEST_SIZE;
+            char *in = realloc(conn->in, size);
+            if (!in) return -1;
+            conn->in = in;
+            conn->in_size = size;
+        }
+    
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
             if (errno == EINTR) continue;
-            log_error("poll() failed: %s", strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            conn->eof = true;
             break;
         }
-        
-        if (ret == 0) continue;
-        
-        if (pfd.revents & POLLIN) {
-            int client_fd = accept(g_server_fd, NULL, NULL);
-            if (client_fd < 0) {
+        conn->in_len += (size_t)n;
+        conn->last_active = time(NULL);
+    
+        /* A stream only reads to notice the peer going away */
+        if (conn->stream) {
+            conn->in_len = 0;
+            continue;
+        }
+    
+        if (process_requests(conn) < 0) return -1;
+        if (conn->out_bytes >= OUTPUT_QUEUE_MAX) break;
+    }
+    return 0;
+}
+
+/* Close a failed or finished connection, else wait for what it needs next */
+static void conn_settle(http_conn_t *conn, int ret) {
+    /* A peer that shut down its side still gets the responses owed to it */
+    if (ret < 0 || ((conn->eof || conn->closing) && !conn->out_head && !conn->held) ||
+        conn_update_events(conn) < 0) {
+        conn_close(conn);
+    }
+}
+
+static void conn_event(http_conn_t *conn, uint32_t events) {
+    int ret = 0;
+    
+    if (events & EPOLLOUT) {
+        /* Drained: send the newest events, or answer requests held back meanwhile */
+        ret = conn_flush(conn);
+        conn->last_active = time(NULL);
+        if (ret == 0 && !conn->out_head && conn->stream_pending) ret = stream_update(conn);
+        if (ret == 0 && !conn->out_head) ret = process_requests(conn);
+    }
+    if (ret == 0 && (events & EPOLLIN)) {
+        ret = conn_read(conn);
+    }
+    if (ret == 0 && (events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        ret = -1;
+    }
+    
+    /* A stream whose peer went away has nothing more to send */
+    if (conn->stream && conn->eof) {
+        ret = -1;
+    }
+    conn_settle(conn, ret);
+}
+
+/* Latest snapshot to every stream of the worker not still busy with events */
+static void push_publication(http_worker_t *w) {
+    http_conn_t *next;
+    for (http_conn_t *conn = w->conns; conn; conn = next) {
+        next = conn->next;
+        if (!conn->stream) continue;
+    
+        conn->stream_pending = true;
+        if (conn->out_head) continue;   /* Sent once the queue drains */
+        conn_settle(conn, stream_update(conn));
+    }
+}
+
+/* Handle held requests: all after a publication, else those that waited long enough */
+static void resume_held(http_worker_t *w, bool published) {
+    uint64_t now = now_ms();
+    
+    http_conn_t *next;
+    for (http_conn_t *conn = w->conns; conn; conn = next) {
+        next = conn->next;
+        if (!conn->held || (!published && now - conn->held_since < SNAPSHOT_DEMAND_WAIT_MS)) {
+            continue;
+        }
+    
+        conn->held = false;
+        conn->rebuilt = true;
+        w->held_count--;
+        conn_settle(conn, process_requests(conn));
+    }
+}
+
+static void accept_connections(http_worker_t *w) {
+    for (;;) {
+        int fd = accept(g_server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
                 log_warn("accept() failed: %s", strerror(errno));
-                continue;
             }
-            
-            handle_client(client_fd);
-            close(client_fd);
+            return;
+        }
+    
+        if (atomic_load(&g_conn_count) >= MAX_CONNECTIONS) {
+            log_warn("HTTP connection limit (%d) reached", MAX_CONNECTIONS);
+            close(fd);
+            continue;
+        }
+    
+        http_conn_t *conn = calloc(1, sizeof(*conn));
+        char *in = malloc(IN_BUF_SIZE);
+        if (!conn || !in || set_nonblocking(fd) < 0) {
+            free(conn);
+            free(in);
+            close(fd);
+            continue;
+        }
+        conn->worker = w;
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        conn->in = in;
+        conn->in_size = IN_BUF_SIZE;
+        conn->last_active = time(NULL);
+    
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(conn->in);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->next = w->conns;
+        if (w->conns) w->conns->prev = conn;
+        w->conns = conn;
+        atomic_fetch_add(&g_conn_count, 1);
+    }
+}
+
+/*
+ * Close kept-alive connections that have been idle too long, or whose
+ * peer has taken none of their output for as long, and keep quiet
+ * streams from being dropped by proxies on the way
+ */
+static void close_idle(http_worker_t *w, time_t now) {
+    static const char heartbeat[] = ": keep-alive\n\n";
+    
+    http_conn_t *next;
+    for (http_conn_t *conn = w->conns; conn; conn = next) {
+        next = conn->next;
+        if (conn->out_head) {
+            if (now - conn->out_progress > IDLE_TIMEOUT) {
+                log_debug("HTTP connection stalled with %zu bytes queued, closing", conn->out_bytes);
+                conn_close(conn);
+            }
+            continue;
+        }
+    
+        if (conn->stream) {
+            if (now - conn->last_active >= STREAM_HEARTBEAT) {
+                struct iovec iov = { .iov_base = (void *)heartbeat, .iov_len = sizeof(heartbeat) - 1 };
+                conn->last_active = now;
+                conn_settle(conn, conn_send(conn, &iov, 1));
+            }
+        } else if (now - conn->last_active > IDLE_TIMEOUT) {
+            conn_close(conn);
+        }
+    }
+}
+
+static void *worker_thread(void *arg) {
+    http_worker_t *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+    
+    while (g_running) {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, w->held_count > 0 ? HELD_POLL_MS : 1000);
+    
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait() failed: %s", strerror(errno));
+            break;
+        }
+    
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_connections(w);
+            } else if (events[i].data.ptr == w) {
+                if (snapshot_take_published(w->publish_fd)) {
+                    resume_held(w, true);
+                    push_publication(w);
+                }
+            } else {
+                conn_event(events[i].data.ptr, events[i].events);
+            }
+        }
+    
+        /* Rebuilds that never came: handle with what is published */
+        if (w->held_count > 0) {
+            resume_held(w, false);
+        }
+    
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            close_idle(w, now);
+            last_sweep = now;
         }
     }
     
-    log_info("HTTP server stopped");
     return NULL;
 }
 
+/* Close a worker's connections and its event loop; the thread has exited */
+static void worker_cleanup(http_worker_t *w) {
+    while (w->conns) {
+        conn_close(w->conns);
+    }
+    snapshot_publish_fd_close(w->publish_fd);
+    w->publish_fd = -1;
+    close(w->epoll_fd);
+    w->epoll_fd = -1;
+}
+
 int http_server_start(const qmem_config_t *cfg) {
     if (!cfg->web_enabled) {
         log_info("Web server disabled");
@@ -227,23 +875,59 @@ int http_server_start(const qmem_config_t *cfg) {
         return -1;
     }
     
-    if (listen(g_server_fd, 10) < 0) {
+    if (listen(g_server_fd, SOMAXCONN) < 0 || set_nonblocking(g_server_fd) < 0) {
         log_error("Failed to listen: %s", strerror(errno));
         close(g_server_fd);
         g_server_fd = -1;
         return -1;
     }
     
+    int count = cfg->web_threads;
+    if (count < 1) count = 1;
+    if (count > MAX_WORKERS) count = MAX_WORKERS;
+    
+    /* Each worker's loop: the listening socket is the entry without a connection */
     g_running = 1;
-    if (pthread_create(&g_server_thread, NULL, server_thread, NULL) != 0) {
-        log_error("Failed to create HTTP server thread");
+    for (g_worker_count = 0; g_worker_count < count; g_worker_count++) {
+        http_worker_t *w = &g_workers[g_worker_count];
+        w->conns = NULL;
+        w->held_count = 0;
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (w->epoll_fd < 0 || epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, g_server_fd, &ev) < 0) {
+            log_error("Failed to set up epoll: %s", strerror(errno));
+            if (w->epoll_fd >= 0) close(w->epoll_fd);
+            w->epoll_fd = -1;
+            break;
+        }
+    
+        /* Publications wake the worker to handle held requests and update its streams */
+        w->publish_fd = snapshot_publish_fd_open();
+        ev = (struct epoll_event){ .events = EPOLLIN, .data.ptr = w };
+        if (w->publish_fd >= 0 && epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->publish_fd, &ev) < 0) {
+            log_warn("Event streams get no updates: %s", strerror(errno));
+        }
+    
+        if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+            log_error("Failed to create HTTP worker thread");
+            snapshot_publish_fd_close(w->publish_fd);
+            w->publish_fd = -1;
+            close(w->epoll_fd);
+            w->epoll_fd = -1;
+            break;
+        }
+    }
+    
+    if (g_worker_count == 0) {
         close(g_server_fd);
         g_server_fd = -1;
         g_running = 0;
         return -1;
     }
     
-    log_info("HTTP server listening on %s:%d", cfg->web_listen, cfg->web_port);
+    log_info("HTTP server listening on %s:%d (%d workers)", cfg->web_listen, cfg->web_port,
+             g_worker_count);
     return 0;
 }
 
@@ -252,13 +936,18 @@ void http_server_stop(void) {
     
     g_running = 0;
     
+    for (int i = 0; i < g_worker_count; i++) {
+        pthread_join(g_workers[i].thread, NULL);
+        worker_cleanup(&g_workers[i]);
+    }
+    g_worker_count = 0;
+    
     if (g_server_fd >= 0) {
-        shutdown(g_server_fd, SHUT_RDWR);
         close(g_server_fd);
         g_server_fd = -1;
     }
     
-    pthread_join(g_server_thread, NULL);
+    log_info("HTTP server stopped");
 }
 
 int http_server_is_running(void) {
@@ -16,11 +16,31 @@ typedef struct {
     size_t body_len;
 } http_request_t;
 
+/* Connection kept open after the response to send events (text/event-stream) */
+typedef struct http_conn http_stream_t;
+
+typedef struct {
+    /*
+     * Send whatever events are due with http_stream_send(). Called when the
+     * stream opens and after snapshot publications, never while earlier
+     * events are still queued. Returning -1 ends the stream
+     */
+    int (*update)(http_stream_t *stream, void *state);
+    /* Free the state once the stream is closed */
+    void (*close)(void *state);
+} http_stream_ops_t;
+
 typedef struct {
     int status_code;
     const char *content_type;
     const char *body;
     size_t body_len;
+    /* Called with body_ref once the body has been sent, if set */
+    void (*body_release)(const void *body_ref);
+    const void *body_ref;
+    /* Set to answer with an event stream instead of the body */
+    const http_stream_ops_t *stream;
+    void *stream_state;
 } http_response_t;
 
 typedef void (*http_handler_t)(const http_request_t *req, http_response_t *resp);
@@ -37,7 +57,16 @@ int http_server_is_running(void);
 /* Register route handler */
 void http_register_handler(const char *path, http_handler_t handler);
 
+/*
+ * Register a handler that reads the published snapshot: if it is stale,
+ * the request waits (without blocking the worker) for its rebuild
+ */
+void http_register_snapshot_handler(const char *path, http_handler_t handler);
+
 /* Set default handler (for static files) */
 void http_set_default_handler(http_handler_t handler);
 
+/* Send an event (name may be NULL); data is one line. Returns -1 on failure */
+int http_stream_send(http_stream_t *stream, const char *name, const char *data, size_t len);
+
 #endif /* QMEM_HTTP_SERVER_H */
@@ -236,8 +236,7 @@ static const char STYLE_CSS[] =
 /* Embedded app.js */
 static const char APP_JS[] =
 "(function() {\n"
-"    const API_URL = '/api/status';\n"
-"    const REFRESH_INTERVAL = 5000;\n"
+"    const STREAM_URL = '/api/stream';\n"
 "\n"
 "    function formatBytes(kb) {\n"
 "        if (kb >= 1048576) return (kb / 1048576).toFixed(2) + ' GB';\n"
@@ -307,23 +306,38 @@ static const char APP_JS[] =
 "        }\n"
 "    }\n"
 "\n"
-"    function fetchData() {\n"
-"        fetch(API_URL)\n"
-"            .then(res => res.json())\n"
-"            .then(data => updateUI(data))\n"
-"            .catch(err => {\n"
-"                console.error('Fetch error:', err);\n"
-"                const status = document.getElementById('status');\n"
-"                status.textContent = 'Disconnected';\n"
-"                status.classList.remove('connected');\n"
-"            });\n"
+"    function setDisconnected() {\n"
+"        const status = document.getElementById('status');\n"
+"        status.textContent = 'Disconnected';\n"
+"        status.classList.remove('connected');\n"
 "    }\n"
 "\n"
-"    // Initial fetch\n"
-"    fetchData();\n"
+"    // Apply a JSON merge patch (RFC 7396)\n"
+"    function mergePatch(target, patch) {\n"
+"        if (patch === null || typeof patch !== 'object' || Array.isArray(patch)) return patch;\n"
+"        if (target === null || typeof target !== 'object' || Array.isArray(target)) target = {};\n"
+"        for (const key of Object.keys(patch)) {\n"
+"            if (patch[key] === null) delete target[key];\n"
+"            else target[key] = mergePatch(target[key], patch[key]);\n"
+"        }\n"
+"        return target;\n"
+"    }\n"
 "\n"
-"    // Periodic refresh\n"
-"    setInterval(fetchData, REFRESH_INTERVAL);\n"
+"    // Snapshot, then merge patches of what changed, pushed over one connection\n"
+"    let data = null;\n"
+"    const source = new EventSource(STREAM_URL);\n"
+"    source.addEventListener('snapshot', e => {\n"
+"        data = JSON.parse(e.data);\n"
+"        updateUI(data);\n"
+"    });\n"
+"    source.addEventListener('patch', e => {\n"
+"        if (!data) return;\n"
+"        data = mergePatch(data, JSON.parse(e.data));\n"
+"        updateUI(data);\n"
+"    });\n"
+"\n"
+"    // EventSource reconnects by itself and gets a full snapshot first\n"
+"    source.onerror = () => setDisconnected();\n"
 "})();\n";
 
 /* File lookup table */
@@ -0,0 +1,403 @@
+/*
+ * test_history.c - Compressed history store tests
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "daemon/history.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) do { \
+    printf("  %s... ", #name); \
+    tests_run++; \
+    if (test_##name()) { \
+        printf("PASS\n"); \
+        tests_passed++; \
+    } else { \
+        printf("FAIL\n"); \
+    } \
+} while (0)
+
+static int test_round_trip(void) {
+    history_t *h = history_create(256, 0);
+    history_point_t points[2000];
+    
+    /* Steady cadence, jitter, big jumps, fractions and repeats */
+    int64_t ts = 1700000000;
+    double values[1000];
+    for (int i = 0; i < 1000; i++) {
+        ts += (i % 7 == 0) ? 10 + i % 3 : (i % 100 == 0 ? 100000 : 10);
+        values[i] = (i % 5 == 0) ? values[i > 0 ? i - 1 : 0] : i * 1024.0 + (i % 3) * 0.25;
+        if (i == 0) values[i] = -42.5;
+        history_add(h, "a.b", ts, values[i]);
+    }
+    
+    int n = history_query(h, "a.b", INT64_MIN, INT64_MAX, points, 2000);
+    int ok = n == 1000;
+    for (int i = 0; ok && i < n; i++) {
+        ok = points[i].value == values[i] && (i == 0 || points[i].timestamp > points[i - 1].timestamp);
+    }
+    
+    history_destroy(h);
+    return ok;
+}
+
+static int test_newest_in_range(void) {
+    history_t *h = history_create(64, 0);
+    history_point_t points[8];
+    
+    for (int i = 0; i < 100; i++) {
+        history_add(h, "s", 1000 + i, i);
+    }
+    history_add(h, "s", 1050, -1);      /* Out of order: ignored */
+    
+    int n = history_query(h, "s", 1000, 1049, points, 8);
+    int ok = n == 8 && points[0].timestamp == 1042 && points[7].timestamp == 1049 &&
+             points[7].value == 49;
+    
+    ok = ok && history_query(h, "missing", 0, 2000, points, 8) == -1;
+    
+    /* Counted from whole blocks: never fewer than the query returns */
+    ok = ok && history_count(h, "s", 0, 1000, 1049) >= 50 &&
+         history_count(h, "s", 0, 0, 999) == 0 &&
+         history_count(h, "missing", 0, 0, 2000) == -1;
+    
+    history_destroy(h);
+    return ok;
+}
+
+static int test_ingest_snapshot(void) {
+    const char *json =
+        "{\"timestamp\":5,\"services\":{"
+        "\"meminfo\":{\"usage_percent\":12.5,\"memory\":{\"free_kb\":{\"value\":100,\"delta\":-3}}},"
+        "\"netstat\":{\"interfaces\":[{\"name\":\"eth0\",\"rx\":{\"bytes\":7}},{\"pid\":1,\"rss_kb\":2}]},"
+        "\"procmem\":{\"top_rss\":[{\"pid\":1,\"rss_kb\":2}],\"rss_delta_kb\":4,\"ok\":true,\"cmd\":\"x\"}"
+        "}}";
+    history_t *h = history_create(64, 0);
+    history_point_t p;
+    
+    int added = history_ingest(h, json, strlen(json), 100);
+    int ok = added == 3 && history_series_count(h) == 3 &&
+             history_query(h, "meminfo.usage_percent", 0, 200, &p, 1) == 1 && p.value == 12.5 &&
+             history_query(h, "meminfo.memory.free_kb.value", 0, 200, &p, 1) == 1 && p.value == 100 &&
+             history_query(h, "netstat.interfaces.eth0.rx.bytes", 0, 200, &p, 1) == 1 &&
+             p.timestamp == 100;
+    
+    ok = ok && history_ingest(h, "{\"services\":{\"a\":[1,", 20, 200) == -1;
+    
+    history_destroy(h);
+    return ok;
+}
+
+static int test_retention_and_eviction(void) {
+    history_point_t points[4];
+    history_stats_t stats;
+    
+    /* Retention: only the last 100s survive once blocks roll over */
+    history_t *h = history_create(64, 100);
+    for (int i = 0; i < 5000; i++) {
+        history_add(h, "r", i, (double)(i * 7919 % 104729));
+    }
+    int n = history_query(h, "r", 0, 1000, points, 4);
+    int ok = n == 0;
+    history_destroy(h);
+    
+    /* A tiny pool keeps the newest data of every series */
+    h = history_create(1, 0);
+    for (int i = 0; i < 2000; i++) {
+        history_add(h, "x", i, (double)(i * 31337 % 65521));
+        history_add(h, "y", i, (double)(i * 7919 % 104729));
+    }
+    history_get_stats(h, &stats);
+    ok = ok && stats.blocks_used == stats.blocks_total &&
+         history_query(h, "x", 0, 5000, points, 1) == 1 && points[0].timestamp == 1999 &&
+         history_query(h, "y", 0, 5000, points, 1) == 1 && points[0].timestamp == 1999;
+    history_destroy(h);
+    
+    return ok;
+}
+
+static int test_downsample(void) {
+    history_point_t points[10];
+    history_bucket_t buckets[4];
+    
+    /* 1001..1005 and 1010..1012: buckets of 5s starting at 1000 */
+    for (int i = 0; i < 8; i++) {
+        points[i].timestamp = i < 5 ? 1001 + i : 1005 + i;
+        points[i].value = i;
+    }
+    
+    int n = history_downsample(points, 8, 5, buckets, 4);
+    int ok = n == 3 &&
+             buckets[0].timestamp == 1000 && buckets[0].count == 4 &&
+             buckets[0].min == 0 && buckets[0].max == 3 && buckets[0].sum == 6 &&
+             buckets[1].timestamp == 1005 && buckets[1].count == 1 && buckets[1].last == 4 &&
+             buckets[2].timestamp == 1010 && buckets[2].count == 3 && buckets[2].last == 7;
+    
+    ok = ok && history_downsample(points, 8, 5, buckets, 2) == 2;
+    return ok;
+}
+
+static int test_lttb(void) {
+    history_point_t points[1000];
+    history_point_t out[1000];
+    
+    /* Flat line with one spike: the spike must survive */
+    for (int i = 0; i < 1000; i++) {
+        points[i].timestamp = i;
+        points[i].value = i == 537 ? 100 : 0;
+    }
+    
+    int n = history_lttb(points, 1000, out, 50);
+    int ok = n == 50 && out[0].timestamp == 0 && out[49].timestamp == 999;
+    int spike = 0;
+    for (int i = 0; i < n; i++) {
+        if (out[i].value == 100) spike = 1;
+        if (i > 0 && out[i].timestamp <= out[i - 1].timestamp) ok = 0;
+    }
+    
+    ok = ok && spike && history_lttb(points, 10, out, 50) == 10;
+    return ok;
+}
+
+static int test_rollup_tiers(void) {
+    history_t *h = history_create(64, 100);
+    history_bucket_t rollups[64];
+    history_bucket_t merged[8];
+    history_point_t p;
+    
+    int ok = history_add_tier(h, 60, 0) == 1 && history_add_tier(h, 30, 0) == -1;
+    
+    /* 10 minutes at 1s: raw keeps 100s, the 60s tier keeps everything */
+    for (int i = 0; i < 600; i++) {
+        history_add(h, "m", i, i % 60);
+    }
+    ok = ok && history_add_tier(h, 600, 0) == -1;  /* Too late */
+    ok = ok && history_query(h, "m", 0, 99, &p, 1) == 0;
+    
+    int n = history_query_rollup(h, "m", 1, 0, 1000, rollups, 64);
+    ok = ok && n == 10 && rollups[0].timestamp == 0 && rollups[9].timestamp == 540;
+    ok = ok && history_count(h, "m", 1, 0, 1000) >= n && history_count(h, "m", 2, 0, 1000) == -1;
+    for (int i = 0; ok && i < n; i++) {
+        ok = rollups[i].count == 60 && rollups[i].min == 0 && rollups[i].max == 59 &&
+             rollups[i].sum == 1770 && rollups[i].last == 59;
+    }
+    
+    /* Merged into 5-minute buckets */
+    int m = history_merge_buckets(rollups, n, 300, merged, 8);
+    ok = ok && m == 2 && merged[0].count == 300 && merged[1].timestamp == 300 &&
+         merged[1].sum == 5 * 1770;
+    
+    ok = ok && history_query_rollup(h, "m", 2, 0, 1000, rollups, 64) == -1;
+    
+    history_destroy(h);
+    return ok;
+}
+
+static int test_default_config(void) {
+    history_point_t points[400];
+    history_bucket_t rollups[200];
+    history_stats_t stats;
+    char name[32];
+    
+    /* qmem.conf defaults: 4 MB, 360 raw samples at 10s, tiers 1m:24h and 10m:30d */
+    history_t *h = history_create(4096, 360 * 10);
+    history_add_tier(h, 60, 24 * 3600);
+    history_add_tier(h, 600, 30 * 24 * 3600);
+    
+    /* 300 series for two days, well past the point where the pool fills */
+    int64_t end = 2 * 24 * 3600;
+    for (int64_t ts = 10; ts <= end; ts += 10) {
+        for (int i = 0; i < 300; i++) {
+            snprintf(name, sizeof(name), "svc.metric%d", i);
+            history_add(h, name, ts, (double)((ts / 10 * 7919 + i * 104729) % 65521));
+        }
+    }
+    history_get_stats(h, &stats);
+    int ok = stats.series == 300 && stats.blocks_used == stats.blocks_total;
+    
+    /* Every series still has its last hour of raw samples and recent rollups */
+    for (int i = 0; ok && i < 300; i++) {
+        snprintf(name, sizeof(name), "svc.metric%d", i);
+        ok = history_query(h, name, end - 3599, end, points, 400) == 360 &&
+             history_query_rollup(h, name, 1, end - 3600, end, rollups, 200) > 0 &&
+             history_query_rollup(h, name, 2, end - 3600, end, rollups, 200) > 0;
+    }
+    
+    history_destroy(h);
+    return ok;
+}
+
+/* Fill a default-tiered store with 10 series for 31 days at 10s */
+static history_t *fill_month(size_t memory_kb) {
+    char name[32];
+    
+    history_t *h = history_create(memory_kb, 360 * 10);
+    history_add_tier(h, 60, 24 * 3600);
+    history_add_tier(h, 600, 30 * 24 * 3600);
+    for (int64_t ts = 10; ts <= 31 * 24 * 3600; ts += 10) {
+        for (int i = 0; i < 10; i++) {
+            snprintf(name, sizeof(name), "svc.metric%d", i);
+            history_add(h, name, ts, (double)((ts / 10 * 7919 + i * 104729) % 65521));
+        }
+    }
+    return h;
+}
+
+static int test_retention_met(void) {
+    static history_bucket_t rollups[5000];
+    history_point_t points[400];
+    history_tier_t tier;
+    char name[32];
+    int64_t end = 31 * 24 * 3600;
+    
+    /* Enough memory: every tier of every series spans its whole retention */
+    history_t *h = fill_month(4096);
+    int ok = history_tier_count(h) == 3;
+    for (int t = 0; ok && t < 3; t++) {
+        ok = history_get_tier(h, t, &tier) == 0 && tier.oldest == 0;
+    }
+    for (int i = 0; ok && i < 10; i++) {
+        snprintf(name, sizeof(name), "svc.metric%d", i);
+        ok = history_query(h, name, end - 3599, end, points, 400) == 360 &&
+             history_query_rollup(h, name, 1, end - 24 * 3600, end, rollups, 5000) >= 1440 &&
+             history_query_rollup(h, name, 2, end - 30 * 24 * 3600, end, rollups, 5000) >= 4320;
+    }
+    history_destroy(h);
+    
+    /* A quarter of that: every tier falls short by a like fraction and says so */
+    int64_t kept[3];
+    h = fill_month(256);
+    for (int t = 0; ok && t < 3; t++) {
+        ok = history_get_tier(h, t, &tier) == 0 && tier.oldest > end - tier.retention;
+        kept[t] = (end - tier.oldest) * 100 / tier.retention;
+    }
+    ok = ok && kept[0] * 2 > kept[2] && kept[2] * 2 > kept[0] &&
+         kept[1] * 2 > kept[2] && kept[2] * 2 > kept[1];
+    
+    /* Past the reported oldest the data is complete */
+    history_get_tier(h, 2, &tier);
+    int64_t from = tier.oldest - tier.oldest % 600 + 600;
+    for (int i = 0; ok && i < 10; i++) {
+        snprintf(name, sizeof(name), "svc.metric%d", i);
+        ok = history_query_rollup(h, name, 2, from, end, rollups, 5000) >= (end - from) / 600;
+    }
+    history_destroy(h);
+    return ok;
+}
+
+static int test_series_expiry(void) {
+    history_point_t p;
+    char name[32];
+    
+    /* Fill the series table, then let all but one series go quiet */
+    history_t *h = history_create(1024, 100);
+    history_add_tier(h, 60, 600);
+    for (int i = 0; i < 2048; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        history_add(h, name, 1000, i);
+    }
+    int ok = history_add(h, "late", 1000, 1) < 0 && history_series_count(h) == 2048;
+    
+    /* Past the longest retention the quiet series make room */
+    ok = ok && history_add(h, "s7", 2000, 7) == 1 && history_add(h, "late", 2000, 1) == 1 &&
+         history_series_count(h) == 2 &&
+         history_query(h, "s7", 0, 5000, &p, 1) == 1 && p.timestamp == 2000 &&
+         history_query(h, "late", 0, 5000, &p, 1) == 1 &&
+         history_query(h, "s8", 0, 5000, &p, 1) == -1;
+    
+    history_destroy(h);
+    return ok;
+}
+
+
+/* Copy a file while the store still has it mapped, as a crash would leave it */
+static int copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    char buf[65536];
+    size_t n;
+    int ok = in && out;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ok = fwrite(buf, 1, n, out) == n;
+    }
+    if (in) fclose(in);
+    if (out) fclose(out);
+    return ok;
+}
+
+static int test_persistence(void) {
+    char path[64], crashed[64];
+    snprintf(path, sizeof(path), "/tmp/test_history.%d.dat", (int)getpid());
+    snprintf(crashed, sizeof(crashed), "/tmp/test_history.%d.crash", (int)getpid());
+    history_point_t points[600];
+    history_bucket_t rollups[16];
+    
+    history_t *h = history_create(64, 0);
+    history_add_tier(h, 60, 0);
+    int ok = history_attach(h, path) == 0;
+    for (int i = 0; i < 300; i++) {
+        history_add(h, "a", 1000 + i, i * 0.5);
+        history_add(h, "b", 1000 + i, 7);
+    }
+    ok = ok && copy_file(path, crashed);
+    history_destroy(h);
+    
+    /* Clean reopen: same data, appends continue the same series */
+    h = history_create(64, 0);
+    history_add_tier(h, 60, 0);
+    ok = ok && history_attach(h, path) == 0 && history_series_count(h) == 2;
+    for (int i = 300; i < 600; i++) {
+        history_add(h, "a", 1000 + i, i * 0.5);
+    }
+    int n = history_query(h, "a", 0, 5000, points, 600);
+    ok = ok && n == 600;
+    for (int i = 0; ok && i < n; i++) {
+        ok = points[i].timestamp == 1000 + i && points[i].value == i * 0.5;
+    }
+    ok = ok && history_query_rollup(h, "a", 1, 0, 5000, rollups, 16) == 11 &&
+         rollups[0].timestamp == 960 && rollups[0].count == 20;
+    history_destroy(h);
+    
+    /* Unclean copy recovers what was committed */
+    h = history_create(64, 0);
+    history_add_tier(h, 60, 0);
+    ok = ok && history_attach(h, crashed) == 0 &&
+         history_query(h, "b", 0, 5000, points, 600) == 300 && points[299].value == 7;
+    history_destroy(h);
+    
+    /* Another layout starts over */
+    h = history_create(32, 0);
+    ok = ok && history_attach(h, path) == 0 && history_series_count(h) == 0;
+    history_destroy(h);
+    
+    unlink(path);
+    unlink(crashed);
+    return ok;
+}
+
+int main(void) {
+    printf("History Tests\n");
+    printf("=============\n");
+    
+    TEST(round_trip);
+    TEST(newest_in_range);
+    TEST(ingest_snapshot);
+    TEST(retention_and_eviction);
+    TEST(downsample);
+    TEST(lttb);
+    TEST(rollup_tiers);
+    TEST(default_config);
+    TEST(retention_met);
+    TEST(series_expiry);
+    TEST(persistence);
+    
+    printf("\nResults: %d/%d passed\n", tests_passed, tests_run);
+    return tests_passed == tests_run ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * test_ipc.c - IPC server tests
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <qmem/protocol.h>
+#include "daemon/config.h"
+#include "daemon/ipc_server.h"
+#include "daemon/snapshot.h"
+
+#define FILL_LEN 3000
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) do { \
+    printf("  %s... ", #name); \
+    tests_run++; \
+    if (test_##name()) { \
+        printf("PASS\n"); \
+        tests_passed++; \
+    } else { \
+        printf("FAIL\n"); \
+    } \
+} while (0)
+
+static atomic_bool g_publishing;
+
+/* Publish generation gen: a counter and a fill of one letter derived from it */
+static int publish(int gen) {
+    snapshot_t *snap = snapshot_begin();
+    if (!snap) return -1;
+    
+    size_t need = FILL_LEN + 128;
+    if (snap->capacity < need) {
+        char *data = realloc(snap->data, need);
+        if (!data) return -1;
+        snap->data = data;
+        snap->capacity = need;
+    }
+    
+    int len = snprintf(snap->data, snap->capacity,
+                       "{\"timestamp\":%d,\"services\":{\"test\":{\"gen\":%d,\"fill\":\"", gen, gen);
+    memset(snap->data + len, 'a' + gen % 26, FILL_LEN);
+    len += FILL_LEN;
+    len += snprintf(snap->data + len, snap->capacity - len, "\"}}}");
+    snapshot_publish(snap, (size_t)len);
+    return 0;
+}
+
+static void *publisher_main(void *arg) {
+    (void)arg;
+    for (int gen = 2; atomic_load(&g_publishing); gen++) {
+        publish(gen);
+    }
+    return NULL;
+}
+
+/* Parse a snapshot written by publish(); -1 if it is torn */
+static int check_snapshot(const char *json, long len) {
+    int gen;
+    int prefix;
+    if (sscanf(json, "{\"timestamp\":%*d,\"services\":{\"test\":{\"gen\":%d,\"fill\":\"%n",
+               &gen, &prefix) != 1 || len != prefix + FILL_LEN + 4) {
+        return -1;
+    }
+    for (int i = 0; i < FILL_LEN; i++) {
+        if (json[prefix + i] != 'a' + gen % 26) return -1;
+    }
+    return strcmp(json + prefix + FILL_LEN, "\"}}}") == 0 ? gen : -1;
+}
+
+/* Ask for the shared region; returns its descriptor (SCM_RIGHTS) or -1 */
+static int request_shared(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    
+    qmem_msg_header_t header;
+    qmem_msg_header_init(&header, QMEM_REQ_SHARED, 0);
+    if (send(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        close(fd);
+        return -1;
+    }
+    
+    /* The descriptor rides on the first byte of the response */
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    int shm_fd = -1;
+    if (recvmsg(fd, &msg, MSG_WAITALL) == sizeof(header)) {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&shm_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    
+    char body[256];
+    if (shm_fd >= 0 && (header.type != QMEM_REQ_SHARED || header.length >= sizeof(body) ||
+                        recv(fd, body, header.length, MSG_WAITALL) != (ssize_t)header.length)) {
+        close(shm_fd);
+        shm_fd = -1;
+    }
+    close(fd);
+    return shm_fd;
+}
+
+static int test_shared_snapshot(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_ipc.%d.sock", (int)getpid());
+    qmem_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    snprintf(cfg.socket_path, sizeof(cfg.socket_path), "%s", path);
+    
+    int ok = snapshot_init(4096) == 0 && publish(1) == 0;
+    ipc_set_snapshot_callback(snapshot_acquire);
+    ok = ok && ipc_server_start(&cfg) == 0;
+    
+    int shm_fd = ok ? request_shared(path) : -1;
+    struct stat st;
+    ok = ok && shm_fd >= 0 && fstat(shm_fd, &st) == 0;
+    const qmem_shm_header_t *shm = ok ?
+        mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, shm_fd, 0) : MAP_FAILED;
+    ok = ok && shm != MAP_FAILED && shm->magic == QMEM_SHM_MAGIC;
+    
+    /* Every read while the daemon publishes is whole, and never goes back */
+    pthread_t publisher;
+    atomic_store(&g_publishing, true);
+    bool started = ok && pthread_create(&publisher, NULL, publisher_main, NULL) == 0;
+    ok = ok && started;
+    
+    char *buf = malloc(FILL_LEN + 256);
+    int first = -1, last = -1, reads = 0;
+    for (int i = 0; ok && buf && i < 20000 && last - first < 100; i++) {
+        long len = qmem_shm_read(shm, buf, FILL_LEN + 256);
+        if (len < 0) continue;
+        int gen = check_snapshot(buf, len);
+        ok = gen >= 0 && gen >= last;
+        if (first < 0) first = gen;
+        last = gen;
+        reads++;
+    }
+    ok = ok && buf && reads > 0 && last > first;
+    
+    atomic_store(&g_publishing, false);
+    if (started) {
+        pthread_join(publisher, NULL);
+    }
+    free(buf);
+    if (shm != MAP_FAILED) munmap((void *)shm, (size_t)st.st_size);
+    if (shm_fd >= 0) close(shm_fd);
+    ipc_server_stop();
+    snapshot_shutdown();
+    return ok;
+}
+
+/* Subscribers holding the same frame share one rendering and patch */
+static int test_shared_views(void) {
+    static const char frame1[] = "{\"timestamp\":1,\"services\":{\"test\":{\"gen\":1}}}";
+    static const char patch2[] = "{\"timestamp\":2,\"services\":{\"test\":{\"gen\":2}}}";
+    snapshot_views_t views;
+    snapshot_views_init(&views, 1024 * 1024);
+    
+    int ok = snapshot_init(4096) == 0 && publish(1) == 0;
+    const snapshot_t *snap = ok ? snapshot_acquire() : NULL;
+    const snapshot_view_t *v = snap ? snapshot_view(&views, snap, "test.gen", 0, NULL, 0) : NULL;
+    ok = v && !v->patch && v->frame_len == strlen(frame1) &&
+         memcmp(v->frame, frame1, v->frame_len) == 0;
+    uint64_t base = snap ? snap->generation : 0;
+    snapshot_release(snap);
+    
+    snap = ok && publish(2) == 0 ? snapshot_acquire() : NULL;
+    const snapshot_view_t *a = snap ?
+        snapshot_view(&views, snap, "test.gen", base, frame1, strlen(frame1)) : NULL;
+    const snapshot_view_t *b = snap ?
+        snapshot_view(&views, snap, "test.gen", base, frame1, strlen(frame1)) : NULL;
+    ok = a && a == b && a->patch && a->changed && a->patch_len == strlen(patch2) &&
+         memcmp(a->patch, patch2, a->patch_len) == 0;
+    
+    /* A new subscriber gets the whole frame */
+    const snapshot_view_t *c = snap ? snapshot_view(&views, snap, "test.gen", 0, NULL, 0) : NULL;
+    ok = ok && c && c != a && !c->patch;
+    
+    snapshot_release(snap);
+    snapshot_views_free(&views);
+    snapshot_shutdown();
+    return ok;
+}
+
+int main(void) {
+    printf("IPC Tests\n");
+    printf("=========\n");
+    
+    TEST(shared_snapshot);
+    TEST(shared_views);
+    
+    printf("\nResults: %d/%d passed\n", tests_passed, tests_run);
+    return tests_passed == tests_run ? 0 : 1;
+}
@@ -2,9 +2,12 @@
  * test_json.c - JSON builder tests
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include "common/json.h"
+#include "common/json_patch.h"
+#include "common/cbor.h"
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -68,6 +71,112 @@ static int test_array(void) {
     return strstr(buf, "\"nums\":[1,2,3]") != NULL;
 }
 
+static int test_growable(void) {
+    json_builder_t j;
+    json_init_growable(&j, NULL, 16, 4096);
+    
+    json_array_start(&j);
+    for (int i = 0; i < 100; i++) {
+        json_int(&j, i);
+    }
+    json_array_end(&j);
+    int ok = !json_error(&j) && j.size > 256 &&
+             strncmp(j.buf, "[0,1,2,", 7) == 0 && strstr(j.buf, ",99]") != NULL;
+    free(j.buf);
+    
+    /* Growth stops at the limit */
+    json_init_growable(&j, NULL, 16, 64);
+    for (int i = 0; i < 100; i++) {
+        json_kv_int(&j, "key", i);
+    }
+    ok = ok && json_error(&j) && j.size <= 64;
+    free(j.buf);
+    return ok;
+}
+
+static int test_object_find(void) {
+    const char *doc = "{\"a\":{\"s\":\"x,}\\\"\"},\"b\":[1,{\"c\":2}],\"n\":-3.5}";
+    size_t len;
+    
+    const char *b = json_object_find(doc, strlen(doc), "b", &len);
+    if (!b || len != 11 || strncmp(b, "[1,{\"c\":2}]", len) != 0) return 0;
+    
+    const char *n = json_object_find(doc, strlen(doc), "n", &len);
+    if (!n || len != 4) return 0;
+    
+    return json_object_find(doc, strlen(doc), "c", &len) == NULL &&
+           json_value_len(doc, strlen(doc)) == strlen(doc);
+}
+
+static int test_merge_diff(void) {
+    const char *old = "{\"t\":1,\"m\":{\"free\":10,\"used\":5},\"gone\":true,\"l\":[1]}";
+    const char *new_json = "{\"t\":2,\"m\":{\"free\":10,\"used\":6},\"l\":[1],\"added\":\"x\"}";
+    char buf[256];
+    json_builder_t j;
+    json_init(&j, buf, sizeof(buf));
+    
+    if (!json_merge_diff(&j, old, strlen(old), new_json, strlen(new_json))) return 0;
+    if (strcmp(buf, "{\"t\":2,\"m\":{\"used\":6},\"added\":\"x\",\"gone\":null}") != 0) return 0;
+    
+    /* Equal documents give an empty patch */
+    json_init(&j, buf, sizeof(buf));
+    if (json_merge_diff(&j, old, strlen(old), old, strlen(old)) || strcmp(buf, "{}") != 0) return 0;
+    
+    /* Members are matched by key, in any order */
+    char big_old[1024], big_new[1024];
+    int o = 0, n = 0;
+    o += snprintf(big_old + o, sizeof(big_old) - o, "{");
+    n += snprintf(big_new + n, sizeof(big_new) - n, "{");
+    for (int i = 0; i < 40; i++) {
+        o += snprintf(big_old + o, sizeof(big_old) - o, "%s\"k%d\":%d", i ? "," : "", i, i);
+        n += snprintf(big_new + n, sizeof(big_new) - n, "%s\"k%d\":%d", i ? "," : "",
+                      39 - i, 39 - i == 7 ? 70 : 39 - i);
+    }
+    snprintf(big_old + o, sizeof(big_old) - o, "}");
+    snprintf(big_new + n, sizeof(big_new) - n, ",\"k40\":40}");
+    json_init(&j, buf, sizeof(buf));
+    return json_merge_diff(&j, big_old, strlen(big_old), big_new, strlen(big_new)) &&
+           strcmp(buf, "{\"k7\":70,\"k40\":40}") == 0;
+}
+
+static int test_project(void) {
+    const char *doc = "{\"a\":{\"x\":1,\"y\":[2],\"z\":{\"w\":3}},\"b\":\"s\",\"c\":4}";
+    char buf[256];
+    json_builder_t j;
+    
+    json_init(&j, buf, sizeof(buf));
+    json_project(&j, doc, strlen(doc), "c,a.y,a.z.w,missing,a.x.none");
+    if (strcmp(buf, "{\"c\":4,\"a\":{\"y\":[2],\"z\":{\"w\":3}}}") != 0) return 0;
+    
+    /* A whole member wins over paths below it */
+    json_init(&j, buf, sizeof(buf));
+    json_project(&j, doc, strlen(doc), "a.x,a");
+    return strcmp(buf, "{\"a\":{\"x\":1,\"y\":[2],\"z\":{\"w\":3}}}") == 0;
+}
+
+static int test_cbor(void) {
+    const char *doc = "{\"a\":[1,-2,1.5,300,true,null],\"key\":\"key\",\"s\":\"x\\ny\"}";
+    static const uint8_t expected[] = {
+        0xd9, 0x01, 0x00,                       /* stringref namespace */
+        0xbf,                                   /* map */
+        0x61, 'a',
+        0x9f, 0x01, 0x21, 0xfa, 0x3f, 0xc0, 0x00, 0x00, 0x19, 0x01, 0x2c, 0xf5, 0xf6, 0xff,
+        0x63, 'k', 'e', 'y',                    /* numbered 0 */
+        0xd8, 0x19, 0x00,                       /* reference to 0 */
+        0x61, 's',
+        0x63, 'x', '\n', 'y',
+        0xff,
+    };
+    uint8_t out[128];
+    
+    size_t len = cbor_from_json(doc, strlen(doc), out, sizeof(out));
+    if (len != sizeof(expected) || memcmp(out, expected, len) != 0) return 0;
+    
+    /* Malformed input and overflow both fail */
+    return cbor_from_json("{\"a\":", 5, out, sizeof(out)) == 0 &&
+           cbor_from_json(doc, strlen(doc), out, 10) == 0;
+}
+
 int main(void) {
     printf("JSON Builder Tests\n");
     printf("==================\n");
@@ -75,6 +184,11 @@ int main(void) {
     TEST(simple_object);
     TEST(nested_object);
     TEST(array);
+    TEST(growable);
+    TEST(object_find);
+    TEST(merge_diff);
+    TEST(project);
+    TEST(cbor);
     
     printf("\nResults: %d/%d passed\n", tests_passed, tests_run);
     return tests_passed == tests_run ? 0 : 1;
@@ -1,11 +1,19 @@
 /*
  * test_services.c - Service initialization tests
  */
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "services/meminfo.h"
+#include "services/cpuload.h"
+#include "daemon/config.h"
 #include "common/json.h"
+#include "common/proc_utils.h"
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -33,12 +41,80 @@ static int test_meminfo_has_ops(void) {
            meminfo_service.ops->snapshot != NULL;
 }
 
+static int test_parse_status_fields(void) {
+    const char *status =
+        "Name:\tbash\n"
+        "VmSize:\t  8436 kB\n"
+        "VmRSS:\t    5120 kB\n"
+        "VmData:\t    1024 kB\n"
+        "Threads:\t4\n"
+        "voluntary_ctxt_switches:\t120\n";
+    int64_t values[PROC_STATUS_COUNT];
+    
+    unsigned int mask = PROC_STATUS_MASK(PROC_STATUS_VMRSS) |
+                        PROC_STATUS_MASK(PROC_STATUS_THREADS) |
+                        PROC_STATUS_MASK(PROC_STATUS_VMSWAP) |
+                        PROC_STATUS_MASK(PROC_STATUS_VOLUNTARY_CTXT);
+    int found = proc_parse_status(status, mask, values);
+    
+    /* A table walked without PROC_FIELD_STATUS reports every field absent */
+    proc_table_t table;
+    proc_table_init(&table);
+    int absent = proc_table_build(&table, PROC_FIELD_STAT) > 0 &&
+                 table.records[0].status[PROC_STATUS_VMRSS] == -1 &&
+                 table.records[0].status[PROC_STATUS_THREADS] == -1;
+    proc_table_free(&table);
+    
+    return found == 3 && absent &&
+           values[PROC_STATUS_VMRSS] == 5120 &&
+           values[PROC_STATUS_THREADS] == 4 &&
+           values[PROC_STATUS_VOLUNTARY_CTXT] == 120 &&
+           values[PROC_STATUS_VMSWAP] == -1 &&
+           values[PROC_STATUS_VMDATA] == -1;  /* Not requested */
+}
+
+/* A spinning child shows up with CPU time, with taskstats asked for or not */
+static int test_cpuload_busy_process(void) {
+    pid_t child = fork();
+    if (child == 0) {
+        for (;;) {}
+    }
+    if (child < 0) return 0;
+    
+    qmem_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.taskstats = true;
+    
+    int found = 0;
+    if (cpuload_service.ops->init(&cpuload_service, &cfg) == 0) {
+        struct timespec spin = { .tv_sec = 0, .tv_nsec = 300 * 1000 * 1000 };
+        cpuload_service.ops->collect(&cpuload_service);
+        nanosleep(&spin, NULL);
+        cpuload_service.ops->collect(&cpuload_service);
+    
+        cpuload_entry_t top[20];
+        int n = cpuload_get_top(top, 20);
+        for (int i = 0; i < n; i++) {
+            if (top[i].pid == child && top[i].cpu_percent > 0 && top[i].utime + top[i].stime > 0) {
+                found = 1;
+            }
+        }
+        cpuload_service.ops->destroy(&cpuload_service);
+    }
+    
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    return found;
+}
+
 int main(void) {
     printf("Service Tests\n");
     printf("=============\n");
     
     TEST(meminfo_service_exists);
     TEST(meminfo_has_ops);
+    TEST(parse_status_fields);
+    TEST(cpuload_busy_process);
     
     printf("\nResults: %d/%d passed\n", tests_passed, tests_run);
     return tests_passed == tests_run ? 0 : 1;